@@ -0,0 +1,100 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Bump allocator. Memory is handed out from large chunks and released all at
+// once when the arena is reset or destroyed; pointers stay valid until then.
+// Destructors of objects created in the arena are never run.
+//
+// Chunks are chunk_size bytes, or start at chunk_size and double up to
+// max_chunk_size, for arenas that are often small.
+class Arena {
+public:
+  static constexpr std::size_t DefaultChunkSize = 64 * 1024;
+
+  explicit Arena(std::size_t chunk_size = DefaultChunkSize) :
+    m_chunk_size(chunk_size), m_max_chunk_size(chunk_size) {}
+  Arena(std::size_t chunk_size, std::size_t max_chunk_size) :
+    m_chunk_size(chunk_size), m_max_chunk_size(max_chunk_size) {}
+  Arena(const Arena&) = delete;
+  Arena(Arena&&) = default;
+  Arena& operator=(const Arena&) = delete;
+  Arena& operator=(Arena&&) = default;
+
+  void* allocate(std::size_t size, std::size_t align = alignof(std::max_align_t)) {
+    auto p = align_up(m_cur, align);
+    if (p + size > m_end) {
+      return allocate_slow(size, align);
+    }
+    m_cur = p + size;
+    return p;
+  }
+
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  // Frees every chunk but the first one, which is reused.
+  void reset() {
+    if (m_chunks.empty())
+      return;
+    m_chunks.resize(1);
+    m_cur = m_chunks[0].data.get();
+    m_end = m_cur + m_chunks[0].size;
+  }
+
+  std::size_t get_reserved_bytes() const {
+    std::size_t result = 0;
+    for (auto& chunk : m_chunks) result += chunk.size;
+    return result;
+  }
+
+  std::size_t get_chunks_count() const { return m_chunks.size(); }
+
+private:
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+
+  std::size_t m_chunk_size;
+  std::size_t m_max_chunk_size;
+  std::vector<Chunk> m_chunks;
+  char* m_cur = nullptr;
+  char* m_end = nullptr;
+
+  static char* align_up(char* p, std::size_t align) {
+    return (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+  }
+
+  void* allocate_slow(std::size_t size, std::size_t align) {
+    // Big blocks get a chunk of their own so that the current one keeps being used.
+    if (size + align > m_chunk_size / 4) {
+      Chunk chunk{std::unique_ptr<char[]>(new char[size + align]), size + align};
+      auto p = align_up(chunk.data.get(), align);
+      if (m_chunks.empty()) {
+        m_chunks.emplace_back(std::move(chunk));
+      } else {
+        m_chunks.insert(m_chunks.end() - 1, std::move(chunk));
+      }
+      return p;
+    }
+    m_chunks.push_back(Chunk{std::unique_ptr<char[]>(new char[m_chunk_size]), m_chunk_size});
+    m_cur = m_chunks.back().data.get();
+    m_end = m_cur + m_chunk_size;
+    m_chunk_size = std::min(m_chunk_size * 2, m_max_chunk_size);
+    auto p = align_up(m_cur, align);
+    m_cur = p + size;
+    return p;
+  }
+};
+
+#endif  // ARENA_HPP
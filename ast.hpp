@@ -1,17 +1,67 @@
 #ifndef AST_HPP
 #define AST_HPP
 
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <cstdint>
 #include <vector>
 #include <deque>
+#include <new>
+#include <type_traits>
 
+#include "arena.hpp"
 #include "ast_node_index.hpp"
 #include "id_index.hpp"
-#include "ordered_dict.hpp"
+#include "flat_ordered_dict.hpp"
+#include "strong_type.hpp"
 
+// A list of node or id indices in the extra data of the Ast.
+struct ExtraRange {
+  uint32_t start;
+  uint32_t count;
+};
+
+// Read only view of a list in the extra data, T is AstNodeIndex or IdIndex.
+// Valid until more extra data is added to the Ast.
+template <typename T>
+class ExtraList {
+public:
+  class Iterator {
+  public:
+    explicit Iterator(const uint32_t* p) : m_p(p) {}
+    T operator*() const { return T(*m_p); }
+    Iterator& operator++() { ++m_p; return *this; }
+    bool operator==(const Iterator& other) const { return m_p == other.m_p; }
+    bool operator!=(const Iterator& other) const { return m_p != other.m_p; }
+  private:
+    const uint32_t* m_p;
+  };
+
+  ExtraList(const uint32_t* data, uint32_t size) : m_data(data), m_size(size) {}
+
+  uint32_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  T operator[](uint32_t i) const { return T(m_data[i]); }
+  T back() const { return T(m_data[m_size - 1]); }
+  Iterator begin() const { return Iterator(m_data); }
+  Iterator end() const { return Iterator(m_data + m_size); }
+
+private:
+  const uint32_t* m_data;
+  uint32_t m_size;
+};
+
+// Nodes own no memory: lists of children live in the extra data of the Ast
+// and scope dicts in a side table of it, so nodes are trivially destructible
+// and the Ast frees everything at once.
+//
+// A node is 16 bytes, four to a cache line: a one byte kind and a payload of
+// at most 12 bytes. The few variants that need more (function, for_stmt,
+// the parameters of fun_type) keep an overflow index to a record in the
+// extra data instead.
 struct AstNode {
-  enum class Kind {
+  enum class Kind : uint8_t {
     None, Type, Value, 
     I8Type, I16Type, I32Type, U8Type, U16Type, U32Type, F32Type, F64Type, 
     StructType, UnionType, FunType, FunTypeWithNamedParams, LocalVariable, 
@@ -21,7 +71,11 @@ struct AstNode {
     ParenthExpr, NegExpr, StructField, UnionField, Function, Struct, Union, 
     BlockScope, GlobalScope, VariableDeclStmt, BlockStmt, FunctionDeclStmt, 
     StructDeclStmt, UnionDeclStmt, IfElseStmt, WhileStmt, ExprStmt, ReturnStmt,
+    NotEqualExpr, AddExpr, SubExpr, MulExpr, DivExpr,
+    AddAssignExpr, SubAssignExpr, MulAssignExpr, DivAssignExpr,
+    NameExpr, CallExpr, MemberExpr, NamedType, Class, ClassDeclStmt, ForStmt,
   };
+  static constexpr std::size_t KindsCount = (std::size_t)Kind::ForStmt + 1;
   enum class StatementKind {};
 
   AstNode(Kind kind) {
@@ -36,7 +90,7 @@ struct AstNode {
 
   bool is_stmt() const { return is_stmt(kind); }
 
-  static bool is_stmt(AstNode::Kind kind) {
+  static constexpr bool is_stmt(AstNode::Kind kind) {
     switch (kind) {
       case AstNode::Kind::VariableDeclStmt:
       case AstNode::Kind::BlockStmt:
@@ -47,6 +101,8 @@ struct AstNode {
       case AstNode::Kind::WhileStmt:
       case AstNode::Kind::ExprStmt:
       case AstNode::Kind::ReturnStmt:
+      case AstNode::Kind::ClassDeclStmt:
+      case AstNode::Kind::ForStmt:
         return true;
       default:
         return false;
@@ -55,7 +111,35 @@ struct AstNode {
 
   bool is_expr() const { return is_expr(kind); }
 
-  static bool is_expr(AstNode::Kind kind) {
+  static constexpr bool is_expr(AstNode::Kind kind) {
+    switch (kind) {
+      case AstNode::Kind::AssignExpr:
+      case AstNode::Kind::EqualExpr:
+      case AstNode::Kind::GreatExpr:
+      case AstNode::Kind::GreatOrEqualExpr:
+      case AstNode::Kind::LessExpr:
+      case AstNode::Kind::LessOrEqualExpr:
+      case AstNode::Kind::ParenthExpr:
+      case AstNode::Kind::NegExpr:
+      case AstNode::Kind::NotEqualExpr:
+      case AstNode::Kind::AddExpr:
+      case AstNode::Kind::SubExpr:
+      case AstNode::Kind::MulExpr:
+      case AstNode::Kind::DivExpr:
+      case AstNode::Kind::AddAssignExpr:
+      case AstNode::Kind::SubAssignExpr:
+      case AstNode::Kind::MulAssignExpr:
+      case AstNode::Kind::DivAssignExpr:
+      case AstNode::Kind::NameExpr:
+      case AstNode::Kind::CallExpr:
+      case AstNode::Kind::MemberExpr:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  static constexpr bool is_binary_expr(AstNode::Kind kind) {
     switch (kind) {
       case AstNode::Kind::AssignExpr:
       case AstNode::Kind::EqualExpr:
@@ -63,6 +147,15 @@ struct AstNode {
       case AstNode::Kind::GreatOrEqualExpr:
       case AstNode::Kind::LessExpr:
       case AstNode::Kind::LessOrEqualExpr:
+      case AstNode::Kind::NotEqualExpr:
+      case AstNode::Kind::AddExpr:
+      case AstNode::Kind::SubExpr:
+      case AstNode::Kind::MulExpr:
+      case AstNode::Kind::DivExpr:
+      case AstNode::Kind::AddAssignExpr:
+      case AstNode::Kind::SubAssignExpr:
+      case AstNode::Kind::MulAssignExpr:
+      case AstNode::Kind::DivAssignExpr:
         return true;
       default:
         return false;
@@ -71,11 +164,12 @@ struct AstNode {
 
   bool is_scope() const { return is_scope(kind); }
 
-  static bool is_scope(AstNode::Kind kind) {
+  static constexpr bool is_scope(AstNode::Kind kind) {
     switch (kind) {
       case AstNode::Kind::Function:
       case AstNode::Kind::Struct:
       case AstNode::Kind::Union:
+      case AstNode::Kind::Class:
       case AstNode::Kind::BlockScope:
       case AstNode::Kind::GlobalScope:
         return true;
@@ -86,7 +180,7 @@ struct AstNode {
 
   bool is_type() const { return is_type(kind); }
 
-  static bool is_type(AstNode::Kind kind) {
+  static constexpr bool is_type(AstNode::Kind kind) {
     switch (kind) {
       case AstNode::Kind::I8Type: 
       case AstNode::Kind::I16Type: 
@@ -99,6 +193,7 @@ struct AstNode {
       case AstNode::Kind::StructType:
       case AstNode::Kind::UnionType:
       case AstNode::Kind::FunType:
+      case AstNode::Kind::NamedType:
         return true;
       default: 
         return false;
@@ -107,7 +202,7 @@ struct AstNode {
 
   bool is_value() const { return is_value(kind); }
 
-  static bool is_value(AstNode::Kind kind) {
+  static constexpr bool is_value(AstNode::Kind kind) {
     switch (kind) {
       case AstNode::Kind::LocalVariable:
       case AstNode::Kind::GlobalVariable:
@@ -129,26 +224,7 @@ struct AstNode {
     }
   }
 
-  ~AstNode() { clean(); }
-
   void clean() {
-    switch (kind) {
-      case AstNode::Kind::FunTypeWithNamedParams:
-        delete fun_type_with_named_params.names;
-      case AstNode::Kind::FunType:
-        delete fun_type.param_types;
-        break;
-      case AstNode::Kind::Function:
-      case AstNode::Kind::Struct:
-      case AstNode::Kind::Union:
-        delete scope.dict;
-        break;
-      case AstNode::Kind::BlockStmt:
-        delete block_stmt.stmts;
-        break;
-      default:
-        break;
-    }
     memset((void*)this, 0, sizeof(AstNode));
     kind = AstNode::Kind::None;
   }
@@ -186,82 +262,110 @@ struct AstNode {
 
   struct FunType {
     AstNodeIndex return_type;
-    std::vector<AstNodeIndex>* param_types;
     IdIndex name;
-
-    void add_param_type(AstNodeIndex type) {
-      if (!param_types) param_types = new std::vector<AstNodeIndex>;
-      param_types->emplace_back(type);
-    }
-  };
-  struct FunTypeWithNamedParams {
-    FunType fun_type;
-    std::vector<IdIndex>* names;
-
-    void add_name(IdIndex id) {
-      if (!names) names = new std::vector<IdIndex>;
-      names->emplace_back(id);
-    }
+    // Parameter record in the extra data, see Ast::add_params. 0 is the
+    // empty record.
+    uint32_t params;
   };
   struct Scope {
     AstNodeIndex outer_scope;
-    IdIndex name;
-    using Dict = OrderedDict<IdIndex, AstNodeIndex, IdIndex::Hash>;
-    Dict* dict;
-
-    void add_node(AstNodeIndex node_idx, IdIndex name = IdIndex::undefined) {
-      if (!dict) dict = new Dict();
-      if (name != IdIndex::undefined) {
-        dict->append(name, node_idx);
-      } else {
-        dict->append(node_idx);
-      }
-    }
+    // 1 + index of the scope's dict in the Ast, 0 while nothing is declared.
+    uint32_t dict;
   };
   struct StructOrUnion {
     Scope scope;
+    IdIndex name;
+  };
+
+  // Overflow records, see Ast::add_overflow.
+  struct FunctionOverflow {
+    AstNodeIndex function_type_with_named_params;
+    AstNodeIndex body;
+  };
+  struct ForStmtOverflow {
+    AstNodeIndex variable;
+    AstNodeIndex from;
+    AstNodeIndex to;
   };
 
 
   union {
     Value value;
 
+    // is_val marks a variable declared with val, it can't be assigned to.
     struct {
       Value value;
       IdIndex name;
+      bool is_val;
     } global_variable;
 
     struct {
       Value value;
       IdIndex name;
+      bool is_val;
     } local_variable;
 
     UnaryExpr parenth_expr;
     UnaryExpr neg_expr;
 
+    // Any of the binary expressions, they all share the layout.
+    BinaryExpr binary_expr;
     BinaryExpr assign_expr;
     BinaryExpr equal_expr;
     BinaryExpr great_expr;
     BinaryExpr great__or_equal_expr;
     BinaryExpr less_expr;
     BinaryExpr less_or_equal_expr;
+    BinaryExpr not_equal_expr;
+    BinaryExpr add_expr;
+    BinaryExpr sub_expr;
+    BinaryExpr mul_expr;
+    BinaryExpr div_expr;
+    BinaryExpr add_assign_expr;
+    BinaryExpr sub_assign_expr;
+    BinaryExpr mul_assign_expr;
+    BinaryExpr div_assign_expr;
+
+    // decl is the variable, function, ... the name resolves to, undefined
+    // when the name is not declared.
+    struct {
+      AstNodeIndex decl;
+      IdIndex name;
+    } name_expr;
+
+    struct {
+      AstNodeIndex callee;
+      // AstNodeIndex list.
+      ExtraRange args;
+    } call_expr;
+
+    struct {
+      AstNodeIndex object;
+      IdIndex name;
+    } member_expr;
     StringLiteral string_literal;
     CharLiteral char_literal;
     NumberLiteral<int8_t> i8_literal;
     NumberLiteral<int16_t> i16_literal;
     NumberLiteral<int32_t> i32_literal;
-    NumberLiteral<int64_t> i64_literal;
     NumberLiteral<uint8_t> u8_literal;
     NumberLiteral<uint16_t> u16_literal;
     NumberLiteral<uint32_t> u32_literal;
 
+    // FunType and FunTypeWithNamedParams, the names of the parameters are
+    // in the parameter record of the latter.
     FunType fun_type;
-    FunTypeWithNamedParams fun_type_with_named_params;
 
     struct {
       AstNodeIndex struct_scope;
     } struct_type;
 
+    // A type given by name: a struct, union or class, decl as in name_expr.
+    struct {
+      AstNodeIndex decl;
+      IdIndex name;
+    } named_type;
+
     struct {
       Value value;
       IdIndex name;
@@ -273,6 +377,7 @@ struct AstNode {
 
     struct {
       Scope scope;
+      AstNodeIndex block_stmt;
     } global_scope;
 
     struct {
@@ -280,13 +385,24 @@ struct AstNode {
       AstNodeIndex block_stmt;
     } block_scope;
 
+    // FunctionOverflow record.
     struct {
       Scope scope;
-      AstNodeIndex function_type_with_named_params;
+      uint32_t overflow;
     } function;
 
     StructOrUnion struc;
     StructOrUnion unio;
+    StructOrUnion clas;
+
+    // FunctionDeclStmt, StructDeclStmt, UnionDeclStmt and ClassDeclStmt.
+    struct {
+      AstNodeIndex decl;
+    } decl_stmt;
+
+    struct {
+      AstNodeIndex expr;
+    } expr_stmt;
 
     struct {
       AstNodeIndex variable;
@@ -295,12 +411,8 @@ struct AstNode {
 
     struct {
       AstNodeIndex block_scope;
-      std::vector<AstNodeIndex>* stmts;
-
-      void add_stmt(AstNodeIndex node_idx) {
-        if (!stmts) stmts = new std::vector<AstNodeIndex>();
-        stmts->emplace_back(node_idx);
-      }
+      // AstNodeIndex list.
+      ExtraRange stmts;
     } block_stmt;
 
     struct {
@@ -318,37 +430,582 @@ struct AstNode {
       AstNodeIndex stmt;
     } while_stmt;
 
+    // for (variable in from..to) stmt, the variable is declared in
+    // block_scope. The variable and the range are in a ForStmtOverflow record.
+    struct {
+      AstNodeIndex block_scope;
+      AstNodeIndex stmt;
+      uint32_t overflow;
+    } for_stmt;
+
   };
 };
 
+static_assert(std::is_trivially_destructible<AstNode>::value, "Ast never runs node destructors");
+static_assert(sizeof(AstNode::Kind) == 1, "AstNode::Kind grew past a byte");
+static_assert(sizeof(AstNode) == 16, "a variant outgrew the 12 byte payload, move its tail to an overflow record");
+static_assert(alignof(AstNode) == 4, "node payloads are made of 32 bit fields");
+
+struct AstRegionPhantom {};
+using AstRegionIndex = StrongType<uint32_t, AstRegionPhantom>;
+
+// Nodes are placed in fixed size chunks taken from an Arena, so building an
+// Ast costs an allocation per ChunkSize nodes and destroying it just frees
+// the arena chunks. Node references stay valid while nodes are added.
+//
+// Every chunk belongs to a region and nodes are created in the chunks of the
+// current region. The root region holds the whole Ast until a nested region
+// is begun, say for a function or a speculative parse. Releasing a region
+// gives its chunks back to the Ast with their indices at once, no node is
+// visited: the cost is a step per chunk list, per scope dict and per nested
+// region, which go with it.
 class Ast {
 public:
-  AstNodeIndex create(AstNode::Kind kind) {
-    if (removed.empty()) {
-      nodes.emplace_back(kind);
-      return AstNodeIndex(nodes.size() - 1);
+  using ScopeDict = FlatOrderedDict<IdIndex, AstNodeIndex, IdIndex::Hash>;
+
+  static inline const AstRegionIndex RootRegion{0};
+
+  Ast() = default;
+  Ast(const Ast&) = delete;
+  Ast(Ast&&) = default;
+  Ast& operator=(const Ast&) = delete;
+  Ast& operator=(Ast&&) = default;
+
+  // Creates the node in the current region.
+  AstNodeIndex create(AstNode::Kind kind) { return create(m_region, kind); }
+
+  // The extra data of a removed node is not reclaimed, its scope dict is.
+  // The index is reused by the next create in the node's region.
+  void remove(AstNodeIndex index) {
+    auto& node = (*this)[index];
+    if (node.is_scope()) clear_scope(index);
+    node.clean();
+    m_regions[m_chunk_regions[index.get() >> ChunkBits]].removed.emplace_back(index);
+  }
+
+  // Removes the nodes below index (see for_each_child) and empties its scope,
+  // the node itself stays. Other nodes keep their indices, the removed ones
+  // are reused by the next creates.
+  void remove_children(AstNodeIndex index) {
+    std::vector<AstNodeIndex> stack;
+    const auto push = [&](AstNodeIndex child) { stack.emplace_back(child); };
+    for_each_child(index, push);
+    while (!stack.empty()) {
+      const auto child = stack.back();
+      stack.pop_back();
+      for_each_child(child, push);
+      remove(child);
     }
-    const auto index = removed.back();
-    nodes[index.get()].kind = kind;
-    removed.pop_back();
-    return index;
+    if ((*this)[index].is_scope()) clear_scope(index);
   }
 
-  void remove(AstNodeIndex index) {
-    nodes[index.get()].clean();
-    removed.emplace_back(index);
+  // Empties the dict of scope, for a scope whose nodes were released with
+  // their region.
+  void clear_scope(AstNodeIndex scope) {
+    auto& dict_index = (*this)[scope].scope.dict;
+    if (dict_index != 0) {
+      m_dict_regions[dict_index - 1] = NoRegion;
+      m_free_dicts.emplace_back(dict_index);
+      dict_index = 0;
+    }
+  }
+
+  // Begins a region nested in the current one and makes it current. It ends
+  // with end_region, or is released or reset with the region it is in.
+  AstRegionIndex begin_region() {
+    uint32_t index;
+    if (m_free_regions.empty()) {
+      index = (uint32_t)m_regions.size();
+      m_regions.emplace_back();
+    } else {
+      index = m_free_regions.back();
+      m_free_regions.pop_back();
+    }
+    auto& region = m_regions[index];
+    auto& parent = m_regions[m_region];
+    region.parent = m_region;
+    region.next_sibling = parent.first_child;
+    if (parent.first_child != NoRegion) m_regions[parent.first_child].prev_sibling = index;
+    parent.first_child = index;
+    m_region = index;
+    return AstRegionIndex(index);
+  }
+
+  // Makes the parent of the current region current again.
+  void end_region() {
+    m_region = m_regions[m_region].parent;
+  }
+
+  AstRegionIndex get_current_region() const { return AstRegionIndex(m_region); }
+
+  AstRegionIndex get_region(AstNodeIndex index) const {
+    return AstRegionIndex(m_chunk_regions[index.get() >> ChunkBits]);
+  }
+
+  // Frees the nodes of an ended region other than the root one and of the
+  // regions nested in it; the region index goes too. No node outside may
+  // link to them any more, and scopes outside that declared them need a
+  // clear_scope.
+  void release_region(AstRegionIndex index) {
+    const auto region_index = index.get();
+    auto& region = m_regions[region_index];
+    auto& parent = m_regions[region.parent];
+    if (region.prev_sibling != NoRegion) {
+      m_regions[region.prev_sibling].next_sibling = region.next_sibling;
+    } else {
+      parent.first_child = region.next_sibling;
+    }
+    if (region.next_sibling != NoRegion) m_regions[region.next_sibling].prev_sibling = region.prev_sibling;
+    free_region(region_index);
+  }
+
+  // Empties a region other than the root one. It stays as it was, current
+  // or ended, and creates its next nodes in the chunks it had, cleared to
+  // None like new ones.
+  void reset_region(AstRegionIndex index) {
+    free_contents(index.get());
+    auto& region = m_regions[index.get()];
+    for (auto chunk = region.first_chunk; chunk != NoChunk; chunk = m_chunk_next[chunk]) {
+      memset((void*)m_chunks[chunk], 0, ChunkSize * sizeof(AstNode));
+    }
+    region.fill_chunk = region.first_chunk;
+    region.used = region.first_chunk != NoChunk ? 0 : ChunkSize;
+  }
+
+  // The node of a primitive type (I8Type ... F64Type), created in the root
+  // region on first use and shared by all uses.
+  AstNodeIndex get_primitive_type(AstNode::Kind kind) {
+    auto& type = m_primitive_types[(int)kind - (int)AstNode::Kind::I8Type];
+    if (type == UndefinedAstNodeIndex) {
+      type = create(RootRegion.get(), kind);
+    }
+    return type;
   }
 
   const AstNode& operator[](AstNodeIndex index) const {
-    return nodes[index.get()];
+    return m_chunks[index.get() >> ChunkBits][index.get() & ChunkMask];
   }
 
   AstNode& operator[](AstNodeIndex index) {
-    return nodes[index.get()];
+    return m_chunks[index.get() >> ChunkBits][index.get() & ChunkMask];
+  }
+
+  // One past the highest node index created, so nodes removed or released
+  // since are included. Slots no node was created in are None nodes.
+  uint32_t size() const { return m_size; }
+
+  // Adds count zeroed values to the extra data.
+  ExtraRange add_extra(uint32_t count) {
+    const ExtraRange range{(uint32_t)m_extra.size(), count};
+    m_extra.resize(m_extra.size() + count);
+    return range;
   }
+
+  ExtraRange add_extra(const uint32_t* values, uint32_t count) {
+    const ExtraRange range{(uint32_t)m_extra.size(), count};
+    m_extra.insert(m_extra.end(), values, values + count);
+    return range;
+  }
+
+  // Valid until more extra data is added.
+  uint32_t* get_extra(ExtraRange range) { return m_extra.data() + range.start; }
+
+  // Appends value to the list in range. A list that doesn't end the extra
+  // data is moved to the end first, so lists built one by one are best built
+  // one at a time (or collected elsewhere and added with add_extra).
+  template <typename T>
+  void append(ExtraRange& range, T value) {
+    if (range.count == 0) {
+      range.start = (uint32_t)m_extra.size();
+    } else if (range.start + range.count != m_extra.size()) {
+      const auto start = (uint32_t)m_extra.size();
+      m_extra.reserve(m_extra.size() + range.count + 1);
+      for (uint32_t i = 0; i < range.count; ++i) {
+        m_extra.emplace_back(m_extra[range.start + i]);
+      }
+      range.start = start;
+    }
+    m_extra.emplace_back(value.get());
+    ++range.count;
+  }
+
+  ExtraList<AstNodeIndex> get_nodes(ExtraRange range) const {
+    return ExtraList<AstNodeIndex>(m_extra.data() + range.start, range.count);
+  }
+
+  ExtraList<IdIndex> get_ids(ExtraRange range) const {
+    return ExtraList<IdIndex>(m_extra.data() + range.start, range.count);
+  }
+
+  // Overflow records hold the fields of the variants too large for the node
+  // payload. They are copied in and out of the extra data, so a record read
+  // stays valid while the Ast grows; update one with set_overflow.
+  template <typename T>
+  uint32_t add_overflow(const T& record) {
+    static_assert(std::is_trivially_copyable<T>::value && sizeof(T) % sizeof(uint32_t) == 0,
+      "overflow records are made of 32 bit fields");
+    const auto index = (uint32_t)m_extra.size();
+    m_extra.resize(m_extra.size() + sizeof(T) / sizeof(uint32_t));
+    memcpy(m_extra.data() + index, &record, sizeof(T));
+    return index;
+  }
+
+  template <typename T>
+  T get_overflow(uint32_t index) const {
+    // The records default their fields, they are still trivially copyable.
+    T record;
+    memcpy((void*)&record, m_extra.data() + index, sizeof(T));
+    return record;
+  }
+
+  template <typename T>
+  void set_overflow(uint32_t index, const T& record) {
+    memcpy(m_extra.data() + index, &record, sizeof(T));
+  }
+
+  // Adds the parameter record of a FunType: the count, the types and, when
+  // names isn't null (FunTypeWithNamedParams), the names.
+  uint32_t add_params(const uint32_t* types, const uint32_t* names, uint32_t count) {
+    const auto index = (uint32_t)m_extra.size();
+    m_extra.emplace_back(count);
+    m_extra.insert(m_extra.end(), types, types + count);
+    if (names) m_extra.insert(m_extra.end(), names, names + count);
+    return index;
+  }
+
+  ExtraList<AstNodeIndex> get_param_types(const AstNode::FunType& fun_type) const {
+    return ExtraList<AstNodeIndex>(m_extra.data() + fun_type.params + 1, m_extra[fun_type.params]);
+  }
+
+  // Only for a FunTypeWithNamedParams.
+  ExtraList<IdIndex> get_param_names(const AstNode::FunType& fun_type) const {
+    const auto count = m_extra[fun_type.params];
+    return ExtraList<IdIndex>(m_extra.data() + fun_type.params + 1 + count, count);
+  }
+
+  // Declares node in scope, under name unless it is undefined.
+  void add_to_scope(AstNodeIndex scope, AstNodeIndex node, IdIndex name = IdIndex::undefined) {
+    auto& dict_index = (*this)[scope].scope.dict;
+    if (dict_index == 0) {
+      if (m_free_dicts.empty()) {
+        m_dicts.emplace_back();
+        m_dict_regions.emplace_back();
+        dict_index = (uint32_t)m_dicts.size();
+      } else {
+        dict_index = m_free_dicts.back();
+        m_free_dicts.pop_back();
+        m_dicts[dict_index - 1].clear();
+      }
+      const auto region = m_chunk_regions[scope.get() >> ChunkBits];
+      m_dict_regions[dict_index - 1] = region;
+      if (region != RootRegion.get()) m_regions[region].dicts.emplace_back(dict_index);
+    }
+    auto& dict = m_dicts[dict_index - 1];
+    if (name != IdIndex::undefined) {
+      dict.append(name, node);
+    } else {
+      dict.append(node);
+    }
+  }
+
+  AstNodeIndex find_in_scope(AstNodeIndex scope, IdIndex name) const {
+    const auto dict_index = (*this)[scope].scope.dict;
+    return dict_index ? m_dicts[dict_index - 1].find(name) : UndefinedAstNodeIndex;
+  }
+
+  // The nodes declared in scope in declaration order.
+  const std::vector<AstNodeIndex>& get_scope_nodes(AstNodeIndex scope) const {
+    static const std::vector<AstNodeIndex> empty;
+    const auto dict_index = (*this)[scope].scope.dict;
+    return dict_index ? m_dicts[dict_index - 1].get_nodes() : empty;
+  }
+
+  // Calls fn with every child of the node at index. Children are the nodes
+  // the node owns: links back up (outer_scope, block_scope.block_stmt), to
+  // declarations (name_expr.decl, ...) and to the shared primitive type
+  // nodes are left out, so the nodes below a GlobalScope form a tree.
+  template <typename Fn>
+  void for_each_child(AstNodeIndex index, Fn&& fn) const {
+    const auto visit = [&](AstNodeIndex child) {
+      if (child != UndefinedAstNodeIndex && !is_primitive_type((*this)[child].kind)) fn(child);
+    };
+    const auto visit_all = [&](ExtraRange range) {
+      for (const auto child : get_nodes(range)) visit(child);
+    };
+    const auto& node = (*this)[index];
+    switch (node.kind) {
+      case AstNode::Kind::GlobalScope:
+        visit(node.global_scope.block_stmt);
+        break;
+      case AstNode::Kind::Function: {
+        const auto function = get_overflow<AstNode::FunctionOverflow>(node.function.overflow);
+        visit(function.function_type_with_named_params);
+        for (const auto param : get_scope_nodes(index)) visit(param);
+        visit(function.body);
+        break;
+      }
+      case AstNode::Kind::Struct:
+      case AstNode::Kind::Union:
+      case AstNode::Kind::Class:
+        for (const auto member : get_scope_nodes(index)) visit(member);
+        break;
+      case AstNode::Kind::FunType:
+      case AstNode::Kind::FunTypeWithNamedParams:
+        visit(node.fun_type.return_type);
+        for (const auto param : get_param_types(node.fun_type)) visit(param);
+        break;
+      case AstNode::Kind::LocalVariable:
+      case AstNode::Kind::GlobalVariable:
+      case AstNode::Kind::StructField:
+      case AstNode::Kind::UnionField:
+        visit(node.value.type);
+        break;
+      case AstNode::Kind::FunctionDeclStmt:
+      case AstNode::Kind::StructDeclStmt:
+      case AstNode::Kind::UnionDeclStmt:
+      case AstNode::Kind::ClassDeclStmt:
+        visit(node.decl_stmt.decl);
+        break;
+      case AstNode::Kind::VariableDeclStmt:
+        visit(node.variable_decl_stmt.variable);
+        visit(node.variable_decl_stmt.init_expr);
+        break;
+      case AstNode::Kind::BlockStmt:
+        // The GlobalScope owns its block, not the other way round.
+        if ((*this)[node.block_stmt.block_scope].kind == AstNode::Kind::BlockScope) {
+          visit(node.block_stmt.block_scope);
+        }
+        visit_all(node.block_stmt.stmts);
+        break;
+      case AstNode::Kind::ExprStmt:
+        visit(node.expr_stmt.expr);
+        break;
+      case AstNode::Kind::ReturnStmt:
+        visit(node.return_stmt.expr);
+        break;
+      case AstNode::Kind::IfElseStmt:
+        visit(node.if_else_stmt.expr);
+        visit(node.if_else_stmt.stmt);
+        visit(node.if_else_stmt.else_stmt);
+        break;
+      case AstNode::Kind::WhileStmt:
+        visit(node.while_stmt.expr);
+        visit(node.while_stmt.stmt);
+        break;
+      case AstNode::Kind::ForStmt: {
+        const auto range = get_overflow<AstNode::ForStmtOverflow>(node.for_stmt.overflow);
+        visit(node.for_stmt.block_scope);
+        visit(range.variable);
+        visit(range.from);
+        visit(range.to);
+        visit(node.for_stmt.stmt);
+        break;
+      }
+      case AstNode::Kind::ParenthExpr:
+      case AstNode::Kind::NegExpr:
+        visit(node.parenth_expr.expr);
+        break;
+      case AstNode::Kind::CallExpr:
+        visit(node.call_expr.callee);
+        visit_all(node.call_expr.args);
+        break;
+      case AstNode::Kind::MemberExpr:
+        visit(node.member_expr.object);
+        break;
+      default:
+        if (AstNode::is_binary_expr(node.kind)) {
+          visit(node.binary_expr.left);
+          visit(node.binary_expr.right);
+        }
+        break;
+    }
+  }
+
+  // A chunk is the smallest part of a region, 4 KiB of nodes.
+  static constexpr uint32_t ChunkBits = 8;
+  static constexpr uint32_t ChunkSize = 1u << ChunkBits;
+
+  static constexpr uint32_t PrimitiveTypesCount = 8;
+
+  // The raw storage, for AstCache: the nodes chunk by chunk, the extra data,
+  // the free list of the root region, the primitive type nodes and the
+  // scope dicts (a Scope's dict is 1 + the index, unused dicts are empty).
+  // Released chunks hold stale nodes.
+  uint32_t chunks_count() const { return (uint32_t)m_chunks.size(); }
+  const AstNode* get_chunk(uint32_t index) const { return m_chunks[index]; }
+  template <typename Fn>
+  void for_each_released_chunk(Fn&& fn) const {
+    for (auto chunk = m_free_chunk; chunk != NoChunk; chunk = m_chunk_next[chunk]) fn(chunk);
+  }
+  const std::vector<uint32_t>& get_extra_data() const { return m_extra; }
+  const std::vector<AstNodeIndex>& get_removed() const { return m_regions[RootRegion.get()].removed; }
+  const AstNodeIndex* get_primitive_types() const { return m_primitive_types; }
+  uint32_t dicts_count() const { return (uint32_t)m_dicts.size(); }
+  const ScopeDict& get_dict(uint32_t index) const { return m_dicts[index]; }
+
+  // Turns an empty Ast into a saved one, all of it in the root region. The
+  // size nodes at nodes are used in place: they must be writable, padded to
+  // whole chunks and outlive the Ast. The dicts are then refilled in order
+  // through add_dict.
+  void restore(AstNode* nodes, uint32_t size, const uint32_t* extra, uint32_t extra_size,
+      const AstNodeIndex* removed_nodes, uint32_t removed_size, const AstNodeIndex* primitive_types) {
+    m_chunks.clear();
+    m_chunk_next.clear();
+    for (uint32_t i = 0; i < size; i += ChunkSize) {
+      m_chunks.emplace_back(nodes + i);
+      m_chunk_next.emplace_back((uint32_t)m_chunk_next.size() + 1);
+    }
+    m_chunk_regions.assign(m_chunks.size(), RootRegion.get());
+    m_free_chunk = NoChunk;
+    m_size = size;
+    m_regions.resize(1);
+    m_free_regions.clear();
+    m_region = RootRegion.get();
+    auto& root = m_regions[m_region];
+    root = Region();
+    if (!m_chunks.empty()) {
+      m_chunk_next.back() = NoChunk;
+      root.first_chunk = 0;
+      root.last_chunk = root.fill_chunk = (uint32_t)m_chunks.size() - 1;
+      root.used = size - root.fill_chunk * ChunkSize;
+    }
+    m_extra.assign(extra, extra + extra_size);
+    root.removed.assign(removed_nodes, removed_nodes + removed_size);
+    std::copy(primitive_types, primitive_types + PrimitiveTypesCount, m_primitive_types);
+    m_dicts.clear();
+    m_dict_regions.clear();
+    m_free_dicts.clear();
+  }
+
+  ScopeDict& add_dict() {
+    m_dict_regions.emplace_back(RootRegion.get());
+    return m_dicts.emplace_back();
+  }
+
 private:
-  std::deque<AstNode> nodes;
-  std::deque<AstNodeIndex> removed;
+  static bool is_primitive_type(AstNode::Kind kind) {
+    return kind >= AstNode::Kind::I8Type && kind <= AstNode::Kind::F64Type;
+  }
+
+  static constexpr uint32_t ChunkMask = ChunkSize - 1;
+  static constexpr uint32_t NoChunk = UINT32_MAX;
+  static constexpr uint32_t NoRegion = UINT32_MAX;
+
+  // The chunks of a region form a list: nodes fill fill_chunk, then the
+  // chunks behind it (after a reset), then new chunks added to the end.
+  // Nested regions are a list of siblings below their parent.
+  struct Region {
+    uint32_t parent = NoRegion;
+    uint32_t first_child = NoRegion;
+    uint32_t next_sibling = NoRegion;
+    uint32_t prev_sibling = NoRegion;
+    uint32_t first_chunk = NoChunk;
+    uint32_t last_chunk = NoChunk;
+    uint32_t fill_chunk = NoChunk;
+    // Nodes created in fill_chunk.
+    uint32_t used = ChunkSize;
+    std::vector<AstNodeIndex> removed;
+    // 1 + the index of the dicts of its scopes, but for the root region,
+    // some may have been freed since (m_dict_regions tells).
+    std::vector<uint32_t> dicts;
+  };
+
+  AstNodeIndex create(uint32_t region_index, AstNode::Kind kind) {
+    auto& region = m_regions[region_index];
+    if (!region.removed.empty()) {
+      const auto index = region.removed.back();
+      (*this)[index].kind = kind;
+      region.removed.pop_back();
+      return index;
+    }
+    if (region.used == ChunkSize) next_chunk(region_index);
+    const auto index = region.fill_chunk << ChunkBits | region.used++;
+    new (&m_chunks[region.fill_chunk][index & ChunkMask]) AstNode(kind);
+    m_size = std::max(m_size, index + 1);
+    return AstNodeIndex(index);
+  }
+
+  void next_chunk(uint32_t region_index) {
+    auto& region = m_regions[region_index];
+    region.used = 0;
+    if (region.fill_chunk != region.last_chunk) {
+      region.fill_chunk = m_chunk_next[region.fill_chunk];
+      return;
+    }
+    uint32_t chunk = m_free_chunk;
+    if (chunk != NoChunk) {
+      m_free_chunk = m_chunk_next[chunk];
+    } else {
+      chunk = (uint32_t)m_chunks.size();
+      m_chunks.emplace_back((AstNode*)m_arena.allocate(ChunkSize * sizeof(AstNode), alignof(AstNode)));
+      m_chunk_next.emplace_back();
+      m_chunk_regions.emplace_back();
+    }
+    // Slots below size() are always nodes, None until created.
+    memset((void*)m_chunks[chunk], 0, ChunkSize * sizeof(AstNode));
+    m_chunk_next[chunk] = NoChunk;
+    m_chunk_regions[chunk] = region_index;
+    if (region.last_chunk == NoChunk) {
+      region.first_chunk = chunk;
+    } else {
+      m_chunk_next[region.last_chunk] = chunk;
+    }
+    region.last_chunk = region.fill_chunk = chunk;
+  }
+
+  // Frees what the nodes of a region own and the regions nested in it, but
+  // not its chunks.
+  void free_contents(uint32_t region_index) {
+    auto& region = m_regions[region_index];
+    for (const auto dict_index : region.dicts) {
+      auto& owner = m_dict_regions[dict_index - 1];
+      if (owner == region_index) {
+        owner = NoRegion;
+        m_free_dicts.emplace_back(dict_index);
+      }
+    }
+    region.dicts.clear();
+    region.removed.clear();
+    for (auto child = region.first_child; child != NoRegion;) {
+      const auto next = m_regions[child].next_sibling;
+      free_region(child);
+      child = next;
+    }
+    region.first_child = NoRegion;
+  }
+
+  // The whole chunk list goes to the free list, the chunks get their new
+  // region when they are reused.
+  void free_region(uint32_t region_index) {
+    free_contents(region_index);
+    auto& region = m_regions[region_index];
+    if (region.first_chunk != NoChunk) {
+      m_chunk_next[region.last_chunk] = m_free_chunk;
+      m_free_chunk = region.first_chunk;
+    }
+    region = Region();
+    m_free_regions.emplace_back(region_index);
+  }
+
+  Arena m_arena;
+  std::vector<AstNode*> m_chunks;
+  // Per chunk, the next chunk of its region or of the free list, and the
+  // region it belongs to.
+  std::vector<uint32_t> m_chunk_next;
+  std::vector<uint32_t> m_chunk_regions;
+  uint32_t m_free_chunk = NoChunk;
+  uint32_t m_size = 0;
+  std::vector<Region> m_regions{1};
+  std::vector<uint32_t> m_free_regions;
+  uint32_t m_region = 0;
+  // Starts with the empty parameter record, for zeroed FunType nodes.
+  std::vector<uint32_t> m_extra{0};
+  std::deque<ScopeDict> m_dicts;
+  // Per dict, the region of its scope, NoRegion for a free dict.
+  std::vector<uint32_t> m_dict_regions;
+  // 1 + the index of the dicts of removed scopes, cleared when reused.
+  std::vector<uint32_t> m_free_dicts;
+  AstNodeIndex m_primitive_types[PrimitiveTypesCount];
 };
 
 #endif  // AST_HPP
@@ -0,0 +1,263 @@
+#include "ast_cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Every section starts on a cache line, the nodes of a chunk share lines
+// the way they do in memory.
+constexpr std::size_t Alignment = 64;
+constexpr char Magic[8] = {'S', 'M', 'A', 'L', 'A', 'S', 'T', '\0'};
+
+namespace section {
+
+enum : uint32_t {
+  // ast.size() nodes padded with zeroed nodes to whole chunks, so the
+  // format follows Ast::ChunkSize.
+  Nodes,
+  Extra,
+  Removed,
+  // The dicts count, then per dict the count of its nodes and a (name,
+  // node) pair per node, in get_nodes order. Anonymous nodes have an
+  // undefined name.
+  Dicts,
+  // Every string NUL terminated, back to back.
+  Strings,
+  // Offset of every string in Strings, and the end of the last one.
+  StringOffsets,
+  // Name, first offset and size of every file of the source points.
+  SourceFiles,
+  SourcePoints,
+  Count,
+};
+
+}  // namespace section
+
+struct SectionRange {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t node_size;
+  uint64_t key;
+  uint32_t root;
+  uint32_t nodes_count;
+  uint32_t primitive_types[Ast::PrimitiveTypesCount];
+  SectionRange sections[section::Count];
+};
+
+// The image is built in memory and written at once.
+class ImageWriter {
+public:
+  ImageWriter() : m_image(sizeof(Header), '\0') {}
+
+  void begin(uint32_t index) {
+    m_image.resize((m_image.size() + Alignment - 1) / Alignment * Alignment, '\0');
+    m_header.sections[index].offset = m_image.size();
+    m_section = index;
+  }
+
+  void write(const void* data, std::size_t size) {
+    m_image.append((const char*)data, size);
+    m_header.sections[m_section].size = m_image.size() - m_header.sections[m_section].offset;
+  }
+
+  void write(uint32_t value) { write(&value, sizeof(value)); }
+
+  Header& header() { return m_header; }
+
+  bool save(const char* path) {
+    memcpy(&m_image[0], &m_header, sizeof(Header));
+    const auto temp = std::string(path) + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+      out.write(m_image.data(), (std::streamsize)m_image.size());
+      if (!out.flush())
+        return false;
+    }
+    return std::rename(temp.c_str(), path) == 0;
+  }
+
+private:
+  Header m_header{};
+  std::string m_image;
+  uint32_t m_section = section::Nodes;
+};
+
+}  // namespace
+
+bool AstCache::save(const char* path, uint64_t key, const Ast& ast, AstNodeIndex root,
+    const IdCache& id_cache, const SourcePointFactory& source_points) {
+  ImageWriter writer;
+  auto& header = writer.header();
+  memcpy(header.magic, Magic, sizeof(Magic));
+  header.version = Version;
+  header.node_size = sizeof(AstNode);
+  header.key = key;
+  header.root = root.get();
+  header.nodes_count = ast.size();
+  for (uint32_t i = 0; i < Ast::PrimitiveTypesCount; ++i) {
+    header.primitive_types[i] = ast.get_primitive_types()[i].get();
+  }
+
+  // Released chunks are saved as None nodes, the loaded Ast doesn't reuse
+  // them.
+  writer.begin(section::Nodes);
+  std::vector<bool> released(ast.chunks_count());
+  ast.for_each_released_chunk([&](uint32_t chunk) { released[chunk] = true; });
+  const std::vector<char> zeros(Ast::ChunkSize * sizeof(AstNode), '\0');
+  for (uint32_t i = 0; i < ast.chunks_count(); ++i) {
+    const auto used = released[i] ? 0 : std::min(Ast::ChunkSize, ast.size() - i * Ast::ChunkSize);
+    writer.write(ast.get_chunk(i), used * sizeof(AstNode));
+    writer.write(zeros.data(), (Ast::ChunkSize - used) * sizeof(AstNode));
+  }
+
+  writer.begin(section::Extra);
+  const auto& extra = ast.get_extra_data();
+  writer.write(extra.data(), extra.size() * sizeof(uint32_t));
+
+  writer.begin(section::Removed);
+  const auto& removed = ast.get_removed();
+  writer.write(removed.data(), removed.size() * sizeof(AstNodeIndex));
+
+  // Named nodes show up in get_nodes in the order they were named, between
+  // the anonymous ones.
+  writer.begin(section::Dicts);
+  writer.write(ast.dicts_count());
+  std::vector<std::pair<IdIndex, AstNodeIndex>> named;
+  for (uint32_t i = 0; i < ast.dicts_count(); ++i) {
+    const auto& dict = ast.get_dict(i);
+    named.clear();
+    dict.for_each_named([&](IdIndex name, AstNodeIndex node) { named.emplace_back(name, node); });
+    writer.write((uint32_t)dict.get_nodes().size());
+    std::size_t next = 0;
+    for (const auto node : dict.get_nodes()) {
+      auto name = IdIndex::undefined;
+      if (next < named.size() && named[next].second == node) {
+        name = named[next++].first;
+      }
+      writer.write(name.get());
+      writer.write(node.get());
+    }
+  }
+
+  writer.begin(section::Strings);
+  std::vector<uint32_t> offsets;
+  offsets.reserve(id_cache.size() + 1);
+  uint32_t offset = 0;
+  for (uint32_t i = 0; i < id_cache.size(); ++i) {
+    const auto& str = id_cache.get(IdIndex(i));
+    offsets.emplace_back(offset);
+    writer.write(str.str, str.length + 1);
+    offset += str.length + 1;
+  }
+  offsets.emplace_back(offset);
+
+  writer.begin(section::StringOffsets);
+  writer.write(offsets.data(), offsets.size() * sizeof(uint32_t));
+
+  writer.begin(section::SourceFiles);
+  for (const auto& file : source_points.get_files()) {
+    writer.write(file.name.get());
+    writer.write(file.begin);
+    writer.write(file.size);
+  }
+
+  writer.begin(section::SourcePoints);
+  const auto& points = source_points.getSourcePoints();
+  writer.write(points.data(), points.size() * sizeof(SourceOffset));
+  return writer.save(path);
+}
+
+bool AstCache::load(const char* path, uint64_t key) {
+  if (m_loaded || !m_file.open(path, true))
+    return false;
+  m_loaded = true;
+
+  Header header;
+  if (m_file.size() < sizeof(Header))
+    return false;
+  memcpy(&header, m_file.data(), sizeof(Header));
+  if (memcmp(header.magic, Magic, sizeof(Magic)) || header.version != Version
+      || header.node_size != sizeof(AstNode) || header.key != key)
+    return false;
+  for (const auto& range : header.sections) {
+    if (range.offset % Alignment || range.offset > m_file.size() || range.size > m_file.size() - range.offset)
+      return false;
+  }
+
+  char* data = m_file.mutable_data();
+  const auto words = [&](uint32_t index) { return (const uint32_t*)(data + header.sections[index].offset); };
+  const auto words_count = [&](uint32_t index) { return (uint32_t)(header.sections[index].size / sizeof(uint32_t)); };
+
+  const uint64_t chunks = (header.nodes_count + Ast::ChunkSize - 1) / Ast::ChunkSize;
+  if (header.sections[section::Nodes].size != chunks * Ast::ChunkSize * sizeof(AstNode))
+    return false;
+  // Node indices past the nodes would be read out of bounds later.
+  if (header.root >= header.nodes_count)
+    return false;
+  for (const auto type : header.primitive_types) {
+    if (type >= header.nodes_count && AstNodeIndex(type) != UndefinedAstNodeIndex)
+      return false;
+  }
+  m_ast.restore((AstNode*)(data + header.sections[section::Nodes].offset), header.nodes_count,
+    words(section::Extra), words_count(section::Extra),
+    (const AstNodeIndex*)words(section::Removed), words_count(section::Removed),
+    (const AstNodeIndex*)header.primitive_types);
+
+  const auto* dicts = words(section::Dicts);
+  const auto* dicts_end = dicts + words_count(section::Dicts);
+  if (dicts == dicts_end)
+    return false;
+  const auto dicts_count = *dicts++;
+  for (uint32_t i = 0; i < dicts_count; ++i) {
+    if (dicts == dicts_end || (uint64_t)(dicts_end - dicts - 1) < (uint64_t)dicts[0] * 2)
+      return false;
+    const auto count = *dicts++;
+    auto& dict = m_ast.add_dict();
+    for (uint32_t j = 0; j < count; ++j, dicts += 2) {
+      const IdIndex name(dicts[0]);
+      const AstNodeIndex node(dicts[1]);
+      if (dicts[1] >= header.nodes_count)
+        return false;
+      if (name != IdIndex::undefined) {
+        dict.append(name, node);
+      } else {
+        dict.append(node);
+      }
+    }
+  }
+
+  const auto* strings = data + header.sections[section::Strings].offset;
+  const auto strings_size = header.sections[section::Strings].size;
+  const auto* offsets = words(section::StringOffsets);
+  const auto strings_count = words_count(section::StringOffsets);
+  for (uint32_t i = 0; i + 1 < strings_count; ++i) {
+    if (offsets[i] >= offsets[i + 1] || offsets[i + 1] > strings_size)
+      return false;
+    if (m_id_cache.get(strings + offsets[i], offsets[i + 1] - offsets[i] - 1) != IdIndex(i))
+      return false;
+  }
+
+  const auto* files = words(section::SourceFiles);
+  for (uint32_t i = 0; i + 3 <= words_count(section::SourceFiles); i += 3) {
+    if (m_source_points.add_file(IdIndex(files[i]), files[i + 2]) != files[i + 1])
+      return false;
+  }
+  const auto* points = words(section::SourcePoints);
+  for (uint32_t i = 0; i < words_count(section::SourcePoints); ++i) {
+    m_source_points.make(points[i]);
+  }
+
+  m_root = AstNodeIndex(header.root);
+  return true;
+}
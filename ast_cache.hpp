@@ -0,0 +1,63 @@
+#ifndef AST_CACHE_HPP
+#define AST_CACHE_HPP
+
+#include <cstdint>
+#include <string_view>
+
+#include "ast.hpp"
+#include "hash.hpp"
+#include "id_cache.hpp"
+#include "mapped_file.hpp"
+#include "source_point.hpp"
+
+// Binary image of a parsed source, so an unchanged file skips the front end:
+// the Ast with its extra data, free list and scope dicts, the IdCache
+// strings its ids refer to and the source points. File texts aren't saved,
+// give them back with SourcePointFactory::set_text for line lookups.
+//
+// Node links are AstNodeIndex values, not pointers, so nodes are saved as
+// they are and loading maps the file once and hands the node chunks to the
+// Ast in place, with no work per node. The extra data and the free list are
+// copied in bulk, the dicts and the strings are refilled.
+//
+// An image is keyed by the hash of the source text. It doesn't load for
+// another source, another Version or another AstNode layout.
+class AstCache {
+public:
+  static constexpr uint32_t Version = 4;
+
+  static uint64_t key(std::string_view source) { return hash::bytes(source.data(), source.size()); }
+
+  // Writes to a temporary file renamed to path, so a reader never sees a
+  // half written image.
+  static bool save(const char* path, uint64_t key, const Ast& ast, AstNodeIndex root,
+    const IdCache& id_cache, const SourcePointFactory& source_points);
+
+  AstCache() : m_source_points(m_id_cache) {}
+  AstCache(const AstCache&) = delete;
+  AstCache(AstCache&&) = delete;
+  AstCache& operator=(const AstCache&) = delete;
+  AstCache& operator=(AstCache&&) = delete;
+
+  // False when there is no image at path, it was saved for another key, or
+  // it is broken. Works once, a failed AstCache is left unusable.
+  bool load(const char* path, uint64_t key);
+
+  // The Ast keeps its nodes in the mapped image, it lives as long as the
+  // AstCache. Adding and changing nodes is fine, the file never changes.
+  Ast& get_ast() { return m_ast; }
+  AstNodeIndex get_root() const { return m_root; }
+  IdCache& get_id_cache() { return m_id_cache; }
+  SourcePointFactory& get_source_points() { return m_source_points; }
+
+private:
+  // Declared first, so the Ast using its pages is destroyed before.
+  MappedFile m_file;
+  IdCache m_id_cache;
+  SourcePointFactory m_source_points;
+  Ast m_ast;
+  AstNodeIndex m_root;
+  bool m_loaded = false;
+};
+
+#endif  // AST_CACHE_HPP
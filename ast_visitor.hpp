@@ -0,0 +1,129 @@
+#ifndef AST_VISITOR_HPP
+#define AST_VISITOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+
+// Depth first walk over the nodes below a root, the children being the ones
+// of Ast::for_each_child in their order. The walk keeps its own stack, so a
+// deep expression tree costs memory, not native stack.
+//
+// Derived (CRTP) adds public handlers for the kinds it cares about, a call
+// before the children of a node and one after them:
+//
+//   class CountCalls : public AstVisitor<CountCalls> {
+//   public:
+//     using AstVisitor::AstVisitor;
+//     static constexpr bool visits(AstNode::Kind kind) { return kind == AstNode::Kind::CallExpr; }
+//     template <AstNode::Kind K>
+//     bool pre(AstNodeIndex index, const AstNode& node) { ++calls; return true; }
+//     std::size_t calls = 0;
+//   };
+//
+// pre<K> returning false skips the children, post<K> is called either way.
+// The handlers are found in a table with an entry per kind, built at
+// compile time: a kind visits() leaves out, or whose handler Derived doesn't
+// define, costs no call, and post entries are only stacked for kinds with a
+// post. A handler is compiled for its kind K, branch on it with if constexpr.
+template <typename Derived>
+class AstVisitor {
+public:
+  explicit AstVisitor(const Ast& ast) : m_ast(ast) {}
+
+  void walk(AstNodeIndex root) {
+    static constexpr auto table = make_table(std::make_index_sequence<AstNode::KindsCount>());
+    // Taken out of m_stack for the walk, so a handler may start a walk of
+    // its own. The storage is kept for the next one.
+    auto stack = std::move(m_stack);
+    stack.clear();
+    stack.emplace_back(root.get());
+    while (!stack.empty()) {
+      const auto entry = stack.back();
+      stack.pop_back();
+      const AstNodeIndex index(entry & ~PostBit);
+      const auto& node = m_ast[index];
+      const auto& handlers = table[(std::size_t)node.kind];
+      if (entry & PostBit) {
+        handlers.post(derived(), index, node);
+        continue;
+      }
+      if (handlers.pre && !handlers.pre(derived(), index, node)) {
+        if (handlers.post) handlers.post(derived(), index, node);
+        continue;
+      }
+      if (handlers.post) stack.emplace_back(entry | PostBit);
+      // Pushed in order and reversed, so the first child comes out first.
+      const auto first = stack.size();
+      m_ast.for_each_child(index, [&stack](AstNodeIndex child) { stack.emplace_back(child.get()); });
+      if (stack.size() - first > 1) std::reverse(stack.begin() + first, stack.end());
+    }
+    m_stack = std::move(stack);
+  }
+
+  // The defaults, hidden by the ones of Derived.
+  static constexpr bool visits(AstNode::Kind) { return true; }
+
+  template <AstNode::Kind K>
+  bool pre(AstNodeIndex, const AstNode&) { return true; }
+
+  template <AstNode::Kind K>
+  void post(AstNodeIndex, const AstNode&) {}
+
+protected:
+  const Ast& m_ast;
+
+private:
+  // A stack entry is a node index, with PostBit once its children are done.
+  // 4 bytes, the stack is a good part of the memory traffic of a walk.
+  static constexpr uint32_t PostBit = 1u << 31;
+
+  struct Handlers {
+    bool (*pre)(Derived&, AstNodeIndex, const AstNode&);
+    void (*post)(Derived&, AstNodeIndex, const AstNode&);
+  };
+
+  std::vector<uint32_t> m_stack;
+
+  Derived& derived() { return static_cast<Derived&>(*this); }
+
+  template <AstNode::Kind K>
+  static bool call_pre(Derived& self, AstNodeIndex index, const AstNode& node) {
+    return self.template pre<K>(index, node);
+  }
+
+  template <AstNode::Kind K>
+  static void call_post(Derived& self, AstNodeIndex index, const AstNode& node) {
+    self.template post<K>(index, node);
+  }
+
+  template <AstNode::Kind K>
+  static constexpr Handlers make_handlers() {
+    Handlers handlers{nullptr, nullptr};
+    if constexpr (Derived::visits(K)) {
+      // Derived's own handlers are members of Derived, the defaults aren't.
+      if constexpr (!std::is_same<decltype(&Derived::template pre<K>),
+          bool (AstVisitor::*)(AstNodeIndex, const AstNode&)>::value) {
+        handlers.pre = &call_pre<K>;
+      }
+      if constexpr (!std::is_same<decltype(&Derived::template post<K>),
+          void (AstVisitor::*)(AstNodeIndex, const AstNode&)>::value) {
+        handlers.post = &call_post<K>;
+      }
+    }
+    return handlers;
+  }
+
+  template <std::size_t... Kinds>
+  static constexpr std::array<Handlers, AstNode::KindsCount> make_table(std::index_sequence<Kinds...>) {
+    return {{make_handlers<(AstNode::Kind)Kinds>()...}};
+  }
+};
+
+#endif  // AST_VISITOR_HPP
@@ -0,0 +1,1018 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_cache.hpp"
+#include "ast_visitor.hpp"
+#include "char_scanner.hpp"
+#include "codegen.hpp"
+#include "driver.hpp"
+#include "hash.hpp"
+#include "id_cache.hpp"
+#include "ir_passes.hpp"
+#include "incremental.hpp"
+#include "lexer.hpp"
+#include "parallel_lexer.hpp"
+#include "parser.hpp"
+#include "relexer.hpp"
+#include "semantic.hpp"
+#include "source_point.hpp"
+#include "vm.hpp"
+
+// Benchmarks for the front end and the vm. Run `smallang_bench [name]` from a
+// Release build, without a name every benchmark runs.
+
+namespace {
+
+class Timer {
+public:
+  Timer() : m_start(std::chrono::steady_clock::now()) {}
+
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+  }
+private:
+  std::chrono::steady_clock::time_point m_start;
+};
+
+// Runs fn repeatedly for at least min_seconds and returns seconds per run.
+template <typename Fn>
+double measure(Fn&& fn, double min_seconds = 0.5) {
+  fn();
+  size_t runs = 0;
+  Timer timer;
+  do {
+    fn();
+    ++runs;
+  } while (timer.seconds() < min_seconds);
+  return timer.seconds() / runs;
+}
+
+// A synthetic program in the shape of README.txt, `functions` functions long.
+// Names repeat after `distinct_names` functions.
+std::string make_source(size_t functions, size_t distinct_names = SIZE_MAX) {
+  std::string source;
+  source.reserve(functions * 200);
+  char buf[512];
+  for (size_t i = 0; i < functions; ++i) {
+    snprintf(buf, sizeof(buf),
+      "fun function_%zu(alpha_%zu: i32, beta: i32): i32 {\n"
+      "  var counter: i32 = %zu;\n"
+      "  for (i in 0..100) {\n"
+      "    alpha_%zu += beta + 10;\n"
+      "  }\n"
+      "  print(\"result of function %zu: {}\", alpha_%zu)\n"
+      "  return alpha_%zu\n"
+      "}\n\n",
+      i % distinct_names, i % 97, i * 31, i % 97, i % distinct_names, i % 97, i % 97);
+    source += buf;
+  }
+  return source;
+}
+
+void report(const char* name, double seconds, double items, const char* unit) {
+  printf("  %-36s %10.3f ms %12.1f %s/s\n", name, seconds * 1e3, items / seconds, unit);
+}
+
+void bench_lexer() {
+  printf("lexer\n");
+  // Few distinct names so that the numbers show the scanner, not the interner.
+  const auto source = make_source(50000, 100);
+  const double mb = source.size() / (1024.0 * 1024.0);
+  printf("  source: %.1f MiB\n", mb);
+
+  const auto lex_stream = [&] {
+    std::istringstream in(source);
+    Lexer::Tokens tokens;
+    IdCache id_cache;
+    Lexer lexer(in, tokens, id_cache);
+    while (lexer.next().get_kind() != Token::Kind::Eof) {}
+  };
+  report("istream", measure(lex_stream), mb, "MiB");
+
+  const auto best = char_scanner::best_level();
+  for (auto level : {char_scanner::Level::Scalar, char_scanner::Level::Sse2, char_scanner::Level::Avx2}) {
+    if (level > best)
+      break;
+    char_scanner::set_level(level);
+    const auto lex_view = [&] {
+      Lexer::Tokens tokens;
+      IdCache id_cache;
+      Lexer lexer(std::string_view(source), tokens, id_cache);
+      while (lexer.next().get_kind() != Token::Kind::Eof) {}
+    };
+    char name[64];
+    snprintf(name, sizeof(name), "string_view %s", char_scanner::level_name(level));
+    report(name, measure(lex_view), mb, "MiB");
+  }
+  char_scanner::set_level(best);
+}
+
+// IdCache as it was before the arena and open addressing table, kept as the
+// baseline for bench_id_cache.
+class LegacyIdCache {
+public:
+  ~LegacyIdCache() {
+    for (auto& s : m_strings) delete [] s.first;
+  }
+
+  IdIndex get(const char* str, uint32_t length) {
+    StringPair sp{str, length};
+    auto it = m_map.find(sp);
+    if (it == m_map.end()) {
+      auto s = new char[length + 1];
+      memcpy(s, str, length);
+      s[length] = '\0';
+      const IdIndex id_index((IdIndex::value_type)m_strings.size());
+      m_map.emplace(StringPair{s, length}, id_index);
+      m_strings.emplace_back(s, length);
+      return id_index;
+    }
+    return it->second;
+  }
+
+  using StringPair = std::pair<const char*, uint32_t>;
+
+  struct StringHash {
+    std::size_t operator()(const StringPair& s) const {
+      auto h = std::hash<uint32_t>{}(s.second);
+      for (uint32_t i = 0; i < s.second; ++i) {
+        auto ch = std::hash<char>{}(s.first[i]);
+        h = h ^ (ch << 1);
+      }
+      return h;
+    }
+  };
+
+private:
+  struct StringEqual {
+    bool operator()(const StringPair& s1, const StringPair& s2) const {
+      return s1.second == s2.second && !memcmp(s1.first, s2.first, s1.second);
+    }
+  };
+
+  std::unordered_map<StringPair, IdIndex, StringHash, StringEqual> m_map;
+  std::vector<StringPair> m_strings;
+};
+
+class Random {
+public:
+  explicit Random(uint64_t seed) : m_state(seed) {}
+
+  uint64_t next() {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 7;
+    m_state ^= m_state << 17;
+    return m_state;
+  }
+
+  uint32_t below(uint32_t n) { return next() % n; }
+private:
+  uint64_t m_state;
+};
+
+// Short loop variables, snake_case and camelCase names built from common
+// words, and compiler generated temporaries.
+std::vector<std::string> make_identifiers(size_t count) {
+  static const char* words[] = {
+    "get", "set", "value", "node", "count", "index", "size", "buffer", "name", "type",
+    "parse", "token", "scope", "result", "left", "right", "next", "prev", "data", "len",
+    "first", "last", "item", "list", "map", "key", "offset", "begin", "end", "total"};
+  const size_t words_count = sizeof(words) / sizeof(words[0]);
+  std::unordered_set<std::string> seen;
+  std::vector<std::string> result;
+  Random random(42);
+
+  for (char c = 'a'; c <= 'z'; ++c) {
+    for (int d = -1; d < 10 && result.size() < count; ++d) {
+      auto id = std::string(1, c) + (d < 0 ? "" : std::to_string(d));
+      if (seen.insert(id).second) result.emplace_back(std::move(id));
+    }
+  }
+  while (result.size() < count) {
+    std::string id;
+    switch (random.below(3)) {
+      case 0:
+        id = std::string(words[random.below(words_count)]) + "_" + words[random.below(words_count)];
+        if (random.below(2)) id += std::string("_") + words[random.below(words_count)];
+        break;
+      case 1: {
+        id = words[random.below(words_count)];
+        std::string second = words[random.below(words_count)];
+        second[0] = second[0] - 'a' + 'A';
+        id += second;
+        break;
+      }
+      default:
+        id = "tmp_" + std::to_string(random.below(1000000));
+        break;
+    }
+    if (seen.insert(id).second) result.emplace_back(std::move(id));
+  }
+  return result;
+}
+
+// Fraction of identifiers whose home bucket in a table of 2 * count buckets
+// is already taken.
+template <typename Hash>
+double bucket_collision_rate(const std::vector<std::string>& ids, Hash&& hash) {
+  size_t buckets = 1;
+  while (buckets < ids.size() * 2) buckets <<= 1;
+  std::vector<bool> used(buckets);
+  size_t collisions = 0;
+  for (auto& id : ids) {
+    const auto b = hash(id) & (buckets - 1);
+    if (used[b]) ++collisions;
+    used[b] = true;
+  }
+  return (double)collisions / ids.size();
+}
+
+template <typename Hash>
+double full_hash_collision_rate(const std::vector<std::string>& ids, Hash&& hash) {
+  std::unordered_set<uint64_t> hashes;
+  for (auto& id : ids) hashes.insert(hash(id));
+  return 1.0 - (double)hashes.size() / ids.size();
+}
+
+void bench_id_cache() {
+  printf("id_cache\n");
+  const auto ids = make_identifiers(20000);
+
+  const auto legacy_hash = [](const std::string& s) {
+    return (uint64_t)LegacyIdCache::StringHash{}(LegacyIdCache::StringPair{s.data(), (uint32_t)s.size()});
+  };
+  const auto new_hash = [](const std::string& s) { return hash::bytes(s.data(), s.size()); };
+  printf("  %zu distinct identifiers\n", ids.size());
+  printf("  %-36s %9.2f%% full hash, %6.2f%% buckets\n", "legacy xor hash collisions",
+    full_hash_collision_rate(ids, legacy_hash) * 100, bucket_collision_rate(ids, legacy_hash) * 100);
+  printf("  %-36s %9.2f%% full hash, %6.2f%% buckets\n", "wyhash collisions",
+    full_hash_collision_rate(ids, new_hash) * 100, bucket_collision_rate(ids, new_hash) * 100);
+
+  // Identifier uses are skewed, a few names make up most of the tokens.
+  std::vector<const std::string*> stream;
+  Random random(7);
+  for (size_t i = 0; i < 1000000; ++i) {
+    const auto r = random.below(1000);
+    const auto range = r < 700 ? 64 : (r < 950 ? 2000 : ids.size());
+    stream.emplace_back(&ids[random.below(range)]);
+  }
+  const double lookups = stream.size() / 1e6;
+
+  if (ids.size() <= 2000) {
+    report("legacy IdCache lookups", measure([&] {
+      LegacyIdCache id_cache;
+      for (auto s : stream) id_cache.get(s->data(), s->size());
+    }), lookups, "M");
+  } else {
+    // The xor hash degrades to linear chains, a smaller run keeps this quick.
+    std::vector<const std::string*> short_stream(stream.begin(), stream.begin() + stream.size() / 10);
+    report("legacy IdCache lookups (1/10 stream)", measure([&] {
+      LegacyIdCache id_cache;
+      for (auto s : short_stream) id_cache.get(s->data(), s->size());
+    }), lookups / 10, "M");
+  }
+  report("IdCache lookups", measure([&] {
+    IdCache id_cache;
+    for (auto s : stream) id_cache.get(s->data(), s->size());
+  }), lookups, "M");
+}
+
+void bench_relex() {
+  printf("relex\n");
+  auto source = make_source(50000, 100);
+  IdCache id_cache;
+  const auto lex_all = [&] {
+    TokenWindow window(2);
+    StreamingLexer lexer(std::string_view(source), window, id_cache);
+    TokenStore store;
+    store.lex(lexer);
+    return store;
+  };
+  auto store = lex_all();
+  printf("  source: %.1f MiB, %zu tokens\n", source.size() / (1024.0 * 1024.0), store.size());
+  report("full lex", measure(lex_all), 1, "files");
+
+  // Keystrokes: insert a char, then delete it again. Typing moves the cursor
+  // a little between edits, jumps go anywhere in the file.
+  for (const bool jumps : {false, true}) {
+    Random random(11);
+    const size_t edits = 2000;
+    size_t relexed = 0;
+    double seconds = 0;
+    uint32_t cursor = source.size() / 2;
+    for (size_t i = 0; i < edits; ++i) {
+      cursor = jumps ? random.below(source.size()) : (cursor + random.below(400) - 200) % source.size();
+      for (const auto& edit : {TextEdit{cursor, 0, "x"}, TextEdit{cursor, 1, ""}}) {
+        // Editing the text itself is the editor's cost, only relex is timed.
+        edit.apply(source);
+        Timer timer;
+        relexed += relex(store, source, edit, id_cache).range.count();
+        seconds += timer.seconds();
+      }
+    }
+    report(jumps ? "relex one char edit, random place" : "relex one char edit, typing",
+      seconds / (edits * 2), 1, "edits");
+    printf("  %-36s %10.2f\n", "tokens relexed per edit", (double)relexed / (edits * 2));
+  }
+}
+
+void bench_driver() {
+  printf("driver\n");
+  const size_t files = 64;
+  std::vector<std::string> paths;
+  size_t bytes = 0;
+  for (size_t i = 0; i < files; ++i) {
+    const auto source = make_source(2000 + i * 50, 500);
+    paths.emplace_back("/tmp/smallang_bench_" + std::to_string(i) + ".sl");
+    std::ofstream(paths.back(), std::ios::binary) << source;
+    bytes += source.size();
+  }
+  printf("  %zu files, %.1f MiB\n", files, bytes / (1024.0 * 1024.0));
+
+  std::vector<size_t> threads_counts;
+  const auto max_threads = ThreadPool::default_threads_count();
+  for (size_t threads = 1; threads < max_threads; threads *= 2) threads_counts.push_back(threads);
+  threads_counts.push_back(max_threads);
+
+  for (const auto threads : threads_counts) {
+    ConcurrentIdCache id_cache;
+    Driver driver(id_cache, threads);
+    driver.run(paths);  // warms the page cache
+    const auto report = driver.run(paths);
+    char name[64];
+    snprintf(name, sizeof(name), "%zu threads", threads);
+    printf("  %-36s %10.3f ms %12.1f MiB/s  cpu %.3f ms\n", name, report.wall_seconds * 1e3,
+      bytes / (1024.0 * 1024.0) / report.wall_seconds, report.cpu_seconds * 1e3);
+  }
+  for (const auto& path : paths) {
+    std::remove(path.c_str());
+  }
+}
+
+void bench_parallel_lex() {
+  printf("parallel_lex\n");
+  const auto source = make_source(500000, 5000);
+  const double mib = source.size() / (1024.0 * 1024.0);
+  printf("  source: %.1f MiB\n", mib);
+
+  report("sequential", measure([&] {
+    IdCache id_cache;
+    TokenWindow window(2);
+    StreamingLexer lexer(std::string_view(source), window, id_cache);
+    TokenStore store;
+    store.lex(lexer);
+  }), mib, "MiB");
+
+  std::vector<size_t> threads_counts;
+  const auto max_threads = ThreadPool::default_threads_count();
+  for (size_t threads = 1; threads < max_threads; threads *= 2) threads_counts.push_back(threads);
+  threads_counts.push_back(max_threads);
+
+  for (const auto threads : threads_counts) {
+    ThreadPool pool(threads);
+    ParallelLexResult result{};
+    const auto seconds = measure([&] {
+      IdCache id_cache;
+      TokenStore store;
+      result = lex_parallel(std::string_view(source), store, id_cache, pool);
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "%zu threads, %zu chunks", threads, result.chunks);
+    report(name, seconds, mib, "MiB");
+  }
+}
+
+void bench_parser() {
+  printf("parser\n");
+  const auto source = make_source(200000, 5000);
+  const auto lines = std::count(source.begin(), source.end(), '\n');
+  printf("  source: %.1f MiB, %ld lines\n", source.size() / (1024.0 * 1024.0), (long)lines);
+
+  IdCache id_cache;
+  TokenWindow window(2);
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  TokenStore store;
+  store.lex(lexer);
+
+  report("parse stored tokens", measure([&] {
+    Ast ast;
+    TokenStore::Reader reader(store);
+    TokenStoreParser parser(reader, ast, id_cache);
+    parser.parse();
+  }), lines, "lines");
+
+  report("lex and parse", measure([&] {
+    Ast ast;
+    TokenWindow window;
+    StreamingLexer lexer(std::string_view(source), window, id_cache);
+    StreamingParser parser(lexer, ast, id_cache);
+    parser.parse();
+  }), lines, "lines");
+}
+
+// Visitors of bench_ast_traversal: every node, then only the calls.
+class CountVisitor : public AstVisitor<CountVisitor> {
+public:
+  using AstVisitor::AstVisitor;
+  template <AstNode::Kind K>
+  bool pre(AstNodeIndex, const AstNode&) { ++pres; return true; }
+  template <AstNode::Kind K>
+  void post(AstNodeIndex, const AstNode&) { ++posts; }
+  uint64_t pres = 0;
+  uint64_t posts = 0;
+};
+
+class CallVisitor : public AstVisitor<CallVisitor> {
+public:
+  using AstVisitor::AstVisitor;
+  static constexpr bool visits(AstNode::Kind kind) { return kind == AstNode::Kind::CallExpr; }
+  template <AstNode::Kind K>
+  bool pre(AstNodeIndex, const AstNode&) { ++calls; return true; }
+  uint64_t calls = 0;
+};
+
+// Walks a big parsed program, depth first from the GlobalScope and as a
+// linear sweep over the node chunks. Both are bound by memory traffic, so
+// they follow the size of AstNode. AstVisitor walks the same nodes on its
+// own stack, with a call per handler.
+void bench_ast_traversal() {
+  printf("ast_traversal\n");
+  const auto source = make_source(200000, 5000);
+  IdCache id_cache;
+  TokenWindow window;
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  Ast ast;
+  StreamingParser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+  printf("  %u nodes of %zu bytes, %.1f MiB\n", ast.size(), sizeof(AstNode),
+    ast.size() * sizeof(AstNode) / (1024.0 * 1024.0));
+
+  std::vector<AstNodeIndex> stack;
+  uint64_t visited = 0;
+  report("depth first walk", measure([&] {
+    visited = 0;
+    stack.push_back(global);
+    while (!stack.empty()) {
+      const auto index = stack.back();
+      stack.pop_back();
+      ++visited;
+      ast.for_each_child(index, [&](AstNodeIndex child) { stack.push_back(child); });
+    }
+  }), ast.size(), "nodes");
+  printf("  %lu nodes reached\n", (unsigned long)visited);
+
+  uint64_t exprs = 0;
+  report("linear sweep", measure([&] {
+    exprs = 0;
+    for (uint32_t i = 0; i < ast.size(); ++i) {
+      exprs += ast[AstNodeIndex(i)].is_expr();
+    }
+  }), ast.size(), "nodes");
+  printf("  %lu expressions\n", (unsigned long)exprs);
+
+  // The same walks through AstVisitor: every node, then only the calls.
+  CountVisitor count_visitor(ast);
+  report("visitor pre and post", measure([&] {
+    count_visitor.pres = count_visitor.posts = 0;
+    count_visitor.walk(global);
+  }), ast.size(), "nodes");
+  printf("  %lu pre, %lu post\n", (unsigned long)count_visitor.pres, (unsigned long)count_visitor.posts);
+  CallVisitor call_visitor(ast);
+  report("visitor calls only", measure([&] {
+    call_visitor.calls = 0;
+    call_visitor.walk(global);
+  }), ast.size(), "nodes");
+  printf("  %lu calls\n", (unsigned long)call_visitor.calls);
+}
+
+// Name resolution the way the parser does it: up the outer_scope chain with
+// a find in every scope. The chain is the one of a statement nested in two
+// blocks of a function, below a global scope of many functions: a few names
+// in every scope but the last.
+void bench_scope_lookup() {
+  printf("scope_lookup\n");
+  static constexpr uint32_t Functions = 5000;
+  static constexpr uint32_t Chains = 20000;
+  IdCache id_cache;
+  std::vector<IdIndex> function_names;
+  for (uint32_t i = 0; i < Functions; ++i) {
+    function_names.emplace_back(id_cache.get(("function_" + std::to_string(i)).c_str()));
+  }
+  const IdIndex locals[] = {
+    id_cache.get("alpha"), id_cache.get("beta"), id_cache.get("gamma"),
+    id_cache.get("counter"), id_cache.get("i"), id_cache.get("j"), id_cache.get("sum"),
+  };
+  const auto missing = id_cache.get("missing");
+
+  std::vector<AstNodeIndex> innermost;
+  const auto build = [&](Ast& ast) {
+    const auto create_scope = [&](AstNode::Kind kind, AstNodeIndex outer) {
+      const auto scope = ast.create(kind);
+      ast[scope].scope.outer_scope = outer;
+      return scope;
+    };
+    const auto global = create_scope(AstNode::Kind::GlobalScope, UndefinedAstNodeIndex);
+    for (const auto name : function_names) {
+      ast.add_to_scope(global, ast.create(AstNode::Kind::Function), name);
+    }
+    innermost.clear();
+    for (uint32_t i = 0; i < Chains; ++i) {
+      const auto function = create_scope(AstNode::Kind::Function, global);
+      for (int j = 0; j < 3; ++j) ast.add_to_scope(function, ast.create(AstNode::Kind::LocalVariable), locals[j]);
+      const auto block = create_scope(AstNode::Kind::BlockScope, function);
+      ast.add_to_scope(block, ast.create(AstNode::Kind::LocalVariable), locals[3]);
+      const auto inner = create_scope(AstNode::Kind::BlockScope, block);
+      for (int j = 4; j < 7; ++j) ast.add_to_scope(inner, ast.create(AstNode::Kind::LocalVariable), locals[j]);
+      innermost.emplace_back(inner);
+    }
+  };
+  report("declare", measure([&] {
+    Ast ast;
+    build(ast);
+  }), Functions + Chains * 7, "names");
+
+  Ast ast;
+  build(ast);
+  const auto lookup = [&](IdIndex name, AstNodeIndex scope) {
+    for (auto index = scope; index != UndefinedAstNodeIndex; index = ast[index].scope.outer_scope) {
+      const auto found = ast.find_in_scope(index, name);
+      if (found != UndefinedAstNodeIndex) return found;
+    }
+    return UndefinedAstNodeIndex;
+  };
+
+  // Every chain looks up all its locals, a function and a missing name.
+  const uint32_t lookups = Chains * 9;
+  uint64_t found = 0;
+  report("resolve through the scope chain", measure([&] {
+    found = 0;
+    for (uint32_t i = 0; i < Chains; ++i) {
+      for (const auto name : locals) found += lookup(name, innermost[i]) != UndefinedAstNodeIndex;
+      found += lookup(function_names[(i * 7919) % Functions], innermost[i]) != UndefinedAstNodeIndex;
+      found += lookup(missing, innermost[i]) != UndefinedAstNodeIndex;
+    }
+  }), lookups, "lookups");
+  printf("  %lu of %u found\n", (unsigned long)found, lookups);
+}
+
+// Startup of one big source: cold runs the front end and saves the image,
+// warm hashes the source and loads the image.
+void bench_ast_cache() {
+  printf("ast_cache\n");
+  const auto source = make_source(200000, 5000);
+  const auto path = std::string("/tmp/smallang_bench.ast");
+  const auto lines = std::count(source.begin(), source.end(), '\n');
+
+  const auto front_end = [&](IdCache& id_cache, Ast& ast) {
+    TokenWindow window;
+    StreamingLexer lexer(std::string_view(source), window, id_cache);
+    StreamingParser parser(lexer, ast, id_cache);
+    return parser.parse();
+  };
+
+  report("front end", measure([&] {
+    IdCache id_cache;
+    Ast ast;
+    front_end(id_cache, ast);
+  }), lines, "lines");
+
+  report("cold: front end and save", measure([&] {
+    IdCache id_cache;
+    Ast ast;
+    const auto root = front_end(id_cache, ast);
+    SourcePointFactory source_points(id_cache);
+    AstCache::save(path.c_str(), AstCache::key(source), ast, root, id_cache, source_points);
+  }), lines, "lines");
+
+  std::ifstream image(path, std::ios::binary | std::ios::ate);
+  printf("  image: %.1f MiB\n", image.tellg() / (1024.0 * 1024.0));
+
+  bool loaded = false;
+  report("warm: hash and load", measure([&] {
+    AstCache cache;
+    loaded = cache.load(path.c_str(), AstCache::key(source));
+  }), lines, "lines");
+  printf("  loaded: %s\n", loaded ? "yes" : "no");
+  std::remove(path.c_str());
+}
+
+// Throws away the subtree of one big function: node by node through the
+// free list, against releasing the region an incremental reparse put it in.
+void bench_ast_regions() {
+  printf("ast_regions\n");
+  std::string source = "fun big(a: i32): i32 {\n";
+  for (int i = 0; i < 100000; ++i) source += "  a += a * 3 + 1;\n";
+  source += "  return a\n}\n";
+  const auto offset = (uint32_t)source.find("3 + 1");
+
+  const size_t runs = 20;
+  double remove_seconds = 0;
+  double release_seconds = 0;
+  uint32_t nodes = 0;
+  for (size_t i = 0; i < runs; ++i) {
+    IdCache id_cache;
+    IncrementalUnit unit(source, id_cache);
+    auto& ast = unit.get_ast();
+    const auto function = unit.get_function_spans()[0].function;
+    nodes = ast.size();
+    Timer timer;
+    ast.remove_children(function);
+    remove_seconds += timer.seconds();
+
+    IncrementalUnit reparsed(source, id_cache);
+    reparsed.apply(TextEdit{offset, 1, "4"});
+    auto& region_ast = reparsed.get_ast();
+    const auto record = region_ast.get_overflow<AstNode::FunctionOverflow>(region_ast[function].function.overflow);
+    const auto region = region_ast.get_region(record.function_type_with_named_params);
+    Timer release_timer;
+    region_ast.release_region(region);
+    region_ast.clear_scope(function);
+    release_seconds += release_timer.seconds();
+  }
+  printf("  %u nodes\n", nodes);
+  report("remove node by node", remove_seconds / runs, nodes, "nodes");
+  report("release region", release_seconds / runs, nodes, "nodes");
+}
+
+// Edits in a function body of a big program: a char typed and deleted
+// again, each edit relexed and the function parsed again against a full
+// parse of the file.
+void bench_incremental() {
+  printf("incremental\n");
+  const auto source = make_source(50000, 100);
+  IdCache id_cache;
+  IncrementalUnit unit(source, id_cache);
+  printf("  source: %.1f MiB, %zu nodes\n", source.size() / (1024.0 * 1024.0), (size_t)unit.get_ast().size());
+
+  report("full parse", measure([&] {
+    Ast ast;
+    TokenStore::Reader reader(unit.get_tokens());
+    TokenStoreParser parser(reader, ast, id_cache);
+    parser.parse();
+  }), 1, "files");
+
+  Random random(13);
+  const size_t edits = 2000;
+  size_t reparsed = 0;
+  Timer timer;
+  for (size_t i = 0; i < edits; ++i) {
+    // A digit of the `beta + 10` literal somewhere in the file.
+    const auto& spans = unit.get_function_spans();
+    const auto& span = spans[random.below(spans.size())];
+    const auto offset = (uint32_t)unit.get_source().find("+ 10", span.begin) + 2;
+    reparsed += unit.apply(TextEdit{offset, 0, "7"});
+    reparsed += unit.apply(TextEdit{offset, 1, ""});
+  }
+  report("relex and reparse one function", timer.seconds() / (edits * 2), 1, "edits");
+  printf("  reparsed: %zu of %zu, nodes: %zu\n", reparsed, edits * 2, (size_t)unit.get_ast().size());
+}
+
+// A location per token of a big file: making them, then the first lookup,
+// which scans the newlines, and lookups after it.
+void bench_source_points() {
+  printf("source_points\n");
+  const auto source = make_source(200000, 5000);
+  IdCache id_cache;
+  TokenWindow window(2);
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  TokenStore store;
+  store.lex(lexer);
+
+  const auto make_all = [&] {
+    SourcePointFactory source_points(id_cache);
+    const auto begin = source_points.add_file("bench.sl", 8, source);
+    for (uint32_t i = 0; i < store.size(); ++i) {
+      source_points.make(begin + store.offset(TokenIndex(i)));
+    }
+    return source_points;
+  };
+  report("make a point per token", measure(make_all), store.size(), "points");
+  auto source_points = make_all();
+  printf("  %zu points, %.1f MiB\n", source_points.getSourcePoints().size(),
+    source_points.getSourcePoints().size() * sizeof(SourceOffset) / (1024.0 * 1024.0));
+
+  Timer timer;
+  source_points.get(0);
+  report("first lookup, newline scan", timer.seconds(), source.size() / (1024.0 * 1024.0), "MiB");
+  Random random(17);
+  const size_t lookups = 1000000;
+  LineNumber lines = 0;
+  Timer lookup_timer;
+  for (size_t i = 0; i < lookups; ++i) {
+    lines += source_points.get(random.below(store.size())).m_line;
+  }
+  report("lookup", lookup_timer.seconds() / lookups, 1, "lookups");
+  printf("  mean line %.0f\n", (double)lines / lookups);
+}
+
+// The semantic pass over a big program, on 1 thread and on every core.
+void bench_semantic() {
+  printf("semantic\n");
+  const auto source = make_source(200000);
+  const auto lines = std::count(source.begin(), source.end(), '\n');
+  IdCache id_cache;
+  TokenWindow window;
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  Ast ast;
+  StreamingParser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+
+  size_t errors = 0;
+  for (const auto threads : {(size_t)1, ThreadPool::default_threads_count()}) {
+    ThreadPool pool(threads);
+    char name[64];
+    snprintf(name, sizeof(name), "check, %zu threads", threads);
+    report(name, measure([&] {
+      SemanticPass pass(ast, id_cache);
+      pass.run(global, pool);
+      errors = pass.get_errors().size();
+    }), lines, "lines");
+  }
+  printf("  errors: %zu\n", errors);
+}
+
+// The node list of ir::Function as it was before its arena: a heap
+// allocation per node, deleted one by one. Kept as the baseline for bench_ir.
+class HeapNodeList {
+public:
+  ~HeapNodeList() {
+    auto node = m_head;
+    while (node) {
+      auto next = node->m_next;
+      delete node;
+      node = next;
+    }
+  }
+
+  template <typename... Args>
+  ir::Node& add(ir::Instr instr, ir::Type type, Args... args) {
+    ir::Node* node;
+    if constexpr (sizeof...(args) > 0) {
+      auto node_args = new ir::NodeArgs<sizeof...(args)>();
+      std::size_t i = 0;
+      ((node_args->args[i++] = args), ...);
+      node = node_args;
+    } else {
+      node = new ir::Node();
+    }
+    node->m_instr = instr;
+    node->m_type = type;
+    if (m_tail) {
+      m_tail->m_next = node;
+      node->m_prev = m_tail;
+      m_tail = node;
+    } else {
+      m_head = m_tail = node;
+    }
+    return *node;
+  }
+
+  ir::Node* get_head() const { return m_head; }
+
+private:
+  ir::Node* m_head = nullptr;
+  ir::Node* m_tail = nullptr;
+};
+
+// Builds, walks and destroys functions of 100k instructions: a loop body of
+// an add, a mov, a label and a compare jump back to it, over and over.
+template <typename Function>
+uint64_t build_ir(Function& function, uint32_t instrs) {
+  using namespace ir;
+  for (uint32_t i = 0; i < instrs / 4; ++i) {
+    const auto slot = (uint16_t)(i % 200);
+    function.add(Instr::add, Type::I, Arg{.local_index = slot}, Arg{.local_index = 1}, Arg{.local_index = 2});
+    function.add(Instr::mov, Type::I, Arg{.local_index = 3}, Arg{.local_index = slot});
+    auto& label = function.add(Instr::label, Type::V);
+    function.add(Instr::jle, Type::I, Arg{.node_pointer = &label}, Arg{.local_index = 3}, Arg{.local_index = 4});
+  }
+  uint64_t sum = 0;
+  for (auto* node = function.get_head(); node; node = node->m_next) sum += (uint64_t)node->m_instr;
+  return sum;
+}
+
+void bench_ir() {
+  printf("ir\n");
+  static constexpr uint32_t Instrs = 100000;
+  static constexpr uint32_t Functions = 10;
+  IdCache id_cache;
+  const auto name = id_cache.get("f");
+  uint64_t sum = 0;
+  report("heap nodes, build, walk, free", measure([&] {
+    for (uint32_t i = 0; i < Functions; ++i) {
+      HeapNodeList function;
+      sum += build_ir(function, Instrs);
+    }
+  }), Instrs * Functions, "instrs");
+  report("arena nodes, build, walk, free", measure([&] {
+    for (uint32_t i = 0; i < Functions; ++i) {
+      ir::Function function(ir::FunctionBuilder{name});
+      sum += build_ir(function, Instrs);
+    }
+  }), Instrs * Functions, "instrs");
+  report("arena nodes, build, compact", measure([&] {
+    for (uint32_t i = 0; i < Functions; ++i) {
+      ir::Function function(ir::FunctionBuilder{name});
+      sum += build_ir(function, Instrs);
+      function.compact();
+      sum += function.get_compacted_code().size();
+    }
+  }), Instrs * Functions, "instrs");
+  printf("  checksum %lu\n", (unsigned long)sum);
+}
+
+// Loop heavy functions for the Vm, each run with an argument.
+const char* vm_source =
+  "fun sum(n: i32): i32 {\n"
+  "  var s = 0;\n"
+  "  for (i in 1..n) {\n"
+  "    s += i * 3 + 7;\n"
+  "  }\n"
+  "  return s\n"
+  "}\n"
+  "fun nested(n: i32): i32 {\n"
+  "  var s = 0;\n"
+  "  for (i in 0..n) {\n"
+  "    for (j in 0..n) {\n"
+  "      s += i - j;\n"
+  "      if (s > 100000) s -= 100000\n"
+  "    }\n"
+  "  }\n"
+  "  return s\n"
+  "}\n"
+  "fun countdown(n: i32): i32 {\n"
+  "  var k = 0;\n"
+  "  while (n > 0) {\n"
+  "    n -= 1;\n"
+  "    k += 2;\n"
+  "  }\n"
+  "  return k\n"
+  "}\n"
+  "fun fib(n: i32): i32 {\n"
+  "  if (n < 2) return n\n"
+  "  return fib(n - 1) + fib(n - 2)\n"
+  "}\n"
+  "fun scaled(n: i32): i32 {\n"
+  "  var s = 0;\n"
+  "  var step = 4 * 8 - 30;\n"
+  "  for (i in 1..n) {\n"
+  "    var k = step * 3;\n"
+  "    s += i + k;\n"
+  "  }\n"
+  "  return s\n"
+  "}\n";
+
+struct VmRun {
+  const char* function;
+  int32_t arg;
+};
+
+const VmRun vm_runs[] = {
+  {"sum", 1000000},
+  {"nested", 1000},
+  {"countdown", 1000000},
+  {"fib", 25},
+  {"scaled", 1000000},
+};
+
+// Parses, checks and lowers source into module.
+bool lower_source(const std::string& source, IdCache& id_cache, Ast& ast, ir::Module& module) {
+  TokenWindow window;
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  StreamingParser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+  ThreadPool pool(1);
+  SemanticPass pass(ast, id_cache);
+  pass.run(global, pool);
+  CodeGen codegen(ast, id_cache, pass);
+  return codegen.lower(module);
+}
+
+// Bytes of bytecode of the functions of module, compacting them.
+size_t compact_all(ir::Module& module, bool superinstructions = true) {
+  size_t code = 0;
+  for (auto& function : module.get_functions()) {
+    function.compact(superinstructions);
+    code += function.get_compacted_code().size();
+  }
+  return code;
+}
+
+void report_passes(const ir::PassManager& passes) {
+  for (size_t i = 0; i < (size_t)ir::Pass::Count; ++i) {
+    const auto& stats = passes.get_stats((ir::Pass)i);
+    printf("    %-20s %8u rewritten %8u removed\n", ir::pass_name((ir::Pass)i), stats.rewritten, stats.removed);
+  }
+}
+
+// Lowering a big program to IR and compacting it, then the Vm on vm_source,
+// without the IR passes, with them, and with them but no superinstructions.
+void bench_vm() {
+  printf("vm\n");
+  for (const bool optimize : {false, true}) {
+    const auto source = make_source(20000);
+    const auto lines = std::count(source.begin(), source.end(), '\n');
+    IdCache id_cache;
+    Ast ast;
+    TokenWindow window;
+    StreamingLexer lexer(std::string_view(source), window, id_cache);
+    StreamingParser parser(lexer, ast, id_cache);
+    const auto global = parser.parse();
+    ThreadPool pool(1);
+    SemanticPass pass(ast, id_cache);
+    pass.run(global, pool);
+    size_t code = 0;
+    ir::PassManager passes;
+    report(optimize ? "lower, passes and compact" : "lower and compact", measure([&] {
+      ir::Context context;
+      auto& module = context.add_module(id_cache.get("bench"));
+      CodeGen codegen(ast, id_cache, pass);
+      codegen.lower(module);
+      if (optimize) {
+        passes = ir::PassManager();
+        passes.run(module);
+      }
+      code = compact_all(module);
+    }), lines, "lines");
+    printf("  %zu bytes of bytecode\n", code);
+    if (optimize) report_passes(passes);
+  }
+
+  struct Mode {
+    const char* name;
+    bool optimize;
+    bool superinstructions;
+  };
+  for (const auto& mode : {Mode{"without passes", false, true}, Mode{"with passes", true, true},
+         Mode{"with passes, no superinstructions", true, false}}) {
+    printf("  %s\n", mode.name);
+    IdCache id_cache;
+    Ast ast;
+    ir::Context context;
+    auto& module = context.add_module(id_cache.get("bench"));
+    if (!lower_source(vm_source, id_cache, ast, module)) {
+      printf("  vm_source doesn't lower\n");
+      return;
+    }
+    ir::PassManager passes;
+    if (mode.optimize) passes.run(module);
+    printf("  %zu bytes of bytecode\n", compact_all(module, mode.superinstructions));
+    Vm vm(context, id_cache);
+    for (const auto& run : vm_runs) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s(%d)", run.function, run.arg);
+      const ir::Value arg{.i_value = (uint32_t)run.arg, .type = ir::Type::I};
+      report(name, measure([&] {
+        vm.run(module.get_name(), id_cache.get(run.function), {arg});
+      }), 1, "runs");
+      printf("  result %d, %llu dispatches\n", (int32_t)vm.get_result().i_value,
+        (unsigned long long)vm.get_dispatches());
+    }
+  }
+}
+
+struct Bench {
+  const char* name;
+  void (*run)();
+};
+
+const Bench benches[] = {
+  {"lexer", bench_lexer},
+  {"id_cache", bench_id_cache},
+  {"relex", bench_relex},
+  {"driver", bench_driver},
+  {"parallel_lex", bench_parallel_lex},
+  {"parser", bench_parser},
+  {"ast_traversal", bench_ast_traversal},
+  {"scope_lookup", bench_scope_lookup},
+  {"ast_cache", bench_ast_cache},
+  {"ast_regions", bench_ast_regions},
+  {"incremental", bench_incremental},
+  {"source_points", bench_source_points},
+  {"semantic", bench_semantic},
+  {"ir", bench_ir},
+  {"vm", bench_vm},
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* only = argc > 1 ? argv[1] : nullptr;
+  for (const auto& bench : benches) {
+    if (!only || !strcmp(only, bench.name)) {
+      bench.run();
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+#include "char_scanner.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHAR_SCANNER_X86 1
+#endif
+
+namespace char_scanner {
+namespace {
+
+template <uint8_t Flags>
+const char* skip_scalar(const char* p, const char* end) {
+  while (p < end && char_class::is(*p, Flags)) ++p;
+  return p;
+}
+
+template <char C>
+const char* find_scalar(const char* p, const char* end) {
+  while (p < end && *p != C) ++p;
+  return p;
+}
+
+#ifdef CHAR_SCANNER_X86
+
+// 0xff in every byte of v that lies in [lo, hi]. SSE2 has no unsigned byte
+// compare, so the range is shifted down to start at -128 first.
+inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+  const auto shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - lo)));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + (hi - lo) + 1)));
+}
+
+inline __m128i spaces_sse2(__m128i v) {
+  return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+}
+
+inline __m128i id_sse2(__m128i v) {
+  const auto alpha = in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+  const auto digit = in_range_sse2(v, '0', '9');
+  const auto underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+  return _mm_or_si128(_mm_or_si128(alpha, digit), underscore);
+}
+
+inline __m128i digits_sse2(__m128i v) {
+  return in_range_sse2(v, '0', '9');
+}
+
+template <__m128i (*Class)(__m128i), uint8_t Flags>
+const char* skip_sse2(const char* p, const char* end) {
+  while (end - p >= 16) {
+    const auto v = _mm_loadu_si128((const __m128i*)p);
+    const auto mask = (uint32_t)_mm_movemask_epi8(Class(v));
+    if (mask != 0xffff) {
+      return p + __builtin_ctz(~mask);
+    }
+    p += 16;
+  }
+  return skip_scalar<Flags>(p, end);
+}
+
+template <char C>
+const char* find_sse2(const char* p, const char* end) {
+  const auto c = _mm_set1_epi8(C);
+  while (end - p >= 16) {
+    const auto v = _mm_loadu_si128((const __m128i*)p);
+    const auto mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+  return find_scalar<C>(p, end);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+  const auto shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - lo)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + (hi - lo) + 1)), shifted);
+}
+
+AVX2 inline __m256i spaces_avx2(__m256i v) {
+  return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+}
+
+AVX2 inline __m256i id_avx2(__m256i v) {
+  const auto alpha = in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+  const auto digit = in_range_avx2(v, '0', '9');
+  const auto underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(_mm256_or_si256(alpha, digit), underscore);
+}
+
+AVX2 inline __m256i digits_avx2(__m256i v) {
+  return in_range_avx2(v, '0', '9');
+}
+
+template <__m256i (*Class)(__m256i), uint8_t Flags>
+AVX2 const char* skip_avx2(const char* p, const char* end) {
+  while (end - p >= 32) {
+    const auto v = _mm256_loadu_si256((const __m256i*)p);
+    const auto mask = (uint32_t)_mm256_movemask_epi8(Class(v));
+    if (mask != 0xffffffff) {
+      return p + __builtin_ctz(~mask);
+    }
+    p += 32;
+  }
+  return skip_scalar<Flags>(p, end);
+}
+
+template <char C>
+AVX2 const char* find_avx2(const char* p, const char* end) {
+  const auto c = _mm256_set1_epi8(C);
+  while (end - p >= 32) {
+    const auto v = _mm256_loadu_si256((const __m256i*)p);
+    const auto mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  return find_scalar<C>(p, end);
+}
+
+#undef AVX2
+
+#endif  // CHAR_SCANNER_X86
+
+constexpr Functions scalar_functions = {
+  skip_scalar<char_class::Space>,
+  skip_scalar<char_class::IdContinue>,
+  skip_scalar<char_class::Digit>,
+  find_scalar<'"'>,
+  find_scalar<'\n'>,
+};
+
+Functions make_functions(Level level) {
+#ifdef CHAR_SCANNER_X86
+  switch (level) {
+    case Level::Avx2:
+      return Functions{
+        skip_avx2<spaces_avx2, char_class::Space>,
+        skip_avx2<id_avx2, char_class::IdContinue>,
+        skip_avx2<digits_avx2, char_class::Digit>,
+        find_avx2<'"'>,
+        find_avx2<'\n'>,
+      };
+    case Level::Sse2:
+      return Functions{
+        skip_sse2<spaces_sse2, char_class::Space>,
+        skip_sse2<id_sse2, char_class::IdContinue>,
+        skip_sse2<digits_sse2, char_class::Digit>,
+        find_sse2<'"'>,
+        find_sse2<'\n'>,
+      };
+    default:
+      break;
+  }
+#endif
+  return scalar_functions;
+}
+
+Level s_level = Level::Scalar;
+
+struct Init {
+  Init() { set_level(best_level()); }
+};
+
+}  // namespace
+
+Functions functions = scalar_functions;
+
+static Init s_init;
+
+Level best_level() {
+#ifdef CHAR_SCANNER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return Level::Avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return Level::Sse2;
+#endif
+  return Level::Scalar;
+}
+
+Level get_level() {
+  return s_level;
+}
+
+void set_level(Level level) {
+  const auto best = best_level();
+  if (level > best)
+    level = best;
+  s_level = level;
+  functions = make_functions(level);
+}
+
+const char* level_name(Level level) {
+  switch (level) {
+    case Level::Scalar: return "scalar";
+    case Level::Sse2: return "sse2";
+    case Level::Avx2: return "avx2";
+  }
+  return "";
+}
+
+}  // namespace char_scanner
@@ -0,0 +1,75 @@
+#ifndef CHAR_SCANNER_HPP
+#define CHAR_SCANNER_HPP
+
+#include <array>
+#include <cstdint>
+
+// Locale independent character classes used by the Lexer instead of
+// ::isspace/::isalpha/::isdigit.
+namespace char_class {
+
+enum : uint8_t {
+  Space = 1 << 0,
+  Alpha = 1 << 1,
+  Digit = 1 << 2,
+  IdStart = 1 << 3,
+  IdContinue = 1 << 4,
+};
+
+constexpr std::array<uint8_t, 256> make_table() {
+  std::array<uint8_t, 256> table{};
+  for (int c = 0; c < 256; ++c) {
+    uint8_t flags = 0;
+    if (c == ' ' || (c >= '\t' && c <= '\r')) flags |= Space;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) flags |= Alpha | IdStart | IdContinue;
+    if (c >= '0' && c <= '9') flags |= Digit | IdContinue;
+    if (c == '_') flags |= IdStart | IdContinue;
+    table[c] = flags;
+  }
+  return table;
+}
+
+inline constexpr std::array<uint8_t, 256> table = make_table();
+
+inline constexpr bool is(char c, uint8_t flags) { return table[(uint8_t)c] & flags; }
+inline constexpr bool is_space(char c) { return is(c, Space); }
+inline constexpr bool is_digit(char c) { return is(c, Digit); }
+inline constexpr bool is_id_start(char c) { return is(c, IdStart); }
+inline constexpr bool is_id_continue(char c) { return is(c, IdContinue); }
+
+}  // namespace char_class
+
+// Finds the end of a run of characters of one class, or the next quote or
+// newline. Every function returns the first pointer in [p, end) that does
+// not belong to the run (that is the character looked for), or end.
+// The implementation (scalar, SSE2 or AVX2) is chosen once at startup from
+// the cpu features and can be overridden with set_level.
+namespace char_scanner {
+
+enum class Level : uint8_t { Scalar, Sse2, Avx2 };
+
+struct Functions {
+  const char* (*skip_spaces)(const char* p, const char* end);
+  const char* (*skip_id)(const char* p, const char* end);
+  const char* (*skip_digits)(const char* p, const char* end);
+  const char* (*find_quote)(const char* p, const char* end);
+  const char* (*find_newline)(const char* p, const char* end);
+};
+
+extern Functions functions;
+
+Level best_level();
+Level get_level();
+// Falls back to the best supported level if the cpu can't run the requested one.
+void set_level(Level level);
+const char* level_name(Level level);
+
+inline const char* skip_spaces(const char* p, const char* end) { return functions.skip_spaces(p, end); }
+inline const char* skip_id(const char* p, const char* end) { return functions.skip_id(p, end); }
+inline const char* skip_digits(const char* p, const char* end) { return functions.skip_digits(p, end); }
+inline const char* find_quote(const char* p, const char* end) { return functions.find_quote(p, end); }
+inline const char* find_newline(const char* p, const char* end) { return functions.find_newline(p, end); }
+
+}  // namespace char_scanner
+
+#endif  // CHAR_SCANNER_HPP
@@ -0,0 +1,594 @@
+#include "codegen.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+using Functions = std::unordered_map<uint32_t, ir::Function*>;
+using Slot = uint16_t;
+using Label = uint32_t;
+
+static constexpr uint32_t MaxSlots = std::numeric_limits<Slot>::max();
+
+bool is_comparison(AstNode::Kind kind) {
+  return (kind >= AstNode::Kind::EqualExpr && kind <= AstNode::Kind::LessOrEqualExpr)
+    || kind == AstNode::Kind::NotEqualExpr;
+}
+
+bool is_compound_assignment(AstNode::Kind kind) {
+  return kind >= AstNode::Kind::AddAssignExpr && kind <= AstNode::Kind::DivAssignExpr;
+}
+
+// The jump taken when a comparison is true, or false.
+ir::Instr compare_jump(AstNode::Kind kind, bool when) {
+  switch (kind) {
+    case AstNode::Kind::EqualExpr: return when ? ir::Instr::je : ir::Instr::jne;
+    case AstNode::Kind::NotEqualExpr: return when ? ir::Instr::jne : ir::Instr::je;
+    case AstNode::Kind::GreatExpr: return when ? ir::Instr::jg : ir::Instr::jle;
+    case AstNode::Kind::GreatOrEqualExpr: return when ? ir::Instr::jge : ir::Instr::jl;
+    case AstNode::Kind::LessExpr: return when ? ir::Instr::jl : ir::Instr::jge;
+    default: return when ? ir::Instr::jle : ir::Instr::jg;
+  }
+}
+
+ir::Instr arithmetic(AstNode::Kind kind) {
+  switch (kind) {
+    case AstNode::Kind::AddExpr:
+    case AstNode::Kind::AddAssignExpr:
+      return ir::Instr::add;
+    case AstNode::Kind::SubExpr:
+    case AstNode::Kind::SubAssignExpr:
+      return ir::Instr::sub;
+    case AstNode::Kind::MulExpr:
+    case AstNode::Kind::MulAssignExpr:
+      return ir::Instr::mul;
+    default:
+      return ir::Instr::div;
+  }
+}
+
+ir::Arg slot_arg(Slot slot) {
+  return ir::Arg{.local_index = slot};
+}
+
+// Lowers the body of one function into its ir::Function.
+class FunctionLowering {
+public:
+  FunctionLowering(const Ast& ast, IdCache& id_cache, IdIndex print, const FunctionFacts& facts,
+      const Functions& functions, ir::Function& function, std::vector<CodeGenError>& errors) :
+    m_ast(ast), m_id_cache(id_cache), m_print(print), m_facts(facts), m_functions(functions),
+    m_function(function), m_errors(errors) {}
+
+  void lower() {
+    const auto record = m_ast.get_overflow<AstNode::FunctionOverflow>(m_ast[m_facts.function].function.overflow);
+    for (const auto param : m_ast.get_scope_nodes(m_facts.function)) {
+      m_variables[param.get()] = alloc();
+    }
+    stmt(record.body);
+
+    // Falling off the end returns nothing, or 0.
+    const auto* tail = m_function.get_tail();
+    if (!tail || (tail->m_instr != ir::Instr::ret && tail->m_instr != ir::Instr::retv)) {
+      const auto return_type = m_ast[record.function_type_with_named_params].fun_type.return_type;
+      const auto type = ir_type(canonical(return_type));
+      if (return_type == UndefinedAstNodeIndex || type == ir::Type::A) {
+        m_function.add(ir::Instr::retv, ir::Type::V);
+      } else {
+        const auto slot = alloc();
+        m_function.add(ir::Instr::ldc, type, slot_arg(slot), slot_arg(zero(type)));
+        m_function.add(ir::Instr::ret, type, slot_arg(slot));
+      }
+    }
+
+    for (const auto& [arg, label] : m_jumps) {
+      arg->node_pointer = m_labels[label];
+    }
+    m_function.set_locals_size((uint16_t)(m_max_slot - m_function.get_args_size()));
+  }
+
+private:
+  const Ast& m_ast;
+  IdCache& m_id_cache;
+  IdIndex m_print;
+  const FunctionFacts& m_facts;
+  const Functions& m_functions;
+  ir::Function& m_function;
+  std::vector<CodeGenError>& m_errors;
+
+  // Slots below m_next_slot may be live, the ones above are free.
+  uint32_t m_next_slot = 0;
+  uint32_t m_max_slot = 0;
+  std::unordered_map<uint32_t, Slot> m_variables;
+  std::map<std::pair<ir::Type, uint64_t>, uint16_t> m_consts;
+  // Label nodes by Label, bound when the code behind them is reached, and
+  // the jump targets waiting for them.
+  std::vector<ir::Node*> m_labels;
+  std::vector<std::pair<ir::Arg*, Label>> m_jumps;
+
+  void error(AstNodeIndex node, const char* message) {
+    m_errors.emplace_back(CodeGenError{node, message});
+  }
+
+  AstNodeIndex canonical(AstNodeIndex type) const {
+    if (type != UndefinedAstNodeIndex && m_ast[type].kind == AstNode::Kind::NamedType)
+      return m_ast[type].named_type.decl;
+    return type;
+  }
+
+  // V for no type, A for what has no IR type yet.
+  ir::Type ir_type(AstNodeIndex type) const {
+    if (type == UndefinedAstNodeIndex)
+      return ir::Type::V;
+    const auto kind = m_ast[type].kind;
+    if (kind >= AstNode::Kind::I8Type && kind <= AstNode::Kind::U32Type)
+      return ir::Type::I;
+    if (kind == AstNode::Kind::F32Type || kind == AstNode::Kind::F64Type)
+      return ir::Type::D;
+    return ir::Type::A;
+  }
+
+  // u8, u16 and u32 live in I slots too, the Vm only compares and divides
+  // them signed.
+  bool is_unsigned(AstNodeIndex expr) const {
+    const auto type = canonical(m_facts.get_type(expr));
+    if (type == UndefinedAstNodeIndex)
+      return false;
+    const auto kind = m_ast[type].kind;
+    return kind >= AstNode::Kind::U8Type && kind <= AstNode::Kind::U32Type;
+  }
+
+  ir::Type expr_type(AstNodeIndex expr) const {
+    if (m_ast[expr].kind == AstNode::Kind::StringLiteral)
+      return ir::Type::S;
+    return ir_type(m_facts.get_type(expr));
+  }
+
+  Slot alloc() {
+    if (m_next_slot == MaxSlots) {
+      error(m_facts.function, "too many slots in the function");
+      return 0;
+    }
+    const auto slot = (Slot)m_next_slot++;
+    m_max_slot = std::max(m_max_slot, m_next_slot);
+    return slot;
+  }
+
+  // Index of the constant, added on its first use.
+  uint16_t constant(ir::Value value, uint64_t bits) {
+    const auto found = m_consts.find({value.type, bits});
+    if (found != m_consts.end())
+      return found->second;
+    auto& consts = m_function.get_consts();
+    if (consts.size() == std::numeric_limits<uint16_t>::max()) {
+      error(m_facts.function, "too many constants in the function");
+      return 0;
+    }
+    const auto index = (uint16_t)consts.size();
+    m_consts.emplace(std::make_pair(value.type, bits), index);
+    m_function.add_const(std::move(value));
+    return index;
+  }
+
+  uint16_t int_constant(int32_t value) {
+    return constant(ir::Value{.i_value = (uint32_t)value, .type = ir::Type::I}, (uint32_t)value);
+  }
+
+  uint16_t string_constant(IdIndex string) {
+    return constant(ir::Value{.str_value = string, .type = ir::Type::S}, string.get());
+  }
+
+  uint16_t zero(ir::Type type) {
+    if (type == ir::Type::D)
+      return constant(ir::Value{.d_value = 0, .type = ir::Type::D}, 0);
+    return int_constant(0);
+  }
+
+  Label new_label() {
+    m_labels.emplace_back(nullptr);
+    return (Label)(m_labels.size() - 1);
+  }
+
+  void bind(Label label) {
+    m_labels[label] = &m_function.add(ir::Instr::label, ir::Type::V);
+  }
+
+  // jmp takes no slot, jz and jnz one, the compare jumps two.
+  void jump(ir::Instr instr, ir::Type type, Label target, Slot a = 0, Slot b = 0) {
+    const ir::Arg none{.node_pointer = nullptr};
+    ir::Node* node;
+    if (instr == ir::Instr::jmp) {
+      node = &m_function.add(instr, ir::Type::V, none);
+    } else if (instr == ir::Instr::jz || instr == ir::Instr::jnz) {
+      node = &m_function.add(instr, type, none, slot_arg(a));
+    } else {
+      node = &m_function.add(instr, type, none, slot_arg(a), slot_arg(b));
+    }
+    m_jumps.emplace_back(&static_cast<ir::NodeArgs<1>*>(node)->args[0], target);
+  }
+
+  void stmt(AstNodeIndex index) {
+    if (index == UndefinedAstNodeIndex)
+      return;
+    const auto& node = m_ast[index];
+    const auto mark = m_next_slot;
+    switch (node.kind) {
+      case AstNode::Kind::BlockStmt:
+        for (const auto child : m_ast.get_nodes(node.block_stmt.stmts)) stmt(child);
+        break;
+      case AstNode::Kind::VariableDeclStmt: {
+        // The variable outlives the statement, till the end of its block.
+        const auto variable = node.variable_decl_stmt.variable;
+        const auto slot = alloc();
+        m_variables[variable.get()] = slot;
+        const auto variable_mark = m_next_slot;
+        if (node.variable_decl_stmt.init_expr != UndefinedAstNodeIndex) {
+          into(node.variable_decl_stmt.init_expr, slot);
+        } else {
+          const auto type = ir_type(canonical(m_ast[variable].local_variable.value.type));
+          if (type == ir::Type::I || type == ir::Type::D) {
+            m_function.add(ir::Instr::ldc, type, slot_arg(slot), slot_arg(zero(type)));
+          } else {
+            error(variable, "variable type not supported by the code generator");
+          }
+        }
+        m_next_slot = variable_mark;
+        return;
+      }
+      case AstNode::Kind::ExprStmt:
+        value(node.expr_stmt.expr);
+        break;
+      case AstNode::Kind::ReturnStmt:
+        if (node.return_stmt.expr == UndefinedAstNodeIndex) {
+          m_function.add(ir::Instr::retv, ir::Type::V);
+        } else {
+          const auto slot = value(node.return_stmt.expr);
+          m_function.add(ir::Instr::ret, expr_type(node.return_stmt.expr), slot_arg(slot));
+        }
+        break;
+      case AstNode::Kind::IfElseStmt: {
+        const auto otherwise = new_label();
+        branch(node.if_else_stmt.expr, false, otherwise);
+        stmt(node.if_else_stmt.stmt);
+        if (node.if_else_stmt.else_stmt != UndefinedAstNodeIndex) {
+          const auto end = new_label();
+          jump(ir::Instr::jmp, ir::Type::V, end);
+          bind(otherwise);
+          stmt(node.if_else_stmt.else_stmt);
+          bind(end);
+        } else {
+          bind(otherwise);
+        }
+        break;
+      }
+      case AstNode::Kind::WhileStmt: {
+        // The condition at the bottom, a jump per iteration.
+        const auto body = new_label();
+        const auto condition = new_label();
+        jump(ir::Instr::jmp, ir::Type::V, condition);
+        bind(body);
+        stmt(node.while_stmt.stmt);
+        bind(condition);
+        branch(node.while_stmt.expr, true, body);
+        break;
+      }
+      case AstNode::Kind::ForStmt: {
+        // for (i in from..to) runs i from from to to, both included, with to
+        // evaluated once. i is compared before it is incremented, so it never
+        // goes past to, which may be the largest i32.
+        const auto range = m_ast.get_overflow<AstNode::ForStmtOverflow>(node.for_stmt.overflow);
+        if (is_unsigned(range.from) || is_unsigned(range.to)) {
+          error(index, "unsigned ranges are not supported by the code generator");
+          break;
+        }
+        const auto variable = alloc();
+        m_variables[range.variable.get()] = variable;
+        into(range.from, variable);
+        const auto to = alloc();
+        into(range.to, to);
+        const auto next = new_label();
+        const auto body = new_label();
+        const auto end = new_label();
+        jump(ir::Instr::jg, ir::Type::I, end, variable, to);
+        jump(ir::Instr::jmp, ir::Type::V, body);
+        bind(next);
+        m_function.add(ir::Instr::inc, ir::Type::I, slot_arg(variable));
+        bind(body);
+        stmt(node.for_stmt.stmt);
+        jump(ir::Instr::jl, ir::Type::I, next, variable, to);
+        bind(end);
+        break;
+      }
+      case AstNode::Kind::FunctionDeclStmt:
+      case AstNode::Kind::StructDeclStmt:
+      case AstNode::Kind::UnionDeclStmt:
+      case AstNode::Kind::ClassDeclStmt:
+        error(index, "nested declarations are not supported by the code generator");
+        break;
+      default:
+        break;
+    }
+    m_next_slot = mark;
+  }
+
+  // Jumps to target when expr is when.
+  void branch(AstNodeIndex expr, bool when, Label target) {
+    const auto& node = m_ast[expr];
+    if (node.kind == AstNode::Kind::ParenthExpr) {
+      branch(node.parenth_expr.expr, when, target);
+      return;
+    }
+    if (is_comparison(node.kind)) {
+      const auto type = expr_type(node.binary_expr.left);
+      if (is_unsigned(node.binary_expr.left) || is_unsigned(node.binary_expr.right)) {
+        error(expr, "unsigned comparison not supported by the code generator");
+      } else if (type == ir::Type::I || type == ir::Type::D) {
+        const auto left = left_value(node.binary_expr.left, node.binary_expr.right);
+        const auto right = value(node.binary_expr.right);
+        jump(compare_jump(node.kind, when), type, target, left, right);
+      } else {
+        error(expr, "comparison not supported by the code generator");
+      }
+      return;
+    }
+    const auto slot = value(expr);
+    jump(when ? ir::Instr::jnz : ir::Instr::jz, expr_type(expr), target, slot);
+  }
+
+  // Whether expr assigns a variable anywhere in it.
+  bool assigns(AstNodeIndex expr) const {
+    const auto kind = m_ast[expr].kind;
+    if (kind == AstNode::Kind::AssignExpr || is_compound_assignment(kind))
+      return true;
+    bool found = false;
+    m_ast.for_each_child(expr, [&](AstNodeIndex child) { found = found || assigns(child); });
+    return found;
+  }
+
+  // The value of the left operand of a binary expression. The slot of a
+  // variable is copied when right assigns, right may assign that variable
+  // and left is evaluated first.
+  Slot left_value(AstNodeIndex left, AstNodeIndex right) {
+    if (!assigns(right))
+      return value(left);
+    const auto slot = alloc();
+    into(left, slot);
+    return slot;
+  }
+
+  // The slot of a variable, or of the variable an assignment assigns, else
+  // a new temporary holding the value.
+  Slot value(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    switch (node.kind) {
+      case AstNode::Kind::NameExpr: {
+        const auto found = m_variables.find(node.name_expr.decl.get());
+        if (found != m_variables.end())
+          return found->second;
+        break;
+      }
+      case AstNode::Kind::ParenthExpr:
+        return value(node.parenth_expr.expr);
+      default:
+        if (node.kind == AstNode::Kind::AssignExpr || is_compound_assignment(node.kind))
+          return assign(expr);
+        break;
+    }
+    const auto slot = alloc();
+    into(expr, slot);
+    return slot;
+  }
+
+  // Evaluates expr into dst, which is only written last.
+  void into(AstNodeIndex expr, Slot dst) {
+    const auto& node = m_ast[expr];
+    switch (node.kind) {
+      case AstNode::Kind::I8Literal:
+        load(dst, int_constant(node.i8_literal.literal_value));
+        break;
+      case AstNode::Kind::I16Literal:
+        load(dst, int_constant(node.i16_literal.literal_value));
+        break;
+      case AstNode::Kind::I32Literal:
+        load(dst, int_constant(node.i32_literal.literal_value));
+        break;
+      case AstNode::Kind::U8Literal:
+        load(dst, int_constant(node.u8_literal.literal_value));
+        break;
+      case AstNode::Kind::U16Literal:
+        load(dst, int_constant(node.u16_literal.literal_value));
+        break;
+      case AstNode::Kind::U32Literal:
+        load(dst, int_constant((int32_t)node.u32_literal.literal_value));
+        break;
+      case AstNode::Kind::CharLiteral:
+        load(dst, int_constant(node.char_literal.chr));
+        break;
+      case AstNode::Kind::StringLiteral:
+        m_function.add(ir::Instr::ldc, ir::Type::S, slot_arg(dst), slot_arg(string_constant(node.string_literal.string)));
+        break;
+      case AstNode::Kind::NameExpr: {
+        const auto found = m_variables.find(node.name_expr.decl.get());
+        if (found == m_variables.end()) {
+          error(expr, "only local variables are supported by the code generator");
+        } else if (found->second != dst) {
+          m_function.add(ir::Instr::mov, expr_type(expr), slot_arg(dst), slot_arg(found->second));
+        }
+        break;
+      }
+      case AstNode::Kind::ParenthExpr:
+        into(node.parenth_expr.expr, dst);
+        break;
+      case AstNode::Kind::NegExpr: {
+        const auto slot = value(node.neg_expr.expr);
+        m_function.add(ir::Instr::neg, expr_type(expr), slot_arg(dst), slot_arg(slot));
+        break;
+      }
+      case AstNode::Kind::CallExpr:
+        call(expr, dst);
+        break;
+      case AstNode::Kind::AddExpr:
+      case AstNode::Kind::SubExpr:
+      case AstNode::Kind::MulExpr:
+      case AstNode::Kind::DivExpr: {
+        if (node.kind == AstNode::Kind::DivExpr && is_unsigned(expr)) {
+          error(expr, "unsigned division not supported by the code generator");
+          break;
+        }
+        const auto left = left_value(node.binary_expr.left, node.binary_expr.right);
+        const auto right = value(node.binary_expr.right);
+        m_function.add(arithmetic(node.kind), expr_type(expr), slot_arg(dst), slot_arg(left), slot_arg(right));
+        break;
+      }
+      default:
+        if (is_comparison(node.kind)) {
+          // 1 unless the comparison jumps over it.
+          const auto end = new_label();
+          const auto result = alloc();
+          load(result, int_constant(0));
+          branch(expr, false, end);
+          load(result, int_constant(1));
+          bind(end);
+          m_function.add(ir::Instr::mov, ir::Type::I, slot_arg(dst), slot_arg(result));
+        } else if (node.kind == AstNode::Kind::AssignExpr || is_compound_assignment(node.kind)) {
+          const auto slot = assign(expr);
+          if (slot != dst) m_function.add(ir::Instr::mov, expr_type(expr), slot_arg(dst), slot_arg(slot));
+        } else {
+          error(expr, "expression not supported by the code generator");
+        }
+        break;
+    }
+  }
+
+  void load(Slot dst, uint16_t constant) {
+    m_function.add(ir::Instr::ldc, ir::Type::I, slot_arg(dst), slot_arg(constant));
+  }
+
+  // The slot of the variable assigned.
+  Slot assign(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    const auto& target = m_ast[node.binary_expr.left];
+    const auto found = target.kind == AstNode::Kind::NameExpr
+      ? m_variables.find(target.name_expr.decl.get()) : m_variables.end();
+    if (found == m_variables.end()) {
+      error(node.binary_expr.left, "only local variables are assigned by the code generator");
+      return 0;
+    }
+    const auto slot = found->second;
+    if (node.kind == AstNode::Kind::AssignExpr) {
+      into(node.binary_expr.right, slot);
+    } else if (node.kind == AstNode::Kind::DivAssignExpr && is_unsigned(node.binary_expr.left)) {
+      error(expr, "unsigned division not supported by the code generator");
+    } else {
+      const auto left = left_value(node.binary_expr.left, node.binary_expr.right);
+      const auto right = value(node.binary_expr.right);
+      m_function.add(arithmetic(node.kind), expr_type(node.binary_expr.left), slot_arg(slot), slot_arg(left), slot_arg(right));
+    }
+    return slot;
+  }
+
+  void call(AstNodeIndex expr, Slot dst) {
+    const auto& node = m_ast[expr];
+    const auto args = m_ast.get_nodes(node.call_expr.args);
+    const auto& callee = m_ast[node.call_expr.callee];
+    if (callee.kind == AstNode::Kind::NameExpr && callee.name_expr.decl == UndefinedAstNodeIndex
+        && callee.name_expr.name == m_print) {
+      print(expr);
+      return;
+    }
+    const auto function = callee.kind == AstNode::Kind::NameExpr
+      ? m_functions.find(callee.name_expr.decl.get()) : m_functions.end();
+    if (function == m_functions.end()) {
+      error(expr, "only calls of global functions are supported by the code generator");
+      return;
+    }
+
+    // The arguments in a row on top of the live slots, where the frame of
+    // the callee begins.
+    const auto base = (Slot)m_next_slot;
+    for (uint32_t i = 0; i < args.size(); ++i) alloc();
+    for (uint32_t i = 0; i < args.size(); ++i) into(args[i], (Slot)(base + i));
+    const auto type = expr_type(expr);
+    const ir::Arg callee_arg{.function_pointer = function->second};
+    if (type == ir::Type::V) {
+      m_function.add(ir::Instr::callv, ir::Type::V, callee_arg, slot_arg(base));
+    } else {
+      m_function.add(ir::Instr::call, type, callee_arg, slot_arg(base), slot_arg(dst));
+    }
+  }
+
+  // print("a {} b {}", x, y) prints "a ", x, " b ", y and " \n", the pieces
+  // of the format are constants.
+  void print(AstNodeIndex expr) {
+    const auto args = m_ast.get_nodes(m_ast[expr].call_expr.args);
+    if (args.size() == 0 || m_ast[args[0]].kind != AstNode::Kind::StringLiteral) {
+      error(expr, "print needs a string literal format");
+      return;
+    }
+    const auto& format = m_id_cache.get(m_ast[args[0]].string_literal.string);
+    const std::string text(format.str, format.length);
+    std::size_t begin = 0;
+    uint32_t arg = 1;
+    const auto print_text = [&](std::string piece) {
+      if (piece.empty())
+        return;
+      const auto slot = alloc();
+      const auto string = m_id_cache.get(piece.c_str(), (uint32_t)piece.size());
+      m_function.add(ir::Instr::ldc, ir::Type::S, slot_arg(slot), slot_arg(string_constant(string)));
+      m_function.add(ir::Instr::print, ir::Type::S, slot_arg(slot));
+    };
+    for (auto open = text.find("{}"); open != std::string::npos; open = text.find("{}", begin)) {
+      if (arg == args.size()) {
+        error(expr, "print has fewer arguments than its format");
+        return;
+      }
+      print_text(text.substr(begin, open - begin));
+      const auto slot = value(args[arg]);
+      m_function.add(ir::Instr::print, expr_type(args[arg]), slot_arg(slot));
+      ++arg;
+      begin = open + 2;
+    }
+    if (arg != args.size()) {
+      error(expr, "print has more arguments than its format");
+      return;
+    }
+    print_text(text.substr(begin) + "\n");
+  }
+};
+
+}  // namespace
+
+bool CodeGen::lower(ir::Module& module) {
+  if (!m_semantic.get_errors().empty()) {
+    m_errors.emplace_back(CodeGenError{UndefinedAstNodeIndex, "the program has semantic errors"});
+    return false;
+  }
+
+  // Every global function first, calls take the ir::Function.
+  Functions functions;
+  std::vector<const FunctionFacts*> bodies;
+  for (const auto& facts : m_semantic.get_functions()) {
+    const auto& node = m_ast[facts.function];
+    if (m_ast[node.function.scope.outer_scope].kind != AstNode::Kind::GlobalScope)
+      continue;
+    const auto record = m_ast.get_overflow<AstNode::FunctionOverflow>(node.function.overflow);
+    const auto& fun_type = m_ast[record.function_type_with_named_params].fun_type;
+    auto builder = ir::FunctionBuilder(fun_type.name)
+      .set_args_size((uint16_t)m_ast.get_param_types(fun_type).size());
+    functions[facts.function.get()] = &module.add_function(std::move(builder));
+    bodies.emplace_back(&facts);
+  }
+
+  const auto errors = m_errors.size();
+  for (const auto* facts : bodies) {
+    FunctionLowering lowering(m_ast, m_id_cache, m_print, *facts, functions, *functions[facts->function.get()], m_errors);
+    lowering.lower();
+  }
+  return m_errors.size() == errors;
+}
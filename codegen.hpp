@@ -0,0 +1,46 @@
+#ifndef CODEGEN_HPP
+#define CODEGEN_HPP
+
+#include <vector>
+
+#include "ast.hpp"
+#include "id_cache.hpp"
+#include "id_index.hpp"
+#include "ir.hpp"
+#include "semantic.hpp"
+
+// An error of the code generator, at the node it can't lower.
+struct CodeGenError {
+  AstNodeIndex node;
+  const char* message;
+};
+
+// Lowers the global functions of a checked program to ir::Functions of a
+// module, named like them. The parameters of a function take its first
+// slots, in order, then come its variables and the temporaries of its
+// expressions; the slots of a block are reused after it. Each distinct
+// literal is a constant of the function.
+//
+// i8 to u32 are lowered to I and f32, f64 to D. print takes a string literal
+// with a {} for every argument behind it and ends the line. Structs, unions,
+// classes and global variables have no IR yet, using them is an error.
+class CodeGen {
+public:
+  CodeGen(const Ast& ast, IdCache& id_cache, const SemanticPass& semantic) :
+    m_ast(ast), m_id_cache(id_cache), m_semantic(semantic), m_print(id_cache.get("print")) {}
+
+  // Adds every function to module, so calls may come before the callee.
+  // False when the semantic pass found errors or on errors of its own.
+  bool lower(ir::Module& module);
+
+  const std::vector<CodeGenError>& get_errors() const { return m_errors; }
+
+private:
+  const Ast& m_ast;
+  IdCache& m_id_cache;
+  const SemanticPass& m_semantic;
+  IdIndex m_print;
+  std::vector<CodeGenError> m_errors;
+};
+
+#endif  // CODEGEN_HPP
@@ -0,0 +1,193 @@
+#ifndef CONCURRENT_ID_CACHE_HPP
+#define CONCURRENT_ID_CACHE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "arena.hpp"
+#include "hash.hpp"
+#include "id_index.hpp"
+
+// Thread safe IdCache. Strings are spread over shards by their hash, every
+// shard has its own lock that is taken only to insert a new string; finding
+// an interned string and get(IdIndex) never lock. An IdIndex holds the
+// shard in its low bits and stays valid for the lifetime of the cache.
+class ConcurrentIdCache {
+public:
+  struct String {
+    const char* str;
+    uint32_t length;
+  };
+
+  static constexpr uint32_t ShardBits = 6;
+  static constexpr uint32_t ShardsCount = 1u << ShardBits;
+
+  ConcurrentIdCache() = default;
+  ConcurrentIdCache(const ConcurrentIdCache&) = delete;
+  ConcurrentIdCache(ConcurrentIdCache&&) = delete;
+  ConcurrentIdCache& operator=(const ConcurrentIdCache&) = delete;
+  ConcurrentIdCache& operator=(ConcurrentIdCache&&) = delete;
+
+  IdIndex get(const char* str) {
+    return get(str, ::strlen(str));
+  }
+
+  IdIndex get(const char* str, uint32_t length) {
+    const auto h = hash::bytes(str, length);
+    // The table uses the low bits of the hash, the shard the high ones.
+    auto& shard = m_shards[h >> (64 - ShardBits)];
+    if (auto entry = shard.find(shard.table.load(std::memory_order_acquire), h, str, length)) {
+      return entry->index;
+    }
+    return shard.insert(h, str, length);
+  }
+
+  const String& get(IdIndex index) const {
+    const auto& shard = m_shards[index.get() & (ShardsCount - 1)];
+    return shard.entry(index.get() >> ShardBits)->string;
+  }
+
+  std::size_t size() const {
+    std::size_t result = 0;
+    for (auto& shard : m_shards) result += shard.size.load(std::memory_order_relaxed);
+    return result;
+  }
+
+private:
+  struct Entry {
+    uint64_t hash;
+    String string;
+    IdIndex index;
+  };
+
+  struct Table {
+    explicit Table(std::size_t capacity) : slots(new std::atomic<Entry*>[capacity]), mask(capacity - 1) {
+      for (std::size_t i = 0; i < capacity; ++i) slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<std::atomic<Entry*>[]> slots;
+    std::size_t mask;
+  };
+
+  // Entries by local index live in segments of doubling size, so a segment
+  // never moves once it is published.
+  static constexpr uint32_t FirstSegmentBits = 8;
+  static constexpr uint32_t SegmentsCount = 32 - ShardBits - FirstSegmentBits + 1;
+
+  struct alignas(64) Shard {
+    uint32_t number = 0;
+    std::atomic<Table*> table{nullptr};
+    std::atomic<uint32_t> size{0};
+    std::array<std::atomic<Entry**>, SegmentsCount> segments{};
+    std::mutex mutex;
+    // Replaced tables are kept until the cache dies, a reader may still probe them.
+    std::vector<std::unique_ptr<Table>> tables;
+    std::vector<std::unique_ptr<Entry*[]>> segment_storage;
+    Arena arena;
+
+    const Entry* find(const Table* t, uint64_t h, const char* str, uint32_t length) const {
+      if (!t)
+        return nullptr;
+      auto i = h & t->mask;
+      while (auto entry = t->slots[i].load(std::memory_order_acquire)) {
+        if (entry->hash == h && entry->string.length == length
+          && !memcmp(entry->string.str, str, length)) {
+          return entry;
+        }
+        i = (i + 1) & t->mask;
+      }
+      return nullptr;
+    }
+
+    IdIndex insert(uint64_t h, const char* str, uint32_t length) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto t = table.load(std::memory_order_relaxed);
+      // Another thread may have inserted the string since the lock free probe.
+      if (auto entry = find(t, h, str, length)) {
+        return entry->index;
+      }
+      const auto local_index = size.load(std::memory_order_relaxed);
+      if (!t || (local_index + 1) * 2 > t->mask + 1) {
+        t = grow(t);
+      }
+
+      auto s = (char*)arena.allocate(length + 1, 1);
+      memcpy(s, str, length);
+      s[length] = '\0';
+      auto entry = arena.create<Entry>();
+      entry->hash = h;
+      entry->string = String{s, length};
+      entry->index = IdIndex((local_index << ShardBits) | number);
+
+      store_entry(local_index, entry);
+      auto i = h & t->mask;
+      while (t->slots[i].load(std::memory_order_relaxed)) {
+        i = (i + 1) & t->mask;
+      }
+      t->slots[i].store(entry, std::memory_order_release);
+      size.store(local_index + 1, std::memory_order_release);
+      return entry->index;
+    }
+
+    Table* grow(Table* old) {
+      const std::size_t capacity = old ? (old->mask + 1) * 2 : 64;
+      auto t = std::make_unique<Table>(capacity);
+      if (old) {
+        for (std::size_t j = 0; j <= old->mask; ++j) {
+          auto entry = old->slots[j].load(std::memory_order_relaxed);
+          if (!entry)
+            continue;
+          auto i = entry->hash & t->mask;
+          while (t->slots[i].load(std::memory_order_relaxed)) {
+            i = (i + 1) & t->mask;
+          }
+          t->slots[i].store(entry, std::memory_order_relaxed);
+        }
+      }
+      auto result = t.get();
+      tables.emplace_back(std::move(t));
+      table.store(result, std::memory_order_release);
+      return result;
+    }
+
+    static uint32_t segment_of(uint32_t local_index, uint32_t& offset) {
+      const uint32_t biased = (local_index >> FirstSegmentBits) + 1;
+      const uint32_t segment = 31 - __builtin_clz(biased);
+      offset = local_index - (((1u << segment) - 1) << FirstSegmentBits);
+      return segment;
+    }
+
+    void store_entry(uint32_t local_index, Entry* entry) {
+      uint32_t offset;
+      const auto segment = segment_of(local_index, offset);
+      auto entries = segments[segment].load(std::memory_order_relaxed);
+      if (!entries) {
+        segment_storage.emplace_back(new Entry*[std::size_t(1) << (segment + FirstSegmentBits)]);
+        entries = segment_storage.back().get();
+        segments[segment].store(entries, std::memory_order_release);
+      }
+      entries[offset] = entry;
+    }
+
+    const Entry* entry(uint32_t local_index) const {
+      uint32_t offset;
+      const auto segment = segment_of(local_index, offset);
+      return segments[segment].load(std::memory_order_acquire)[offset];
+    }
+  };
+
+  struct Shards : std::array<Shard, ShardsCount> {
+    Shards() {
+      for (uint32_t i = 0; i < ShardsCount; ++i) (*this)[i].number = i;
+    }
+  };
+
+  Shards m_shards;
+};
+
+#endif  // CONCURRENT_ID_CACHE_HPP
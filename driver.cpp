@@ -0,0 +1,77 @@
+#include "driver.hpp"
+
+#include <chrono>
+#include <ctime>
+
+#include "mapped_file.hpp"
+#include "parser.hpp"
+
+namespace {
+
+double thread_cpu_seconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double process_cpu_seconds() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+}  // namespace
+
+void DriverReport::print(std::ostream& out) const {
+  out << "files: " << files;
+  if (failed_files) out << " (" << failed_files << " failed)";
+  out << ", " << bytes << " bytes, " << tokens << " tokens, " << parse_errors << " parse errors, "
+    << threads << " threads\n"
+    << "wall: " << wall_seconds * 1e3 << " ms, cpu: " << cpu_seconds * 1e3 << " ms, "
+    << "cpu/wall: " << (wall_seconds > 0 ? cpu_seconds / wall_seconds : 0) << "\n";
+}
+
+DriverReport Driver::run(const std::vector<std::string>& paths) {
+  m_units.clear();
+  for (auto& path : paths) {
+    m_units.emplace_back(std::make_unique<CompilationUnit>());
+    m_units.back()->path = path;
+  }
+
+  const auto wall_start = std::chrono::steady_clock::now();
+  const auto cpu_start = process_cpu_seconds();
+
+  m_pool.parallel_for(m_units.size(), [this](std::size_t i) { compile(*m_units[i]); });
+
+  DriverReport report;
+  report.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  report.cpu_seconds = process_cpu_seconds() - cpu_start;
+  report.threads = m_pool.size();
+  for (auto& unit : m_units) {
+    ++report.files;
+    if (!unit->opened) ++report.failed_files;
+    report.bytes += unit->bytes;
+    report.tokens += unit->tokens.size();
+    report.parse_errors += unit->errors.size();
+  }
+  return report;
+}
+
+void Driver::compile(CompilationUnit& unit) {
+  const auto cpu_start = thread_cpu_seconds();
+  MappedFile file(unit.path.c_str());
+  unit.opened = file.is_open();
+  if (unit.opened) {
+    unit.bytes = file.size();
+    TokenWindow window(2);
+    BasicLexer<ConcurrentIdCache, TokenWindow> lexer(file.view(), window, m_id_cache);
+    unit.tokens.reserve(file.size() / 4);
+    unit.tokens.lex(lexer);
+
+    TokenStore::Reader reader(unit.tokens);
+    BasicParser<TokenStore::Reader, ConcurrentIdCache> parser(reader, unit.ast, m_id_cache);
+    unit.global_scope = parser.parse();
+    unit.errors = parser.get_errors();
+  }
+  unit.cpu_seconds = thread_cpu_seconds() - cpu_start;
+}
@@ -0,0 +1,65 @@
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "concurrent_id_cache.hpp"
+#include "parser.hpp"
+#include "thread_pool.hpp"
+#include "token_store.hpp"
+
+struct CompilationUnit {
+  std::string path;
+  bool opened = false;
+  std::size_t bytes = 0;
+  TokenStore tokens;
+  Ast ast;
+  AstNodeIndex global_scope;
+  std::vector<ParseError> errors;
+  double cpu_seconds = 0;
+};
+
+struct DriverReport {
+  std::size_t files = 0;
+  std::size_t failed_files = 0;
+  std::size_t bytes = 0;
+  std::size_t tokens = 0;
+  std::size_t parse_errors = 0;
+  std::size_t threads = 0;
+  double wall_seconds = 0;
+  double cpu_seconds = 0;
+
+  void print(std::ostream& out) const;
+};
+
+// Lexes and parses many files at once, one task per file on a work stealing
+// ThreadPool. Every file gets its own TokenStore and Ast, identifiers of all
+// files go into one ConcurrentIdCache, so an IdIndex means the same name in
+// every unit.
+class Driver {
+public:
+  using Units = std::vector<std::unique_ptr<CompilationUnit>>;
+
+  Driver(ConcurrentIdCache& id_cache, std::size_t threads_count = ThreadPool::default_threads_count()) :
+    m_id_cache(id_cache), m_pool(threads_count) {}
+
+  // Units are kept in the order of paths.
+  DriverReport run(const std::vector<std::string>& paths);
+
+  Units& get_units() { return m_units; }
+  const Units& get_units() const { return m_units; }
+
+private:
+  ConcurrentIdCache& m_id_cache;
+  ThreadPool m_pool;
+  Units m_units;
+
+  void compile(CompilationUnit& unit);
+};
+
+#endif  // DRIVER_HPP
@@ -0,0 +1,161 @@
+#ifndef FLAT_ORDERED_DICT_HPP
+#define FLAT_ORDERED_DICT_HPP
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// OrderedDict for 32 bit keys (IdIndex), sized for scopes: most hold a
+// handful of names. Up to InlineCapacity names live inline in the dict and
+// a find compares the key against all of them at once (SSE2). Past that the
+// names move to flat arrays indexed by an open addressing table, linear
+// probing at a load factor of 1/2 at most. No allocation but get_nodes.
+template <typename Key, typename Value, typename Hash = typename Key::Hash>
+class FlatOrderedDict {
+public:
+  static_assert(std::is_same<typename Key::value_type, uint32_t>::value, "keys are 32 bit");
+
+  static constexpr uint32_t InlineCapacity = 8;
+
+  FlatOrderedDict() = default;
+  FlatOrderedDict(const FlatOrderedDict&) = delete;
+  FlatOrderedDict(FlatOrderedDict&&) = delete;
+  FlatOrderedDict& operator=(const FlatOrderedDict&) = delete;
+  FlatOrderedDict& operator=(FlatOrderedDict&&) = delete;
+
+  // Does nothing when name is in the dict already.
+  void append(Key name, Value node_index) {
+    const auto key = name.get();
+    if (m_count <= InlineCapacity ? find_inline(key) != InlineCapacity : find_slot(key) != Empty)
+      return;
+    if (m_count < InlineCapacity) {
+      m_inline_keys[m_count] = key;
+      m_inline_values[m_count] = node_index;
+    } else {
+      if (m_count == InlineCapacity) spill();
+      m_keys.emplace_back(key);
+      m_values.emplace_back(node_index);
+      if ((m_count + 1) * 2 > m_slots.size()) {
+        rehash((uint32_t)m_slots.size() * 2);
+      } else {
+        insert_slot(m_count);
+      }
+    }
+    ++m_count;
+    m_nodes.emplace_back(node_index);
+  }
+
+  void append(Value node_index) {
+    m_nodes.emplace_back(node_index);
+  }
+
+  const Value find(Key name) const {
+    const auto key = name.get();
+    if (m_count <= InlineCapacity) {
+      const auto i = find_inline(key);
+      return i != InlineCapacity ? m_inline_values[i] : Value();
+    }
+    const auto entry = find_slot(key);
+    return entry != Empty ? m_values[entry - 1] : Value();
+  }
+
+  // Calls fn(name, value) for the named entries in insertion order.
+  template <typename Fn>
+  void for_each_named(Fn&& fn) const {
+    const bool inline_names = m_count <= InlineCapacity;
+    for (uint32_t i = 0; i < m_count; ++i) {
+      if (inline_names) {
+        fn(Key(m_inline_keys[i]), m_inline_values[i]);
+      } else {
+        fn(Key(m_keys[i]), m_values[i]);
+      }
+    }
+  }
+
+  // Keeps the memory, for the next use of the dict.
+  void clear() {
+    m_count = 0;
+    m_keys.clear();
+    m_values.clear();
+    m_slots.clear();
+    m_nodes.clear();
+  }
+
+  const std::vector<Value>& get_nodes() const { return m_nodes; }
+  std::vector<Value>& get_nodes() { return m_nodes; }
+
+private:
+  static constexpr uint32_t Empty = 0;
+
+  // Named entries, inline while there are InlineCapacity at most, else in
+  // m_keys and m_values.
+  uint32_t m_count = 0;
+  uint32_t m_inline_keys[InlineCapacity] = {};
+  Value m_inline_values[InlineCapacity];
+  std::vector<uint32_t> m_keys;
+  std::vector<Value> m_values;
+  // 1 + the entry index, Empty for a free slot.
+  std::vector<uint32_t> m_slots;
+  std::vector<Value> m_nodes;
+
+  // Index of key among the inline names, InlineCapacity when missing.
+  uint32_t find_inline(uint32_t key) const {
+#if defined(__SSE2__)
+    static_assert(InlineCapacity == 8, "the scan compares two vectors of four keys");
+    const auto needle = _mm_set1_epi32((int)key);
+    const auto low = _mm_loadu_si128((const __m128i*)m_inline_keys);
+    const auto high = _mm_loadu_si128((const __m128i*)(m_inline_keys + 4));
+    uint32_t bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(low, needle)))
+      | (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(high, needle))) << 4;
+    bits &= (1u << m_count) - 1;
+    return bits ? (uint32_t)__builtin_ctz(bits) : InlineCapacity;
+#else
+    for (uint32_t i = 0; i < m_count; ++i) {
+      if (m_inline_keys[i] == key) return i;
+    }
+    return InlineCapacity;
+#endif
+  }
+
+  // Fibonacci hashing on top of Hash, IdIndex hashes to itself.
+  uint32_t home_slot(uint32_t key) const {
+    const uint64_t hash = Hash()(Key(key)) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(hash >> 32) & ((uint32_t)m_slots.size() - 1);
+  }
+
+  // The slot entry of key, Empty when missing.
+  uint32_t find_slot(uint32_t key) const {
+    const auto mask = (uint32_t)m_slots.size() - 1;
+    for (auto slot = home_slot(key);; slot = (slot + 1) & mask) {
+      const auto entry = m_slots[slot];
+      if (entry == Empty || m_keys[entry - 1] == key) return entry;
+    }
+  }
+
+  void insert_slot(uint32_t index) {
+    const auto mask = (uint32_t)m_slots.size() - 1;
+    auto slot = home_slot(m_keys[index]);
+    while (m_slots[slot] != Empty) slot = (slot + 1) & mask;
+    m_slots[slot] = index + 1;
+  }
+
+  void rehash(uint32_t slots_count) {
+    m_slots.assign(slots_count, Empty);
+    for (uint32_t i = 0; i < m_keys.size(); ++i) insert_slot(i);
+  }
+
+  void spill() {
+    m_keys.reserve(InlineCapacity * 2);
+    m_values.reserve(InlineCapacity * 2);
+    m_keys.assign(m_inline_keys, m_inline_keys + InlineCapacity);
+    m_values.assign(m_inline_values, m_inline_values + InlineCapacity);
+    m_slots.assign(InlineCapacity * 4, Empty);
+    for (uint32_t i = 0; i < InlineCapacity; ++i) insert_slot(i);
+  }
+};
+
+#endif  // FLAT_ORDERED_DICT_HPP
@@ -0,0 +1,92 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// wyhash (final version 4) by Wang Yi, public domain.
+namespace hash {
+
+namespace detail {
+
+inline void mum(uint64_t* a, uint64_t* b) {
+  const __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+  mum(&a, &b);
+  return a ^ b;
+}
+
+inline uint64_t read8(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t read4(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint64_t read3(const uint8_t* p, std::size_t k) {
+  return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+inline constexpr uint64_t secret[4] = {
+  0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+}  // namespace detail
+
+inline uint64_t bytes(const void* key, std::size_t len, uint64_t seed = 0) {
+  using namespace detail;
+  auto p = (const uint8_t*)key;
+  seed ^= mix(seed ^ secret[0], secret[1]);
+  uint64_t a;
+  uint64_t b;
+
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+      b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = read3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    std::size_t i = len;
+    if (i > 48) {
+      uint64_t see1 = seed;
+      uint64_t see2 = seed;
+      do {
+        seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+        see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+        see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = read8(p + i - 16);
+    b = read8(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= seed;
+  mum(&a, &b);
+  return mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+}  // namespace hash
+
+#endif  // HASH_HPP
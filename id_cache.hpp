@@ -3,11 +3,10 @@
 
 #include <cstdint>
 #include <cstring>
-#include <utility>
 #include <vector>
-#include <algorithm>
-#include <unordered_map>
 
+#include "arena.hpp"
+#include "hash.hpp"
 #include "id_index.hpp"
 
 class IdCache {
@@ -17,62 +16,88 @@ public:
     uint32_t length;
   };
 
-  ~IdCache() {
-    std::for_each(
-      m_strings.begin(), 
-      m_strings.end(), 
-      [](String& s){ delete [] s.str;});
+  IdCache() : m_slots(InitialCapacity), m_mask(InitialCapacity - 1) {
+    m_strings.reserve(InitialCapacity / 2);
   }
+  IdCache(const IdCache&) = delete;
+  IdCache(IdCache&&) = default;
+  IdCache& operator=(const IdCache&) = delete;
+  IdCache& operator=(IdCache&&) = default;
 
   IdIndex get(const char* str) {
     return get(str, ::strlen(str));
   }
 
   IdIndex get(const char* str, uint32_t length) {
-    StringPair sp{str, length};
-    auto it = m_map.find(sp);
-    if (it == m_map.end()) {
-      auto s = new char[length + 1];
-      strncpy(s, str, length);
-      s[length] = '\0';
-
-      const auto id_index = (IdIndex::value_type)m_strings.size();
-      m_map.emplace(StringPair{s, length}, id_index);
-      m_strings.emplace_back(String{s, length});
-      return IdIndex(id_index);
+    const auto h = hash::bytes(str, length);
+    auto i = h & m_mask;
+
+    while (true) {
+      auto& slot = m_slots[i];
+      if (slot.index == IdIndex::undefined) {
+        return insert(slot, h, str, length);
+      }
+      // The full hash and the length reject nearly every other string before memcmp.
+      if (slot.hash == h && slot.length == length
+        && !memcmp(m_strings[slot.index.get()].str, str, length)) {
+        return slot.index;
+      }
+      i = (i + 1) & m_mask;
     }
-    return it->second;
   }
 
   const String& get(IdIndex index) const {
     return m_strings[index.get()];
   }
 
+  std::size_t size() const { return m_strings.size(); }
+
 private:
-  using StringPair = std::pair<const char*, uint32_t>;
-  struct StringEqual {
-    bool operator()(const StringPair& s1, const StringPair& s2) const {
-      if (s1.second != s2.second) 
-        return false;
+  static constexpr std::size_t InitialCapacity = 256;
 
-      return !strcmp(s1.first, s2.first);
-    }
+  // Open addressing with linear probing. Empty slots have an undefined index.
+  struct Slot {
+    uint64_t hash;
+    uint32_t length;
+    IdIndex index;
   };
 
-  struct StringHash {
-    std::size_t operator()(const StringPair& s) const {
-      auto h = std::hash<uint32_t>{}(s.second);
-      for (uint32_t i = 0; i < s.second; ++i) {
-        auto ch = std::hash<char>{}(s.first[i]);
-        h = h ^ (ch << 1);
-      }
-      return h;
+  std::vector<Slot> m_slots;
+  std::size_t m_mask;
+  std::vector<String> m_strings;
+  Arena m_arena;
+
+  IdIndex insert(Slot& slot, uint64_t h, const char* str, uint32_t length) {
+    auto s = (char*)m_arena.allocate(length + 1, 1);
+    memcpy(s, str, length);
+    s[length] = '\0';
+
+    const IdIndex id_index((IdIndex::value_type)m_strings.size());
+    m_strings.emplace_back(String{s, length});
+    slot = Slot{h, length, id_index};
+
+    // Keeps the load factor below 1/2.
+    if (m_strings.size() * 2 > m_slots.size()) {
+      grow();
     }
-  };
+    return id_index;
+  }
 
-  using Map = std::unordered_map<StringPair, IdIndex, StringHash, StringEqual>;
-  Map m_map;
-  std::vector<String> m_strings;
+  void grow() {
+    std::vector<Slot> slots(m_slots.size() * 2);
+    const auto mask = slots.size() - 1;
+    for (auto& slot : m_slots) {
+      if (slot.index == IdIndex::undefined)
+        continue;
+      auto i = slot.hash & mask;
+      while (slots[i].index != IdIndex::undefined) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = slot;
+    }
+    m_slots.swap(slots);
+    m_mask = mask;
+  }
 };
 
 #endif  // ID_CACHE_HPP
@@ -0,0 +1,78 @@
+#include "incremental.hpp"
+
+#include <string_view>
+#include <utility>
+
+#include "lexer.hpp"
+#include "token_window.hpp"
+
+IncrementalUnit::IncrementalUnit(std::string source, IdCache& id_cache) :
+  m_id_cache(id_cache), m_source(std::move(source)) {
+  parse_all();
+}
+
+bool IncrementalUnit::apply(const TextEdit& edit) {
+  edit.apply(m_source);
+  relex(m_tokens, m_source, edit, m_id_cache);
+
+  // Spans are still in the offsets before the edit. An edit touching the
+  // fun token or the tokens behind the function can change what the
+  // function is, that takes a full parse.
+  for (auto& span : m_function_spans) {
+    if (span.begin >= edit.offset)
+      break;
+    if (edit.offset + edit.removed < span.end) {
+      if (reparse(span, edit))
+        return true;
+      break;
+    }
+  }
+  parse_all();
+  return false;
+}
+
+void IncrementalUnit::parse_all() {
+  m_tokens = TokenStore();
+  TokenWindow window(2);
+  StreamingLexer lexer(std::string_view(m_source), window, m_id_cache);
+  m_tokens.lex(lexer);
+
+  m_ast = Ast();
+  TokenStore::Reader reader(m_tokens);
+  TokenStoreParser parser(reader, m_ast, m_id_cache);
+  m_global_scope = parser.parse();
+  m_errors = parser.get_errors();
+  m_function_spans = parser.get_function_spans();
+}
+
+bool IncrementalUnit::reparse(FunctionSpan& span, const TextEdit& edit) {
+  const auto delta = edit.get_delta();
+  const auto end = (uint32_t)(span.end + delta);
+  const auto from = m_tokens.lower_bound(span.begin);
+  TokenStore::Reader reader(m_tokens, TokenRange{from, TokenIndex((uint32_t)m_tokens.size() - 1)});
+  TokenStoreParser parser(reader, m_ast, m_id_cache);
+  // The function must end where it did, at the same token, or the edit
+  // moved tokens between functions.
+  if (!parser.reparse_function(span.function) || reader.last_offset() != end)
+    return false;
+
+  std::vector<ParseError> errors;
+  for (const auto& error : m_errors) {
+    if (error.offset < span.begin) errors.emplace_back(error);
+  }
+  errors.insert(errors.end(), parser.get_errors().begin(), parser.get_errors().end());
+  for (const auto& error : m_errors) {
+    if (error.offset >= span.end) errors.emplace_back(ParseError{(uint32_t)(error.offset + delta), error.message});
+  }
+  m_errors.swap(errors);
+
+  const auto old_end = span.end;
+  for (auto& other : m_function_spans) {
+    if (other.begin >= old_end) {
+      other.begin += delta;
+      other.end += delta;
+    }
+  }
+  span.end = end;
+  return true;
+}
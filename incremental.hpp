@@ -0,0 +1,46 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "id_cache.hpp"
+#include "parser.hpp"
+#include "relexer.hpp"
+#include "token_store.hpp"
+
+// One source kept lexed and parsed under edits. An edit is relexed, and
+// when it lies inside a function of the global scope only that function is
+// parsed again (BasicParser::reparse_function): the rest of the Ast, the
+// function's node and every AstNodeIndex outside the function stay valid.
+// Any other edit parses the whole source again into a new Ast.
+class IncrementalUnit {
+public:
+  IncrementalUnit(std::string source, IdCache& id_cache);
+
+  // True when a single function was parsed again.
+  bool apply(const TextEdit& edit);
+
+  const std::string& get_source() const { return m_source; }
+  const TokenStore& get_tokens() const { return m_tokens; }
+  Ast& get_ast() { return m_ast; }
+  AstNodeIndex get_global_scope() const { return m_global_scope; }
+  // Sorted by offset.
+  const std::vector<ParseError>& get_errors() const { return m_errors; }
+  const std::vector<FunctionSpan>& get_function_spans() const { return m_function_spans; }
+
+private:
+  IdCache& m_id_cache;
+  std::string m_source;
+  TokenStore m_tokens;
+  Ast m_ast;
+  AstNodeIndex m_global_scope;
+  std::vector<ParseError> m_errors;
+  std::vector<FunctionSpan> m_function_spans;
+
+  void parse_all();
+  bool reparse(FunctionSpan& span, const TextEdit& edit);
+};
+
+#endif  // INCREMENTAL_HPP
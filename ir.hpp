@@ -4,11 +4,16 @@
 #include <cassert>
 #include <cstdint>
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <deque>
+#include <limits>
+#include <type_traits>
+#include "arena.hpp"
 #include "strong_type.hpp"
 #include "id_index.hpp"
-#include "ordered_dict.hpp"
+#include "flat_ordered_dict.hpp"
 
 namespace ir {
 
@@ -29,24 +34,44 @@ enum class Type: uint8_t {
   A,
   V,
 };
+// Operands are slots of the frame, args first, then locals. Jumps go to
+// label nodes, which compact to nothing. ldc loads a constant of the
+// function, print appends a slot to the output of the Vm.
+//
+// The instructions after print are superinstructions, only compact() makes
+// them: incjl and incjle increment the slot they compare, ldcadd, ldcsub and
+// ldcmul load a constant and take it as the right operand, jlinc and jleinc
+// jump to an inc of the slot they compare and do the inc as they jump.
 enum class Instr: std::uint8_t {
   mov, add, sub, div, mul, shr, shl, inc, dec, 
   jmp, jg, jl, jge, jle, je, jne, jz, jnz,
-  call, callv, ret, retv, label,
+  call, callv, ret, retv, label, ldc, neg, print,
+  incjl, incjle, ldcadd, ldcsub, ldcmul, jlinc, jleinc,
 };
 
 static constexpr inline uint16_t instr_type(Instr instr, Type type) {
   return (uint16_t)instr | ((uint16_t)type << (sizeof(instr) * 8));
 }
 
+// Set in the type byte of a compacted jump with a 32-bit target.
+static constexpr uint8_t WideJump = 0x80;
+
+static constexpr inline uint16_t wide_instr_type(Instr instr, Type type) {
+  return instr_type(instr, type) | ((uint16_t)WideJump << (sizeof(instr) * 8));
+}
+
 static std::size_t instr_to_args_count(Instr instr, Type type) {
   switch (instr) {
     case Instr::jmp:
     case Instr::inc:
     case Instr::dec:
-    case Instr::label:
+    case Instr::print:
       return 1;
     case Instr::mov:
+    case Instr::ldc:
+    case Instr::neg:
+    case Instr::jz:
+    case Instr::jnz:
       return 2;
     case Instr::add:
     case Instr::sub:
@@ -60,20 +85,72 @@ static std::size_t instr_to_args_count(Instr instr, Type type) {
     case Instr::jle:
     case Instr::je:
     case Instr::jne:
-    case Instr::jz:
-    case Instr::jnz:
       return 3;
     case Instr::ret:
-    case Instr::call:
       return 1;
+    // function, base slot of the arguments, and the slot of the result.
+    case Instr::call:
+      return 3;
     case Instr::callv:
+      return 2;
     case Instr::retv:
+    case Instr::label:
       return 0;
     default:
       assert(false);
   }
 }
 
+// Arithmetic of the Vm, shared with the passes that fold it. Integers wrap
+// around like the unsigned ones.
+template <typename T>
+T add(T a, T b) {
+  if constexpr (std::is_integral<T>::value) {
+    return (T)((std::make_unsigned_t<T>)a + (std::make_unsigned_t<T>)b);
+  } else {
+    return a + b;
+  }
+}
+
+template <typename T>
+T sub(T a, T b) {
+  if constexpr (std::is_integral<T>::value) {
+    return (T)((std::make_unsigned_t<T>)a - (std::make_unsigned_t<T>)b);
+  } else {
+    return a - b;
+  }
+}
+
+template <typename T>
+T mul(T a, T b) {
+  if constexpr (std::is_integral<T>::value) {
+    return (T)((std::make_unsigned_t<T>)a * (std::make_unsigned_t<T>)b);
+  } else {
+    return a * b;
+  }
+}
+
+// Integer division by 0 is an error the caller checks, the one overflow of
+// signed division wraps.
+template <typename T>
+T div(T a, T b) {
+  if constexpr (std::is_integral<T>::value) {
+    if (b == -1) return sub<T>(0, a);
+  }
+  return a / b;
+}
+
+// Shifts take the count modulo the width.
+template <typename T>
+T shl(T a, T b) {
+  return (T)((std::make_unsigned_t<T>)a << (b & (sizeof(T) * 8 - 1)));
+}
+
+template <typename T>
+T shr(T a, T b) {
+  return a >> (b & (sizeof(T) * 8 - 1));
+}
+
 struct Node {
   union {
     struct {
@@ -93,7 +170,7 @@ struct Value {
     IdIndex str_value;
     uint32_t i_value;
     uint64_t l_value;
-    IdIndex d_value;
+    double d_value;
   };
   Type type;
 };
@@ -135,11 +212,17 @@ private:
   std::vector<Value> m_consts;
 };
 
+// Nodes live in an arena of the function, freed with it at once. They stay
+// where they are, jumps point at them.
 class Function {
 private:
+  // Most functions are small, their arena starts with a chunk of 1 KiB.
+  static constexpr std::size_t FirstChunkSize = 1024;
+
   template <typename NodeType>
   NodeType& add_impl(Instr instr, Type type) {
-    auto node = new NodeType();
+    static_assert(std::is_trivially_destructible<NodeType>::value, "the arena runs no destructors");
+    auto node = m_nodes.create<NodeType>();
     node->m_instr = instr;
     node->m_type = type;
 
@@ -153,103 +236,263 @@ private:
     return *node;
   }  
 
+  static bool is_jump(Instr instr) {
+    return instr >= Instr::jmp && instr <= Instr::jnz;
+  }
+
+  // Bytes of the compacted node with short jumps: the instr and type bytes
+  // and 2 for each operand, 4 for the function index of a call. Labels take
+  // none.
+  static std::size_t compacted_size(const Node* node) {
+    if (node->m_instr == Instr::label)
+      return 0;
+    auto size = 2 + 2 * instr_to_args_count(node->m_instr, node->m_type);
+    if (node->m_instr == Instr::call || node->m_instr == Instr::callv)
+      size += 2;
+    return size;
+  }
+
+  // A jump during compacting, with the offsets of it and of its target as
+  // if every jump was short. Its offset is the final one once written. to is
+  // the node it goes to, past the inc for jlinc and jleinc.
+  struct Jump {
+    Node* node;
+    uint32_t offset;
+    uint32_t target;
+    bool wide;
+    const Node* to;
+  };
+
   template <typename T>
-  void compact_bytes(T bytes) {
-    uint8_t* b = (uint8_t*)&bytes;
-    for (size_t i = 0; i < sizeof(bytes); ++i) {
-      m_compacted_code.emplace_back(b[i]);
+  static uint8_t* store(uint8_t* out, T value) {
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+  }
+
+  // The superinstruction node and the one after it compact to, if any. No
+  // jump may go to the second one, targets are the nodes jumps go to, sorted.
+  static bool fuse(const Node* node, const std::vector<const Node*>& targets, Instr& fused) {
+    const auto next = node->m_next;
+    if (!next || next->m_type != node->m_type || std::binary_search(targets.begin(), targets.end(), next))
+      return false;
+    const auto a = ((const NodeArgs<3>*)node)->args.data();
+    const auto b = ((const NodeArgs<3>*)next)->args.data();
+    switch (node->m_instr) {
+      // inc i; jle end, i, n
+      case Instr::inc:
+        if ((next->m_instr != Instr::jl && next->m_instr != Instr::jle) || b[1].local_index != a[0].local_index
+            || (node->m_type != Type::I && node->m_type != Type::L))
+          return false;
+        fused = next->m_instr == Instr::jl ? Instr::incjl : Instr::incjle;
+        return true;
+      // ldc t, c; add d, a, t
+      case Instr::ldc:
+        switch (next->m_instr) {
+          case Instr::add: fused = Instr::ldcadd; break;
+          case Instr::sub: fused = Instr::ldcsub; break;
+          case Instr::mul: fused = Instr::ldcmul; break;
+          default: return false;
+        }
+        if (node->m_type != Type::I && node->m_type != Type::L && node->m_type != Type::D)
+          return false;
+        // add and mul may take the constant on the left.
+        return b[2].local_index == a[0].local_index
+          || (next->m_instr != Instr::sub && b[1].local_index == a[0].local_index);
+      // mov d, s; ret d is ret s.
+      case Instr::mov:
+        fused = Instr::ret;
+        return next->m_instr == Instr::ret && b[0].local_index == a[0].local_index;
+      default:
+        return false;
     }
   }
+
+  // The jlinc or jleinc a jl or jle compacts to, if it goes to an inc of the
+  // slot it compares; to is the node after the inc.
+  static bool fuse_jump(const Node* node, Instr& fused, const Node*& to) {
+    if ((node->m_instr != Instr::jl && node->m_instr != Instr::jle)
+        || (node->m_type != Type::I && node->m_type != Type::L))
+      return false;
+    const auto& args = ((const NodeArgs<3>*)node)->args;
+    auto inc = args[0].node_pointer;
+    while (inc->m_instr == Instr::label && inc->m_next) inc = inc->m_next;
+    if (inc->m_instr != Instr::inc || inc->m_type != node->m_type || !inc->m_next
+        || ((const NodeArgs<1>*)inc)->args[0].local_index != args[1].local_index)
+      return false;
+    fused = node->m_instr == Instr::jl ? Instr::jlinc : Instr::jleinc;
+    to = inc->m_next;
+    return true;
+  }
+
+  // Bytes of a superinstruction: inc and its jump take the bytes of the
+  // jump, mov and ret those of the ret, ldc and its operation the instr and
+  // type bytes, t, c, d and a.
+  static std::size_t fused_size(const Node* node, Instr fused) {
+    if (fused == Instr::ldcadd || fused == Instr::ldcsub || fused == Instr::ldcmul)
+      return 2 + 4 * 2;
+    return compacted_size(node->m_next);
+  }
+
 public:
   void verify() {
 
   }
 
-  void compact() {
+  // Jumps take the offset of their target from the start of the code, in 16
+  // bits. Targets past that make the jump wide, with the WideJump bit in its
+  // type byte and 32 bits of target. A wide jump moves what is behind it by 2
+  // bytes and may push more targets out, so widening repeats over the jumps
+  // until none widens; jumps only grow, it ends. The code is sized before
+  // any of it is written.
+  //
+  // Pairs of nodes that make a superinstruction are compacted to it, unless
+  // superinstructions is false, and so are jl and jle to an inc.
+  void compact(bool superinstructions = true) {
     assert(!m_compacted && m_compacted_code.empty());
-    auto node = get_head();
-    m_compacted_code.reserve(1024);
-    std::vector<std::pair<Node*, uint64_t>> jump_offsets; 
-
-    while (node) {
-      auto next = node->m_next;
-
-      const auto offset = m_compacted_code.size();
-      compact_bytes(node->m_instr);
-      compact_bytes(node->m_type);
-      const auto args_count = instr_to_args_count(node->m_instr, node->m_type);
+    // A jlinc or jleinc goes to the node after the inc, which is a target too.
+    std::vector<const Node*> targets;
+    if (superinstructions) {
+      for (auto node = m_head; node; node = node->m_next) {
+        if (!is_jump(node->m_instr))
+          continue;
+        targets.push_back(((NodeArgs<1>*)node)->args[0].node_pointer);
+        Instr fused;
+        const Node* to;
+        if (fuse_jump(node, fused, to)) targets.push_back(to);
+      }
+      std::sort(targets.begin(), targets.end());
+    }
+    // The second node of a pair isn't fused again.
+    const auto jump_to = [&](Node* node, uint32_t offset, bool paired) {
+      const Node* to = ((NodeArgs<1>*)node)->args[0].node_pointer;
+      Instr fused;
+      if (superinstructions && !paired) fuse_jump(node, fused, to);
+      return Jump{node, offset, 0, false, to};
+    };
+    std::vector<Jump> jumps;
+    std::size_t size = 0;
+    Instr fused;
+    // The offsets take the place of the prev links, next ones stay.
+    for (auto node = m_head; node; node = node->m_next) {
+      node->m_offset_during_compacting = size;
+      if (superinstructions && fuse(node, targets, fused)) {
+        const auto next = node->m_next;
+        next->m_offset_during_compacting = size;
+        if (is_jump(next->m_instr)) jumps.push_back(jump_to(next, (uint32_t)size, true));
+        size += fused_size(node, fused);
+        node = next;
+        continue;
+      }
+      if (is_jump(node->m_instr)) jumps.push_back(jump_to(node, (uint32_t)size, false));
+      size += compacted_size(node);
+    }
+    assert(size <= std::numeric_limits<uint32_t>::max() / 2);
+    for (auto& jump : jumps) {
+      jump.target = (uint32_t)jump.to->m_offset_during_compacting;
+    }
 
-      switch (node->m_instr) {
-        case Instr::ret:
-        case Instr::inc:
-        case Instr::dec: {
-          NodeArgs<1>* node_args = (NodeArgs<1>*)node;
-          compact_bytes(node_args->args[0].local_index);
-          break;
-        }
-        case Instr::mov: {
-          NodeArgs<2>* node_args = (NodeArgs<2>*)node;
-          compact_bytes(node_args->args[0].local_index);
-          compact_bytes(node_args->args[1].local_index);
-          break;
-        }
-        case Instr::add:        
-        case Instr::sub:        
-        case Instr::mul:        
-        case Instr::div:        
-        case Instr::shl:        
-        case Instr::shr: {
-          NodeArgs<3>* node_args = (NodeArgs<3>*)node;
-          compact_bytes(node_args->args[0].local_index);
-          compact_bytes(node_args->args[1].local_index);
-          compact_bytes(node_args->args[2].local_index);
-          break;
-        }
-        case Instr::call: {
-          NodeArgs<1>* node_args = (NodeArgs<1>*)node;
-          break;
+    if (size > std::numeric_limits<uint16_t>::max()) {
+      // Offsets of the wide jumps, ascending; the ones before a target move it.
+      std::vector<uint32_t> wide;
+      const auto moved = [&](uint32_t offset) {
+        return offset + 2 * (uint32_t)(std::lower_bound(wide.begin(), wide.end(), offset) - wide.begin());
+      };
+      for (bool widened = true; widened;) {
+        widened = false;
+        for (auto& jump : jumps) {
+          if (!jump.wide && moved(jump.target) > std::numeric_limits<uint16_t>::max()) {
+            jump.wide = widened = true;
+          }
         }
-        case Instr::je:
-        case Instr::jne:
-        case Instr::jz:
-        case Instr::jnz:
-        case Instr::jg:
-        case Instr::jge:
-        case Instr::jl:
-        case Instr::jle:
-        case ir::Instr::jmp: {
-          auto node_args = (NodeArgs<1>*)node;
-          jump_offsets.emplace_back(node_args->args[0].node_pointer, m_compacted_code.size());
-          compact_bytes((uint16_t)0);
-
-          switch (node->m_instr) {
-            case Instr::jz:
-            case Instr::jnz:
-              compact_bytes(node_args->args[1].local_index);
-              break;
-            case Instr::jmp:
-              break;
-            default:
-              compact_bytes(node_args->args[1].local_index);
-              compact_bytes(node_args->args[2].local_index);
-              break;
+        if (widened) {
+          wide.clear();
+          for (auto& jump : jumps) {
+            if (jump.wide) wide.push_back(jump.offset);
           }
-          break;
         }
-        default:
-          assert(false);
-          break;
-      }     
-      node->m_offset_during_compacting = offset;
-      node = next;
+      }
+      size += 2 * wide.size();
     }
 
-    for (auto& p : jump_offsets) {
-      auto ptr = (uint16_t*)&m_compacted_code.data()[p.second];
-      *ptr = (uint16_t)p.first->m_offset_during_compacting;
+    // Nodes take their final offsets as they are written, the targets are
+    // stored once all of them have one.
+    m_compacted_code.resize(size);
+    const auto code = m_compacted_code.data();
+    auto out = code;
+    auto jump = jumps.begin();
+    for (auto node = m_head; node; node = node->m_next) {
+      node->m_offset_during_compacting = out - code;
+      if (node->m_instr == Instr::label)
+        continue;
+      // Only the first args_count args are there.
+      auto node_args = (const NodeArgs<3>*)node;
+      auto instr = node->m_instr;
+      std::size_t i = 1;
+
+      if (superinstructions && fuse(node, targets, fused)) {
+        const auto next = node->m_next;
+        const auto next_args = (const NodeArgs<3>*)next;
+        next->m_offset_during_compacting = out - code;
+        switch (fused) {
+          case Instr::incjl:
+          case Instr::incjle:
+            // The jump, under the instr of the superinstruction.
+            node = next;
+            node_args = next_args;
+            instr = fused;
+            break;
+          case Instr::ret:
+            out = store(out, Instr::ret);
+            out = store(out, node->m_type);
+            out = store(out, node_args->args[1].local_index);
+            node = next;
+            continue;
+          default: {
+            const auto t = node_args->args[0].local_index;
+            out = store(out, fused);
+            out = store(out, node->m_type);
+            out = store(out, t);
+            out = store(out, node_args->args[1].local_index);
+            out = store(out, next_args->args[0].local_index);
+            out = store(out, next_args->args[2].local_index == t ? next_args->args[1].local_index : next_args->args[2].local_index);
+            node = next;
+            continue;
+          }
+        }
+      }
+      const auto args_count = instr_to_args_count(node->m_instr, node->m_type);
+
+      if (is_jump(node->m_instr)) {
+        const Node* to;
+        if (superinstructions && instr == node->m_instr) fuse_jump(node, instr, to);
+        jump->offset = (uint32_t)(out - code);
+        out = store(out, instr);
+        out = store(out, jump->wide ? (uint8_t)((uint8_t)node->m_type | WideJump) : (uint8_t)node->m_type);
+        out += jump->wide ? 4 : 2;
+        ++jump;
+      } else {
+        out = store(out, instr);
+        out = store(out, node->m_type);
+        if (node->m_instr == Instr::call || node->m_instr == Instr::callv) {
+          out = store(out, node_args->args[0].function_pointer->get_index());
+        } else {
+          i = 0;
+        }
+      }
+      for (; i < args_count; ++i) {
+        out = store(out, node_args->args[i].local_index);
+      }
+    }
+    assert(out == code + size);
+    for (auto& jump : jumps) {
+      const auto target = jump.to->m_offset_during_compacting;
+      if (jump.wide) {
+        store(code + jump.offset + 2, (uint32_t)target);
+      } else {
+        store(code + jump.offset + 2, (uint16_t)target);
+      }
     }
     m_compacted = true;
-    m_compacted_code.shrink_to_fit();
   }
 
   inline Node& add(Instr instr, Type type) {
@@ -269,6 +512,13 @@ public:
     return node;
   }
 
+  // Unlinks node, which stays in the arena. Jumps must not point at it.
+  void remove(Node* node) {
+    if (node->m_prev) node->m_prev->m_next = node->m_next; else m_head = node->m_next;
+    if (node->m_next) node->m_next->m_prev = node->m_prev; else m_tail = node->m_prev;
+    if (m_insert_point == node) m_insert_point = nullptr;
+  }
+
   void set_insert_point(Node* point) {
     m_insert_point = point;
   }
@@ -282,15 +532,7 @@ public:
     m_args_size(builder.get_args_size()), 
     m_locals_size(builder.get_locals_size()) {}
 
-  ~Function() {
-    auto node = m_head;
-    while (node) {
-      auto next = node->m_next;
-      delete node;
-      node = next;
-    }
-  }
-
+  bool is_compacted() const { return m_compacted; }
   std::vector<uint8_t>& get_compacted_code() { assert(m_compacted); return m_compacted_code; }
   const std::vector<uint8_t>& get_compacted_code() const { assert(m_compacted); return m_compacted_code; }
 
@@ -303,6 +545,11 @@ public:
   Consts& get_consts() { return m_consts; }
   const Consts& get_consts() const { return m_consts; }
 
+  uint16_t get_args_size() const { return m_args_size; }
+  uint16_t get_locals_size() const { return m_locals_size; }
+  // Locals are known once the body is built, after the function was added.
+  void set_locals_size(uint16_t size) { m_locals_size = size; }
+
   void set_index(uint32_t index) { m_index = index; }
   uint32_t get_index() const { return m_index; }
 
@@ -310,6 +557,7 @@ private:
   IdIndex m_name;
   static const uint32_t UndefinedIndex = std::numeric_limits<uint32_t>::max();
   uint32_t m_index = UndefinedIndex;
+  Arena m_nodes{FirstChunkSize, Arena::DefaultChunkSize};
   Node* m_head = nullptr;
   Node* m_tail = nullptr;
   Node* m_insert_point = nullptr;
@@ -347,12 +595,14 @@ public:
     return m_dict.find(name);
   }
 
+  Functions& get_functions() { return m_functions; }
+
 private:
   IdIndex m_name;
   uint32_t m_base_index;
   std::deque<Function> m_functions;
 
-  using Dict = OrderedDict<IdIndex, FunctionIndex, typename IdIndex::Hash>;
+  using Dict = FlatOrderedDict<IdIndex, FunctionIndex, typename IdIndex::Hash>;
   Dict m_dict;
 
   void setup_function(Function& fun) {
@@ -364,7 +614,7 @@ private:
 class Context {
 public:
   using Modules = std::deque<Module>;
-  using ModulesDict = OrderedDict<IdIndex, ModuleIndex, typename IdIndex::Hash>;
+  using ModulesDict = FlatOrderedDict<IdIndex, ModuleIndex, typename IdIndex::Hash>;
 
   Module& add_module(IdIndex name, uint32_t base_index = 0) {
     ModuleIndex module_index(m_modules.size());
@@ -0,0 +1,744 @@
+#include "ir_passes.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace ir {
+
+namespace {
+
+using Slot = uint16_t;
+
+bool is_jump(Instr instr) {
+  return instr >= Instr::jmp && instr <= Instr::jnz;
+}
+
+bool is_binary(Instr instr) {
+  return instr >= Instr::add && instr <= Instr::shl;
+}
+
+bool ends_block(Instr instr) {
+  return is_jump(instr) || instr == Instr::ret || instr == Instr::retv;
+}
+
+bool falls_through(Instr instr) {
+  return instr != Instr::jmp && instr != Instr::ret && instr != Instr::retv;
+}
+
+// Only the first instr_to_args_count args of a node are there.
+Arg* args(Node* node) {
+  return static_cast<NodeArgs<3>*>(node)->args.data();
+}
+
+Node* target(Node* node) {
+  return args(node)[0].node_pointer;
+}
+
+// The nodes jumps go to, sorted to be looked up, with how many jumps go to
+// each. A node no jump goes to any more isn't a target.
+class Targets {
+public:
+  static constexpr uint32_t None = std::numeric_limits<uint32_t>::max();
+
+  void reset(Function& function) {
+    m_nodes.clear();
+    m_jumps.clear();
+    for (auto node = function.get_head(); node; node = node->m_next) {
+      if (is_jump(node->m_instr)) m_nodes.push_back(target(node));
+    }
+    std::sort(m_nodes.begin(), m_nodes.end());
+    m_jumps.reserve(m_nodes.size());
+    for (std::size_t i = 0, j = 0; i < m_nodes.size(); i = j) {
+      for (j = i + 1; j < m_nodes.size() && m_nodes[j] == m_nodes[i]; ++j) {}
+      m_nodes[m_jumps.size()] = m_nodes[i];
+      m_jumps.push_back((uint32_t)(j - i));
+    }
+    m_nodes.resize(m_jumps.size());
+  }
+
+  std::size_t size() const { return m_nodes.size(); }
+  bool has(const Node* node) const { return index(node) != None; }
+
+  uint32_t index(const Node* node) const {
+    const auto found = std::lower_bound(m_nodes.begin(), m_nodes.end(), node);
+    if (found == m_nodes.end() || *found != node)
+      return None;
+    const auto index = (uint32_t)(found - m_nodes.begin());
+    return m_jumps[index] ? index : None;
+  }
+
+  // A jump to node went away.
+  void remove_jump(const Node* node) {
+    --m_jumps[std::lower_bound(m_nodes.begin(), m_nodes.end(), node) - m_nodes.begin()];
+  }
+
+private:
+  std::vector<const Node*> m_nodes;
+  std::vector<uint32_t> m_jumps;
+};
+
+// The slots of the frame of the callee, which begins at base.
+uint32_t frame_size(Node* node) {
+  const auto callee = args(node)[0].function_pointer;
+  return (uint32_t)callee->get_args_size() + callee->get_locals_size();
+}
+
+// Calls fn(slot, arg) for every slot node reads; arg is where the slot is,
+// or nullptr for the arguments of a call, which are read in a row.
+template <typename Fn>
+void for_each_use(Node* node, Fn&& fn) {
+  auto a = args(node);
+  switch (node->m_instr) {
+    case Instr::mov:
+    case Instr::neg:
+    case Instr::jz:
+    case Instr::jnz:
+      fn(a[1].local_index, &a[1]);
+      break;
+    case Instr::inc:
+    case Instr::dec:
+    case Instr::print:
+    case Instr::ret:
+      fn(a[0].local_index, &a[0]);
+      break;
+    case Instr::call:
+    case Instr::callv: {
+      const auto callee = a[0].function_pointer;
+      for (uint32_t i = 0; i < callee->get_args_size(); ++i) fn((uint32_t)a[1].local_index + i, nullptr);
+      break;
+    }
+    default:
+      if (is_binary(node->m_instr) || (is_jump(node->m_instr) && node->m_instr != Instr::jmp)) {
+        fn(a[1].local_index, &a[1]);
+        fn(a[2].local_index, &a[2]);
+      }
+      break;
+  }
+}
+
+// Calls fn(first, last) for the slots node writes. A call writes the frame
+// of its callee as well as its result.
+template <typename Fn>
+void for_each_def(Node* node, Fn&& fn) {
+  auto a = args(node);
+  switch (node->m_instr) {
+    case Instr::mov:
+    case Instr::ldc:
+    case Instr::neg:
+    case Instr::inc:
+    case Instr::dec:
+      fn(a[0].local_index, a[0].local_index);
+      break;
+    case Instr::call:
+    case Instr::callv:
+      if (frame_size(node)) fn(a[1].local_index, a[1].local_index + frame_size(node) - 1);
+      if (node->m_instr == Instr::call) fn(a[2].local_index, a[2].local_index);
+      break;
+    default:
+      if (is_binary(node->m_instr)) fn(a[0].local_index, a[0].local_index);
+      break;
+  }
+}
+
+// One past the highest slot the function names.
+uint32_t slots_count(Function& function) {
+  uint32_t count = (uint32_t)function.get_args_size() + function.get_locals_size();
+  for (auto node = function.get_head(); node; node = node->m_next) {
+    for_each_use(node, [&](uint32_t slot, Arg*) { count = std::max(count, slot + 1); });
+    for_each_def(node, [&](uint32_t, uint32_t last) { count = std::max(count, last + 1); });
+  }
+  return count;
+}
+
+// How many instructions write each slot, the args are written once more by
+// the call.
+void writes_count(Function& function, uint32_t slots, std::vector<uint32_t>& writes) {
+  writes.assign(slots, 0);
+  for (uint32_t slot = 0; slot < function.get_args_size(); ++slot) ++writes[slot];
+  for (auto node = function.get_head(); node; node = node->m_next) {
+    for_each_def(node, [&](uint32_t first, uint32_t last) {
+      for (auto slot = first; slot <= last; ++slot) ++writes[slot];
+    });
+  }
+}
+
+// Per slot state of a pass within a block, forgotten at the next block.
+template <typename T>
+class BlockState {
+public:
+  void reset(uint32_t slots, T none) {
+    m_values.assign(slots, none);
+    m_touched.clear();
+    m_none = none;
+  }
+
+  const T& operator[](uint32_t slot) const { return m_values[slot]; }
+
+  void set(uint32_t slot, T value) {
+    m_values[slot] = value;
+    m_touched.push_back(slot);
+  }
+
+  void clear() {
+    for (const auto slot : m_touched) m_values[slot] = m_none;
+    m_touched.clear();
+  }
+
+private:
+  std::vector<T> m_values;
+  std::vector<uint32_t> m_touched;
+  T m_none{};
+};
+
+// The constants of a function by type and bits, to find or add folded ones.
+// They are indexed on the first fold.
+class Consts {
+public:
+  void reset(Function& function) {
+    m_function = &function;
+    m_index.clear();
+    m_indexed = 0;
+  }
+
+  const Value& operator[](uint16_t index) const { return m_function->get_consts()[index]; }
+
+  // False when the function has no room for another constant.
+  bool find_or_add(const Value& value, uint16_t& index) {
+    const auto& consts = m_function->get_consts();
+    for (; m_indexed < consts.size(); ++m_indexed) {
+      m_index.emplace(key(consts[m_indexed]), (uint16_t)m_indexed);
+    }
+    const auto found = m_index.find(key(value));
+    if (found != m_index.end()) {
+      index = found->second;
+      return true;
+    }
+    if (consts.size() == std::numeric_limits<uint16_t>::max())
+      return false;
+    index = (uint16_t)consts.size();
+    m_function->add_const(Value(value));
+    return true;
+  }
+
+private:
+  struct Key {
+    uint64_t bits;
+    Type type;
+
+    bool operator==(const Key& other) const { return bits == other.bits && type == other.type; }
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const { return hash::bytes(&key.bits, sizeof(key.bits), (uint64_t)key.type); }
+  };
+
+  Function* m_function = nullptr;
+  std::unordered_map<Key, uint16_t, KeyHash> m_index;
+  std::size_t m_indexed = 0;
+
+  static Key key(const Value& value) {
+    switch (value.type) {
+      case Type::I: return {value.i_value, value.type};
+      case Type::L: return {value.l_value, value.type};
+      case Type::D: {
+        uint64_t bits;
+        memcpy(&bits, &value.d_value, sizeof(bits));
+        return {bits, value.type};
+      }
+      default: return {value.str_value.get(), value.type};
+    }
+  }
+};
+
+// A block of a function: split before the targets of jumps and after jumps
+// and returns.
+struct Block {
+  Node* first;
+  Node* last;
+  uint32_t successors[2];
+  uint32_t successors_count;
+};
+
+// What the passes know of a function, computed once for all the rounds and
+// kept up to date as nodes go: nodes are only removed, rewrites keep the
+// slots they write and the targets of jumps. The buffers of the passes come
+// along, so that a module reuses them from function to function.
+struct Facts {
+  void reset(Function& function) {
+    targets.reset(function);
+    consts.reset(function);
+    slots = slots_count(function);
+    writes_count(function, slots, writes);
+  }
+
+  Targets targets;
+  Consts consts;
+  uint32_t slots = 0;
+  std::vector<uint32_t> writes;
+
+  BlockState<int32_t> block_state;
+  std::vector<int32_t> always;
+  std::vector<uint32_t> versions[2];
+  std::vector<Block> blocks;
+  std::vector<uint32_t> block_of;
+  std::vector<uint32_t> work;
+  std::vector<uint8_t> reached;
+  std::vector<uint64_t> words;
+
+  void remove(Function& function, Node* node) {
+    if (is_jump(node->m_instr)) targets.remove_jump(target(node));
+    for_each_def(node, [&](uint32_t first, uint32_t last) {
+      for (auto slot = first; slot <= last; ++slot) --writes[slot];
+    });
+    function.remove(node);
+  }
+};
+
+template <typename T>
+T get(const Value& value) {
+  if constexpr (std::is_same<T, int32_t>::value) {
+    return (int32_t)value.i_value;
+  } else if constexpr (std::is_same<T, int64_t>::value) {
+    return (int64_t)value.l_value;
+  } else {
+    return value.d_value;
+  }
+}
+
+template <typename T>
+Value make(T result) {
+  if constexpr (std::is_same<T, int32_t>::value) {
+    return Value{.i_value = (uint32_t)result, .type = Type::I};
+  } else if constexpr (std::is_same<T, int64_t>::value) {
+    return Value{.l_value = (uint64_t)result, .type = Type::L};
+  } else {
+    return Value{.d_value = result, .type = Type::D};
+  }
+}
+
+// The value of a binary or neg node, false when it isn't folded. Integer
+// division by 0 is left to fail in the Vm.
+template <typename T>
+bool fold(Instr instr, const Value& a, const Value& b, Value& result) {
+  const auto x = get<T>(a);
+  const auto y = get<T>(b);
+  switch (instr) {
+    case Instr::add: result = make<T>(add<T>(x, y)); return true;
+    case Instr::sub: result = make<T>(sub<T>(x, y)); return true;
+    case Instr::mul: result = make<T>(mul<T>(x, y)); return true;
+    case Instr::div:
+      if constexpr (std::is_integral<T>::value) {
+        if (y == 0) return false;
+      }
+      result = make<T>(div<T>(x, y));
+      return true;
+    case Instr::neg: result = make<T>(sub<T>(0, x)); return true;
+    default:
+      if constexpr (std::is_integral<T>::value) {
+        result = make<T>(instr == Instr::shl ? shl<T>(x, y) : shr<T>(x, y));
+        return true;
+      }
+      return false;
+  }
+}
+
+template <typename T>
+bool jumps(Instr instr, const Value& a, const Value& b) {
+  const auto x = get<T>(a);
+  const auto y = get<T>(b);
+  switch (instr) {
+    case Instr::jg: return x > y;
+    case Instr::jl: return x < y;
+    case Instr::jge: return x >= y;
+    case Instr::jle: return x <= y;
+    case Instr::je: return x == y;
+    case Instr::jne: return x != y;
+    case Instr::jz: return x == 0;
+    default: return x != 0;
+  }
+}
+
+template <typename Fn>
+bool by_type(Type type, Fn&& fn) {
+  switch (type) {
+    case Type::I: return fn(int32_t{});
+    case Type::L: return fn(int64_t{});
+    case Type::D: return fn(double{});
+    default: return false;
+  }
+}
+
+void constant_folding(Function& function, Facts& facts, PassStats& stats) {
+  static constexpr int32_t Unknown = -1;
+  const auto& targets = facts.targets;
+  auto& consts = facts.consts;
+  const auto slots = facts.slots;
+  // The constant each slot holds, by index. A slot only ever written by one
+  // ldc holds its constant anywhere it is read.
+  auto& known = facts.block_state;
+  known.reset(slots, Unknown);
+  auto& always = facts.always;
+  always.assign(slots, Unknown);
+  const auto& writes = facts.writes;
+  for (auto node = function.get_head(); node; node = node->m_next) {
+    if (node->m_instr == Instr::ldc && writes[args(node)[0].local_index] == 1)
+      always[args(node)[0].local_index] = args(node)[1].local_index;
+  }
+  const auto constant = [&](Slot slot, Type type, const Value*& value) {
+    const auto index = known[slot] != Unknown ? known[slot] : always[slot];
+    if (index == Unknown || consts[(uint16_t)index].type != type)
+      return false;
+    value = &consts[(uint16_t)index];
+    return true;
+  };
+
+  for (auto node = function.get_head(); node;) {
+    const auto next = node->m_next;
+    if (targets.has(node)) known.clear();
+    auto a = args(node);
+    const auto instr = node->m_instr;
+    const Value* x = nullptr;
+    const Value* y = nullptr;
+    Value result{.i_value = 0, .type = node->m_type};
+
+    if (instr == Instr::ldc) {
+      known.set(a[0].local_index, a[1].local_index);
+    } else if ((is_binary(instr) && constant(a[1].local_index, node->m_type, x) && constant(a[2].local_index, node->m_type, y))
+        || (instr == Instr::neg && constant(a[1].local_index, node->m_type, x) && (y = x))) {
+      uint16_t index;
+      if (by_type(node->m_type, [&](auto t) { return fold<decltype(t)>(instr, *x, *y, result); })
+          && consts.find_or_add(result, index)) {
+        node->m_instr = Instr::ldc;
+        a[1].local_index = index;
+        known.set(a[0].local_index, index);
+        ++stats.rewritten;
+      } else {
+        known.set(a[0].local_index, Unknown);
+      }
+    } else if (instr == Instr::mov && constant(a[1].local_index, node->m_type, x)) {
+      node->m_instr = Instr::ldc;
+      a[1].local_index = (uint16_t)(x - &consts[0]);
+      known.set(a[0].local_index, a[1].local_index);
+      ++stats.rewritten;
+    } else if (is_jump(instr) && instr != Instr::jmp && constant(a[1].local_index, node->m_type, x)
+        && (instr == Instr::jz || instr == Instr::jnz || constant(a[2].local_index, node->m_type, y))) {
+      if (!y) y = x;
+      if (by_type(node->m_type, [&](auto t) { return jumps<decltype(t)>(instr, *x, *y); })) {
+        node->m_instr = Instr::jmp;
+        node->m_type = Type::V;
+        ++stats.rewritten;
+      } else if (!targets.has(node)) {
+        facts.remove(function, node);
+        ++stats.removed;
+      }
+    } else {
+      for_each_def(node, [&](uint32_t first, uint32_t last) {
+        for (auto slot = first; slot <= last; ++slot) known.set(slot, Unknown);
+      });
+    }
+    if (ends_block(node->m_instr)) known.clear();
+    node = next;
+  }
+}
+
+void copy_propagation(Function& function, Facts& facts, PassStats& stats) {
+  static constexpr int32_t None = -1;
+  const auto& targets = facts.targets;
+  const auto slots = facts.slots;
+  // The slot each one is a copy of, while the version of that slot is the
+  // one it was copied at. Writing a slot makes a new version of it.
+  auto& copy_of = facts.block_state;
+  copy_of.reset(slots, None);
+  auto& copied_version = facts.versions[0];
+  copied_version.assign(slots, 0);
+  auto& version = facts.versions[1];
+  version.assign(slots, 0);
+  // A slot only ever written by a mov from an arg nothing else writes is a
+  // copy of the arg anywhere it is read.
+  auto& always = facts.always;
+  always.assign(slots, None);
+  const auto& writes = facts.writes;
+  for (auto node = function.get_head(); node; node = node->m_next) {
+    const auto a = args(node);
+    if (node->m_instr == Instr::mov && writes[a[0].local_index] == 1 && a[1].local_index < function.get_args_size()
+        && writes[a[1].local_index] == 1)
+      always[a[0].local_index] = a[1].local_index;
+  }
+
+  for (auto node = function.get_head(); node;) {
+    const auto next = node->m_next;
+    if (targets.has(node)) copy_of.clear();
+    // inc and dec write the slot they read.
+    if (node->m_instr != Instr::inc && node->m_instr != Instr::dec) {
+      for_each_use(node, [&](uint32_t slot, Arg* arg) {
+        auto source = copy_of[slot];
+        if (source == None || version[source] != copied_version[slot]) source = always[slot];
+        if (arg && source != None) {
+          arg->local_index = (Slot)source;
+          ++stats.rewritten;
+        }
+      });
+    }
+    auto a = args(node);
+    if (node->m_instr == Instr::mov && a[0].local_index == a[1].local_index && !targets.has(node)) {
+      facts.remove(function, node);
+      ++stats.removed;
+      node = next;
+      continue;
+    }
+    for_each_def(node, [&](uint32_t first, uint32_t last) {
+      for (auto slot = first; slot <= last; ++slot) {
+        ++version[slot];
+        copy_of.set(slot, None);
+      }
+    });
+    if (node->m_instr == Instr::mov && a[0].local_index != a[1].local_index) {
+      copy_of.set(a[0].local_index, a[1].local_index);
+      copied_version[a[0].local_index] = version[a[1].local_index];
+    }
+    if (ends_block(node->m_instr)) copy_of.clear();
+    node = next;
+  }
+}
+
+// Fills facts.blocks with the blocks of the function in order.
+const std::vector<Block>& blocks_of(Function& function, Facts& facts) {
+  const auto& targets = facts.targets;
+  auto& blocks = facts.blocks;
+  blocks.clear();
+  // The block each target begins, by the index of the target.
+  auto& block_of = facts.block_of;
+  block_of.assign(targets.size(), 0);
+  for (auto node = function.get_head(); node; node = node->m_next) {
+    const auto index = targets.index(node);
+    if (blocks.empty() || index != Targets::None || ends_block(blocks.back().last->m_instr)) {
+      blocks.push_back(Block{node, node, {}, 0});
+      if (index != Targets::None) block_of[index] = (uint32_t)blocks.size() - 1;
+    }
+    blocks.back().last = node;
+  }
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    auto& block = blocks[i];
+    if (is_jump(block.last->m_instr)) {
+      block.successors[block.successors_count++] = block_of[targets.index(target(block.last))];
+    }
+    if (falls_through(block.last->m_instr) && i + 1 < blocks.size()) {
+      block.successors[block.successors_count++] = i + 1;
+    }
+  }
+  return blocks;
+}
+
+// Removes the nodes of a block, the labels aren't counted.
+void remove_block(Function& function, Facts& facts, const Block& block, PassStats& stats) {
+  const auto end = block.last->m_next;
+  for (auto node = block.first; node != end;) {
+    const auto next = node->m_next;
+    if (node->m_instr != Instr::label) ++stats.removed;
+    facts.remove(function, node);
+    node = next;
+  }
+}
+
+void unreachable_blocks(Function& function, Facts& facts, PassStats& stats) {
+  const auto& targets = facts.targets;
+  const auto& blocks = blocks_of(function, facts);
+  auto& reached = facts.reached;
+  reached.assign(blocks.size(), false);
+  auto& work = facts.work;
+  work.clear();
+  if (!blocks.empty()) {
+    reached[0] = true;
+    work.push_back(0);
+  }
+  while (!work.empty()) {
+    const auto& block = blocks[work.back()];
+    work.pop_back();
+    for (uint32_t i = 0; i < block.successors_count; ++i) {
+      if (!reached[block.successors[i]]) {
+        reached[block.successors[i]] = true;
+        work.push_back(block.successors[i]);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    if (!reached[i]) remove_block(function, facts, blocks[i], stats);
+  }
+
+  // A jump over nothing but labels goes on to its target anyway.
+  for (auto node = function.get_head(); node;) {
+    auto next = node->m_next;
+    if (is_jump(node->m_instr)) {
+      auto after = next;
+      while (after && after != target(node) && after->m_instr == Instr::label) after = after->m_next;
+      if (after && after == target(node) && !targets.has(node)) {
+        facts.remove(function, node);
+        ++stats.removed;
+      }
+    }
+    node = next;
+  }
+
+  for (auto node = function.get_head(); node;) {
+    const auto next = node->m_next;
+    if (node->m_instr == Instr::label && !targets.has(node)) facts.remove(function, node);
+    node = next;
+  }
+}
+
+// Sets of slots as bits, all in one vector.
+class SlotSets {
+public:
+  // Empty sets in words.
+  SlotSets(std::vector<uint64_t>& words, std::size_t count, uint32_t slots) :
+    m_words_per_set((slots + 63) / 64), m_words(words) {
+    m_words.assign(count * m_words_per_set, 0);
+  }
+
+  uint64_t* operator[](std::size_t set) { return m_words.data() + set * m_words_per_set; }
+  std::size_t words() const { return m_words_per_set; }
+
+  static bool has(const uint64_t* set, uint32_t slot) { return set[slot / 64] >> (slot % 64) & 1; }
+  static void add(uint64_t* set, uint32_t slot) { set[slot / 64] |= uint64_t(1) << (slot % 64); }
+  static void remove(uint64_t* set, uint32_t slot) { set[slot / 64] &= ~(uint64_t(1) << (slot % 64)); }
+
+private:
+  std::size_t m_words_per_set;
+  std::vector<uint64_t>& m_words;
+};
+
+// Instructions without effects beyond the slot they write.
+bool is_pure(const Node* node) {
+  switch (node->m_instr) {
+    case Instr::mov:
+    case Instr::ldc:
+    case Instr::neg:
+    case Instr::inc:
+    case Instr::dec:
+    case Instr::add:
+    case Instr::sub:
+    case Instr::mul:
+    case Instr::shl:
+    case Instr::shr:
+      return true;
+    case Instr::div:
+      return node->m_type == Type::D;
+    default:
+      return false;
+  }
+}
+
+void dead_code(Function& function, Facts& facts, PassStats& stats) {
+  const auto& targets = facts.targets;
+  const auto& blocks = blocks_of(function, facts);
+  // Per block the slots it reads before writing them, the ones it writes and
+  // the live ones at its entry and exit; then a scratch set.
+  enum { Gen, Kill, In, Out, PerBlock };
+  SlotSets sets(facts.words, blocks.size() * PerBlock + 1, facts.slots);
+  const auto words = sets.words();
+  const auto set = [&](std::size_t block, int which) { return sets[block * PerBlock + which]; };
+  const auto live_before = [](Node* node, uint64_t* live) {
+    for_each_def(node, [&](uint32_t first, uint32_t last) {
+      for (auto slot = first; slot <= last; ++slot) SlotSets::remove(live, slot);
+    });
+    for_each_use(node, [&](uint32_t slot, Arg*) { SlotSets::add(live, slot); });
+  };
+
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    for (auto node = blocks[i].last;; node = node->m_prev) {
+      for_each_def(node, [&](uint32_t first, uint32_t last) {
+        for (auto slot = first; slot <= last; ++slot) SlotSets::add(set(i, Kill), slot);
+      });
+      live_before(node, set(i, Gen));
+      if (node == blocks[i].first)
+        break;
+    }
+  }
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto i = blocks.size(); i-- > 0;) {
+      const auto out = set(i, Out);
+      for (uint32_t s = 0; s < blocks[i].successors_count; ++s) {
+        const auto successor_in = set(blocks[i].successors[s], In);
+        for (std::size_t w = 0; w < words; ++w) out[w] |= successor_in[w];
+      }
+      const auto gen = set(i, Gen);
+      const auto kill = set(i, Kill);
+      const auto in = set(i, In);
+      for (std::size_t w = 0; w < words; ++w) {
+        const auto word = gen[w] | (out[w] & ~kill[w]);
+        changed |= word != in[w];
+        in[w] = word;
+      }
+    }
+  }
+
+  const auto live = sets[blocks.size() * PerBlock];
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    std::copy(set(i, Out), set(i, Out) + words, live);
+    for (auto node = blocks[i].last; node;) {
+      const auto prev = node == blocks[i].first ? nullptr : node->m_prev;
+      if (is_pure(node) && !SlotSets::has(live, args(node)[0].local_index) && !targets.has(node)) {
+        facts.remove(function, node);
+        ++stats.removed;
+      } else {
+        live_before(node, live);
+      }
+      node = prev;
+    }
+  }
+}
+
+using PassFunction = void (*)(Function&, Facts&, PassStats&);
+
+const PassFunction passes[] = {constant_folding, copy_propagation, unreachable_blocks, dead_code};
+
+void run_passes(Function& function, Facts& facts, const bool* enabled, PassStats* all_stats, uint32_t max_rounds) {
+  if (function.is_compacted())
+    return;
+  facts.reset(function);
+  for (uint32_t round = 0; round < max_rounds; ++round) {
+    bool changed = false;
+    for (std::size_t i = 0; i < (std::size_t)Pass::Count; ++i) {
+      if (!enabled[i])
+        continue;
+      auto& stats = all_stats[i];
+      const auto before = stats.rewritten + stats.removed;
+      passes[i](function, facts, stats);
+      changed |= stats.rewritten + stats.removed != before;
+    }
+    if (!changed)
+      break;
+  }
+}
+
+}  // namespace
+
+const char* pass_name(Pass pass) {
+  switch (pass) {
+    case Pass::ConstantFolding: return "constant folding";
+    case Pass::CopyPropagation: return "copy propagation";
+    case Pass::UnreachableBlocks: return "unreachable blocks";
+    case Pass::DeadCode: return "dead code";
+    default: return "?";
+  }
+}
+
+void PassManager::run(Function& function) {
+  Facts facts;
+  run_passes(function, facts, m_enabled.data(), m_stats.data(), MaxRounds);
+}
+
+void PassManager::run(Module& module) {
+  Facts facts;
+  for (auto& function : module.get_functions()) run_passes(function, facts, m_enabled.data(), m_stats.data(), MaxRounds);
+}
+
+}  // namespace ir
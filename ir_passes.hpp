@@ -0,0 +1,58 @@
+#ifndef IR_PASSES_HPP
+#define IR_PASSES_HPP
+
+#include <array>
+#include <cstdint>
+
+#include "ir.hpp"
+
+namespace ir {
+
+enum class Pass : uint8_t {
+  ConstantFolding,
+  CopyPropagation,
+  UnreachableBlocks,
+  DeadCode,
+  Count,
+};
+
+const char* pass_name(Pass pass);
+
+// What a pass did over all the functions it ran on.
+struct PassStats {
+  uint32_t rewritten = 0;
+  uint32_t removed = 0;
+};
+
+// Optimizes functions between building and compact(), in the order of Pass,
+// over and over until no pass changes anything or MaxRounds rounds ran.
+// Every pass is enabled to start with.
+//
+// Constant folding computes what only depends on ldc within a block, with the
+// arithmetic of the Vm; jumps it decides become jmp or go. Copy propagation
+// reads the source of a mov in its place within a block. Unreachable blocks
+// removes the code no path from the entry takes, jumps to the next
+// instruction and labels nothing jumps to. Dead code removes instructions
+// whose results aren't read, by the liveness of the slots over the blocks
+// of the function. Integer div stays, it may fail.
+class PassManager {
+public:
+  void enable(Pass pass, bool enabled) { m_enabled[(std::size_t)pass] = enabled; }
+  bool is_enabled(Pass pass) const { return m_enabled[(std::size_t)pass]; }
+
+  const PassStats& get_stats(Pass pass) const { return m_stats[(std::size_t)pass]; }
+
+  // Compacted functions have no nodes left, they are skipped.
+  void run(Function& function);
+  void run(Module& module);
+
+private:
+  static constexpr uint32_t MaxRounds = 4;
+
+  std::array<bool, (std::size_t)Pass::Count> m_enabled{true, true, true, true};
+  std::array<PassStats, (std::size_t)Pass::Count> m_stats{};
+};
+
+}  // namespace ir
+
+#endif  // IR_PASSES_HPP
@@ -1,74 +1,139 @@
 #ifndef LEXER_HPP
 #define LEXER_HPP
 
+#include <array>
+#include <cassert>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <istream>
 #include <memory>
+#include <charconv>
 
+#include "char_scanner.hpp"
 #include "token.hpp"
+#include "token_window.hpp"
 #include "id_cache.hpp"
+#include "concurrent_id_cache.hpp"
 
-class Lexer {
+// IdCacheType is IdCache or ConcurrentIdCache when several lexers share one
+// interner across threads. TokensType is a std::vector keeping every token,
+// or a TokenWindow keeping only the newest ones.
+template <typename IdCacheType, typename TokensType = std::vector<Token>>
+class BasicLexer {
 public:
-  using Tokens = std::vector<Token>;
+  using IdCache = IdCacheType;
+  using Tokens = TokensType;
 
-  Lexer(std::istream& in, Tokens& tokens, IdCache& id_cache) : 
-    m_in(in), m_tokens(tokens), m_id_cache(id_cache) {
+  BasicLexer(std::istream& in, Tokens& tokens, IdCacheType& id_cache) :
+    m_in(&in), m_tokens(tokens), m_id_cache(id_cache) {
     m_buffer.reserve(1024);
     next_char();
   }
 
+  // Scans the caller owned buffer (e.g. a MappedFile) in place. Identifiers
+  // and literals are handed to IdCache as slices of the source, so the source
+  // must outlive the lexer.
+  BasicLexer(std::string_view source, Tokens& tokens, IdCacheType& id_cache) :
+    BasicLexer(source, 0, tokens, id_cache) {}
+
+  // Starts at a token boundary inside the source, offsets stay relative to
+  // the start of the source.
+  BasicLexer(std::string_view source, uint32_t start_offset, Tokens& tokens, IdCacheType& id_cache) :
+    m_begin(source.data()), m_cur(source.data() + start_offset), m_end(source.data() + source.size()),
+    m_tokens(tokens), m_id_cache(id_cache) {
+    m_last_char = m_cur < m_end ? *m_cur : EOF;
+  }
+
+  // The current token, the one returned by the last next().
   const Token& last() {
-    return m_tokens.back();
+    return m_tokens[m_tokens.size() - 1 - m_lookahead];
   }
 
   const Token& next() {
-    omit_white_spaces(); 
-    m_buffer.clear();
+    if (m_lookahead) {
+      --m_lookahead;
+      return last();
+    }
+    lex();
+    return m_tokens.back();
+  }
 
-    if (m_last_char == EOF) {
-      if (m_tokens.empty() || m_tokens.back().get_kind() != Token::Kind::Eof) {
-        m_tokens.emplace_back(Token::Kind::Eof);
+  // Byte offset of last() in the input.
+  uint32_t last_offset() const {
+    return m_offsets[(m_lexed - 1 - m_lookahead) & OffsetsMask];
+  }
+
+  // The n-th token after last() without consuming it, Eof past the end.
+  // With a TokenWindow the window must hold n tokens more than last().
+  const Token& peek(std::size_t n = 1) {
+    assert(n <= OffsetsMask);
+    while (m_lookahead < n && !lexed_eof()) {
+      lex();
+      ++m_lookahead;
+    }
+    const auto ahead = n < m_lookahead ? n : m_lookahead;
+    return m_tokens[m_tokens.size() - 1 - (m_lookahead - ahead)];
+  }
+
+private:
+  void lex() {
+    omit_white_spaces();
+    begin_text();
+    m_token_offset = current_offset();
+
+    if (m_last_char == EOF && at_end()) {
+      if (!lexed_eof()) {
+        push_token(Token::Kind::Eof);
       }
     }
-    else if (::isalpha(m_last_char) || m_last_char == '_') {
-      do {
-        m_buffer += m_last_char;
-        next_char();
-      } while (::isalpha(m_last_char) || ::isdigit(m_last_char) || m_last_char == '_');
+    else if (char_class::is_id_start(m_last_char)) {
+      if (m_in) {
+        do {
+          advance();
+        } while (char_class::is_id_continue(m_last_char));
+      } else {
+        skip_to(char_scanner::skip_id(m_cur + 1, m_end));
+      }
+
+      const auto id = text();
+      const auto token_kind = Token::id_2_token_kind(id);
 
-      const auto token_kind = Token::id_2_token_kind(m_buffer);
-      
       if (token_kind == Token::Kind::Id) {
-        m_tokens.emplace_back(token_kind);
-        m_tokens.back().id = m_id_cache.get(m_buffer.c_str(), m_buffer.size());
+        push_token(token_kind).id = m_id_cache.get(id.data(), id.size());
       } else {
-        m_tokens.emplace_back(token_kind);
+        push_token(token_kind);
       }
-    } else if (::isdigit(m_last_char)) {
-      do {
-        m_buffer += m_last_char;
-        next_char();
-      } while (::isdigit(last_char()));
-      const auto value = atoi(m_buffer.c_str());
-      m_tokens.emplace_back(Token::Kind::I32Literal);
-      m_tokens.back().i32 = value;
+    } else if (char_class::is_digit(m_last_char)) {
+      if (m_in) {
+        do {
+          advance();
+        } while (char_class::is_digit(last_char()));
+      } else {
+        skip_to(char_scanner::skip_digits(m_cur + 1, m_end));
+      }
+      const auto digits = text();
+      int32_t value = 0;
+      std::from_chars(digits.data(), digits.data() + digits.size(), value);
+      push_token(Token::Kind::I32Literal).i32 = value;
     } else {
       switch (m_last_char) {
         case '(': push_token_kind(Token::Kind::LeftParen); break;
         case ')': push_token_kind(Token::Kind::RightParen); break;
         case '{': push_token_kind(Token::Kind::LeftBrace); break;
         case '}': push_token_kind(Token::Kind::RightBrace); break;
-        case '+': push_token_kind(Token::Kind::Add); break;
-        case '-': push_token_kind(Token::Kind::Sub); break;
-        case '*': push_token_kind(Token::Kind::Mul); break;
-        case '/': push_token_kind(Token::Kind::Div); break;
+        case '+': push_token_kind(match('=') ? Token::Kind::AddAssign : Token::Kind::Add); break;
+        case '-': push_token_kind(match('=') ? Token::Kind::SubAssign : Token::Kind::Sub); break;
+        case '*': push_token_kind(match('=') ? Token::Kind::MulAssign : Token::Kind::Mul); break;
+        case '/': push_token_kind(match('=') ? Token::Kind::DivAssign : Token::Kind::Div); break;
         case ';': push_token_kind(Token::Kind::Semicolon); break;
         case ':': push_token_kind(Token::Kind::Colon); break;
-        case '=': push_token_kind(Token::Kind::Assign); break;
-        case '>': push_token_kind(Token::Kind::Great); break;
-        case '<': push_token_kind(Token::Kind::Less); break;
+        case ',': push_token_kind(Token::Kind::Comma); break;
+        case '.': push_token_kind(match('.') ? Token::Kind::DotDot : Token::Kind::Dot); break;
+        case '=': push_token_kind(match('=') ? Token::Kind::Equals : Token::Kind::Assign); break;
+        case '!': push_token_kind(match('=') ? Token::Kind::NotEquals : Token::Kind::Unknown); break;
+        case '>': push_token_kind(match('=') ? Token::Kind::GreatOrEqual : Token::Kind::Great); break;
+        case '<': push_token_kind(match('=') ? Token::Kind::LessOrEqual : Token::Kind::Less); break;
         case '\'': {
           const auto chr = next_char();
           if (next_char() != '\'') {
@@ -76,16 +141,21 @@ public:
           } else {
 
           }
+          push_token_kind(Token::Kind::Unknown);
           break;
         }
         case '"': {
           next_char();
-          while (last_char() != '"') {
-            m_buffer += last_char();
-            next_char();
-          } 
-          m_tokens.emplace_back(Token::Kind::StringLiteral);
-          m_tokens.back().str = m_id_cache.get(m_buffer.c_str(), m_buffer.size());
+          begin_text();
+          if (m_in) {
+            while (last_char() != '"' && !at_end()) {
+              advance();
+            }
+          } else {
+            skip_to(char_scanner::find_quote(m_cur, m_end));
+          }
+          const auto str = text();
+          push_token(Token::Kind::StringLiteral).str = m_id_cache.get(str.data(), str.size());
           break;
         }
         default:
@@ -94,34 +164,119 @@ public:
       }
       next_char();
     }
-    return m_tokens.back();
   }
 
-private:
-  std::istream& m_in;
+  // istream mode: m_in is set and token text is collected in m_buffer.
+  // view mode: m_in is null, m_cur points at m_last_char and token text is
+  // the [m_text_begin, m_cur) slice of the source.
+  std::istream* m_in = nullptr;
+  const char* m_begin = nullptr;
+  const char* m_cur = nullptr;
+  const char* m_end = nullptr;
+  const char* m_text_begin = nullptr;
   Tokens& m_tokens;
   std::string m_buffer;
-  IdCache& m_id_cache;
+  IdCacheType& m_id_cache;
+  // Tokens lexed by peek() and not yet returned by next().
+  std::size_t m_lookahead = 0;
+  // Offsets of the newest tokens by their sequence number, the lookahead
+  // is bounded by their count.
+  static constexpr std::size_t OffsetsMask = 7;
+  std::array<uint32_t, OffsetsMask + 1> m_offsets{};
+  uint64_t m_lexed = 0;
+  uint32_t m_token_offset = 0;
+  uint32_t m_offset = (uint32_t)-1;
   char m_last_char = 0;
 
   inline char next_char() {
-    m_last_char = m_in.get() ;
+    if (m_in) {
+      m_last_char = m_in->get();
+      ++m_offset;
+    } else {
+      if (m_cur < m_end) ++m_cur;
+      m_last_char = m_cur < m_end ? *m_cur : EOF;
+    }
     return m_last_char;
   }
 
+  inline bool lexed_eof() const {
+    return !m_tokens.empty() && m_tokens.back().get_kind() == Token::Kind::Eof;
+  }
+
   inline char last_char() {
     return m_last_char;
   }
 
+  // Moves to the char after the current one when it is c, for two char
+  // operators. The switch in lex() then steps over it.
+  inline bool match(char c) {
+    const bool matched = m_in ? m_in->peek() == c : m_cur + 1 < m_end && m_cur[1] == c;
+    if (matched) {
+      next_char();
+    }
+    return matched;
+  }
+
+  // view mode only: makes p the current char.
+  inline void skip_to(const char* p) {
+    m_cur = p;
+    m_last_char = m_cur < m_end ? *m_cur : EOF;
+  }
+
+  inline bool at_end() const {
+    return m_in ? m_in->eof() : m_cur == m_end;
+  }
+
+  inline void begin_text() {
+    if (m_in) {
+      m_buffer.clear();
+    } else {
+      m_text_begin = m_cur;
+    }
+  }
+
+  // Appends the current char to the token text and moves to the next one.
+  inline void advance() {
+    if (m_in) {
+      m_buffer += m_last_char;
+    }
+    next_char();
+  }
+
+  inline std::string_view text() const {
+    if (m_in) {
+      return m_buffer;
+    }
+    return std::string_view(m_text_begin, m_cur - m_text_begin);
+  }
+
+  inline Token& push_token(Token::Kind kind) {
+    m_offsets[m_lexed++ & OffsetsMask] = m_token_offset;
+    return m_tokens.emplace_back(kind);
+  }
+
   inline void push_token_kind(Token::Kind kind) {
-    m_tokens.emplace_back(kind);
+    push_token(kind);
+  }
+
+  // Byte offset of m_last_char from the start of the input.
+  inline uint32_t current_offset() const {
+    return m_in ? m_offset : (uint32_t)(m_cur - m_begin);
   }
 
   inline void omit_white_spaces() {
-    while (::isspace(last_char())) {
-      next_char();
+    if (m_in) {
+      while (char_class::is_space(last_char())) {
+        next_char();
+      }
+    } else if (char_class::is_space(last_char())) {
+      skip_to(char_scanner::skip_spaces(m_cur + 1, m_end));
     }
   }
 };
 
+using Lexer = BasicLexer<IdCache>;
+using ConcurrentLexer = BasicLexer<ConcurrentIdCache>;
+using StreamingLexer = BasicLexer<IdCache, TokenWindow>;
+
 #endif  // LEXER_HPP
@@ -1,20 +1,135 @@
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "id_cache.hpp"
 #include "lexer.hpp"
+#include "mapped_file.hpp"
 #include "ast.hpp"
+#include "codegen.hpp"
+#include "ir_passes.hpp"
+#include "driver.hpp"
+#include "parser.hpp"
+#include "semantic.hpp"
+#include "source_point.hpp"
+#include "vm.hpp"
 
+// Parses, checks and lowers one file, then runs one of its functions.
+static int run_function(const std::string& path, const char* function) {
+  MappedFile file(path.c_str());
+  if (!file.is_open()) {
+    std::cerr << "cannot open " << path << std::endl;
+    return -1;
+  }
+  IdCache id_cache;
+  SourcePointFactory source_points(id_cache);
+  const auto begin = source_points.add_file(path.c_str(), path.size(), file.view());
+  TokenWindow tokens;
+  StreamingLexer lexer(file.view(), tokens, id_cache);
+  Ast ast;
+  StreamingParser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+  for (const auto& error : parser.get_errors()) {
+    const auto point = source_points.locate(begin + error.offset);
+    std::cerr << path << ":" << point.m_line << ":" << point.m_col << ": " << error.message << std::endl;
+  }
+  if (!parser.get_errors().empty())
+    return -1;
+
+  ThreadPool pool(1);
+  SemanticPass semantic(ast, id_cache);
+  semantic.run(global, pool);
+  for (const auto& error : semantic.get_errors()) {
+    std::cerr << path << ": " << error.message << std::endl;
+  }
+  ir::Context context;
+  auto& module = context.add_module(id_cache.get(path.c_str(), (uint32_t)path.size()));
+  CodeGen codegen(ast, id_cache, semantic);
+  if (!codegen.lower(module)) {
+    for (const auto& error : codegen.get_errors()) {
+      std::cerr << path << ": " << error.message << std::endl;
+    }
+    return -1;
+  }
+  ir::PassManager().run(module);
+
+  Vm vm(context, id_cache);
+  const bool ok = vm.run(module.get_name(), id_cache.get(function));
+  std::cout << vm.get_output();
+  if (!ok) {
+    std::cerr << function << ": " << vm.get_error() << std::endl;
+    return -1;
+  }
+  if (vm.get_result().type == ir::Type::I) {
+    std::cout << (int32_t)vm.get_result().i_value << std::endl;
+  }
+  return 0;
+}
+
+// smallang file              prints the token kinds of one file
+// smallang [-jN] file...     lexes and parses all files in parallel
+// smallang -rNAME file       runs function NAME of file, without arguments
 int main(int argc, char* argv[]) {
-  std::cout << sizeof(AstNode) << std::endl;
-  if (argc <= 1) {
+  std::vector<std::string> paths;
+  std::size_t threads_count = ThreadPool::default_threads_count();
+  bool driver_mode = false;
+  const char* function = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "-j", 2)) {
+      threads_count = (std::size_t)atoi(argv[i] + 2);
+      driver_mode = true;
+    } else if (!strncmp(argv[i], "-r", 2)) {
+      function = argv[i] + 2;
+    } else {
+      paths.emplace_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
     std::cerr << "no input file" << std::endl;
     return -1;
   }
-  std::ifstream in(argv[1]);
-  Lexer::Tokens tokens;
+
+  if (function) {
+    return run_function(paths[0], function);
+  }
+  std::cout << sizeof(AstNode) << std::endl;
+
+  if (driver_mode || paths.size() > 1) {
+    ConcurrentIdCache id_cache;
+    Driver driver(id_cache, threads_count);
+    const auto report = driver.run(paths);
+    IdCache file_names;
+    SourcePointFactory source_points(file_names);
+    for (auto& unit : driver.get_units()) {
+      if (!unit->opened) {
+        std::cerr << "cannot open " << unit->path << std::endl;
+      }
+      if (unit->errors.empty())
+        continue;
+      // Lines are only counted in files with errors, mapped again for that.
+      MappedFile file(unit->path.c_str());
+      const auto begin = source_points.add_file(unit->path.c_str(), unit->path.size(), file.view());
+      for (const auto& error : unit->errors) {
+        const auto point = source_points.locate(begin + error.offset);
+        std::cerr << unit->path << ":" << point.m_line << ":" << point.m_col << ": " << error.message << std::endl;
+      }
+    }
+    report.print(std::cout);
+    return report.failed_files || report.parse_errors ? -1 : 0;
+  }
+
+  MappedFile file(paths[0].c_str());
+  if (!file.is_open()) {
+    std::cerr << "cannot open " << paths[0] << std::endl;
+    return -1;
+  }
+  TokenWindow tokens;
   IdCache id_cache;
-  Lexer lexer(in, tokens, id_cache);
+  StreamingLexer lexer(file.view(), tokens, id_cache);
 
   while (lexer.next().get_kind() != Token::Kind::Eof) {
     std::cout << (int)lexer.last().get_kind() << std::endl;
@@ -0,0 +1,77 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile {
+public:
+  MappedFile() = default;
+  explicit MappedFile(const char* path, bool writable = false) { open(path, writable); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile& operator=(MappedFile&&) = delete;
+
+  ~MappedFile() { close(); }
+
+  // A writable mapping is private: writes go to copies of the pages, the
+  // file is never changed.
+  bool open(const char* path, bool writable = false) {
+    close();
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    m_size = (std::size_t)st.st_size;
+    m_opened = true;
+
+    if (m_size != 0) {
+      const int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+      void* data = ::mmap(nullptr, m_size, protection, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        ::close(fd);
+        m_size = 0;
+        m_opened = false;
+        return false;
+      }
+      ::madvise(data, m_size, MADV_SEQUENTIAL);
+      m_data = (const char*)data;
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (m_data) {
+      ::munmap((void*)m_data, m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_opened = false;
+  }
+
+  bool is_open() const { return m_opened; }
+  const char* data() const { return m_data; }
+  // Only for a writable mapping.
+  char* mutable_data() const { return (char*)m_data; }
+  std::size_t size() const { return m_size; }
+  std::string_view view() const { return std::string_view(m_data, m_size); }
+
+private:
+  const char* m_data = nullptr;
+  std::size_t m_size = 0;
+  bool m_opened = false;
+};
+
+#endif  // MAPPED_FILE_HPP
@@ -0,0 +1,200 @@
+#ifndef PARALLEL_LEXER_HPP
+#define PARALLEL_LEXER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include "id_cache.hpp"
+#include "lexer.hpp"
+#include "thread_pool.hpp"
+#include "token_store.hpp"
+#include "token_window.hpp"
+
+struct ParallelLexResult {
+  std::size_t chunks;
+  // Tokens lexed again sequentially because a chunk started inside a token.
+  std::size_t relexed;
+};
+
+// Lexes one big source in chunks on a ThreadPool and appends the tokens to
+// store, the same tokens, payloads and offsets a sequential lexer produces.
+// Without chunks_count there are a few chunks per thread, of 64 KiB at least.
+//
+// Cuts are speculative: a chunk starts behind a new line, which can still be
+// inside a string literal. Every chunk lexes from its start until the first
+// token starting in the next chunk, with an IdCache of its own. The chunks
+// are then joined in order: the true stream continues where the previous
+// chunk stopped, and from the first token of a chunk starting at that very
+// offset on, the chunk is right (the lexer keeps no state between tokens).
+// The tokens in front of it are dropped. When a chunk has no such token, the
+// seam is lexed again sequentially until a token lands on one. The join
+// interns chunk local ids into id_cache in token order, so ids get the
+// numbers a sequential lexer gives them; the payloads are then rewritten in
+// parallel and the chunks copied into store in bulk.
+template <typename IdCacheType>
+ParallelLexResult lex_parallel(std::string_view source, TokenStore& store, IdCacheType& id_cache,
+    ThreadPool& pool, std::size_t chunks_count = 0) {
+  static constexpr std::size_t MinChunkSize = 64 * 1024;
+  static constexpr uint32_t None = std::numeric_limits<uint32_t>::max();
+
+  if (chunks_count == 0) {
+    chunks_count = pool.size() * 4;
+    const auto max_chunks = source.size() / MinChunkSize + 1;
+    if (chunks_count > max_chunks) chunks_count = max_chunks;
+  }
+
+  struct Chunk {
+    uint32_t begin;
+    uint32_t end;
+    // Offset of the first token at or after end.
+    uint32_t stop;
+    TokenStore tokens;
+    IdCache ids;
+    // Ids of the tokens in tokens, without the one lexed for stop.
+    uint32_t ids_count;
+    // The joined stream takes seam, then tokens from from on.
+    TokenStore seam;
+    uint32_t from;
+    std::vector<IdIndex> mapped;
+  };
+
+  std::vector<Chunk> chunks(chunks_count);
+  uint32_t begin = 0;
+  for (std::size_t i = 0; i < chunks_count; ++i) {
+    chunks[i].begin = begin;
+    uint32_t end = (uint32_t)source.size();
+    if (i + 1 < chunks_count) {
+      end = (uint32_t)(source.size() * (i + 1) / chunks_count);
+      if (end < begin) end = begin;
+      const auto new_line = (const char*)memchr(source.data() + end, '\n', source.size() - end);
+      end = new_line ? (uint32_t)(new_line - source.data()) + 1 : (uint32_t)source.size();
+    }
+    chunks[i].end = end;
+    begin = end;
+  }
+
+  pool.parallel_for(chunks_count, [&](std::size_t i) {
+    auto& chunk = chunks[i];
+    const bool last = i + 1 == chunks_count;
+    const auto stop = last ? None : chunk.end;
+    chunk.tokens.reserve((chunk.end - chunk.begin) / 4);
+    TokenWindow window(2);
+    BasicLexer<IdCache, TokenWindow> lexer(source, chunk.begin, window, chunk.ids);
+    while (true) {
+      chunk.ids_count = (uint32_t)chunk.ids.size();
+      const auto& token = lexer.next();
+      const auto offset = lexer.last_offset();
+      if (offset >= stop) {
+        chunk.stop = offset;
+        break;
+      }
+      chunk.tokens.push_back(token, offset);
+      if (token.get_kind() == Token::Kind::Eof) {
+        chunk.ids_count = (uint32_t)chunk.ids.size();
+        break;
+      }
+    }
+    chunk.from = (uint32_t)chunk.tokens.size();
+  });
+
+  // Index of the token of chunk starting at offset, None when the chunk
+  // lexed across offset.
+  const auto find = [](const Chunk& chunk, uint32_t offset) {
+    const auto index = chunk.tokens.lower_bound(offset);
+    const bool found = index.get() < chunk.tokens.size() && chunk.tokens.offset(index) == offset;
+    return found ? index.get() : None;
+  };
+
+  const auto is_id = [](Token::Kind kind) {
+    return kind == Token::Kind::Id || kind == Token::Kind::StringLiteral;
+  };
+
+  // Interns the ids of the tokens kept from chunk in the order they first
+  // appear there. Local ids are numbered in that order already, unless
+  // tokens in front were dropped.
+  const auto map_ids = [&](Chunk& chunk) {
+    chunk.mapped.assign(chunk.ids.size(), IdIndex(None));
+    if (chunk.from == 0) {
+      for (uint32_t id = 0; id < chunk.ids_count; ++id) {
+        const auto& str = chunk.ids.get(IdIndex(id));
+        chunk.mapped[id] = id_cache.get(str.str, str.length);
+      }
+      return;
+    }
+    for (auto i = chunk.from; i < chunk.tokens.size(); ++i) {
+      const TokenIndex index(i);
+      if (!is_id(chunk.tokens.kind(index)))
+        continue;
+      auto& mapped = chunk.mapped[chunk.tokens.payload(index)];
+      if (mapped == IdIndex(None)) {
+        const auto& str = chunk.ids.get(IdIndex(chunk.tokens.payload(index)));
+        mapped = id_cache.get(str.str, str.length);
+      }
+    }
+  };
+
+  // Joins the chunks in order, which decides what to keep of every chunk
+  // and lexes the seams again where needed.
+  ParallelLexResult result{chunks_count, 0};
+  std::size_t i = 0;
+  uint32_t next = 0;
+  bool done = false;
+  while (!done) {
+    while (i + 1 < chunks_count && next >= chunks[i].end) ++i;
+
+    const auto from = find(chunks[i], next);
+    if (from != None) {
+      chunks[i].from = from;
+      map_ids(chunks[i]);
+      if (i + 1 == chunks_count)
+        break;
+      next = chunks[i].stop;
+      ++i;
+      continue;
+    }
+
+    TokenWindow window(2);
+    BasicLexer<IdCacheType, TokenWindow> lexer(source, next, window, id_cache);
+    while (true) {
+      const auto& token = lexer.next();
+      const auto offset = lexer.last_offset();
+      while (i + 1 < chunks_count && offset >= chunks[i].end) ++i;
+      if (offset > next && find(chunks[i], offset) != None) {
+        next = offset;
+        break;
+      }
+      chunks[i].seam.push_back(token, offset);
+      ++result.relexed;
+      if (token.get_kind() == Token::Kind::Eof) {
+        done = true;
+        break;
+      }
+    }
+  }
+
+  pool.parallel_for(chunks_count, [&](std::size_t i) {
+    auto& chunk = chunks[i];
+    for (auto j = chunk.from; j < chunk.tokens.size(); ++j) {
+      const TokenIndex index(j);
+      if (is_id(chunk.tokens.kind(index))) {
+        chunk.tokens.set_payload(index, chunk.mapped[chunk.tokens.payload(index)].get());
+      }
+    }
+  });
+
+  std::size_t size = store.size();
+  for (const auto& chunk : chunks) {
+    size += chunk.seam.size() + chunk.tokens.size() - chunk.from;
+  }
+  store.reserve(size);
+  for (const auto& chunk : chunks) {
+    store.append(chunk.seam);
+    store.append(chunk.tokens, TokenIndex(chunk.from));
+  }
+  return result;
+}
+
+#endif  // PARALLEL_LEXER_HPP
@@ -1,25 +1,751 @@
 #include "parser.hpp"
 #include "lexer.hpp"
 
-void Parser::parse() {
-  auto& token = m_lexer.next(); 
-  if (token.get_kind() != Token::Kind::Fun) 
-    return;
+namespace {
 
-  auto& id_token = m_lexer.next();
+struct BinaryOperator {
+  // 0 for tokens that are no binary operator, higher binds tighter.
+  int precedence;
+  AstNode::Kind kind;
+  bool right_associative;
+};
 
-  if (id_token.get_kind() != Token::Kind::Id)
-    return;
+BinaryOperator binary_operator(Token::Kind kind) {
+  switch (kind) {
+    case Token::Kind::Assign: return {1, AstNode::Kind::AssignExpr, true};
+    case Token::Kind::AddAssign: return {1, AstNode::Kind::AddAssignExpr, true};
+    case Token::Kind::SubAssign: return {1, AstNode::Kind::SubAssignExpr, true};
+    case Token::Kind::MulAssign: return {1, AstNode::Kind::MulAssignExpr, true};
+    case Token::Kind::DivAssign: return {1, AstNode::Kind::DivAssignExpr, true};
+    case Token::Kind::Equals: return {2, AstNode::Kind::EqualExpr, false};
+    case Token::Kind::NotEquals: return {2, AstNode::Kind::NotEqualExpr, false};
+    case Token::Kind::Less: return {3, AstNode::Kind::LessExpr, false};
+    case Token::Kind::LessOrEqual: return {3, AstNode::Kind::LessOrEqualExpr, false};
+    case Token::Kind::Great: return {3, AstNode::Kind::GreatExpr, false};
+    case Token::Kind::GreatOrEqual: return {3, AstNode::Kind::GreatOrEqualExpr, false};
+    case Token::Kind::Add: return {4, AstNode::Kind::AddExpr, false};
+    case Token::Kind::Sub: return {4, AstNode::Kind::SubExpr, false};
+    case Token::Kind::Mul: return {5, AstNode::Kind::MulExpr, false};
+    case Token::Kind::Div: return {5, AstNode::Kind::DivExpr, false};
+    default: return {0, AstNode::Kind::None, false};
+  }
+}
+
+bool starts_expr(Token::Kind kind) {
+  switch (kind) {
+    case Token::Kind::Id:
+    case Token::Kind::I32Literal:
+    case Token::Kind::StringLiteral:
+    case Token::Kind::LeftParen:
+    case Token::Kind::Sub:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool starts_decl(Token::Kind kind) {
+  switch (kind) {
+    case Token::Kind::Fun:
+    case Token::Kind::Struct:
+    case Token::Kind::Union:
+    case Token::Kind::Class:
+    case Token::Kind::Var:
+    case Token::Kind::Val:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// AstNode kinds of the primitive type tokens, from Token::Kind::I32 on.
+constexpr AstNode::Kind primitive_types[] = {
+  AstNode::Kind::I32Type, AstNode::Kind::I16Type, AstNode::Kind::I8Type,
+  AstNode::Kind::U32Type, AstNode::Kind::U16Type, AstNode::Kind::U8Type,
+  AstNode::Kind::F32Type, AstNode::Kind::F64Type,
+};
+
+static_assert((int)Token::Kind::F64 - (int)Token::Kind::I32 + 1 == sizeof(primitive_types) / sizeof(primitive_types[0]),
+  "a primitive type token without a node kind");
+
+bool is_primitive_type(Token::Kind kind) {
+  return kind >= Token::Kind::I32 && kind <= Token::Kind::F64;
+}
 
-  auto& left_paren_token = m_lexer.next();
+}  // namespace
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse() {
+  m_scope = UndefinedAstNodeIndex;
+  const auto global = create_scope(AstNode::Kind::GlobalScope);
+  const auto block = m_ast.create(AstNode::Kind::BlockStmt);
+  m_ast[block].block_stmt.block_scope = global;
+  m_ast[global].global_scope.block_stmt = block;
+  m_scope = global;
+
+  const auto mark = m_scratch.size();
+  advance();
+  while (kind() != Token::Kind::Eof) {
+    const auto consumed = m_consumed;
+    const auto errors = m_errors.size();
+    const auto begin = m_lexer.last_offset();
+    const auto decl = parse_decl();
+    if (decl != UndefinedAstNodeIndex) {
+      m_scratch.emplace_back(decl.get());
+      if (m_ast[decl].kind == AstNode::Kind::FunctionDeclStmt) {
+        m_function_spans.emplace_back(FunctionSpan{m_ast[decl].decl_stmt.decl, begin, m_lexer.last_offset()});
+      }
+    }
+    if (decl == UndefinedAstNodeIndex && m_errors.size() != errors) {
+      while (!starts_decl(kind()) && kind() != Token::Kind::Eof) advance();
+    }
+    if (m_consumed == consumed) advance();
+  }
+  m_ast[block].block_stmt.stmts = take_scratch(mark);
+  resolve_unresolved();
+  return global;
+}
+
+template <typename LexerType, typename IdCacheType>
+bool BasicParser<LexerType, IdCacheType>::reparse_function(AstNodeIndex function) {
+  m_scope = m_ast[function].scope.outer_scope;
+  const auto record = m_ast.get_overflow<AstNode::FunctionOverflow>(m_ast[function].function.overflow);
+  const auto old_name = m_ast[record.function_type_with_named_params].fun_type.name;
+
+  advance();
+  if (kind() != Token::Kind::Fun)
+    return false;
+  advance();
+  if (kind() != Token::Kind::Id || m_lexer.last().id != old_name)
+    return false;
+  advance();
+  // A function parsed again before has its subtree in a region of its own.
+  const auto old_region = m_ast.get_region(record.function_type_with_named_params);
+  if (old_region != m_ast.get_region(function)) {
+    m_ast.release_region(old_region);
+    m_ast.clear_scope(function);
+  } else {
+    m_ast.remove_children(function);
+  }
+  m_ast.begin_region();
+  parse_function_rest(old_name, function);
+  m_ast.end_region();
+  resolve_unresolved();
+  return true;
+}
+
+template <typename LexerType, typename IdCacheType>
+ExtraRange BasicParser<LexerType, IdCacheType>::take_scratch(std::size_t mark) {
+  const auto range = m_ast.add_extra(m_scratch.data() + mark, (uint32_t)(m_scratch.size() - mark));
+  m_scratch.resize(mark);
+  return range;
+}
+
+template <typename LexerType, typename IdCacheType>
+bool BasicParser<LexerType, IdCacheType>::accept(Token::Kind token_kind) {
+  if (kind() != token_kind)
+    return false;
+  advance();
+  return true;
+}
+
+template <typename LexerType, typename IdCacheType>
+bool BasicParser<LexerType, IdCacheType>::expect(Token::Kind token_kind, const char* message) {
+  if (accept(token_kind))
+    return true;
+  error(message);
+  return false;
+}
 
-  if (left_paren_token.get_kind() != Token::Kind::LeftParen)
+template <typename LexerType, typename IdCacheType>
+void BasicParser<LexerType, IdCacheType>::error(const char* message) {
+  m_errors.emplace_back(ParseError{m_lexer.last_offset(), message});
+}
+
+// Skips the rest of a broken statement: up to and including a semicolon,
+// or up to a closing brace or a token starting a statement.
+template <typename LexerType, typename IdCacheType>
+void BasicParser<LexerType, IdCacheType>::synchronize() {
+  while (true) {
+    switch (kind()) {
+      case Token::Kind::Eof:
+      case Token::Kind::RightBrace:
+      case Token::Kind::Fun:
+      case Token::Kind::Struct:
+      case Token::Kind::Union:
+      case Token::Kind::Class:
+      case Token::Kind::Var:
+      case Token::Kind::Val:
+      case Token::Kind::Return:
+      case Token::Kind::If:
+      case Token::Kind::While:
+      case Token::Kind::For:
+        return;
+      case Token::Kind::Semicolon:
+        advance();
+        return;
+      default:
+        advance();
+        break;
+    }
+  }
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::create_scope(AstNode::Kind kind) {
+  const auto index = m_ast.create(kind);
+  m_ast[index].scope.outer_scope = m_scope;
+  return index;
+}
+
+template <typename LexerType, typename IdCacheType>
+void BasicParser<LexerType, IdCacheType>::declare(AstNodeIndex node, IdIndex name) {
+  if (m_ast.find_in_scope(m_scope, name) != UndefinedAstNodeIndex) {
+    error("name already declared in this scope");
     return;
+  }
+  m_ast.add_to_scope(m_scope, node, name);
+}
+
+// With declared_before only names declared so far are visible, else
+// block and function scopes are skipped, as their names must be declared
+// before they are used.
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::lookup(IdIndex name, AstNodeIndex scope, bool declared_before) const {
+  for (auto index = scope; index != UndefinedAstNodeIndex; index = m_ast[index].scope.outer_scope) {
+    const auto& node = m_ast[index];
+    if (!declared_before && (node.kind == AstNode::Kind::BlockScope || node.kind == AstNode::Kind::Function))
+      continue;
+    const auto found = m_ast.find_in_scope(index, name);
+    if (found != UndefinedAstNodeIndex)
+      return found;
+  }
+  return UndefinedAstNodeIndex;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::resolve(AstNodeIndex node, IdIndex name) {
+  const auto decl = lookup(name, m_scope, true);
+  if (decl == UndefinedAstNodeIndex) {
+    m_unresolved.emplace_back(Unresolved{node, m_scope});
+  }
+  return decl;
+}
+
+template <typename LexerType, typename IdCacheType>
+void BasicParser<LexerType, IdCacheType>::resolve_unresolved() {
+  for (const auto& unresolved : m_unresolved) {
+    auto& node = m_ast[unresolved.node];
+    if (node.kind == AstNode::Kind::NameExpr) {
+      node.name_expr.decl = lookup(node.name_expr.name, unresolved.scope, false);
+    } else {
+      node.named_type.decl = lookup(node.named_type.name, unresolved.scope, false);
+    }
+  }
+  m_unresolved.clear();
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_decl() {
+  AstNode::Kind stmt_kind;
+  AstNodeIndex decl;
+  switch (kind()) {
+    case Token::Kind::Fun:
+      stmt_kind = AstNode::Kind::FunctionDeclStmt;
+      decl = parse_function();
+      break;
+    case Token::Kind::Struct:
+      stmt_kind = AstNode::Kind::StructDeclStmt;
+      decl = parse_struct();
+      break;
+    case Token::Kind::Union:
+      stmt_kind = AstNode::Kind::UnionDeclStmt;
+      decl = parse_struct();
+      break;
+    case Token::Kind::Class:
+      stmt_kind = AstNode::Kind::ClassDeclStmt;
+      decl = parse_struct();
+      break;
+    case Token::Kind::Var:
+    case Token::Kind::Val:
+      return parse_var_decl();
+    default:
+      error("expected a declaration");
+      return UndefinedAstNodeIndex;
+  }
+  if (decl == UndefinedAstNodeIndex)
+    return UndefinedAstNodeIndex;
+  const auto stmt = m_ast.create(stmt_kind);
+  m_ast[stmt].decl_stmt.decl = decl;
+  return stmt;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_function() {
+  advance();
+  if (kind() != Token::Kind::Id) {
+    error("expected a function name");
+    return UndefinedAstNodeIndex;
+  }
+  const auto name = m_lexer.last().id;
+  advance();
+  return parse_function_rest(name);
+}
+
+// The parameters, return type and body of a function whose name was read,
+// into function when it is given.
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_function_rest(IdIndex name, AstNodeIndex function) {
+  if (function == UndefinedAstNodeIndex) {
+    function = create_scope(AstNode::Kind::Function);
+    declare(function, name);
+  }
+  const auto type = m_ast.create(AstNode::Kind::FunTypeWithNamedParams);
+  m_ast[type].fun_type.return_type = UndefinedAstNodeIndex;
+  m_ast[type].fun_type.name = name;
+  AstNode::FunctionOverflow record{type, UndefinedAstNodeIndex};
+
+  const auto outer = m_scope;
+  m_scope = function;
+  // Parameter types and names, in pairs.
+  const auto mark = m_scratch.size();
+  bool ok = expect(Token::Kind::LeftParen, "expected ( after the function name");
+  if (ok) {
+    if (kind() != Token::Kind::RightParen) {
+      do {
+        if (kind() != Token::Kind::Id) {
+          error("expected a parameter name");
+          ok = false;
+          break;
+        }
+        const auto param_name = m_lexer.last().id;
+        advance();
+        if (!expect(Token::Kind::Colon, "expected : after the parameter name")) {
+          ok = false;
+          break;
+        }
+        const auto param_type = parse_type();
+        m_scratch.emplace_back(param_type.get());
+        m_scratch.emplace_back(param_name.get());
 
-  m_lexer.next();
+        const auto param = m_ast.create(AstNode::Kind::LocalVariable);
+        m_ast[param].local_variable.value.type = param_type;
+        m_ast[param].local_variable.name = param_name;
+        declare(param, param_name);
+      } while (accept(Token::Kind::Comma));
+    }
+    ok = ok && expect(Token::Kind::RightParen, "expected ) after the parameters");
+  }
+  // Splits the pairs in place: the types go in front, the names behind.
+  const auto params_count = (uint32_t)(m_scratch.size() - mark) / 2;
+  m_scratch.resize(m_scratch.size() + params_count * 2);
+  auto* types = m_scratch.data() + mark + params_count * 2;
+  for (uint32_t i = 0; i < params_count; ++i) {
+    types[i] = m_scratch[mark + i * 2];
+    types[params_count + i] = m_scratch[mark + i * 2 + 1];
+  }
+  m_ast[type].fun_type.params = m_ast.add_params(types, types + params_count, params_count);
+  m_scratch.resize(mark);
+
+  if (ok && accept(Token::Kind::Colon)) {
+    m_ast[type].fun_type.return_type = parse_type();
+  }
+  // After broken parameters the body is still parsed when it is found.
+  if (ok || kind() == Token::Kind::LeftBrace) {
+    record.body = parse_block();
+  }
+  m_ast[function].function.overflow = m_ast.add_overflow(record);
+  m_scope = outer;
+  return function;
+}
+
+// struct, union or class: fields are `name: type`, separated by nothing, a
+// comma or a semicolon. Classes also have methods, declared with fun or as
+// a name directly followed by the parameters (a constructor).
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_struct() {
+  const auto node_kind = kind() == Token::Kind::Struct ? AstNode::Kind::Struct
+    : kind() == Token::Kind::Union ? AstNode::Kind::Union : AstNode::Kind::Class;
+  advance();
+  if (kind() != Token::Kind::Id) {
+    error("expected a type name");
+    return UndefinedAstNodeIndex;
+  }
+  const auto name = m_lexer.last().id;
+  advance();
+
+  const auto node = create_scope(node_kind);
+  // struc, unio and clas share the layout.
+  m_ast[node].struc.name = name;
+  declare(node, name);
+  const auto outer = m_scope;
+  m_scope = node;
+  if (expect(Token::Kind::LeftBrace, "expected { after the type name")) {
+    uint32_t fields_count = 0;
+    while (kind() != Token::Kind::RightBrace && kind() != Token::Kind::Eof) {
+      const auto consumed = m_consumed;
+      const auto errors = m_errors.size();
+      if (node_kind == AstNode::Kind::Class && kind() == Token::Kind::Fun) {
+        parse_function();
+      } else if (kind() == Token::Kind::Id) {
+        const auto member_name = m_lexer.last().id;
+        advance();
+        if (node_kind == AstNode::Kind::Class && kind() == Token::Kind::LeftParen) {
+          parse_function_rest(member_name);
+        } else if (expect(Token::Kind::Colon, "expected : after the field name")) {
+          const auto type = parse_type();
+          const auto field = m_ast.create(node_kind == AstNode::Kind::Union
+            ? AstNode::Kind::UnionField : AstNode::Kind::StructField);
+          m_ast[field].struct_field.value.type = type;
+          m_ast[field].struct_field.name = member_name;
+          m_ast[field].struct_field.offset = fields_count++;
+          declare(field, member_name);
+          if (!accept(Token::Kind::Semicolon)) accept(Token::Kind::Comma);
+        }
+      } else {
+        error("expected a field");
+      }
+      if (m_errors.size() != errors) synchronize();
+      if (m_consumed == consumed) advance();
+    }
+    expect(Token::Kind::RightBrace, "expected } at the end of the type");
+  }
+  m_scope = outer;
+  return node;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::get_type(Token::Kind token_kind) {
+  return m_ast.get_primitive_type(primitive_types[(int)token_kind - (int)Token::Kind::I32]);
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_type() {
+  const auto token_kind = kind();
+  if (is_primitive_type(token_kind)) {
+    advance();
+    return get_type(token_kind);
+  }
+  if (token_kind == Token::Kind::Id) {
+    const auto name = m_lexer.last().id;
+    advance();
+    const auto type = m_ast.create(AstNode::Kind::NamedType);
+    m_ast[type].named_type.name = name;
+    m_ast[type].named_type.decl = resolve(type, name);
+    return type;
+  }
+  error("expected a type");
+  return UndefinedAstNodeIndex;
+}
+
+// var|val name [: type] [= expr], a GlobalVariable in the global scope and
+// a LocalVariable everywhere else.
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_var_decl() {
+  const bool is_val = kind() == Token::Kind::Val;
+  advance();
+  if (kind() != Token::Kind::Id) {
+    error("expected a variable name");
+    return UndefinedAstNodeIndex;
+  }
+  const auto name = m_lexer.last().id;
+  advance();
+
+  const bool global = m_ast[m_scope].kind == AstNode::Kind::GlobalScope;
+  const auto variable = m_ast.create(global ? AstNode::Kind::GlobalVariable : AstNode::Kind::LocalVariable);
+  // global_variable and local_variable share the layout.
+  m_ast[variable].local_variable.value.type = UndefinedAstNodeIndex;
+  m_ast[variable].local_variable.name = name;
+  m_ast[variable].local_variable.is_val = is_val;
+  if (accept(Token::Kind::Colon)) {
+    const auto type = parse_type();
+    m_ast[variable].local_variable.value.type = type;
+  }
+  auto init_expr = UndefinedAstNodeIndex;
+  if (accept(Token::Kind::Assign)) {
+    init_expr = parse_expr();
+  }
+  // Declared after the initializer, which still sees an outer variable of
+  // the same name.
+  declare(variable, name);
+  accept(Token::Kind::Semicolon);
+
+  const auto stmt = m_ast.create(AstNode::Kind::VariableDeclStmt);
+  m_ast[stmt].variable_decl_stmt.variable = variable;
+  m_ast[stmt].variable_decl_stmt.init_expr = init_expr;
+  return stmt;
+}
 
-  while (m_lexer.last().get_kind() != Token::Kind::RightBrace 
-    && m_lexer.last().get_kind() != Token::Kind::Eof) {
-    m_lexer.next();
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_stmt() {
+  switch (kind()) {
+    case Token::Kind::LeftBrace:
+      return parse_block();
+    case Token::Kind::Var:
+    case Token::Kind::Val:
+      return parse_var_decl();
+    case Token::Kind::If:
+      return parse_if();
+    case Token::Kind::While:
+      return parse_while();
+    case Token::Kind::For:
+      return parse_for();
+    case Token::Kind::Return:
+      return parse_return();
+    case Token::Kind::Semicolon:
+      advance();
+      return UndefinedAstNodeIndex;
+    case Token::Kind::Fun:
+    case Token::Kind::Struct:
+    case Token::Kind::Union:
+    case Token::Kind::Class:
+      error("declarations are allowed at the top level only");
+      return UndefinedAstNodeIndex;
+    default:
+      break;
   }
+  const auto expr = parse_expr();
+  if (expr == UndefinedAstNodeIndex)
+    return UndefinedAstNodeIndex;
+  accept(Token::Kind::Semicolon);
+  const auto stmt = m_ast.create(AstNode::Kind::ExprStmt);
+  m_ast[stmt].expr_stmt.expr = expr;
+  return stmt;
 }
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_block() {
+  if (!expect(Token::Kind::LeftBrace, "expected {"))
+    return UndefinedAstNodeIndex;
+
+  const auto scope = create_scope(AstNode::Kind::BlockScope);
+  const auto block = m_ast.create(AstNode::Kind::BlockStmt);
+  m_ast[block].block_stmt.block_scope = scope;
+  m_ast[scope].block_scope.block_stmt = block;
+
+  const auto outer = m_scope;
+  m_scope = scope;
+  const auto mark = m_scratch.size();
+  while (kind() != Token::Kind::RightBrace && kind() != Token::Kind::Eof) {
+    const auto consumed = m_consumed;
+    const auto errors = m_errors.size();
+    const auto stmt = parse_stmt();
+    if (stmt != UndefinedAstNodeIndex) {
+      m_scratch.emplace_back(stmt.get());
+    }
+    if (m_errors.size() != errors) synchronize();
+    if (m_consumed == consumed) advance();
+  }
+  m_ast[block].block_stmt.stmts = take_scratch(mark);
+  expect(Token::Kind::RightBrace, "expected } at the end of the block");
+  m_scope = outer;
+  return block;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_if() {
+  advance();
+  if (!expect(Token::Kind::LeftParen, "expected ( after if"))
+    return UndefinedAstNodeIndex;
+  const auto expr = parse_expr();
+  if (!expect(Token::Kind::RightParen, "expected ) after the condition"))
+    return UndefinedAstNodeIndex;
+  const auto stmt = parse_stmt();
+  const auto else_stmt = accept(Token::Kind::Else) ? parse_stmt() : UndefinedAstNodeIndex;
+
+  const auto node = m_ast.create(AstNode::Kind::IfElseStmt);
+  m_ast[node].if_else_stmt.expr = expr;
+  m_ast[node].if_else_stmt.stmt = stmt;
+  m_ast[node].if_else_stmt.else_stmt = else_stmt;
+  return node;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_while() {
+  advance();
+  if (!expect(Token::Kind::LeftParen, "expected ( after while"))
+    return UndefinedAstNodeIndex;
+  const auto expr = parse_expr();
+  if (!expect(Token::Kind::RightParen, "expected ) after the condition"))
+    return UndefinedAstNodeIndex;
+  const auto stmt = parse_stmt();
+
+  const auto node = m_ast.create(AstNode::Kind::WhileStmt);
+  m_ast[node].while_stmt.expr = expr;
+  m_ast[node].while_stmt.stmt = stmt;
+  return node;
+}
+
+// for (name in from..to) stmt, name is an i32 val visible in stmt only.
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_for() {
+  advance();
+  if (!expect(Token::Kind::LeftParen, "expected ( after for"))
+    return UndefinedAstNodeIndex;
+  if (kind() != Token::Kind::Id) {
+    error("expected the loop variable");
+    return UndefinedAstNodeIndex;
+  }
+  const auto name = m_lexer.last().id;
+  advance();
+  if (!expect(Token::Kind::In, "expected in after the loop variable"))
+    return UndefinedAstNodeIndex;
+  const auto from = parse_expr();
+  if (!expect(Token::Kind::DotDot, "expected .. in the range"))
+    return UndefinedAstNodeIndex;
+  const auto to = parse_expr();
+  if (!expect(Token::Kind::RightParen, "expected ) after the range"))
+    return UndefinedAstNodeIndex;
+
+  const auto scope = create_scope(AstNode::Kind::BlockScope);
+  m_ast[scope].block_scope.block_stmt = UndefinedAstNodeIndex;
+  const auto variable = m_ast.create(AstNode::Kind::LocalVariable);
+  m_ast[variable].local_variable.value.type = get_type(Token::Kind::I32);
+  m_ast[variable].local_variable.name = name;
+  m_ast[variable].local_variable.is_val = true;
+
+  const auto outer = m_scope;
+  m_scope = scope;
+  declare(variable, name);
+  const auto stmt = parse_stmt();
+  m_scope = outer;
+
+  const auto node = m_ast.create(AstNode::Kind::ForStmt);
+  m_ast[node].for_stmt.block_scope = scope;
+  m_ast[node].for_stmt.stmt = stmt;
+  m_ast[node].for_stmt.overflow = m_ast.add_overflow(AstNode::ForStmtOverflow{variable, from, to});
+  return node;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_return() {
+  advance();
+  const auto expr = starts_expr(kind()) ? parse_expr() : UndefinedAstNodeIndex;
+  accept(Token::Kind::Semicolon);
+  const auto node = m_ast.create(AstNode::Kind::ReturnStmt);
+  m_ast[node].return_stmt.expr = expr;
+  return node;
+}
+
+// Precedence climbing: binary operators binding at least as tight as
+// min_precedence are folded into the left operand.
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_expr(int min_precedence) {
+  auto left = parse_unary();
+  while (left != UndefinedAstNodeIndex) {
+    const auto op = binary_operator(kind());
+    if (op.precedence == 0 || op.precedence < min_precedence)
+      break;
+    advance();
+    const auto right = parse_expr(op.right_associative ? op.precedence : op.precedence + 1);
+    if (right == UndefinedAstNodeIndex)
+      return UndefinedAstNodeIndex;
+    const auto node = m_ast.create(op.kind);
+    m_ast[node].binary_expr.left = left;
+    m_ast[node].binary_expr.right = right;
+    left = node;
+  }
+  return left;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_unary() {
+  if (kind() != Token::Kind::Sub)
+    return parse_postfix(parse_primary());
+  advance();
+  const auto expr = parse_unary();
+  if (expr == UndefinedAstNodeIndex)
+    return UndefinedAstNodeIndex;
+  const auto node = m_ast.create(AstNode::Kind::NegExpr);
+  m_ast[node].neg_expr.expr = expr;
+  return node;
+}
+
+// Calls and member accesses following expr.
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_postfix(AstNodeIndex expr) {
+  while (expr != UndefinedAstNodeIndex) {
+    if (accept(Token::Kind::LeftParen)) {
+      const auto node = m_ast.create(AstNode::Kind::CallExpr);
+      m_ast[node].call_expr.callee = expr;
+      const auto mark = m_scratch.size();
+      if (kind() != Token::Kind::RightParen) {
+        do {
+          const auto arg = parse_expr();
+          if (arg == UndefinedAstNodeIndex) {
+            m_scratch.resize(mark);
+            return UndefinedAstNodeIndex;
+          }
+          m_scratch.emplace_back(arg.get());
+        } while (accept(Token::Kind::Comma));
+      }
+      m_ast[node].call_expr.args = take_scratch(mark);
+      if (!expect(Token::Kind::RightParen, "expected ) after the arguments"))
+        return UndefinedAstNodeIndex;
+      expr = node;
+    } else if (accept(Token::Kind::Dot)) {
+      if (kind() != Token::Kind::Id) {
+        error("expected a member name");
+        return UndefinedAstNodeIndex;
+      }
+      const auto node = m_ast.create(AstNode::Kind::MemberExpr);
+      m_ast[node].member_expr.object = expr;
+      m_ast[node].member_expr.name = m_lexer.last().id;
+      advance();
+      expr = node;
+    } else {
+      break;
+    }
+  }
+  return expr;
+}
+
+template <typename LexerType, typename IdCacheType>
+AstNodeIndex BasicParser<LexerType, IdCacheType>::parse_primary() {
+  switch (kind()) {
+    case Token::Kind::Id: {
+      const auto name = m_lexer.last().id;
+      advance();
+      const auto node = m_ast.create(AstNode::Kind::NameExpr);
+      m_ast[node].name_expr.name = name;
+      m_ast[node].name_expr.decl = resolve(node, name);
+      return node;
+    }
+    case Token::Kind::I32Literal: {
+      const auto value = m_lexer.last().i32;
+      advance();
+      const auto node = m_ast.create(AstNode::Kind::I32Literal);
+      m_ast[node].i32_literal.value.type = get_type(Token::Kind::I32);
+      m_ast[node].i32_literal.literal_value = value;
+      return node;
+    }
+    case Token::Kind::StringLiteral: {
+      const auto string = m_lexer.last().str;
+      advance();
+      const auto node = m_ast.create(AstNode::Kind::StringLiteral);
+      m_ast[node].string_literal.value.type = UndefinedAstNodeIndex;
+      m_ast[node].string_literal.string = string;
+      return node;
+    }
+    case Token::Kind::LeftParen: {
+      advance();
+      const auto expr = parse_expr();
+      if (expr == UndefinedAstNodeIndex)
+        return UndefinedAstNodeIndex;
+      if (!expect(Token::Kind::RightParen, "expected )"))
+        return UndefinedAstNodeIndex;
+      const auto node = m_ast.create(AstNode::Kind::ParenthExpr);
+      m_ast[node].parenth_expr.expr = expr;
+      return node;
+    }
+    default:
+      error("expected an expression");
+      return UndefinedAstNodeIndex;
+  }
+}
+
+template class BasicParser<Lexer>;
+template class BasicParser<ConcurrentLexer>;
+template class BasicParser<StreamingLexer>;
+template class BasicParser<TokenStore::Reader, IdCache>;
+template class BasicParser<TokenStore::Reader, ConcurrentIdCache>;
@@ -1,24 +1,122 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
-#include "id_cache.hpp"
+#include <cstdint>
+#include <vector>
 
-class Lexer;
-class Ast;
-class IdCache;
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "token_store.hpp"
 
-class Parser {
+struct ParseError {
+  // Byte offset of the token the error was found at.
+  uint32_t offset;
+  const char* message;
+};
+
+// A function declared in the global scope: from its fun token up to the
+// next token behind it.
+struct FunctionSpan {
+  AstNodeIndex function;
+  uint32_t begin;
+  uint32_t end;
+};
+
+// LexerType is any BasicLexer instantiation or a TokenStore::Reader, the
+// parser interns names in the lexer's IdCache type by default.
+//
+// Recursive descent for declarations and statements, precedence climbing
+// for expressions, in a single pass over the tokens without backtracking.
+// Names are resolved while parsing through the outer_scope chain; names
+// used before their declaration (calls of functions declared later, ...)
+// are resolved once the whole input is parsed.
+template <typename LexerType, typename IdCacheType = typename LexerType::IdCache>
+class BasicParser {
 public:
-  Parser(Lexer& lexer, Ast& ast, IdCache& id_cache) : 
+  using Lexer = LexerType;
+  using IdCache = IdCacheType;
+
+  BasicParser(Lexer& lexer, Ast& ast, IdCache& id_cache) :
     m_lexer(lexer), m_ast(ast), m_id_cache(id_cache) {}
 
-  void parse();
+  // Parses the whole input and returns its GlobalScope node. Errors don't
+  // stop the parser, it skips to the next statement and goes on.
+  AstNodeIndex parse();
+
+  // Parses the declaration of function again, the lexer must be at its fun
+  // token. function is a Function node of this Ast, whose old subtree goes
+  // to the free list or, when it was parsed again before, is released with
+  // its region. The new one is created in a region of its own and hangs
+  // under the same node, so the node index, its declaration and every other
+  // node stay as they are. False before anything changed when the
+  // declaration is not a function of the same name.
+  bool reparse_function(AstNodeIndex function);
+
+  const std::vector<ParseError>& get_errors() const { return m_errors; }
+  // Spans of the functions of the global scope, in source order.
+  const std::vector<FunctionSpan>& get_function_spans() const { return m_function_spans; }
+
 private:
   Lexer& m_lexer;
   Ast& m_ast;
   IdCache& m_id_cache;
+  std::vector<ParseError> m_errors;
+  std::vector<FunctionSpan> m_function_spans;
+  // The innermost scope, declarations go there.
+  AstNodeIndex m_scope;
+  struct Unresolved {
+    AstNodeIndex node;
+    AstNodeIndex scope;
+  };
+  // NameExpr and NamedType nodes whose name was not declared yet.
+  std::vector<Unresolved> m_unresolved;
+  // Tokens consumed so far, to make sure error recovery moves on.
+  uint64_t m_consumed = 0;
+  // Stack of the lists being built (statements of the open blocks, call
+  // arguments, ...), each list is moved to the Ast's extra data when done.
+  std::vector<uint32_t> m_scratch;
+
+  Token::Kind kind() { return m_lexer.last().get_kind(); }
+  void advance() { m_lexer.next(); ++m_consumed; }
+  bool accept(Token::Kind kind);
+  bool expect(Token::Kind kind, const char* message);
+  void error(const char* message);
+  void synchronize();
+  // Moves the scratch values from mark on into the extra data.
+  ExtraRange take_scratch(std::size_t mark);
 
+  AstNodeIndex create_scope(AstNode::Kind kind);
+  void declare(AstNodeIndex node, IdIndex name);
+  AstNodeIndex lookup(IdIndex name, AstNodeIndex scope, bool declared_before) const;
+  AstNodeIndex resolve(AstNodeIndex node, IdIndex name);
+  void resolve_unresolved();
 
+  AstNodeIndex parse_decl();
+  AstNodeIndex parse_function();
+  AstNodeIndex parse_function_rest(IdIndex name, AstNodeIndex function = UndefinedAstNodeIndex);
+  AstNodeIndex parse_struct();
+  // The shared node of a primitive type token, kept by the Ast.
+  AstNodeIndex get_type(Token::Kind token_kind);
+  AstNodeIndex parse_type();
+  AstNodeIndex parse_var_decl();
+
+  AstNodeIndex parse_stmt();
+  AstNodeIndex parse_block();
+  AstNodeIndex parse_if();
+  AstNodeIndex parse_while();
+  AstNodeIndex parse_for();
+  AstNodeIndex parse_return();
+
+  AstNodeIndex parse_expr(int min_precedence = 0);
+  AstNodeIndex parse_unary();
+  AstNodeIndex parse_postfix(AstNodeIndex expr);
+  AstNodeIndex parse_primary();
 };
 
+using Parser = BasicParser<Lexer>;
+using ConcurrentParser = BasicParser<ConcurrentLexer>;
+using StreamingParser = BasicParser<StreamingLexer>;
+using TokenStoreParser = BasicParser<TokenStore::Reader, IdCache>;
+using ConcurrentTokenStoreParser = BasicParser<TokenStore::Reader, ConcurrentIdCache>;
+
 #endif  // PARSER_HPP
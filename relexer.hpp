@@ -0,0 +1,86 @@
+#ifndef RELEXER_HPP
+#define RELEXER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "lexer.hpp"
+#include "token_store.hpp"
+#include "token_window.hpp"
+
+// A change of the source text: removed bytes at offset were replaced with
+// inserted.
+struct TextEdit {
+  uint32_t offset;
+  uint32_t removed;
+  std::string_view inserted;
+
+  int64_t get_delta() const { return (int64_t)inserted.size() - removed; }
+
+  void apply(std::string& source) const {
+    source.replace(offset, removed, inserted.data(), inserted.size());
+  }
+};
+
+struct RelexResult {
+  // The new tokens in the store. Empty (count() == 0) when the edit only
+  // removed tokens or touched white space.
+  TokenRange range;
+  // Number of tokens of the old stream the range replaced.
+  uint32_t removed_count;
+};
+
+// Updates a TokenStore lexed from the source before the edit so that it
+// matches new_source, the source after the edit. Lexing restarts at the
+// token in front of the edit and stops at the first token behind the edit
+// that starts where a token of the old stream started, as from there on the
+// input and so the tokens are the same. The lexer keeps no state between
+// tokens, which makes that token a safe resynchronisation point.
+template <typename IdCacheType>
+RelexResult relex(TokenStore& store, std::string_view new_source, const TextEdit& edit, IdCacheType& id_cache) {
+  const auto delta = edit.get_delta();
+  const uint32_t inserted_end = edit.offset + (uint32_t)edit.inserted.size();
+  const uint32_t removed_end = edit.offset + edit.removed;
+
+  // The token in front of the edit can grow into it, e.g. an identifier
+  // extended by the inserted text.
+  auto first = store.lower_bound(edit.offset).get();
+  if (first > 0) --first;
+  const uint32_t start_offset = first < store.size() ? store.offset(TokenIndex(first)) : 0;
+
+  // Old tokens behind the removed text are the candidates for resynchronisation.
+  auto old_index = store.lower_bound(removed_end).get();
+
+  TokenWindow window(2);
+  BasicLexer<IdCacheType, TokenWindow> lexer(new_source, start_offset, window, id_cache);
+  TokenStore tokens;
+
+  while (true) {
+    const auto& token = lexer.next();
+    const auto offset = lexer.last_offset();
+
+    if (offset >= inserted_end) {
+      while (old_index < store.size() && store.offset(TokenIndex(old_index)) + delta < offset) {
+        ++old_index;
+      }
+      if (old_index < store.size() && store.offset(TokenIndex(old_index)) + delta == offset) {
+        break;
+      }
+    }
+    tokens.push_back(token, offset);
+    // Without an old Eof to meet (an empty store) the new Eof ends the stream.
+    if (token.get_kind() == Token::Kind::Eof) {
+      old_index = (uint32_t)store.size();
+      break;
+    }
+  }
+
+  const auto removed_count = old_index - first;
+  store.splice(TokenIndex(first), removed_count, tokens, delta);
+  return RelexResult{
+    TokenRange{TokenIndex(first), TokenIndex(first + (uint32_t)tokens.size() - 1)},
+    removed_count};
+}
+
+#endif  // RELEXER_HPP
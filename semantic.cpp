@@ -0,0 +1,408 @@
+#include "semantic.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+bool is_number(const Ast& ast, AstNodeIndex type) {
+  if (type == UndefinedAstNodeIndex)
+    return false;
+  const auto kind = ast[type].kind;
+  return kind >= AstNode::Kind::I8Type && kind <= AstNode::Kind::F64Type;
+}
+
+bool is_struct(const Ast& ast, AstNodeIndex type) {
+  if (type == UndefinedAstNodeIndex)
+    return false;
+  const auto kind = ast[type].kind;
+  return kind == AstNode::Kind::Struct || kind == AstNode::Kind::Union || kind == AstNode::Kind::Class;
+}
+
+// A NamedType stands for its declaration.
+AstNodeIndex canonical(const Ast& ast, AstNodeIndex type) {
+  if (type != UndefinedAstNodeIndex && ast[type].kind == AstNode::Kind::NamedType)
+    return ast[type].named_type.decl;
+  return type;
+}
+
+// The error of a declared type that names no struct, union or class.
+const char* type_error(const Ast& ast, AstNodeIndex type) {
+  if (type == UndefinedAstNodeIndex || ast[type].kind != AstNode::Kind::NamedType)
+    return nullptr;
+  const auto decl = ast[type].named_type.decl;
+  if (decl == UndefinedAstNodeIndex)
+    return "unknown type";
+  return is_struct(ast, decl) ? nullptr : "not a type";
+}
+
+bool is_comparison(AstNode::Kind kind) {
+  return (kind >= AstNode::Kind::EqualExpr && kind <= AstNode::Kind::LessOrEqualExpr)
+    || kind == AstNode::Kind::NotEqualExpr;
+}
+
+bool is_assignment(AstNode::Kind kind) {
+  return kind == AstNode::Kind::AssignExpr
+    || (kind >= AstNode::Kind::AddAssignExpr && kind <= AstNode::Kind::DivAssignExpr);
+}
+
+// Checks the statements of one function, or the global variables, into
+// facts. Only reads the Ast and the facts of the globals.
+class BodyChecker {
+public:
+  BodyChecker(const Ast& ast, AstNodeIndex i32, IdIndex print, const FunctionFacts* globals,
+      FunctionFacts& facts, AstNodeIndex return_type) :
+    m_ast(ast), m_i32(i32), m_print(print), m_globals(globals), m_facts(facts), m_return_type(return_type) {}
+
+  void check_stmt(AstNodeIndex stmt) {
+    if (stmt == UndefinedAstNodeIndex)
+      return;
+    const auto& node = m_ast[stmt];
+    switch (node.kind) {
+      case AstNode::Kind::BlockStmt:
+        for (const auto child : m_ast.get_nodes(node.block_stmt.stmts)) check_stmt(child);
+        break;
+      case AstNode::Kind::VariableDeclStmt:
+        check_variable(node.variable_decl_stmt.variable, node.variable_decl_stmt.init_expr);
+        break;
+      case AstNode::Kind::ExprStmt:
+        check_expr(node.expr_stmt.expr);
+        break;
+      case AstNode::Kind::ReturnStmt:
+        check_return(stmt, node.return_stmt.expr);
+        break;
+      case AstNode::Kind::IfElseStmt:
+        check_condition(node.if_else_stmt.expr);
+        check_stmt(node.if_else_stmt.stmt);
+        check_stmt(node.if_else_stmt.else_stmt);
+        break;
+      case AstNode::Kind::WhileStmt:
+        check_condition(node.while_stmt.expr);
+        check_stmt(node.while_stmt.stmt);
+        break;
+      case AstNode::Kind::ForStmt: {
+        const auto range = m_ast.get_overflow<AstNode::ForStmtOverflow>(node.for_stmt.overflow);
+        for (const auto bound : {range.from, range.to}) {
+          const auto type = check_expr(bound);
+          if (type != UndefinedAstNodeIndex && type != m_i32) error(bound, "range bound is not i32");
+        }
+        check_stmt(node.for_stmt.stmt);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  void check_variable(AstNodeIndex variable, AstNodeIndex init_expr) {
+    if (variable == UndefinedAstNodeIndex)
+      return;
+    const auto declared = m_ast[variable].value.type;
+    if (const auto message = type_error(m_ast, declared)) error(declared, message);
+    const auto type = init_expr != UndefinedAstNodeIndex ? check_expr(init_expr) : UndefinedAstNodeIndex;
+    if (declared == UndefinedAstNodeIndex) {
+      if (init_expr == UndefinedAstNodeIndex) {
+        error(variable, "variable needs a type or an initializer");
+      }
+      m_inferred[variable.get()] = type;
+      record(variable, type);
+    } else if (type != UndefinedAstNodeIndex && canonical(m_ast, declared) != type) {
+      error(init_expr, "initializer type differs from the variable");
+    }
+  }
+
+  // The type of expr, recorded in the facts.
+  AstNodeIndex check_expr(AstNodeIndex expr) {
+    if (expr == UndefinedAstNodeIndex)
+      return UndefinedAstNodeIndex;
+    const auto type = expr_type(expr);
+    record(expr, type);
+    return type;
+  }
+
+private:
+  const Ast& m_ast;
+  AstNodeIndex m_i32;
+  IdIndex m_print;
+  const FunctionFacts* m_globals;
+  FunctionFacts& m_facts;
+  AstNodeIndex m_return_type;
+  // Types of the variables declared without one.
+  std::unordered_map<uint32_t, AstNodeIndex> m_inferred;
+
+  void error(AstNodeIndex node, const char* message) {
+    m_facts.errors.emplace_back(SemanticError{node, message});
+  }
+
+  void record(AstNodeIndex node, AstNodeIndex type) {
+    m_facts.types.emplace_back(NodeType{node, type});
+  }
+
+  void check_return(AstNodeIndex stmt, AstNodeIndex expr) {
+    const auto type = check_expr(expr);
+    if (expr == UndefinedAstNodeIndex) {
+      if (m_return_type != UndefinedAstNodeIndex) error(stmt, "return without a value");
+    } else if (m_return_type == UndefinedAstNodeIndex) {
+      error(expr, "return with a value in a function without a return type");
+    } else if (type != UndefinedAstNodeIndex && type != canonical(m_ast, m_return_type)) {
+      error(expr, "return type differs from the function");
+    }
+  }
+
+  void check_condition(AstNodeIndex expr) {
+    const auto type = check_expr(expr);
+    if (type != UndefinedAstNodeIndex && !is_number(m_ast, type)) error(expr, "condition is not a number");
+  }
+
+  AstNodeIndex variable_type(AstNodeIndex variable) const {
+    const auto declared = m_ast[variable].value.type;
+    if (declared != UndefinedAstNodeIndex)
+      return canonical(m_ast, declared);
+    const auto inferred = m_inferred.find(variable.get());
+    if (inferred != m_inferred.end())
+      return inferred->second;
+    return m_globals ? m_globals->get_type(variable) : UndefinedAstNodeIndex;
+  }
+
+  AstNodeIndex expr_type(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    switch (node.kind) {
+      case AstNode::Kind::StringLiteral:
+      case AstNode::Kind::CharLiteral:
+      case AstNode::Kind::I8Literal:
+      case AstNode::Kind::I16Literal:
+      case AstNode::Kind::I32Literal:
+      case AstNode::Kind::U8Literal:
+      case AstNode::Kind::U16Literal:
+      case AstNode::Kind::U32Literal:
+      case AstNode::Kind::F32Literal:
+      case AstNode::Kind::F64Literal:
+        return canonical(m_ast, node.value.type);
+      case AstNode::Kind::NameExpr:
+        return name_type(expr);
+      case AstNode::Kind::ParenthExpr:
+        return check_expr(node.parenth_expr.expr);
+      case AstNode::Kind::NegExpr: {
+        const auto type = check_expr(node.neg_expr.expr);
+        if (type != UndefinedAstNodeIndex && !is_number(m_ast, type)) error(expr, "operand is not a number");
+        return type;
+      }
+      case AstNode::Kind::CallExpr:
+        return call_type(expr);
+      case AstNode::Kind::MemberExpr:
+        return member_type(expr);
+      default:
+        if (AstNode::is_binary_expr(node.kind))
+          return binary_type(expr);
+        return UndefinedAstNodeIndex;
+    }
+  }
+
+  AstNodeIndex name_type(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    const auto decl = node.name_expr.decl;
+    if (decl == UndefinedAstNodeIndex) {
+      if (node.name_expr.name != m_print) error(expr, "undeclared name");
+      return UndefinedAstNodeIndex;
+    }
+    const auto& decl_node = m_ast[decl];
+    switch (decl_node.kind) {
+      case AstNode::Kind::LocalVariable:
+      case AstNode::Kind::GlobalVariable:
+        return variable_type(decl);
+      case AstNode::Kind::StructField:
+      case AstNode::Kind::UnionField:
+        return canonical(m_ast, decl_node.struct_field.value.type);
+      case AstNode::Kind::Function:
+        return m_ast.get_overflow<AstNode::FunctionOverflow>(decl_node.function.overflow).function_type_with_named_params;
+      default:
+        error(expr, "type used as a value");
+        return UndefinedAstNodeIndex;
+    }
+  }
+
+  AstNodeIndex binary_type(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    const auto kind = node.kind;
+    const auto left = check_expr(node.binary_expr.left);
+    const auto right = check_expr(node.binary_expr.right);
+    if (is_assignment(kind)) {
+      check_assignable(node.binary_expr.left);
+    }
+    const bool any_type = kind == AstNode::Kind::AssignExpr
+      || kind == AstNode::Kind::EqualExpr || kind == AstNode::Kind::NotEqualExpr;
+    if (!any_type) {
+      for (const auto type : {left, right}) {
+        if (type != UndefinedAstNodeIndex && !is_number(m_ast, type)) {
+          error(expr, "operand is not a number");
+          return UndefinedAstNodeIndex;
+        }
+      }
+    }
+    if (left != UndefinedAstNodeIndex && right != UndefinedAstNodeIndex && left != right) {
+      error(expr, "operand types differ");
+    }
+    if (is_comparison(kind))
+      return m_i32;
+    return left != UndefinedAstNodeIndex ? left : right;
+  }
+
+  void check_assignable(AstNodeIndex target) {
+    const auto& node = m_ast[target];
+    if (node.kind == AstNode::Kind::MemberExpr)
+      return;
+    if (node.kind == AstNode::Kind::NameExpr && node.name_expr.decl != UndefinedAstNodeIndex) {
+      const auto& decl = m_ast[node.name_expr.decl];
+      if (decl.kind == AstNode::Kind::LocalVariable || decl.kind == AstNode::Kind::GlobalVariable) {
+        if (decl.local_variable.is_val) error(target, "assignment to a val");
+        return;
+      }
+      if (decl.kind == AstNode::Kind::StructField || decl.kind == AstNode::Kind::UnionField)
+        return;
+    }
+    if (node.kind != AstNode::Kind::NameExpr || node.name_expr.decl != UndefinedAstNodeIndex) {
+      error(target, "assignment to a non variable");
+    }
+  }
+
+  AstNodeIndex call_type(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    const auto callee = node.call_expr.callee;
+    const auto args = m_ast.get_nodes(node.call_expr.args);
+    // A struct called by name is constructed, print takes anything.
+    const auto& callee_node = m_ast[callee];
+    if (callee_node.kind == AstNode::Kind::NameExpr
+        && (is_struct(m_ast, callee_node.name_expr.decl)
+          || (callee_node.name_expr.decl == UndefinedAstNodeIndex && callee_node.name_expr.name == m_print))) {
+      record(callee, UndefinedAstNodeIndex);
+      for (const auto arg : args) check_expr(arg);
+      return callee_node.name_expr.decl;
+    }
+
+    const auto type = check_expr(callee);
+    std::vector<AstNodeIndex> arg_types;
+    arg_types.reserve(args.size());
+    for (const auto arg : args) arg_types.emplace_back(check_expr(arg));
+    if (type == UndefinedAstNodeIndex)
+      return UndefinedAstNodeIndex;
+    const auto& type_node = m_ast[type];
+    if (type_node.kind != AstNode::Kind::FunType && type_node.kind != AstNode::Kind::FunTypeWithNamedParams) {
+      error(expr, "call of a non function");
+      return UndefinedAstNodeIndex;
+    }
+    const auto params = m_ast.get_param_types(type_node.fun_type);
+    if (params.size() != args.size()) {
+      error(expr, "wrong number of arguments");
+    } else {
+      for (uint32_t i = 0; i < args.size(); ++i) {
+        const auto param = canonical(m_ast, params[i]);
+        if (arg_types[i] != UndefinedAstNodeIndex && param != UndefinedAstNodeIndex && arg_types[i] != param) {
+          error(args[i], "argument type differs from the parameter");
+        }
+      }
+    }
+    return canonical(m_ast, type_node.fun_type.return_type);
+  }
+
+  AstNodeIndex member_type(AstNodeIndex expr) {
+    const auto& node = m_ast[expr];
+    const auto object = check_expr(node.member_expr.object);
+    if (object == UndefinedAstNodeIndex)
+      return UndefinedAstNodeIndex;
+    if (!is_struct(m_ast, object)) {
+      error(expr, "member of a non struct");
+      return UndefinedAstNodeIndex;
+    }
+    const auto member = m_ast.find_in_scope(object, node.member_expr.name);
+    if (member == UndefinedAstNodeIndex) {
+      error(expr, "no member of that name");
+      return UndefinedAstNodeIndex;
+    }
+    const auto& member_node = m_ast[member];
+    if (member_node.kind == AstNode::Kind::Function)
+      return m_ast.get_overflow<AstNode::FunctionOverflow>(member_node.function.overflow).function_type_with_named_params;
+    return canonical(m_ast, member_node.struct_field.value.type);
+  }
+};
+
+void sort_types(FunctionFacts& facts) {
+  std::sort(facts.types.begin(), facts.types.end(),
+    [](const NodeType& a, const NodeType& b) { return a.node < b.node; });
+}
+
+}  // namespace
+
+AstNodeIndex FunctionFacts::get_type(AstNodeIndex node) const {
+  const auto found = std::lower_bound(types.begin(), types.end(), node,
+    [](const NodeType& type, AstNodeIndex node) { return type.node < node; });
+  return found != types.end() && found->node == node ? found->type : UndefinedAstNodeIndex;
+}
+
+void SemanticPass::run(AstNodeIndex global_scope, ThreadPool& pool) {
+  m_i32 = m_ast.get_primitive_type(AstNode::Kind::I32Type);
+  m_globals = FunctionFacts{global_scope, {}, {}};
+  m_functions.clear();
+
+  // Signatures and fields first, in declaration order.
+  for (const auto decl : m_ast.get_scope_nodes(global_scope)) {
+    const auto& node = m_ast[decl];
+    if (node.kind == AstNode::Kind::Function) {
+      check_signature(decl);
+      m_functions.emplace_back(FunctionFacts{decl, {}, {}});
+    } else if (is_struct(m_ast, decl)) {
+      for (const auto member : m_ast.get_scope_nodes(decl)) {
+        if (m_ast[member].kind == AstNode::Kind::Function) {
+          check_signature(member);
+          m_functions.emplace_back(FunctionFacts{member, {}, {}});
+        } else {
+          check_type(m_ast[member].struct_field.value.type);
+        }
+      }
+    }
+  }
+
+  // Then the global variables, an initializer sees the ones before it.
+  BodyChecker globals(m_ast, m_i32, m_print, nullptr, m_globals, UndefinedAstNodeIndex);
+  for (const auto stmt : m_ast.get_nodes(m_ast[m_ast[global_scope].global_scope.block_stmt].block_stmt.stmts)) {
+    const auto& node = m_ast[stmt];
+    if (node.kind == AstNode::Kind::VariableDeclStmt) {
+      globals.check_variable(node.variable_decl_stmt.variable, node.variable_decl_stmt.init_expr);
+    }
+  }
+  sort_types(m_globals);
+
+  const auto tasks = (m_functions.size() + FunctionsPerTask - 1) / FunctionsPerTask;
+  pool.parallel_for(tasks, [this](std::size_t task) {
+    const auto end = std::min(m_functions.size(), (task + 1) * FunctionsPerTask);
+    for (auto i = task * FunctionsPerTask; i < end; ++i) check_body(m_functions[i]);
+  });
+}
+
+std::vector<SemanticError> SemanticPass::get_errors() const {
+  auto errors = m_globals.errors;
+  for (const auto& function : m_functions) {
+    errors.insert(errors.end(), function.errors.begin(), function.errors.end());
+  }
+  return errors;
+}
+
+void SemanticPass::check_signature(AstNodeIndex function) {
+  const auto record = m_ast.get_overflow<AstNode::FunctionOverflow>(m_ast[function].function.overflow);
+  const auto& fun_type = m_ast[record.function_type_with_named_params].fun_type;
+  for (const auto param : m_ast.get_param_types(fun_type)) check_type(param);
+  check_type(fun_type.return_type);
+}
+
+void SemanticPass::check_type(AstNodeIndex type) {
+  if (const auto message = type_error(m_ast, type)) {
+    m_globals.errors.emplace_back(SemanticError{type, message});
+  }
+}
+
+void SemanticPass::check_body(FunctionFacts& facts) const {
+  const auto record = m_ast.get_overflow<AstNode::FunctionOverflow>(m_ast[facts.function].function.overflow);
+  const auto return_type = m_ast[record.function_type_with_named_params].fun_type.return_type;
+  BodyChecker checker(m_ast, m_i32, m_print, &m_globals, facts, return_type);
+  checker.check_stmt(record.body);
+  sort_types(facts);
+}
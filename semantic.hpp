@@ -0,0 +1,76 @@
+#ifndef SEMANTIC_HPP
+#define SEMANTIC_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "ast.hpp"
+#include "id_index.hpp"
+#include "thread_pool.hpp"
+
+// An error of the semantic pass, at the node it is about.
+struct SemanticError {
+  AstNodeIndex node;
+  const char* message;
+};
+
+// The type of an expression, or of a variable declared without one, which
+// gets the type of its initializer. Types are canonical: a primitive type
+// node, the Struct, Union or Class a NamedType names, or a FunType node.
+// Undefined when nothing is known, as after an error, for a string literal
+// or for a call of a function without a return type.
+struct NodeType {
+  AstNodeIndex node;
+  AstNodeIndex type;
+};
+
+// What the semantic pass found in one function body, or in the initializers
+// of the global variables.
+struct FunctionFacts {
+  AstNodeIndex function;
+  // Sorted by node.
+  std::vector<NodeType> types;
+  // In source order.
+  std::vector<SemanticError> errors;
+
+  AstNodeIndex get_type(AstNodeIndex node) const;
+};
+
+// Type checks a parsed program whose names the parser has resolved. The
+// declarations of the global scope are checked first, in order: the types
+// of the signatures and fields, and the global variables. Function bodies
+// only read those, so they are then checked in parallel, each into its own
+// FunctionFacts, and the results don't depend on the number of threads.
+//
+// The Ast isn't changed but for the i32 type node, created up front.
+// Comparisons are i32, print is the one builtin function.
+class SemanticPass {
+public:
+  template <typename IdCacheType>
+  SemanticPass(Ast& ast, IdCacheType& id_cache) : m_ast(ast), m_print(id_cache.get("print")) {}
+
+  void run(AstNodeIndex global_scope, ThreadPool& pool);
+
+  // Global functions and class methods, in declaration order.
+  const std::vector<FunctionFacts>& get_functions() const { return m_functions; }
+  // Errors in signatures and fields, and the global variables.
+  const FunctionFacts& get_globals() const { return m_globals; }
+  // The errors of the globals, then the ones of every function in order.
+  std::vector<SemanticError> get_errors() const;
+
+private:
+  // Functions checked per task, so small functions don't cost a task each.
+  static constexpr std::size_t FunctionsPerTask = 64;
+
+  Ast& m_ast;
+  IdIndex m_print;
+  AstNodeIndex m_i32;
+  FunctionFacts m_globals;
+  std::vector<FunctionFacts> m_functions;
+
+  void check_signature(AstNodeIndex function);
+  void check_type(AstNodeIndex type);
+  void check_body(FunctionFacts& facts) const;
+};
+
+#endif  // SEMANTIC_HPP
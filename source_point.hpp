@@ -1,13 +1,24 @@
 #ifndef SOURCE_POINT_HPP
 #define SOURCE_POINT_HPP
 
-#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "char_scanner.hpp"
 #include "id_index.hpp"
 #include "id_cache.hpp"
 
 using LineNumber = uint32_t;
 using ColumnNumber = uint32_t;
 
+// A byte offset in the offset space of a SourcePointFactory: every file
+// added takes the range behind the previous one, so an offset alone tells
+// the file. Token offsets of a file plus its first offset are SourceOffsets.
+using SourceOffset = uint32_t;
+
+// Line and column of a location, both from 1, for diagnostics only.
 class SourcePoint {
 public:
   IdIndex m_file;
@@ -15,34 +26,89 @@ public:
   ColumnNumber m_col;
 };
 
-using SourcePoints = std::deque<SourcePoint>;
+struct SourceFile {
+  IdIndex name;
+  SourceOffset begin;
+  uint32_t size;
+  std::string_view text;
+  // Offsets in the file where lines begin, scanned on the first lookup.
+  std::vector<uint32_t> line_starts;
+};
+
+using SourcePoints = std::vector<SourceOffset>;
 using SourcePointIndex = uint32_t;
 
+// Locations are 4 bytes, a SourceOffset. Nothing about lines is known until
+// a diagnostic asks for a SourcePoint: the file's newlines are then found
+// once with char_scanner and the line is a binary search away.
 class SourcePointFactory {
 public:
-  SourcePointFactory(IdCache& id_cache) : m_id_cache(id_cache) {
+  SourcePointFactory(IdCache& id_cache) : m_id_cache(id_cache) {}
+
+  // Adds a file behind the previous ones and returns its first offset. The
+  // text is not copied, it must outlive the lookups of its lines.
+  SourceOffset add_file(const char* filename, size_t filename_len, std::string_view text) {
+    return add_file(m_id_cache.get(filename, filename_len), text);
+  }
+
+  SourceOffset add_file(IdIndex file_index, std::string_view text) {
+    const auto begin = add_file(file_index, (uint32_t)text.size());
+    m_files.back().text = text;
+    return begin;
+  }
 
+  // A file whose text is given later through set_text.
+  SourceOffset add_file(IdIndex file_index, uint32_t size) {
+    const SourceOffset begin = m_files.empty() ? 0 : m_files.back().begin + m_files.back().size;
+    m_files.emplace_back(SourceFile{file_index, begin, size, {}, {}});
+    return begin;
   }
 
-  SourcePointIndex make(const char* filename, size_t filename_len, LineNumber line, ColumnNumber col) {
-    const auto file_index = m_id_cache.get(filename, filename_len);
-    return make(file_index, line, col);
+  void set_text(uint32_t file, std::string_view text) {
+    m_files[file].text = text;
+    m_files[file].line_starts.clear();
   }
 
-  SourcePointIndex make(IdIndex file_index, LineNumber line, ColumnNumber col) {
-    const auto result = m_source_points.size();
-    m_source_points.emplace_back();
-    auto& sp = m_source_points.back();
-    sp.m_file = file_index;
-    sp.m_line = line;
-    sp.m_col = col;
+  SourcePointIndex make(SourceOffset offset) {
+    const auto result = (SourcePointIndex)m_source_points.size();
+    m_source_points.emplace_back(offset);
     return result;
   }
 
+  SourcePoint get(SourcePointIndex index) { return locate(m_source_points[index]); }
+
+  // Line 0 and the column counted from the file start when the file has no
+  // text, an undefined file for an offset behind the last file.
+  SourcePoint locate(SourceOffset offset) {
+    const auto file = std::upper_bound(m_files.begin(), m_files.end(), offset,
+      [](SourceOffset offset, const SourceFile& file) { return offset < file.begin; });
+    if (file == m_files.begin() || offset >= file[-1].begin + file[-1].size)
+      return SourcePoint{IdIndex::undefined, 0, 0};
+    auto& source = file[-1];
+    const auto file_offset = offset - source.begin;
+    if (source.text.empty())
+      return SourcePoint{source.name, 0, file_offset + 1};
+    if (source.line_starts.empty()) scan_lines(source);
+    const auto line = std::upper_bound(source.line_starts.begin(), source.line_starts.end(), file_offset) - 1;
+    return SourcePoint{source.name, (LineNumber)(line - source.line_starts.begin() + 1), file_offset - *line + 1};
+  }
+
   const SourcePoints& getSourcePoints() const { return m_source_points;}
+  const std::vector<SourceFile>& get_files() const { return m_files; }
+
 private:
-  IdCache m_id_cache;
+  IdCache& m_id_cache;
   SourcePoints m_source_points;
+  std::vector<SourceFile> m_files;
+
+  static void scan_lines(SourceFile& file) {
+    const auto* begin = file.text.data();
+    const auto* end = begin + file.text.size();
+    file.line_starts.emplace_back(0);
+    for (auto* p = char_scanner::find_newline(begin, end); p != end; p = char_scanner::find_newline(p + 1, end)) {
+      file.line_starts.emplace_back((uint32_t)(p + 1 - begin));
+    }
+  }
 };
 
 #endif  // SOURCE_POINT_HPP
@@ -1,17 +1,35 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <fstream>
 #include <sstream>
+#include <thread>
 #include <unordered_set>
 
 #include "ast_node_index.hpp"
 #include "id_index.hpp"
 #include "lexer.hpp"
+#include "char_scanner.hpp"
 #include "token.hpp"
+#include "token_store.hpp"
+#include "relexer.hpp"
+#include "parallel_lexer.hpp"
 #include "parser.hpp"
 #include "ast.hpp"
+#include "ordered_dict.hpp"
+#include "flat_ordered_dict.hpp"
 #include "id_cache.hpp"
+#include "concurrent_id_cache.hpp"
 #include "strong_type.hpp"
 #include "ir.hpp"
 #include "vm.hpp"
+#include "thread_pool.hpp"
+#include "driver.hpp"
+#include "ast_cache.hpp"
+#include "incremental.hpp"
+#include "semantic.hpp"
+#include "ast_visitor.hpp"
+#include "codegen.hpp"
+#include "ir_passes.hpp"
 
 TEST(IdCache, Simple) {
   IdCache id_cache;
@@ -21,19 +39,87 @@ TEST(IdCache, Simple) {
   EXPECT_EQ(id_cache.get(index).length, 4);
 }
 
+TEST(IdCache, Many) {
+  IdCache id_cache;
+  std::vector<IdIndex> indices;
+  std::vector<const char*> pointers;
+  for (int i = 0; i < 10000; ++i) {
+    const auto name = "id_" + std::to_string(i);
+    indices.emplace_back(id_cache.get(name.c_str(), name.size()));
+    pointers.emplace_back(id_cache.get(indices.back()).str);
+  }
+  EXPECT_EQ(id_cache.size(), 10000);
+  for (int i = 0; i < 10000; ++i) {
+    const auto name = "id_" + std::to_string(i);
+    ASSERT_EQ(id_cache.get(name.c_str(), name.size()), indices[i]);
+    ASSERT_EQ(id_cache.get(indices[i]).str, pointers[i]);
+    ASSERT_STREQ(id_cache.get(indices[i]).str, name.c_str());
+  }
+}
+
+TEST(IdCache, Anagrams) {
+  IdCache id_cache;
+  const auto ab = id_cache.get("ab");
+  const auto ba = id_cache.get("ba");
+  EXPECT_NE(ab, ba);
+  EXPECT_NE(id_cache.get("i1"), id_cache.get("j0"));
+  EXPECT_EQ(id_cache.get("ab"), ab);
+  EXPECT_NE(id_cache.get("abc", 2), id_cache.get("abc", 3));
+  EXPECT_EQ(id_cache.get("abc", 2), ab);
+  EXPECT_EQ(id_cache.get(id_cache.get("", 0)).length, 0);
+}
+
+TEST(ConcurrentIdCache, Simple) {
+  ConcurrentIdCache id_cache;
+  auto index = id_cache.get("test", 4);
+  EXPECT_EQ(index, id_cache.get("test", 4));
+  EXPECT_NE(index, id_cache.get("tset", 4));
+  EXPECT_STREQ(id_cache.get(index).str, "test");
+  EXPECT_EQ(id_cache.get(index).length, 4);
+  EXPECT_EQ(id_cache.size(), 2);
+}
+
+TEST(ConcurrentIdCache, Threads) {
+  ConcurrentIdCache id_cache;
+  const int threads_count = 4;
+  const int names_count = 20000;
+  std::vector<std::vector<IdIndex>> results(threads_count);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < threads_count; ++t) {
+    threads.emplace_back([&, t] {
+      // Every thread interns the same names, starting at a different one.
+      for (int i = 0; i < names_count; ++i) {
+        const auto name = "name_" + std::to_string((i + t * 5000) % names_count);
+        results[t].emplace_back(id_cache.get(name.c_str(), name.size()));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(id_cache.size(), names_count);
+  for (int t = 0; t < threads_count; ++t) {
+    for (int i = 0; i < names_count; ++i) {
+      const auto n = (i + t * 5000) % names_count;
+      const auto name = "name_" + std::to_string(n);
+      ASSERT_EQ(results[t][i], results[0][(n + names_count) % names_count]);
+      ASSERT_STREQ(id_cache.get(results[t][i]).str, name.c_str());
+    }
+  }
+}
+
 TEST(Ast, Scope) {
   Ast ast;
   IdCache id_cache;
   auto struct_idx = ast.create(AstNode::Kind::Struct);
-  auto& struct_node = ast[struct_idx];
   auto a_field_idx = ast.create(AstNode::Kind::StructField);
   auto& a_field = ast[a_field_idx];
 
   a_field.struct_field.value.type = ast.create(AstNode::Kind::I32Type);
   a_field.struct_field.name = id_cache.get("a_field");
-  struct_node.struc.scope.add_node(a_field_idx, a_field.struct_field.name);
+  ast.add_to_scope(struct_idx, a_field_idx, a_field.struct_field.name);
   {
-    auto a_field_idx = ast[struct_idx].scope.dict->find(id_cache.get("a_field"));
+    auto a_field_idx = ast.find_in_scope(struct_idx, id_cache.get("a_field"));
     ASSERT_FALSE(a_field_idx == UndefinedAstNodeIndex);
     ASSERT_STREQ(id_cache.get(ast[a_field_idx].struct_field.name).str, "a_field");
   }
@@ -69,31 +155,151 @@ TEST(OrderedDict, Simple) {
   EXPECT_STREQ(id_cache.get(b_node.local_variable.name).str, "b");
 }
 
+TEST(Ast, Regions) {
+  Ast ast;
+  const auto global = ast.create(AstNode::Kind::BlockScope);
+  ast.add_to_scope(global, ast.create(AstNode::Kind::LocalVariable), IdIndex(1));
+
+  const auto function = ast.begin_region();
+  EXPECT_EQ(ast.get_current_region(), function);
+  const auto scope = ast.create(AstNode::Kind::BlockScope);
+  const auto variable = ast.create(AstNode::Kind::LocalVariable);
+  ast.add_to_scope(scope, variable, IdIndex(2));
+  const auto type = ast.get_primitive_type(AstNode::Kind::I32Type);
+  const auto nested = ast.begin_region();
+  const auto literal = ast.create(AstNode::Kind::I32Literal);
+  for (int i = 1; i < 300; ++i) ast.create(AstNode::Kind::I32Literal);
+  ast.end_region();
+  ast.end_region();
+  EXPECT_EQ(ast.get_current_region(), Ast::RootRegion);
+  EXPECT_EQ(ast.get_region(global), Ast::RootRegion);
+  EXPECT_EQ(ast.get_region(scope), function);
+  EXPECT_EQ(ast.get_region(type), Ast::RootRegion);
+  EXPECT_EQ(ast.get_region(literal), nested);
+  // Each region fills chunks of its own.
+  EXPECT_EQ(ast.size(), 2 * Ast::ChunkSize + 300);
+
+  // A removed node is reused by its region only.
+  ast.remove(variable);
+  EXPECT_EQ(ast.create(AstNode::Kind::LocalVariable), AstNodeIndex(3));
+
+  // Releasing takes the nested region along. Their chunks come back to the
+  // next region and the scope dict to the next scope.
+  const auto size = ast.size();
+  ast.release_region(function);
+  const auto again = ast.begin_region();
+  EXPECT_EQ(again, function);
+  const auto other_scope = ast.create(AstNode::Kind::BlockScope);
+  EXPECT_EQ(other_scope, scope);
+  ast.add_to_scope(other_scope, ast.create(AstNode::Kind::LocalVariable), IdIndex(3));
+  for (int i = 0; i < 300; ++i) ast.create(AstNode::Kind::I32Literal);
+  ast.end_region();
+  EXPECT_EQ(ast.size(), size);
+  EXPECT_EQ(ast.find_in_scope(other_scope, IdIndex(2)), UndefinedAstNodeIndex);
+  EXPECT_NE(ast.find_in_scope(other_scope, IdIndex(3)), UndefinedAstNodeIndex);
+  EXPECT_NE(ast.find_in_scope(global, IdIndex(1)), UndefinedAstNodeIndex);
+
+  // A reset region creates its next nodes from its first chunk again.
+  const auto scratch = ast.begin_region();
+  const auto first = ast.create(AstNode::Kind::I32Literal);
+  for (int i = 0; i < 300; ++i) ast.create(AstNode::Kind::I32Literal);
+  ast.reset_region(scratch);
+  // The old nodes are gone, not left behind the new ones.
+  EXPECT_EQ(ast[AstNodeIndex(first.get() + 1)].kind, AstNode::Kind::None);
+  EXPECT_EQ(ast.create(AstNode::Kind::I32Literal), first);
+  EXPECT_EQ(ast[AstNodeIndex(first.get() + 300)].kind, AstNode::Kind::None);
+  ast.end_region();
+}
+
+TEST(FlatOrderedDict, InlineAndSpilled) {
+  FlatOrderedDict<IdIndex, AstNodeIndex> dict;
+  std::vector<AstNodeIndex> order;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    // Ids far apart, as the ids of one scope usually are.
+    dict.append(IdIndex(i * 977), AstNodeIndex(i));
+    order.emplace_back(AstNodeIndex(i));
+    if (i % 3 == 0) {
+      dict.append(AstNodeIndex(100000 + i));
+      order.emplace_back(AstNodeIndex(100000 + i));
+    }
+    // A name is only declared once.
+    dict.append(IdIndex(i * 977), AstNodeIndex(200000 + i));
+
+    // Checks both the inline scan and the table, right after the spill too.
+    if (i < 20 || i % 100 == 0) {
+      for (uint32_t j = 0; j <= i; ++j) {
+        ASSERT_EQ(dict.find(IdIndex(j * 977)), AstNodeIndex(j)) << i << " " << j;
+      }
+      ASSERT_EQ(dict.find(IdIndex(i * 977 + 1)), UndefinedAstNodeIndex);
+      ASSERT_EQ(dict.find(IdIndex::undefined), UndefinedAstNodeIndex);
+    }
+  }
+  EXPECT_EQ(dict.get_nodes(), order);
+}
+
 TEST(Ast, FunTypeWithNamedParams) {
   Ast ast;
   IdCache id_cache;
   auto f_idx = ast.create(AstNode::Kind::FunTypeWithNamedParams);
-  auto& f_node = ast[f_idx];
-  auto& fun_type = f_node.fun_type_with_named_params;
-  fun_type.fun_type.add_param_type(ast.create(AstNode::Kind::I32Type));
-  fun_type.add_name(id_cache.get("a"));
-  fun_type.fun_type.add_param_type(ast.create(AstNode::Kind::U32Type));
-  fun_type.add_name(id_cache.get("b"));
-  fun_type.fun_type.return_type = ast.create(AstNode::Kind::F32Type);
+  const uint32_t types[] = {
+    ast.create(AstNode::Kind::I32Type).get(), ast.create(AstNode::Kind::U32Type).get(),
+  };
+  const uint32_t names[] = {id_cache.get("a").get(), id_cache.get("b").get()};
+  auto& fun_type = ast[f_idx].fun_type;
+  fun_type.params = ast.add_params(types, names, 2);
+  fun_type.return_type = ast.create(AstNode::Kind::F32Type);
 
   {
     auto& node = ast[AstNodeIndex(0)];
     ASSERT_EQ(node.kind, AstNode::Kind::FunTypeWithNamedParams);
-    ASSERT_NE(node.fun_type.param_types, nullptr);
-    auto& param1 = ast[node.fun_type.param_types->operator[](0)];
-    auto& param2 = ast[node.fun_type.param_types->operator[](1)];
+    const auto param_types = ast.get_param_types(node.fun_type);
+    ASSERT_EQ(param_types.size(), 2);
+    auto& param1 = ast[param_types[0]];
+    auto& param2 = ast[param_types[1]];
     ASSERT_EQ(param1.kind, AstNode::Kind::I32Type);
     ASSERT_EQ(param2.kind, AstNode::Kind::U32Type);
     auto& return_type = ast[node.fun_type.return_type];
     ASSERT_EQ(return_type.kind, AstNode::Kind::F32Type);
+    const auto names = ast.get_param_names(node.fun_type);
+    ASSERT_EQ(names.size(), 2);
+    EXPECT_STREQ(id_cache.get(names[1]).str, "b");
   }
 }
 
+TEST(Ast, ExtraAndChunks) {
+  Ast ast;
+  IdCache id_cache;
+  ExtraRange a{};
+  ExtraRange b{};
+  // Interleaved lists, every append to the other one moves a list.
+  for (uint32_t i = 0; i < 100; ++i) {
+    ast.append(a, AstNodeIndex(i));
+    ast.append(b, AstNodeIndex(1000 + i));
+  }
+  const auto a_nodes = ast.get_nodes(a);
+  ASSERT_EQ(a_nodes.size(), 100);
+  uint32_t i = 0;
+  for (const auto node : a_nodes) {
+    ASSERT_EQ(node, AstNodeIndex(i++));
+  }
+  EXPECT_EQ(ast.get_nodes(b).back(), AstNodeIndex(1099));
+
+  const auto first = ast.create(AstNode::Kind::I32Literal);
+  auto* first_node = &ast[first];
+  for (int i = 0; i < 5000; ++i) {
+    ast[ast.create(AstNode::Kind::I32Literal)].i32_literal.literal_value = i;
+  }
+  EXPECT_EQ(&ast[first], first_node);
+  EXPECT_EQ(ast.size(), 5001);
+  EXPECT_EQ(ast[AstNodeIndex(4001)].i32_literal.literal_value, 4000);
+
+  const auto scope = ast.create(AstNode::Kind::BlockScope);
+  EXPECT_TRUE(ast.get_scope_nodes(scope).empty());
+  EXPECT_EQ(ast.find_in_scope(scope, id_cache.get("x")), UndefinedAstNodeIndex);
+  ast.add_to_scope(scope, first, id_cache.get("x"));
+  EXPECT_EQ(ast.find_in_scope(scope, id_cache.get("x")), first);
+}
+
 TEST(Ast, Struct) {
   Ast ast;
   IdCache id_cache;
@@ -121,6 +327,372 @@ TEST(Lexer, Simple) {
   ASSERT_EQ(eof1_token, eof2_token);
 }
 
+TEST(Lexer, StringView) {
+  const std::string source = "fun foo(a: i32) { a = 10; \"txt\" foo }";
+  Lexer::Tokens tokens;
+  IdCache id_cache;
+  Lexer lexer(std::string_view(source), tokens, id_cache);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Fun);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  const auto foo = lexer.last().id;
+  EXPECT_STREQ(id_cache.get(foo).str, "foo");
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::LeftParen);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Colon);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::I32);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::RightParen);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::LeftBrace);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Assign);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::I32Literal);
+  EXPECT_EQ(lexer.last().i32, 10);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Semicolon);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::StringLiteral);
+  EXPECT_STREQ(id_cache.get(lexer.last().str).str, "txt");
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  EXPECT_EQ(lexer.last().id, foo);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::RightBrace);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Eof);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Eof);
+}
+
+TEST(Lexer, SameTokensForStreamAndView) {
+  const std::string source = "fun f2(a: i32, b: i32): i32 { a += b + 10; print(\"result:{}\", a) return a }";
+  Lexer::Tokens stream_tokens;
+  Lexer::Tokens view_tokens;
+  IdCache id_cache;
+  std::istringstream in(source);
+  Lexer stream_lexer(in, stream_tokens, id_cache);
+  Lexer view_lexer(std::string_view(source), view_tokens, id_cache);
+
+  while (stream_lexer.next().get_kind() != Token::Kind::Eof) {}
+  while (view_lexer.next().get_kind() != Token::Kind::Eof) {}
+
+  ASSERT_EQ(stream_tokens.size(), view_tokens.size());
+  for (size_t i = 0; i < stream_tokens.size(); ++i) {
+    ASSERT_EQ(stream_tokens[i].get_kind(), view_tokens[i].get_kind());
+    switch (view_tokens[i].get_kind()) {
+      case Token::Kind::Id:
+      case Token::Kind::StringLiteral:
+      case Token::Kind::I32Literal:
+        ASSERT_EQ(stream_tokens[i].u32, view_tokens[i].u32);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+TEST(Token, Keywords) {
+  for (const auto& keyword : keywords::list) {
+    EXPECT_EQ(Token::id_2_token_kind(keyword.text), keyword.kind);
+  }
+  for (const auto* id : {"a", "fu", "funx", "structs", "i64", "u", "val_", "retur", "f16", "classes"}) {
+    EXPECT_EQ(Token::id_2_token_kind(id), Token::Kind::Id) << id;
+  }
+  static_assert(Token::id_2_token_kind("return") == Token::Kind::Return);
+}
+
+TEST(CharScanner, LevelsAgree) {
+  std::string text;
+  const char alphabet[] = " \t\n\r_azAZ09\"+(";
+  uint32_t seed = 1;
+  for (int i = 0; i < 4096; ++i) {
+    seed = seed * 1103515245 + 12345;
+    const auto run = (seed >> 16) % 40;
+    const auto chr = alphabet[(seed >> 8) % (sizeof(alphabet) - 1)];
+    text.append(run, chr);
+  }
+  const auto begin = text.data();
+  const auto end = text.data() + text.size();
+  const auto best = char_scanner::best_level();
+
+  for (auto level : {char_scanner::Level::Sse2, char_scanner::Level::Avx2}) {
+    for (const char* p = begin; p < end; ++p) {
+      char_scanner::set_level(char_scanner::Level::Scalar);
+      const auto spaces = char_scanner::skip_spaces(p, end);
+      const auto id = char_scanner::skip_id(p, end);
+      const auto digits = char_scanner::skip_digits(p, end);
+      const auto quote = char_scanner::find_quote(p, end);
+      const auto newline = char_scanner::find_newline(p, end);
+      char_scanner::set_level(level);
+      ASSERT_EQ(spaces, char_scanner::skip_spaces(p, end));
+      ASSERT_EQ(id, char_scanner::skip_id(p, end));
+      ASSERT_EQ(digits, char_scanner::skip_digits(p, end));
+      ASSERT_EQ(quote, char_scanner::find_quote(p, end));
+      ASSERT_EQ(newline, char_scanner::find_newline(p, end));
+    }
+  }
+  char_scanner::set_level(best);
+}
+
+TEST(Lexer, ConcurrentIdCache) {
+  ConcurrentIdCache id_cache;
+  const std::string sources[] = {"fun a(x: i32) { return x }", "fun b(x: i32, a: i32) { return a }"};
+  std::vector<Lexer::Tokens> tokens(2);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) {
+    threads.emplace_back([&, i] {
+      ConcurrentLexer lexer(std::string_view(sources[i]), tokens[i], id_cache);
+      while (lexer.next().get_kind() != Token::Kind::Eof) {}
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  ASSERT_EQ(tokens[0][1].get_kind(), Token::Kind::Id);
+  ASSERT_EQ(tokens[1][1].get_kind(), Token::Kind::Id);
+  ASSERT_EQ(tokens[0][3].get_kind(), Token::Kind::Id);
+  EXPECT_STREQ(id_cache.get(tokens[0][1].id).str, "a");
+  EXPECT_EQ(tokens[0][3].id, tokens[1][3].id);
+  EXPECT_EQ(tokens[0][1].id, tokens[1][7].id);
+}
+
+TEST(Lexer, Peek) {
+  const std::string source = "fun f(a) a";
+  Lexer::Tokens tokens;
+  IdCache id_cache;
+  Lexer lexer(std::string_view(source), tokens, id_cache);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Fun);
+  EXPECT_EQ(lexer.peek().get_kind(), Token::Kind::Id);
+  EXPECT_EQ(lexer.peek(2).get_kind(), Token::Kind::LeftParen);
+  EXPECT_EQ(lexer.peek(7).get_kind(), Token::Kind::Eof);
+  EXPECT_EQ(lexer.last().get_kind(), Token::Kind::Fun);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  EXPECT_EQ(lexer.last().get_kind(), Token::Kind::Id);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::LeftParen);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::RightParen);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Id);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Eof);
+  ASSERT_EQ(lexer.next().get_kind(), Token::Kind::Eof);
+}
+
+TEST(TokenWindow, Simple) {
+  TokenWindow window(3);
+  EXPECT_EQ(window.capacity(), 4);
+  EXPECT_TRUE(window.empty());
+  window.emplace_back(Token::Kind::Fun);
+  window.emplace_back(Token::Kind::Id).id = IdIndex(7);
+  EXPECT_EQ(window.size(), 2);
+  EXPECT_EQ(window[0].get_kind(), Token::Kind::Fun);
+  EXPECT_EQ(window.back().id, IdIndex(7));
+  for (int i = 0; i < 10; ++i) {
+    window.emplace_back(Token::Kind::I32Literal).i32 = i;
+  }
+  EXPECT_EQ(window.size(), 4);
+  EXPECT_EQ(window.get_total(), 12);
+  EXPECT_EQ(window[0].i32, 6);
+  EXPECT_EQ(window[3].i32, 9);
+  EXPECT_EQ(window.back().i32, 9);
+}
+
+TEST(Lexer, StreamingSameAsVector) {
+  std::string source;
+  for (int i = 0; i < 1000; ++i) {
+    source += "fun f" + std::to_string(i) + "(a: i32) { return a + " + std::to_string(i) + " }\n";
+  }
+  Lexer::Tokens tokens;
+  IdCache id_cache;
+  Lexer lexer(std::string_view(source), tokens, id_cache);
+  while (lexer.next().get_kind() != Token::Kind::Eof) {}
+
+  TokenWindow window(2);
+  StreamingLexer streaming_lexer(std::string_view(source), window, id_cache);
+  size_t i = 0;
+  do {
+    const auto& token = streaming_lexer.next();
+    ASSERT_EQ(token.get_kind(), tokens[i].get_kind());
+    if (token.get_kind() == Token::Kind::Id) {
+      ASSERT_EQ(token.id, tokens[i].id);
+    }
+    if (i > 0) {
+      ASSERT_EQ(window[0].get_kind(), tokens[i - 1].get_kind());
+    }
+    ++i;
+  } while (streaming_lexer.last().get_kind() != Token::Kind::Eof);
+  EXPECT_EQ(i, tokens.size());
+  EXPECT_EQ(window.size(), 2);
+}
+
+TEST(Lexer, Offsets) {
+  const std::string source = "fun  f(\n\"ab\" 123)";
+  std::istringstream in(source);
+  Lexer::Tokens stream_tokens;
+  Lexer::Tokens view_tokens;
+  IdCache id_cache;
+  Lexer stream_lexer(in, stream_tokens, id_cache);
+  Lexer view_lexer(std::string_view(source), view_tokens, id_cache);
+  const uint32_t expected[] = {0, 5, 6, 8, 13, 16, 17};
+  for (auto offset : expected) {
+    stream_lexer.next();
+    view_lexer.next();
+    EXPECT_EQ(stream_lexer.last_offset(), offset);
+    EXPECT_EQ(view_lexer.last_offset(), offset);
+  }
+  EXPECT_EQ(view_lexer.last().get_kind(), Token::Kind::Eof);
+  view_lexer.peek();
+  EXPECT_EQ(view_lexer.last_offset(), 17);
+}
+
+TEST(Lexer, Operators) {
+  const std::string source = "a+=b-=c*=d/=e==f!=g<=h>=i<j>k=l..m.n,o !";
+  const Token::Kind expected[] = {
+    Token::Kind::AddAssign, Token::Kind::SubAssign, Token::Kind::MulAssign, Token::Kind::DivAssign,
+    Token::Kind::Equals, Token::Kind::NotEquals, Token::Kind::LessOrEqual, Token::Kind::GreatOrEqual,
+    Token::Kind::Less, Token::Kind::Great, Token::Kind::Assign, Token::Kind::DotDot, Token::Kind::Dot,
+    Token::Kind::Comma,
+  };
+  std::istringstream in(source);
+  Lexer::Tokens stream_tokens;
+  Lexer::Tokens view_tokens;
+  IdCache id_cache;
+  Lexer stream_lexer(in, stream_tokens, id_cache);
+  Lexer view_lexer(std::string_view(source), view_tokens, id_cache);
+  for (auto* lexer : {&stream_lexer, &view_lexer}) {
+    for (const auto kind : expected) {
+      ASSERT_EQ(lexer->next().get_kind(), Token::Kind::Id);
+      ASSERT_EQ(lexer->next().get_kind(), kind);
+    }
+    ASSERT_EQ(lexer->next().get_kind(), Token::Kind::Id);
+    ASSERT_EQ(lexer->next().get_kind(), Token::Kind::Unknown);
+    ASSERT_EQ(lexer->next().get_kind(), Token::Kind::Eof);
+  }
+  EXPECT_EQ(Token::id_2_token_kind("for"), Token::Kind::For);
+  EXPECT_EQ(Token::id_2_token_kind("in"), Token::Kind::In);
+  EXPECT_EQ(Token::id_2_token_kind("else"), Token::Kind::Else);
+}
+
+TEST(TokenStore, Lex) {
+  const std::string source = "fun f(a: i32) { return a + 10 }";
+  IdCache id_cache;
+  TokenWindow window(2);
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  TokenStore store;
+  store.lex(lexer);
+
+  ASSERT_EQ(store.size(), 14);
+  EXPECT_EQ(store.kind(TokenIndex(0)), Token::Kind::Fun);
+  EXPECT_EQ(store.kind(TokenIndex(1)), Token::Kind::Id);
+  EXPECT_STREQ(id_cache.get(store.get(TokenIndex(1)).id).str, "f");
+  EXPECT_EQ(store.offset(TokenIndex(1)), 4);
+  EXPECT_EQ(store.kind(TokenIndex(11)), Token::Kind::I32Literal);
+  EXPECT_EQ(store.get(TokenIndex(11)).i32, 10);
+  EXPECT_EQ(store.offset(TokenIndex(11)), 27);
+  EXPECT_EQ(store.kind(TokenIndex(13)), Token::Kind::Eof);
+  EXPECT_EQ(store.offset(TokenIndex(13)), source.size());
+  EXPECT_EQ(store.get_range().count(), 14);
+
+  TokenStore::Reader reader(store, TokenRange{TokenIndex(8), TokenIndex(9)});
+  EXPECT_EQ(reader.next().get_kind(), Token::Kind::Return);
+  EXPECT_EQ(reader.peek().get_kind(), Token::Kind::Id);
+  EXPECT_EQ(reader.next().get_kind(), Token::Kind::Id);
+  EXPECT_EQ(reader.last_offset(), 23);
+  EXPECT_EQ(reader.next().get_kind(), Token::Kind::Eof);
+}
+
+static TokenStore lex_all(const std::string& source, IdCache& id_cache) {
+  TokenWindow window(2);
+  StreamingLexer lexer(std::string_view(source), window, id_cache);
+  TokenStore store;
+  store.lex(lexer);
+  return store;
+}
+
+static void expect_same_tokens(const TokenStore& a, const TokenStore& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (uint32_t i = 0; i < a.size(); ++i) {
+    ASSERT_EQ(a.kind(TokenIndex(i)), b.kind(TokenIndex(i))) << i;
+    ASSERT_EQ(a.payload(TokenIndex(i)), b.payload(TokenIndex(i))) << i;
+    ASSERT_EQ(a.offset(TokenIndex(i)), b.offset(TokenIndex(i))) << i;
+  }
+}
+
+TEST(Relexer, Simple) {
+  IdCache id_cache;
+  std::string source = "fun f(a: i32) { return a + 10 }";
+  auto store = lex_all(source, id_cache);
+
+  const TextEdit edit{23, 1, "abc"};
+  edit.apply(source);
+  const auto result = relex(store, source, edit, id_cache);
+  EXPECT_EQ(result.removed_count, 2);
+  EXPECT_EQ(result.range.from, TokenIndex(8));
+  EXPECT_EQ(result.range.count(), 2);
+  EXPECT_STREQ(id_cache.get(store.get(TokenIndex(9)).id).str, "abc");
+  expect_same_tokens(store, lex_all(source, id_cache));
+
+  const TextEdit quote{16, 0, "\""};
+  quote.apply(source);
+  relex(store, source, quote, id_cache);
+  expect_same_tokens(store, lex_all(source, id_cache));
+
+  const TextEdit unquote{16, 1, ""};
+  unquote.apply(source);
+  relex(store, source, unquote, id_cache);
+  expect_same_tokens(store, lex_all(source, id_cache));
+
+  const TextEdit space{12, 0, "  "};
+  space.apply(source);
+  const auto space_result = relex(store, source, space, id_cache);
+  EXPECT_EQ(space_result.range.count(), 1);
+  expect_same_tokens(store, lex_all(source, id_cache));
+}
+
+TEST(Relexer, RandomEdits) {
+  IdCache id_cache;
+  std::string source;
+  for (int i = 0; i < 50; ++i) {
+    source += "fun f" + std::to_string(i) + "(a: i32) { print(\"x y\", a) return a + " + std::to_string(i) + " }\n";
+  }
+  auto store = lex_all(source, id_cache);
+  const char* pieces[] = {"", " ", "x", "1", "\"", "(", "ab c", "\n\n", "12a", "_"};
+  uint32_t seed = 3;
+  for (int i = 0; i < 500; ++i) {
+    seed = seed * 1103515245 + 12345;
+    const uint32_t offset = (seed >> 8) % (source.size() + 1);
+    seed = seed * 1103515245 + 12345;
+    const uint32_t removed = std::min<uint32_t>((seed >> 8) % 4, source.size() - offset);
+    seed = seed * 1103515245 + 12345;
+    const TextEdit edit{offset, removed, pieces[(seed >> 8) % 10]};
+    edit.apply(source);
+    relex(store, source, edit, id_cache);
+    expect_same_tokens(store, lex_all(source, id_cache));
+  }
+}
+
+TEST(ParallelLexer, SameAsSequential) {
+  std::string source;
+  for (int i = 0; i < 200; ++i) {
+    source += "fun f" + std::to_string(i % 7) + "(a: i32) {\n  print(\"line\n" + std::to_string(i)
+      + "\nfun g(b) {\n\", a)\n  return a + " + std::to_string(i) + "\n}\n";
+  }
+  // A string running to the end crosses every later cut.
+  source += "var s = \"\n\n";
+  for (int i = 0; i < 50; ++i) source += "x" + std::to_string(i) + "\n";
+
+  IdCache sequential_ids;
+  const auto sequential = lex_all(source, sequential_ids);
+
+  ThreadPool pool(3);
+  size_t relexed = 0;
+  for (const size_t chunks : {1, 2, 5, 16, 97, 400}) {
+    IdCache id_cache;
+    TokenStore store;
+    const auto result = lex_parallel(std::string_view(source), store, id_cache, pool, chunks);
+    EXPECT_EQ(result.chunks, chunks);
+    relexed += result.relexed;
+    expect_same_tokens(store, sequential);
+    EXPECT_EQ(id_cache.size(), sequential_ids.size());
+  }
+  EXPECT_GT(relexed, 0);
+
+  IdCache id_cache;
+  TokenStore store;
+  lex_parallel(std::string_view(), store, id_cache, pool, 4);
+  ASSERT_EQ(store.size(), 1);
+  EXPECT_EQ(store.kind(TokenIndex(0)), Token::Kind::Eof);
+}
+
 TEST(Ast, FunType) {
   Ast ast;
   IdCache id_cache;
@@ -129,18 +701,18 @@ TEST(Ast, FunType) {
   auto& node = ast[idx];
   node.fun_type.name = id_cache.get("funtype", 7);
   node.fun_type.return_type = i32_type_idx;
-  node.fun_type.param_types = new std::vector<AstNodeIndex>();
-  node.fun_type.param_types->emplace_back(i32_type_idx);
-  node.fun_type.param_types->emplace_back(i32_type_idx);
+  EXPECT_TRUE(ast.get_param_types(node.fun_type).empty());
+  const uint32_t types[] = {i32_type_idx.get(), i32_type_idx.get()};
+  node.fun_type.params = ast.add_params(types, nullptr, 2);
   {
     auto& node = ast[idx];
     EXPECT_STREQ(id_cache.get(node.fun_type.name).str, "funtype");
     auto& return_type_node = ast[node.fun_type.return_type];
     EXPECT_EQ(return_type_node.kind, AstNode::Kind::I32Type);
-    ASSERT_TRUE(node.fun_type.param_types != nullptr);
-    ASSERT_EQ(node.fun_type.param_types->size(), 2);
-    auto& param1_node = ast[(*node.fun_type.param_types)[0]];
-    auto& param2_node = ast[(*node.fun_type.param_types)[1]];
+    const auto param_types = ast.get_param_types(node.fun_type);
+    ASSERT_EQ(param_types.size(), 2);
+    auto& param1_node = ast[param_types[0]];
+    auto& param2_node = ast[param_types[1]];
     EXPECT_EQ(param1_node.kind, AstNode::Kind::I32Type);
     EXPECT_EQ(param2_node.kind, AstNode::Kind::I32Type);
   }
@@ -172,7 +744,8 @@ TEST(Ast, Stmt) {
   var_decl_stmt.variable_decl_stmt.variable = local_var_idx;
   var_decl_stmt.variable_decl_stmt.init_expr = init_idx;
 
-  block_stmt.block_stmt.add_stmt(var_decl_stmt_idx);
+  ast.append(block_stmt.block_stmt.stmts, var_decl_stmt_idx);
+  ASSERT_EQ(ast.get_nodes(block_stmt.block_stmt.stmts).size(), 1);
 }
 
 TEST(Ast, Expession) {
@@ -217,14 +790,872 @@ TEST(StrongType, Simple) {
   EXPECT_NE(s.find(IdIndex(15)), s.end());
 }
 
+static const char* readme_source =
+  "fun f2(a: i32, b: i32): i32 {\n"
+  "  for (i in 0..100) {\n"
+  "    a += b + 10;\n"
+  "  }\n"
+  "  print(\"result:{}\", a)\n"
+  "  return a\n"
+  "}\n"
+  "\n"
+  "fun f1(a: i32, b: i32): i32 {\n"
+  "  a += b;\n"
+  "  return f2(a, b)\n"
+  "}\n";
+
+// Statements of the body of function, a Function node.
+static ExtraList<AstNodeIndex> body_stmts(const Ast& ast, AstNodeIndex function) {
+  const auto body = ast.get_overflow<AstNode::FunctionOverflow>(ast[function].function.overflow).body;
+  return ast.get_nodes(ast[body].block_stmt.stmts);
+}
+
 TEST(Parser, Simple) {
+  std::istringstream in(readme_source);
+  Lexer::Tokens tokens;
+  IdCache id_cache;
+  Lexer lexer(in, tokens, id_cache);
+  Ast ast;
+  Parser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+  EXPECT_TRUE(parser.get_errors().empty());
+
+  auto& global_node = ast[global];
+  ASSERT_EQ(global_node.kind, AstNode::Kind::GlobalScope);
+  ASSERT_EQ(ast.get_nodes(ast[global_node.global_scope.block_stmt].block_stmt.stmts).size(), 2);
+  const auto f2 = ast.find_in_scope(global, id_cache.get("f2"));
+  const auto f1 = ast.find_in_scope(global, id_cache.get("f1"));
+  ASSERT_EQ(ast[f2].kind, AstNode::Kind::Function);
+  ASSERT_EQ(ast[f1].kind, AstNode::Kind::Function);
+
+  const auto f2_record = ast.get_overflow<AstNode::FunctionOverflow>(ast[f2].function.overflow);
+  auto& f2_type = ast[f2_record.function_type_with_named_params];
+  ASSERT_EQ(ast.get_param_types(f2_type.fun_type).size(), 2);
+  EXPECT_EQ(ast[f2_type.fun_type.return_type].kind, AstNode::Kind::I32Type);
+  EXPECT_STREQ(id_cache.get(ast.get_param_names(f2_type.fun_type)[1]).str, "b");
+
+  const auto f2_body = body_stmts(ast, f2);
+  ASSERT_EQ(f2_body.size(), 3);
+  auto& for_stmt = ast[f2_body[0]];
+  ASSERT_EQ(for_stmt.kind, AstNode::Kind::ForStmt);
+  const auto range = ast.get_overflow<AstNode::ForStmtOverflow>(for_stmt.for_stmt.overflow);
+  EXPECT_EQ(ast[range.to].i32_literal.literal_value, 100);
+  EXPECT_EQ(ast[range.variable].kind, AstNode::Kind::LocalVariable);
+  const auto for_body = ast.get_nodes(ast[for_stmt.for_stmt.stmt].block_stmt.stmts);
+  ASSERT_EQ(for_body.size(), 1);
+  auto& add_assign = ast[ast[for_body[0]].expr_stmt.expr];
+  ASSERT_EQ(add_assign.kind, AstNode::Kind::AddAssignExpr);
+  auto& a = ast[add_assign.binary_expr.left];
+  ASSERT_EQ(a.kind, AstNode::Kind::NameExpr);
+  EXPECT_EQ(ast[a.name_expr.decl].kind, AstNode::Kind::LocalVariable);
+  EXPECT_EQ(ast[add_assign.binary_expr.right].kind, AstNode::Kind::AddExpr);
+
+  auto& print = ast[ast[f2_body[1]].expr_stmt.expr];
+  ASSERT_EQ(print.kind, AstNode::Kind::CallExpr);
+  EXPECT_EQ(print.call_expr.args.count, 2);
+  EXPECT_EQ(ast[print.call_expr.callee].name_expr.decl, UndefinedAstNodeIndex);
+  EXPECT_EQ(ast[f2_body[2]].kind, AstNode::Kind::ReturnStmt);
+
+  const auto f1_body = body_stmts(ast, f1);
+  ASSERT_EQ(f1_body.size(), 2);
+  auto& call = ast[ast[f1_body[1]].return_stmt.expr];
+  ASSERT_EQ(call.kind, AstNode::Kind::CallExpr);
+  EXPECT_EQ(ast[call.call_expr.callee].name_expr.decl, f2);
+}
+
+TEST(Ast, ForEachChild) {
+  std::istringstream in(readme_source);
   Lexer::Tokens tokens;
-  std::istringstream in("fun test(i8* str, i32 len) -> i32 { return 10 }");
   IdCache id_cache;
   Lexer lexer(in, tokens, id_cache);
   Ast ast;
   Parser parser(lexer, ast, id_cache);
-  parser.parse();
+  const auto global = parser.parse();
+
+  // Every node but the shared primitive types is reached exactly once.
+  std::vector<int> reached(ast.size());
+  std::vector<AstNodeIndex> stack{global};
+  while (!stack.empty()) {
+    const auto index = stack.back();
+    stack.pop_back();
+    ++reached[index.get()];
+    ast.for_each_child(index, [&](AstNodeIndex child) { stack.push_back(child); });
+  }
+  for (uint32_t i = 0; i < ast.size(); ++i) {
+    const auto kind = ast[AstNodeIndex(i)].kind;
+    const bool primitive = kind >= AstNode::Kind::I8Type && kind <= AstNode::Kind::F64Type;
+    EXPECT_EQ(reached[i], primitive ? 0 : 1) << "node " << i;
+  }
+}
+
+namespace {
+
+// Every pre and post, as (kind, false) and (kind, true).
+class RecordVisitor : public AstVisitor<RecordVisitor> {
+public:
+  using AstVisitor::AstVisitor;
+
+  template <AstNode::Kind K>
+  bool pre(AstNodeIndex, const AstNode&) {
+    calls.emplace_back(K, false);
+    return K != skipped;
+  }
+
+  template <AstNode::Kind K>
+  void post(AstNodeIndex, const AstNode&) { calls.emplace_back(K, true); }
+
+  AstNode::Kind skipped = AstNode::Kind::None;
+  std::vector<std::pair<AstNode::Kind, bool>> calls;
+};
+
+class CountNegVisitor : public AstVisitor<CountNegVisitor> {
+public:
+  using AstVisitor::AstVisitor;
+
+  static constexpr bool visits(AstNode::Kind kind) { return kind == AstNode::Kind::NegExpr; }
+
+  template <AstNode::Kind K>
+  bool pre(AstNodeIndex, const AstNode&) {
+    static_assert(K == AstNode::Kind::NegExpr);
+    ++negs;
+    return true;
+  }
+
+  std::size_t negs = 0;
+};
+
+void record_recursive(const Ast& ast, AstNodeIndex index, std::vector<std::pair<AstNode::Kind, bool>>& calls) {
+  calls.emplace_back(ast[index].kind, false);
+  ast.for_each_child(index, [&](AstNodeIndex child) { record_recursive(ast, child, calls); });
+  calls.emplace_back(ast[index].kind, true);
+}
+
+}  // namespace
+
+TEST(AstVisitor, Order) {
+  std::istringstream in(readme_source);
+  Lexer::Tokens tokens;
+  IdCache id_cache;
+  Lexer lexer(in, tokens, id_cache);
+  Ast ast;
+  Parser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+
+  std::vector<std::pair<AstNode::Kind, bool>> expected;
+  record_recursive(ast, global, expected);
+  RecordVisitor visitor(ast);
+  visitor.walk(global);
+  EXPECT_EQ(visitor.calls, expected);
+
+  // A skipped node still gets its post, its children nothing.
+  RecordVisitor skipping(ast);
+  skipping.skipped = AstNode::Kind::Function;
+  skipping.walk(global);
+  const auto functions = std::count(expected.begin(), expected.end(), std::make_pair(AstNode::Kind::Function, true));
+  EXPECT_GT(functions, 0);
+  EXPECT_EQ(std::count(skipping.calls.begin(), skipping.calls.end(), std::make_pair(AstNode::Kind::Function, true)),
+    functions);
+  EXPECT_EQ(std::count(skipping.calls.begin(), skipping.calls.end(), std::make_pair(AstNode::Kind::ReturnStmt, false)),
+    0);
+}
+
+TEST(AstVisitor, DeepTree) {
+  // Far deeper than native recursion would go.
+  static constexpr std::size_t Depth = 1000000;
+  Ast ast;
+  auto expr = ast.create(AstNode::Kind::I32Literal);
+  for (std::size_t i = 0; i < Depth; ++i) {
+    const auto neg = ast.create(AstNode::Kind::NegExpr);
+    ast[neg].neg_expr.expr = expr;
+    expr = neg;
+  }
+  CountNegVisitor visitor(ast);
+  visitor.walk(expr);
+  EXPECT_EQ(visitor.negs, Depth);
+}
+
+TEST(SourcePointFactory, Locate) {
+  IdCache id_cache;
+  SourcePointFactory source_points(id_cache);
+  const std::string first = "fun f() {\n  return 1\n}\n";
+  const std::string second = "\n\nvar x = 2;";
+  EXPECT_EQ(source_points.add_file("first.sl", 8, first), 0);
+  const auto second_begin = source_points.add_file("second.sl", 9, second);
+  EXPECT_EQ(second_begin, first.size());
+
+  const auto check = [&](SourceOffset offset, const char* file, LineNumber line, ColumnNumber col) {
+    const auto point = source_points.get(source_points.make(offset));
+    EXPECT_STREQ(id_cache.get(point.m_file).str, file) << offset;
+    EXPECT_EQ(point.m_line, line) << offset;
+    EXPECT_EQ(point.m_col, col) << offset;
+  };
+  check(0, "first.sl", 1, 1);
+  check(9, "first.sl", 1, 10);
+  check((SourceOffset)first.find("return"), "first.sl", 2, 3);
+  check((SourceOffset)first.size() - 1, "first.sl", 3, 2);
+  check(second_begin, "second.sl", 1, 1);
+  check(second_begin + (SourceOffset)second.find("x"), "second.sl", 3, 5);
+  EXPECT_EQ(source_points.getSourcePoints().size(), 6);
+  EXPECT_EQ(source_points.locate(second_begin + (SourceOffset)second.size()).m_file, IdIndex::undefined);
+}
+
+TEST(AstCache, RoundTrip) {
+  std::istringstream in(readme_source);
+  Lexer::Tokens tokens;
+  IdCache id_cache;
+  Lexer lexer(in, tokens, id_cache);
+  Ast ast;
+  Parser parser(lexer, ast, id_cache);
+  const auto global = parser.parse();
+  ast.remove(ast.create(AstNode::Kind::ExprStmt));
+  SourcePointFactory source_points(id_cache);
+  const auto f2_offset = (uint32_t)std::string_view(readme_source).find("fun f2");
+  source_points.make(source_points.add_file("readme.sl", 9, readme_source) + f2_offset);
+
+  const auto path = ::testing::TempDir() + "/readme.ast";
+  const auto key = AstCache::key(readme_source);
+  ASSERT_TRUE(AstCache::save(path.c_str(), key, ast, global, id_cache, source_points));
+  {
+    AstCache stale;
+    EXPECT_FALSE(stale.load(path.c_str(), key + 1));
+    AstCache missing;
+    EXPECT_FALSE(missing.load((path + ".missing").c_str(), key));
+    const auto broken_path = path + ".broken";
+    ASSERT_TRUE(AstCache::save(broken_path.c_str(), key, ast, AstNodeIndex(ast.size()), id_cache, source_points));
+    AstCache broken;
+    EXPECT_FALSE(broken.load(broken_path.c_str(), key));
+  }
+
+  AstCache cache;
+  ASSERT_TRUE(cache.load(path.c_str(), key));
+  auto& loaded = cache.get_ast();
+  auto& loaded_ids = cache.get_id_cache();
+  ASSERT_EQ(loaded.size(), ast.size());
+  ASSERT_EQ(cache.get_root(), global);
+  ASSERT_EQ(loaded_ids.size(), id_cache.size());
+  EXPECT_STREQ(loaded_ids.get(id_cache.get("f2")).str, "f2");
+  EXPECT_EQ(loaded.find_in_scope(global, loaded_ids.get("f2")), ast.find_in_scope(global, id_cache.get("f2")));
+
+  // Same nodes, same extra data, same scopes.
+  for (uint32_t i = 0; i < ast.size(); ++i) {
+    const AstNodeIndex index(i);
+    ASSERT_EQ(memcmp(&loaded[index], &ast[index], sizeof(AstNode)), 0) << "node " << i;
+    if (ast[index].is_scope()) {
+      EXPECT_EQ(loaded.get_scope_nodes(index), ast.get_scope_nodes(index));
+    }
+  }
+  EXPECT_EQ(loaded.get_extra_data(), ast.get_extra_data());
+  const auto f2 = ast.find_in_scope(global, id_cache.get("f2"));
+  EXPECT_EQ(body_stmts(loaded, f2).size(), 3);
+
+  // Lines need the text again.
+  auto& loaded_points = cache.get_source_points();
+  ASSERT_EQ(loaded_points.getSourcePoints().size(), 1);
+  EXPECT_STREQ(loaded_ids.get(loaded_points.get(0).m_file).str, "readme.sl");
+  EXPECT_EQ(loaded_points.get(0).m_line, 0);
+  loaded_points.set_text(0, readme_source);
+  EXPECT_EQ(loaded_points.get(0).m_line, source_points.get(0).m_line);
+  EXPECT_EQ(loaded_points.get(0).m_col, 1);
+
+  // The loaded Ast grows like any other, the free list came along.
+  const auto reused = loaded.create(AstNode::Kind::ReturnStmt);
+  EXPECT_LT(reused.get(), ast.size());
+  const auto added = loaded.create(AstNode::Kind::ReturnStmt);
+  EXPECT_EQ(added.get(), ast.size());
+  EXPECT_EQ(loaded[added].kind, AstNode::Kind::ReturnStmt);
+}
+
+// Kinds of the nodes below root in depth first order.
+static std::vector<AstNode::Kind> walk_kinds(const Ast& ast, AstNodeIndex root) {
+  std::vector<AstNode::Kind> kinds;
+  std::vector<AstNodeIndex> stack{root};
+  while (!stack.empty()) {
+    const auto index = stack.back();
+    stack.pop_back();
+    kinds.emplace_back(ast[index].kind);
+    ast.for_each_child(index, [&](AstNodeIndex child) { stack.push_back(child); });
+  }
+  return kinds;
+}
+
+TEST(Incremental, ReparseFunction) {
+  const std::string source =
+    "fun f1(a: i32): i32 {\n"
+    "  return a + 1\n"
+    "}\n"
+    "fun f2(b: i32): i32 {\n"
+    "  var c = b * 2;\n"
+    "  return f3(c)\n"
+    "}\n"
+    "fun f3(d: i32): i32 {\n"
+    "  return d - 3\n"
+    "}\n";
+  IdCache id_cache;
+  IncrementalUnit unit(source, id_cache);
+  auto& ast = unit.get_ast();
+  const auto global = unit.get_global_scope();
+  ASSERT_TRUE(unit.get_errors().empty());
+  ASSERT_EQ(unit.get_function_spans().size(), 3);
+  const auto f1 = ast.find_in_scope(global, id_cache.get("f1"));
+  const auto f2 = ast.find_in_scope(global, id_cache.get("f2"));
+  const auto f3 = ast.find_in_scope(global, id_cache.get("f3"));
+  const auto f3_return = body_stmts(ast, f3)[0];
+
+  // f2's body grows by a statement.
+  const std::string inserted = "  c += 40;\n";
+  const auto offset = (uint32_t)source.find("  return f3");
+  ASSERT_TRUE(unit.apply(TextEdit{offset, 0, inserted}));
+  EXPECT_TRUE(unit.get_errors().empty());
+  EXPECT_EQ(ast.find_in_scope(global, id_cache.get("f2")), f2);
+  EXPECT_EQ(body_stmts(ast, f3)[0], f3_return);
+  EXPECT_EQ(ast[f3_return].kind, AstNode::Kind::ReturnStmt);
+  const auto f2_body = body_stmts(ast, f2);
+  ASSERT_EQ(f2_body.size(), 3);
+  EXPECT_EQ(ast[ast[f2_body[1]].expr_stmt.expr].kind, AstNode::Kind::AddAssignExpr);
+  // The call in f2 still resolves to f3, declared behind it.
+  const auto& call = ast[ast[f2_body[2]].return_stmt.expr];
+  EXPECT_EQ(ast[call.call_expr.callee].name_expr.decl, f3);
+  // The new subtree of f2 is a region, the next edit of f2 releases it and
+  // creates the next one in the same chunk.
+  EXPECT_NE(ast.get_region(f2_body[0]), Ast::RootRegion);
+  EXPECT_EQ(ast.get_region(f2), Ast::RootRegion);
+  const auto size = ast.size();
+  ASSERT_TRUE(unit.apply(TextEdit{offset + (uint32_t)inserted.find("40") + 1, 1, "1"}));
+  EXPECT_EQ(ast.size(), size);
+  const auto& add = ast[ast[body_stmts(ast, f2)[1]].expr_stmt.expr];
+  EXPECT_EQ(ast[add.binary_expr.right].i32_literal.literal_value, 41);
+
+  // Same tree as a fresh parse of the new source.
+  IdCache fresh_ids;
+  IncrementalUnit fresh(unit.get_source(), fresh_ids);
+  EXPECT_EQ(walk_kinds(ast, global), walk_kinds(fresh.get_ast(), fresh.get_global_scope()));
+  EXPECT_EQ(unit.get_function_spans()[2].begin, fresh.get_function_spans()[2].begin);
+
+  // An error in f1 is reported at its new offset, and moves with later edits.
+  const auto f1_offset = (uint32_t)unit.get_source().find("a + 1");
+  ASSERT_TRUE(unit.apply(TextEdit{f1_offset, 5, "a +"}));
+  ASSERT_EQ(unit.get_errors().size(), 1);
+  const auto error_offset = unit.get_errors()[0].offset;
+  ASSERT_TRUE(unit.apply(TextEdit{(uint32_t)unit.get_source().find("d - 3"), 0, "1 + "}));
+  ASSERT_EQ(unit.get_errors().size(), 1);
+  EXPECT_EQ(unit.get_errors()[0].offset, error_offset);
+  EXPECT_EQ(ast.find_in_scope(global, id_cache.get("f1")), f1);
+
+  // Renaming a function needs the whole source.
+  EXPECT_FALSE(unit.apply(TextEdit{(uint32_t)unit.get_source().find("f3(d"), 2, "g3"}));
+  auto& renamed = unit.get_ast();
+  EXPECT_NE(renamed.find_in_scope(unit.get_global_scope(), id_cache.get("g3")), UndefinedAstNodeIndex);
+  EXPECT_EQ(renamed.find_in_scope(unit.get_global_scope(), id_cache.get("f3")), UndefinedAstNodeIndex);
+}
+
+TEST(Parser, ForwardReferences) {
+  const std::string source =
+    "fun f1(a: i32): i32 { var s: S; return f2(a) }\n"
+    "fun f2(b: i32): i32 { return b }\n"
+    "struct S { x: i32 }\n";
+  IdCache id_cache;
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  Ast ast;
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+  EXPECT_TRUE(parser.get_errors().empty());
+
+  const auto find = [&](const char* name) { return ast.find_in_scope(global, id_cache.get(name)); };
+  const auto f1 = find("f1");
+  const auto f1_body = body_stmts(ast, f1);
+  auto& s = ast[ast[f1_body[0]].variable_decl_stmt.variable];
+  EXPECT_EQ(s.kind, AstNode::Kind::LocalVariable);
+  EXPECT_EQ(ast[s.local_variable.value.type].named_type.decl, find("S"));
+  auto& call = ast[ast[f1_body[1]].return_stmt.expr];
+  EXPECT_EQ(ast[call.call_expr.callee].name_expr.decl, find("f2"));
+}
+
+TEST(Parser, Precedence) {
+  const std::string source = "fun f(a: i32, b: i32) { a = b = -1 + 2 * (3 - a) == 4 }";
+  IdCache id_cache;
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  Ast ast;
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+  EXPECT_TRUE(parser.get_errors().empty());
+
+  const auto f = ast.find_in_scope(global, id_cache.get("f"));
+  auto& assign = ast[ast[body_stmts(ast, f)[0]].expr_stmt.expr];
+  ASSERT_EQ(assign.kind, AstNode::Kind::AssignExpr);
+  auto& inner_assign = ast[assign.assign_expr.right];
+  ASSERT_EQ(inner_assign.kind, AstNode::Kind::AssignExpr);
+  auto& equal = ast[inner_assign.assign_expr.right];
+  ASSERT_EQ(equal.kind, AstNode::Kind::EqualExpr);
+  auto& add = ast[equal.equal_expr.left];
+  ASSERT_EQ(add.kind, AstNode::Kind::AddExpr);
+  EXPECT_EQ(ast[add.add_expr.left].kind, AstNode::Kind::NegExpr);
+  auto& mul = ast[add.add_expr.right];
+  ASSERT_EQ(mul.kind, AstNode::Kind::MulExpr);
+  auto& parenth = ast[mul.mul_expr.right];
+  ASSERT_EQ(parenth.kind, AstNode::Kind::ParenthExpr);
+  EXPECT_EQ(ast[parenth.parenth_expr.expr].kind, AstNode::Kind::SubExpr);
+}
+
+TEST(Parser, StructsAndClasses) {
+  const std::string source =
+    "struct P { x: i32, y: i32 }\n"
+    "union U { i: i32; f: f32 }\n"
+    "class C {\n"
+    "  constructor(a: i32) { this.a = a }\n"
+    "  fun get(): i32 { return a }\n"
+    "  a: i32\n"
+    "}\n"
+    "val origin: P\n"
+    "fun test(c: C) { if (c.get() >= 1) { c.a = 1 } else c.a = 2; while (c.a != 0) c.a -= 1 }\n";
+  IdCache id_cache;
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  Ast ast;
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+  EXPECT_TRUE(parser.get_errors().empty());
+
+  const auto find = [&](const char* name) { return ast.find_in_scope(global, id_cache.get(name)); };
+  const auto p = find("P");
+  ASSERT_EQ(ast[p].kind, AstNode::Kind::Struct);
+  const auto y = ast.find_in_scope(p, id_cache.get("y"));
+  EXPECT_EQ(ast[y].kind, AstNode::Kind::StructField);
+  EXPECT_EQ(ast[y].struct_field.offset, 1);
+  const auto f = ast.find_in_scope(find("U"), id_cache.get("f"));
+  EXPECT_EQ(ast[f].kind, AstNode::Kind::UnionField);
+  EXPECT_EQ(ast[ast[f].struct_field.value.type].kind, AstNode::Kind::F32Type);
+
+  const auto c = find("C");
+  ASSERT_EQ(ast[c].kind, AstNode::Kind::Class);
+  auto& members = ast.get_scope_nodes(c);
+  ASSERT_EQ(members.size(), 3);
+  EXPECT_EQ(ast[members[0]].kind, AstNode::Kind::Function);
+  EXPECT_EQ(ast[members[1]].kind, AstNode::Kind::Function);
+  EXPECT_EQ(ast[members[2]].kind, AstNode::Kind::StructField);
+  // The method sees the field declared behind it.
+  auto& get_return = ast[body_stmts(ast, members[1])[0]];
+  EXPECT_EQ(ast[get_return.return_stmt.expr].name_expr.decl, members[2]);
+
+  auto& origin = ast[find("origin")];
+  EXPECT_EQ(origin.kind, AstNode::Kind::GlobalVariable);
+  EXPECT_TRUE(origin.global_variable.is_val);
+
+  const auto test_body = body_stmts(ast, find("test"));
+  ASSERT_EQ(test_body.size(), 2);
+  auto& if_stmt = ast[test_body[0]];
+  ASSERT_EQ(if_stmt.kind, AstNode::Kind::IfElseStmt);
+  EXPECT_EQ(ast[if_stmt.if_else_stmt.expr].kind, AstNode::Kind::GreatOrEqualExpr);
+  EXPECT_EQ(ast[if_stmt.if_else_stmt.else_stmt].kind, AstNode::Kind::ExprStmt);
+  auto& while_stmt = ast[test_body[1]];
+  ASSERT_EQ(while_stmt.kind, AstNode::Kind::WhileStmt);
+  auto& sub_assign = ast[ast[while_stmt.while_stmt.stmt].expr_stmt.expr];
+  ASSERT_EQ(sub_assign.kind, AstNode::Kind::SubAssignExpr);
+  EXPECT_EQ(ast[sub_assign.binary_expr.left].kind, AstNode::Kind::MemberExpr);
+}
+
+TEST(Parser, Errors) {
+  const std::string source =
+    "fun f( { return }\n"
+    "fun g(): i32 { var = 1; 3 + ; return 2 }\n"
+    "} )\n"
+    "fun h() { val x = 1 val x = 2 }\n";
+  IdCache id_cache;
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  Ast ast;
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+
+  auto& errors = parser.get_errors();
+  ASSERT_EQ(errors.size(), 5);
+  EXPECT_EQ(errors[0].offset, 7);
+  EXPECT_EQ(errors[1].offset, 37);
+  EXPECT_EQ(errors[2].offset, 46);
+  EXPECT_EQ(errors[3].offset, 59);
+  EXPECT_STREQ(errors[4].message, "name already declared in this scope");
+
+  const auto find = [&](const char* name) { return ast.find_in_scope(global, id_cache.get(name)); };
+  const auto g = find("g");
+  ASSERT_NE(g, UndefinedAstNodeIndex);
+  const auto g_body = body_stmts(ast, g);
+  ASSERT_FALSE(g_body.empty());
+  EXPECT_EQ(ast[g_body.back()].kind, AstNode::Kind::ReturnStmt);
+  EXPECT_NE(find("h"), UndefinedAstNodeIndex);
+}
+
+TEST(Semantic, Check) {
+  const std::string source =
+    "struct P { x: i32 }\n"
+    "var g = 2;\n"
+    "val h: i32 = g + 1;\n"
+    "fun f1(a: i32, p: P): i32 {\n"
+    "  var c = a * g;\n"
+    "  c += p.x;\n"
+    "  p.y = 1;\n"
+    "  h = 3;\n"
+    "  print(\"{}\", c < a)\n"
+    "  return f2(c)\n"
+    "}\n"
+    "fun f2(a: i32, b: i32): i32 {\n"
+    "  var s: Q;\n"
+    "  if (a < b) return p\n"
+    "  return missing\n"
+    "}\n";
+  IdCache id_cache;
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  Ast ast;
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+  ASSERT_TRUE(parser.get_errors().empty());
+
+  ThreadPool pool(2);
+  SemanticPass pass(ast, id_cache);
+  pass.run(global, pool);
+  const auto errors = pass.get_errors();
+  std::vector<std::string> messages;
+  for (const auto& error : errors) messages.emplace_back(error.message);
+  EXPECT_EQ(messages, (std::vector<std::string>{"no member of that name", "assignment to a val",
+    "wrong number of arguments", "unknown type", "undeclared name", "undeclared name"}));
+
+  const auto find = [&](const char* name) { return ast.find_in_scope(global, id_cache.get(name)); };
+  const auto i32 = ast.get_primitive_type(AstNode::Kind::I32Type);
+  EXPECT_EQ(pass.get_globals().get_type(find("g")), i32);
+  ASSERT_EQ(pass.get_functions().size(), 2);
+  const auto& f1 = pass.get_functions()[0];
+  EXPECT_EQ(f1.function, find("f1"));
+  const auto body = body_stmts(ast, find("f1"));
+  // var c = a * g, inferred from the initializer.
+  EXPECT_EQ(f1.get_type(ast[body[0]].variable_decl_stmt.variable), i32);
+  // c += p.x
+  const auto& add = ast[ast[body[1]].expr_stmt.expr];
+  EXPECT_EQ(f1.get_type(add.binary_expr.right), i32);
+  EXPECT_EQ(f1.get_type(ast[add.binary_expr.right].member_expr.object), find("P"));
+  EXPECT_EQ(errors[0].node, ast[ast[body[2]].expr_stmt.expr].binary_expr.left);
+}
+
+TEST(Semantic, ThreadCountIndependent) {
+  std::string source = "struct P { x: i32 }\nvar g = 1;\n";
+  for (int i = 0; i < 300; ++i) {
+    const auto n = std::to_string(i);
+    source += "fun f" + n + "(a: i32, p: P): i32 {\n"
+      "  var c = a + g * " + n + ";\n"
+      "  c += p.x + p.z" + n + ";\n"
+      "  if (c > 10) return f" + std::to_string((i + 1) % 300) + "(c, p)\n"
+      "  return c\n"
+      "}\n";
+  }
+  IdCache id_cache;
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  Ast ast;
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+
+  const auto run = [&](std::size_t threads) {
+    ThreadPool pool(threads);
+    SemanticPass pass(ast, id_cache);
+    pass.run(global, pool);
+    std::vector<uint32_t> result;
+    for (const auto& function : pass.get_functions()) {
+      result.emplace_back(function.function.get());
+      for (const auto& type : function.types) {
+        result.emplace_back(type.node.get());
+        result.emplace_back(type.type.get());
+      }
+    }
+    for (const auto& error : pass.get_errors()) result.emplace_back(error.node.get());
+    return result;
+  };
+  const auto one = run(1);
+  EXPECT_EQ(one, run(4));
+  EXPECT_EQ(one, run(7));
+}
+
+// Parses, checks and lowers source into module, the errors of the code
+// generator.
+static std::vector<CodeGenError> lower_source(const std::string& source, IdCache& id_cache, Ast& ast,
+    ir::Module& module) {
+  auto store = lex_all(source, id_cache);
+  TokenStore::Reader reader(store);
+  TokenStoreParser parser(reader, ast, id_cache);
+  const auto global = parser.parse();
+  EXPECT_TRUE(parser.get_errors().empty());
+  ThreadPool pool(1);
+  SemanticPass pass(ast, id_cache);
+  pass.run(global, pool);
+  CodeGen codegen(ast, id_cache, pass);
+  const bool lowered = codegen.lower(module);
+  EXPECT_EQ(lowered, codegen.get_errors().empty());
+  return codegen.get_errors();
+}
+
+static int32_t run_i32(Vm& vm, IdCache& id_cache, const char* function, std::initializer_list<int32_t> args) {
+  std::vector<ir::Value> values;
+  for (const auto arg : args) values.emplace_back(ir::Value{.i_value = (uint32_t)arg, .type = ir::Type::I});
+  bool ok = false;
+  switch (values.size()) {
+    case 1: ok = vm.run(id_cache.get("mod"), id_cache.get(function), {values[0]}); break;
+    case 2: ok = vm.run(id_cache.get("mod"), id_cache.get(function), {values[0], values[1]}); break;
+    default: ADD_FAILURE() << "arguments"; break;
+  }
+  EXPECT_TRUE(ok) << function << ": " << (vm.get_error() ? vm.get_error() : "");
+  EXPECT_EQ(vm.get_result().type, ir::Type::I) << function;
+  return (int32_t)vm.get_result().i_value;
+}
+
+TEST(CodeGen, Readme) {
+  IdCache id_cache;
+  Ast ast;
+  ir::Context context;
+  auto& module = context.add_module(id_cache.get("mod"));
+  ASSERT_TRUE(lower_source(readme_source, id_cache, ast, module).empty());
+
+  // The loop of f2 compares at its bottom and jumps back to the inc before
+  // the body.
+  auto& f2 = module.get_function(module.find_function(id_cache.get("f2")));
+  EXPECT_EQ(f2.get_args_size(), 2);
+  std::vector<ir::Instr> instrs;
+  for (auto* node = f2.get_head(); node; node = node->m_next) instrs.emplace_back(node->m_instr);
+  const auto inc = std::find(instrs.begin(), instrs.end(), ir::Instr::inc);
+  ASSERT_NE(inc, instrs.end());
+  EXPECT_EQ(inc[-1], ir::Instr::label);
+  EXPECT_NE(std::find(inc, instrs.end(), ir::Instr::jl), instrs.end());
+  // 0, 100, 10 and the two pieces of the format.
+  EXPECT_EQ(f2.get_consts().size(), 5);
+
+  Vm vm(context, id_cache);
+  // f2 runs the loop 101 times from a = 1 + 2.
+  EXPECT_EQ(run_i32(vm, id_cache, "f1", {1, 2}), 3 + 101 * 12);
+  EXPECT_EQ(vm.get_output(), "result:1215\n");
+}
+
+TEST(CodeGen, ControlFlow) {
+  const std::string source =
+    "fun fib(n: i32): i32 {\n"
+    "  if (n < 2) return n\n"
+    "  return fib(n - 1) + fib(n - 2)\n"
+    "}\n"
+    "fun sum_below(n: i32): i32 {\n"
+    "  var s = 0;\n"
+    "  var i = 0;\n"
+    "  while (i < n) {\n"
+    "    s += i;\n"
+    "    i += 1;\n"
+    "  }\n"
+    "  return s\n"
+    "}\n"
+    "fun sign(x: i32): i32 {\n"
+    "  if (x > 0) return 1 else if (x == 0) return 0\n"
+    "  return -1\n"
+    "}\n"
+    "fun mix(a: i32, b: i32): i32 {\n"
+    "  var less = a < b;\n"
+    "  var c: i32;\n"
+    "  c = (a == b) + less * 10;\n"
+    "  return c + -a / 2\n"
+    "}\n"
+    "fun fall(a: i32): i32 {\n"
+    "  a = a * 2;\n"
+    "}\n"
+    "fun order(x: i32): i32 {\n"
+    "  var y = x + (x = 5);\n"
+    "  x += (x = 7);\n"
+    "  return y * 100 + x\n"
+    "}\n"
+    "fun bound(from: i32): i32 {\n"
+    "  var s = 0;\n"
+    "  for (i in from..2147483647) {\n"
+    "    s += 1;\n"
+    "    if (s > 5) return 99\n"
+    "  }\n"
+    "  return s\n"
+    "}\n";
+  IdCache id_cache;
+  Ast ast;
+  ir::Context context;
+  auto& module = context.add_module(id_cache.get("mod"));
+  ASSERT_TRUE(lower_source(source, id_cache, ast, module).empty());
+
+  Vm vm(context, id_cache);
+  EXPECT_EQ(run_i32(vm, id_cache, "fib", {15}), 610);
+  EXPECT_EQ(run_i32(vm, id_cache, "sum_below", {100}), 4950);
+  EXPECT_EQ(run_i32(vm, id_cache, "sum_below", {0}), 0);
+  EXPECT_EQ(run_i32(vm, id_cache, "sign", {7}), 1);
+  EXPECT_EQ(run_i32(vm, id_cache, "sign", {0}), 0);
+  EXPECT_EQ(run_i32(vm, id_cache, "sign", {-7}), -1);
+  EXPECT_EQ(run_i32(vm, id_cache, "mix", {3, 5}), 10 - 1);
+  EXPECT_EQ(run_i32(vm, id_cache, "mix", {4, 4}), 1 - 2);
+  EXPECT_EQ(run_i32(vm, id_cache, "fall", {4}), 0);
+  // The left operand is read before the right one assigns it.
+  EXPECT_EQ(run_i32(vm, id_cache, "order", {1}), 6 * 100 + 12);
+  // i stops at the largest i32 instead of wrapping around.
+  EXPECT_EQ(run_i32(vm, id_cache, "bound", {2147483646}), 2);
+  EXPECT_EQ(run_i32(vm, id_cache, "bound", {2147483647}), 1);
+
+  EXPECT_FALSE(vm.run(id_cache.get("mod"), id_cache.get("fib")));
+  EXPECT_STREQ(vm.get_error(), "wrong number of arguments");
+}
+
+TEST(CodeGen, Unsupported) {
+  const std::string source =
+    "struct P { x: i32 }\n"
+    "var g = 2;\n"
+    "fun f(p: P): i32 {\n"
+    "  return p.x + g\n"
+    "}\n"
+    "fun u(a: u32, b: u32): u32 {\n"
+    "  if (a > b) return b\n"
+    "  b /= a;\n"
+    "  return a / b\n"
+    "}\n";
+  IdCache id_cache;
+  Ast ast;
+  ir::Context context;
+  auto& module = context.add_module(id_cache.get("mod"));
+  const auto errors = lower_source(source, id_cache, ast, module);
+  ASSERT_EQ(errors.size(), 5);
+  EXPECT_STREQ(errors[0].message, "expression not supported by the code generator");
+  EXPECT_STREQ(errors[1].message, "only local variables are supported by the code generator");
+  // u32 would compare and divide as i32.
+  EXPECT_STREQ(errors[2].message, "unsigned comparison not supported by the code generator");
+  EXPECT_STREQ(errors[3].message, "unsigned division not supported by the code generator");
+  EXPECT_STREQ(errors[4].message, "unsigned division not supported by the code generator");
+}
+
+static std::size_t instrs_count(ir::Function& function) {
+  std::size_t count = 0;
+  for (auto* node = function.get_head(); node; node = node->m_next) count += node->m_instr != ir::Instr::label;
+  return count;
+}
+
+TEST(IrPasses, Fold) {
+  const std::string source =
+    "fun consts(n: i32): i32 {\n"
+    "  var a = 6 * 7;\n"
+    "  var b = a - 2;\n"
+    "  var s = 0;\n"
+    "  if (b > 100) s = 5 else s = 1\n"
+    "  for (i in 0..10) {\n"
+    "    s += i * b;\n"
+    "  }\n"
+    "  return s + n\n"
+    "}\n"
+    "fun dead(n: i32): i32 {\n"
+    "  var x = n * 2;\n"
+    "  var y = x + 1;\n"
+    "  return n\n"
+    "}\n";
+  IdCache id_cache;
+  Ast ast;
+  ir::Context context;
+  auto& module = context.add_module(id_cache.get("mod"));
+  ASSERT_TRUE(lower_source(source, id_cache, ast, module).empty());
+  auto& consts = module.get_function(module.find_function(id_cache.get("consts")));
+  auto& dead = module.get_function(module.find_function(id_cache.get("dead")));
+  EXPECT_EQ(instrs_count(consts), 21u);
+
+  ir::PassManager passes;
+  passes.run(module);
+  // a and b fold, the if goes with its else, so does the check before the
+  // loop: what is left is the jump into the loop, the loop and the return.
+  EXPECT_EQ(instrs_count(consts), 11u);
+  ASSERT_EQ(instrs_count(dead), 1u);
+  EXPECT_EQ(dead.get_head()->m_instr, ir::Instr::ret);
+  EXPECT_EQ(passes.get_stats(ir::Pass::ConstantFolding).rewritten, 3u);
+  EXPECT_EQ(passes.get_stats(ir::Pass::ConstantFolding).removed, 1u);
+  EXPECT_EQ(passes.get_stats(ir::Pass::UnreachableBlocks).removed, 3u);
+  EXPECT_GT(passes.get_stats(ir::Pass::DeadCode).removed, 0u);
+
+  Vm vm(context, id_cache);
+  EXPECT_EQ(run_i32(vm, id_cache, "consts", {5}), 1 + 40 * 55 + 5);
+  EXPECT_EQ(run_i32(vm, id_cache, "dead", {5}), 5);
+}
+
+TEST(IrPasses, SameResults) {
+  IdCache id_cache;
+  Ast ast;
+  ir::Context context;
+  auto& module = context.add_module(id_cache.get("mod"));
+  const std::string source = std::string(readme_source) +
+    "fun sum(n: i32): i32 {\n"
+    "  var s = 0;\n"
+    "  for (i in 1..n) {\n"
+    "    s += i * 3 + 7;\n"
+    "  }\n"
+    "  return s\n"
+    "}\n"
+    "fun nested(n: i32): i32 {\n"
+    "  var s = 0;\n"
+    "  for (i in 0..n) {\n"
+    "    for (j in 0..n) {\n"
+    "      s += i - j;\n"
+    "      if (s > 100000) s -= 100000\n"
+    "    }\n"
+    "  }\n"
+    "  return s\n"
+    "}\n"
+    "fun fib(n: i32): i32 {\n"
+    "  if (n < 2) return n\n"
+    "  var a = n - 1;\n"
+    "  var b = a;\n"
+    "  return fib(b) + fib(n - 2)\n"
+    "}\n";
+  ASSERT_TRUE(lower_source(source, id_cache, ast, module).empty());
+  ir::PassManager passes;
+  passes.run(module);
+  // The copy of a in b goes, a is passed instead.
+  EXPECT_GT(passes.get_stats(ir::Pass::CopyPropagation).rewritten, 0u);
+
+  Vm vm(context, id_cache);
+  EXPECT_EQ(run_i32(vm, id_cache, "f1", {1, 2}), 3 + 101 * 12);
+  EXPECT_EQ(vm.get_output(), "result:1215\n");
+  EXPECT_EQ(run_i32(vm, id_cache, "sum", {100}), 3 * 5050 + 700);
+  EXPECT_EQ(run_i32(vm, id_cache, "nested", {50}), 0);
+  EXPECT_EQ(run_i32(vm, id_cache, "fib", {15}), 610);
+}
+
+TEST(IrPasses, Switches) {
+  using namespace ir;
+  IdCache id_cache;
+  Module module(id_cache.get("mod"));
+  auto builder = FunctionBuilder(id_cache.get("f"))
+    .set_args_size(1)
+    .set_locals_size(2)
+    .add_const(Value{.i_value = 2, .type = Type::I});
+  auto& f = module.add_function(std::move(builder));
+  // A jump to the next instruction, a mov of a slot to itself and code
+  // after the return.
+  auto& jmp = (NodeArgs<1>&)f.add(Instr::jmp, Type::V, Arg{});
+  jmp.args[0].node_pointer = &f.add(Instr::label, Type::V);
+  f.add(Instr::mov, Type::I, Arg{.local_index = 0}, Arg{.local_index = 0});
+  f.add(Instr::ldc, Type::I, Arg{.local_index = 1}, Arg{.local_index = 0});
+  f.add(Instr::add, Type::I, Arg{.local_index = 2}, Arg{.local_index = 0}, Arg{.local_index = 1});
+  f.add(Instr::ret, Type::I, Arg{.local_index = 2});
+  f.add(Instr::inc, Type::I, Arg{.local_index = 2});
+  f.add(Instr::ret, Type::I, Arg{.local_index = 2});
+
+  PassManager none;
+  for (auto pass : {Pass::ConstantFolding, Pass::CopyPropagation, Pass::UnreachableBlocks, Pass::DeadCode}) {
+    none.enable(pass, false);
+  }
+  none.run(f);
+  EXPECT_EQ(instrs_count(f), 7u);
+
+  PassManager unreachable;
+  unreachable.enable(Pass::CopyPropagation, false);
+  unreachable.run(f);
+  // jmp, inc and the second ret.
+  EXPECT_EQ(unreachable.get_stats(Pass::UnreachableBlocks).removed, 3u);
+  EXPECT_EQ(unreachable.get_stats(Pass::CopyPropagation).removed, 0u);
+  EXPECT_EQ(instrs_count(f), 4u);
+
+  PassManager all;
+  all.run(f);
+  EXPECT_EQ(all.get_stats(Pass::CopyPropagation).removed, 1u);
+  EXPECT_EQ(instrs_count(f), 3u);
 }
 
 TEST(Ir, Simple) {
@@ -267,6 +1698,35 @@ TEST(Ir, Compact) {
   f.compact();
 }
 
+TEST(Ir, ManyNodes) {
+  using namespace ir;
+  IdCache id_cache;
+  Module m(id_cache.get("mod"));
+  auto builder = FunctionBuilder(id_cache.get("big")).set_locals_size(3);
+  auto& f = m.add_function(std::move(builder));
+  // Far more than the first chunk of the function's arena.
+  auto& first = f.add(Instr::label, Type::V);
+  for (uint16_t i = 0; i < 10000; ++i) {
+    f.add(Instr::add, Type::I, Arg{.local_index = 0}, Arg{.local_index = 1}, Arg{.local_index = i});
+    f.add(Instr::jnz, Type::I, Arg{.node_pointer = &first}, Arg{.local_index = 2});
+  }
+  EXPECT_EQ(f.get_head(), &first);
+  std::size_t count = 0;
+  const Node* prev = nullptr;
+  for (auto* node = f.get_head(); node; node = node->m_next) {
+    EXPECT_EQ(node->m_prev, prev);
+    if (node->m_instr == Instr::add) {
+      EXPECT_EQ(((NodeArgs<3>*)node)->args[2].local_index, count / 2);
+    } else if (node->m_instr == Instr::jnz) {
+      EXPECT_EQ(((NodeArgs<2>*)node)->args[0].node_pointer, &first);
+    }
+    prev = node;
+    count += node->m_instr != Instr::label;
+  }
+  EXPECT_EQ(count, 20000);
+  EXPECT_EQ(f.get_tail(), prev);
+}
+
 TEST(Ir, Test) {
   using namespace ir;
   IdCache id_cache;
@@ -309,11 +1769,240 @@ TEST(Vm, Test) {
     .add_const(Value{.i_value = 100});
 
   auto& fun = mod.add_function(std::move(fun_builder));
-  fun.add(Instr::add, Type::I, Arg{.local_index = 3}, Arg{.local_index = 0}, Arg{.local_index = 1});
-  fun.add(Instr::ret, Type::I, Arg{.local_index = 3});
+  fun.add(Instr::ldc, Type::I, Arg{.local_index = 2}, Arg{.local_index = 0});
+  fun.add(Instr::add, Type::I, Arg{.local_index = 2}, Arg{.local_index = 2}, Arg{.local_index = 0});
+  fun.add(Instr::add, Type::I, Arg{.local_index = 2}, Arg{.local_index = 2}, Arg{.local_index = 1});
+  fun.add(Instr::ret, Type::I, Arg{.local_index = 2});
 
   Vm vm(context);
-  vm.run(id_cache.get("example"), id_cache.get("main"));
+  ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get("main"), {Value{.i_value = 20, .type = Type::I}, Value{.i_value = 3, .type = Type::I}}));
+  EXPECT_EQ(vm.get_result().type, Type::I);
+  EXPECT_EQ(vm.get_result().i_value, 123);
+  EXPECT_FALSE(vm.run(id_cache.get("example"), id_cache.get("missing")));
+}
+
+TEST(Vm, WideJumps) {
+  using namespace ir;
+  Context context;
+  IdCache id_cache;
+  auto& mod = context.add_module(id_cache.get("example"));
+  auto fun_builder = FunctionBuilder(id_cache.get("main"))
+    .set_args_size(1)
+    .set_locals_size(2)
+    .add_const(Value{.i_value = 1, .type = Type::I})
+    .add_const(Value{.i_value = 0, .type = Type::I});
+  auto& fun = mod.add_function(std::move(fun_builder));
+
+  // Each block of adds is 72000 bytes, the forward jumps go past 64 KiB.
+  static constexpr int Adds = 9000;
+  fun.add(Instr::ldc, Type::I, Arg{.local_index = 1}, Arg{.local_index = 1});
+  fun.add(Instr::ldc, Type::I, Arg{.local_index = 2}, Arg{.local_index = 0});
+  auto& jz = (NodeArgs<2>&)fun.add(Instr::jz, Type::I, Arg{}, Arg{.local_index = 0});
+  auto& top = fun.add(Instr::label, Type::V);
+  for (int i = 0; i < Adds; ++i) {
+    fun.add(Instr::add, Type::I, Arg{.local_index = 1}, Arg{.local_index = 1}, Arg{.local_index = 2});
+  }
+  fun.add(Instr::dec, Type::I, Arg{.local_index = 0});
+  fun.add(Instr::jnz, Type::I, Arg{.node_pointer = &top}, Arg{.local_index = 0});
+  auto& jmp = (NodeArgs<1>&)fun.add(Instr::jmp, Type::V, Arg{});
+  for (int i = 0; i < Adds; ++i) {
+    fun.add(Instr::add, Type::I, Arg{.local_index = 1}, Arg{.local_index = 1}, Arg{.local_index = 1});
+  }
+  auto& end = fun.add(Instr::label, Type::V);
+  jz.args[0].node_pointer = &end;
+  jmp.args[0].node_pointer = &end;
+  fun.add(Instr::ret, Type::I, Arg{.local_index = 1});
+
+  Vm vm(context);
+  ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get("main"), {Value{.i_value = 3, .type = Type::I}}));
+  EXPECT_EQ(vm.get_result().i_value, 3u * Adds);
+  const auto& code = fun.get_compacted_code();
+  EXPECT_EQ(code.size(), 12u + 8 + Adds * 8 + 4 + 6 + 6 + Adds * 8 + 4);
+  // jz is wide, jnz goes back to a short target, jmp is wide again.
+  EXPECT_EQ(code[12], (uint8_t)Instr::jz);
+  EXPECT_EQ(code[13], (uint8_t)Type::I | WideJump);
+  EXPECT_EQ(code[20 + Adds * 8 + 4 + 1], (uint8_t)Type::I);
+  EXPECT_EQ(code[20 + Adds * 8 + 10 + 1], (uint8_t)Type::V | WideJump);
+  ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get("main"), {Value{.i_value = 0, .type = Type::I}}));
+  EXPECT_EQ(vm.get_result().i_value, 0u);
+}
+
+TEST(Vm, Superinstructions) {
+  using namespace ir;
+  Context context;
+  IdCache id_cache;
+  auto& mod = context.add_module(id_cache.get("example"));
+  // s = 0; i = 0; do { s += 3 } while (++i <= n); return s
+  auto build = [&](const char* name) -> Function& {
+    auto fun_builder = FunctionBuilder(id_cache.get(name))
+      .set_args_size(1)
+      .set_locals_size(3)
+      .add_const(Value{.i_value = 0, .type = Type::I})
+      .add_const(Value{.i_value = 3, .type = Type::I});
+    auto& fun = mod.add_function(std::move(fun_builder));
+    fun.add(Instr::ldc, Type::I, Arg{.local_index = 1}, Arg{.local_index = 0});
+    fun.add(Instr::ldc, Type::I, Arg{.local_index = 2}, Arg{.local_index = 0});
+    auto& top = fun.add(Instr::label, Type::V);
+    fun.add(Instr::ldc, Type::I, Arg{.local_index = 3}, Arg{.local_index = 1});
+    fun.add(Instr::add, Type::I, Arg{.local_index = 2}, Arg{.local_index = 2}, Arg{.local_index = 3});
+    fun.add(Instr::inc, Type::I, Arg{.local_index = 1});
+    fun.add(Instr::jle, Type::I, Arg{.node_pointer = &top}, Arg{.local_index = 1}, Arg{.local_index = 0});
+    fun.add(Instr::mov, Type::I, Arg{.local_index = 3}, Arg{.local_index = 2});
+    fun.add(Instr::ret, Type::I, Arg{.local_index = 3});
+    return fun;
+  };
+  auto& fused = build("fused");
+  auto& plain = build("plain");
+  plain.compact(false);
+
+  Vm vm(context);
+  ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get("fused"), {Value{.i_value = 9, .type = Type::I}}));
+  EXPECT_EQ(vm.get_result().i_value, 30u);
+  EXPECT_EQ(vm.get_dispatches(), 2u + 10 * 2 + 1);
+  ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get("plain"), {Value{.i_value = 9, .type = Type::I}}));
+  EXPECT_EQ(vm.get_result().i_value, 30u);
+  EXPECT_EQ(vm.get_dispatches(), 2u + 10 * 4 + 2);
+
+  // ldc ldc ldcadd incjle ret
+  const auto& code = fused.get_compacted_code();
+  ASSERT_EQ(code.size(), 6u + 6 + 10 + 8 + 4);
+  EXPECT_EQ(code[12], (uint8_t)Instr::ldcadd);
+  EXPECT_EQ(code[22], (uint8_t)Instr::incjle);
+  EXPECT_EQ(code[30], (uint8_t)Instr::ret);
+  EXPECT_EQ(code[32], 2u);
+  EXPECT_EQ(plain.get_compacted_code().size(), 6u + 6 + 6 + 8 + 4 + 8 + 6 + 4);
+}
+
+TEST(Vm, SuperinstructionsAndTargets) {
+  using namespace ir;
+  Context context;
+  IdCache id_cache;
+  auto& mod = context.add_module(id_cache.get("example"));
+  // i = 0; goto check; top: ++i; check: if (i < n) goto top; return i
+  // The jl is a target itself, the inc before it mustn't take it in.
+  auto build = [&](const char* name) -> Function& {
+    auto fun_builder = FunctionBuilder(id_cache.get(name))
+      .set_args_size(1)
+      .set_locals_size(1)
+      .add_const(Value{.i_value = 0, .type = Type::I});
+    auto& fun = mod.add_function(std::move(fun_builder));
+    fun.add(Instr::ldc, Type::I, Arg{.local_index = 1}, Arg{.local_index = 0});
+    auto& jmp = (NodeArgs<1>&)fun.add(Instr::jmp, Type::V, Arg{});
+    auto& top = fun.add(Instr::label, Type::V);
+    fun.add(Instr::inc, Type::I, Arg{.local_index = 1});
+    auto& check = fun.add(Instr::jl, Type::I, Arg{.node_pointer = &top}, Arg{.local_index = 1}, Arg{.local_index = 0});
+    jmp.args[0].node_pointer = &check;
+    fun.add(Instr::ret, Type::I, Arg{.local_index = 1});
+    return fun;
+  };
+  auto& fused = build("fused");
+  build("plain").compact(false);
+
+  Vm vm(context);
+  for (const char* name : {"fused", "plain"}) {
+    for (const uint32_t n : {0u, 3u}) {
+      ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get(name), {Value{.i_value = n, .type = Type::I}}));
+      EXPECT_EQ(vm.get_result().i_value, n) << name;
+    }
+  }
+  // ldc jmp inc jlinc ret: the jl goes to the inc and does it as it jumps.
+  const auto& code = fused.get_compacted_code();
+  ASSERT_EQ(code.size(), 6u + 4 + 4 + 8 + 4);
+  EXPECT_EQ(code[10], (uint8_t)Instr::inc);
+  EXPECT_EQ(code[14], (uint8_t)Instr::jlinc);
+  // ldc, jmp, (inc, jl) 3 times and the jl out, ret; jlinc runs for both.
+  EXPECT_EQ(vm.get_dispatches(), 2u + 3 * 2 + 1 + 1);
+  ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get("fused"), {Value{.i_value = 3, .type = Type::I}}));
+  EXPECT_EQ(vm.get_dispatches(), 2u + 3 + 1 + 1);
+
+  // i = 0; if (i < n) goto top; return i; top: ++i; if (i < n) goto top; return i
+  // The first jl becomes a jlinc that lands on the second one, the inc before
+  // that mustn't take it in.
+  auto build_entry = [&](const char* name) -> Function& {
+    auto fun_builder = FunctionBuilder(id_cache.get(name))
+      .set_args_size(1)
+      .set_locals_size(1)
+      .add_const(Value{.i_value = 0, .type = Type::I});
+    auto& fun = mod.add_function(std::move(fun_builder));
+    fun.add(Instr::ldc, Type::I, Arg{.local_index = 1}, Arg{.local_index = 0});
+    auto& enter = (NodeArgs<3>&)fun.add(Instr::jl, Type::I, Arg{}, Arg{.local_index = 1}, Arg{.local_index = 0});
+    fun.add(Instr::ret, Type::I, Arg{.local_index = 1});
+    auto& top = fun.add(Instr::label, Type::V);
+    enter.args[0].node_pointer = &top;
+    fun.add(Instr::inc, Type::I, Arg{.local_index = 1});
+    fun.add(Instr::jl, Type::I, Arg{.node_pointer = &top}, Arg{.local_index = 1}, Arg{.local_index = 0});
+    fun.add(Instr::ret, Type::I, Arg{.local_index = 1});
+    return fun;
+  };
+  auto& entry = build_entry("entry_fused");
+  build_entry("entry_plain").compact(false);
+  for (const char* name : {"entry_fused", "entry_plain"}) {
+    for (const uint32_t n : {0u, 1u, 3u}) {
+      ASSERT_TRUE(vm.run(id_cache.get("example"), id_cache.get(name), {Value{.i_value = n, .type = Type::I}}));
+      EXPECT_EQ(vm.get_result().i_value, n) << name << " " << n;
+    }
+  }
+  // ldc jlinc ret inc jlinc ret
+  const auto& entry_code = entry.get_compacted_code();
+  ASSERT_EQ(entry_code.size(), 6u + 8 + 4 + 4 + 8 + 4);
+  EXPECT_EQ(entry_code[6], (uint8_t)Instr::jlinc);
+  EXPECT_EQ(entry_code[18], (uint8_t)Instr::inc);
+  EXPECT_EQ(entry_code[22], (uint8_t)Instr::jlinc);
+}
+
+TEST(ThreadPool, ParallelFor) {
+  ThreadPool pool(4);
+  std::vector<int> values(1000);
+  pool.parallel_for(values.size(), [&](size_t i) { values[i] = (int)i * 2; });
+  for (size_t i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(values[i], (int)i * 2);
+  }
+}
+
+TEST(ThreadPool, NestedSubmit) {
+  ThreadPool pool(3);
+  std::atomic<int> count{0};
+  for (int i = 0; i < 10; ++i) {
+    pool.submit([&] {
+      for (int j = 0; j < 10; ++j) {
+        pool.submit([&] { ++count; });
+      }
+    });
+  }
+  pool.wait();
+  EXPECT_EQ(count.load(), 100);
+}
+
+TEST(Driver, Files) {
+  const std::string dir = ::testing::TempDir();
+  std::vector<std::string> paths;
+  for (int i = 0; i < 8; ++i) {
+    paths.emplace_back(dir + "/driver_" + std::to_string(i) + ".sl");
+    std::ofstream out(paths.back());
+    out << "fun shared(a: i32) { return a + " << i << " }\n";
+  }
+  paths.emplace_back(dir + "/driver_missing.sl");
+
+  ConcurrentIdCache id_cache;
+  Driver driver(id_cache, 3);
+  const auto report = driver.run(paths);
+  EXPECT_EQ(report.files, 9);
+  EXPECT_EQ(report.failed_files, 1);
+  EXPECT_EQ(report.tokens, 8 * 14);
+  EXPECT_EQ(report.parse_errors, 0);
+  EXPECT_EQ(report.threads, 3);
+
+  auto& units = driver.get_units();
+  ASSERT_EQ(units.size(), 9);
+  const auto shared = id_cache.get("shared");
+  for (int i = 0; i < 8; ++i) {
+    auto& tokens = units[i]->tokens;
+    ASSERT_EQ(tokens.size(), 14);
+    EXPECT_EQ(units[i]->path, paths[i]);
+    EXPECT_EQ(tokens.get(TokenIndex(1)).id, shared);
+    EXPECT_EQ(tokens.get(TokenIndex(11)).i32, i);
+  }
+  EXPECT_FALSE(units[8]->opened);
 }
 
 int main(int argc, char* argv[]) {
@@ -0,0 +1,184 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Every worker owns a deque: it takes its own
+// newest task first and, when out of work, steals the oldest task of
+// another worker. Tasks submitted from a worker go to that worker's deque,
+// tasks from other threads are spread round robin. Submitting and claiming
+// only touch the deque locks and atomic counters; the pool-wide mutex is
+// for parking idle workers and waking them up.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(std::size_t threads_count = default_threads_count()) {
+    if (threads_count == 0) threads_count = 1;
+    m_workers.reserve(threads_count);
+    for (std::size_t i = 0; i < threads_count; ++i) {
+      m_workers.emplace_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < threads_count; ++i) {
+      m_workers[i]->thread = std::thread([this, i] { run(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool(ThreadPool&&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool& operator=(ThreadPool&&) = delete;
+
+  ~ThreadPool() {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_work_available.notify_all();
+    for (auto& worker : m_workers) {
+      worker->thread.join();
+    }
+  }
+
+  static std::size_t default_threads_count() {
+    const auto count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+  }
+
+  std::size_t size() const { return m_workers.size(); }
+
+  void submit(Task task) {
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    const auto index = s_worker_pool == this
+      ? s_worker_index
+      : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    {
+      auto& worker = *m_workers[index];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.tasks.emplace_back(std::move(task));
+    }
+    m_queued.fetch_add(1, std::memory_order_seq_cst);
+    // A worker parks after counting itself sleeping and seeing nothing
+    // queued, both under m_mutex, so taking it here can't miss that worker.
+    if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+      { std::lock_guard<std::mutex> lock(m_mutex); }
+      m_work_available.notify_one();
+    }
+  }
+
+  // Blocks until every submitted task, including the ones submitted by
+  // tasks, has finished. Must not be called from a task.
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_all_done.wait_for(lock, WaitSlice, [this] { return m_pending.load(std::memory_order_acquire) == 0; })) {}
+  }
+
+  // Runs fn(i) for every i in [0, count) and waits for all of them.
+  template <typename Fn>
+  void parallel_for(std::size_t count, Fn&& fn) {
+    for (std::size_t i = 0; i < count; ++i) {
+      submit([&fn, i] { fn(i); });
+    }
+    wait();
+  }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<std::size_t> m_next_worker{0};
+  std::atomic<std::size_t> m_pending{0};
+  std::mutex m_mutex;
+  std::condition_variable m_work_available;
+  std::condition_variable m_all_done;
+  // Tasks sitting in the deques that no worker has claimed yet.
+  std::atomic<std::size_t> m_queued{0};
+  // Workers parked on m_work_available.
+  std::atomic<std::size_t> m_sleeping{0};
+  // Guarded by m_mutex.
+  bool m_stop = false;
+
+  // Waits go through wait_for: condition_variable::wait(unique_lock&) is a
+  // GLIBCXX_3.4.30 symbol, which older libstdc++ runtimes loaded next to
+  // prebuilt libraries (GTest) don't have, while wait_for is header only.
+  static constexpr std::chrono::milliseconds WaitSlice{100};
+
+  static inline thread_local ThreadPool* s_worker_pool = nullptr;
+  static inline thread_local std::size_t s_worker_index = 0;
+
+  // Claims one queued task, pop is then bound to find one.
+  bool claim() {
+    auto queued = m_queued.load(std::memory_order_relaxed);
+    while (queued > 0 && !m_queued.compare_exchange_weak(queued, queued - 1, std::memory_order_acq_rel)) {}
+    return queued > 0;
+  }
+
+  bool pop(std::size_t index, Task& task) {
+    {
+      auto& own = *m_workers[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (std::size_t i = 1; i < m_workers.size(); ++i) {
+      auto& victim = *m_workers[(index + i) % m_workers.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(std::size_t index) {
+    s_worker_pool = this;
+    s_worker_index = index;
+    Task task;
+
+    while (true) {
+      if (!claim()) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+        while (!m_work_available.wait_for(lock, WaitSlice, [this] {
+          return m_stop || m_queued.load(std::memory_order_seq_cst) > 0;
+        })) {}
+        m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+        if (m_stop && m_queued.load(std::memory_order_relaxed) == 0)
+          return;
+        continue;
+      }
+      while (!pop(index, task)) {
+        std::this_thread::yield();
+      }
+      task();
+      task = nullptr;
+
+      if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_all_done.notify_all();
+      }
+    }
+  }
+};
+
+#endif  // THREAD_POOL_HPP
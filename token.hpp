@@ -1,23 +1,25 @@
 #ifndef TOKEN_HPP
 #define TOKEN_HPP
 
-#include <string>
-#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <string_view>
 #include <type_traits>
 #include "id_index.hpp"
 #include "strong_type.hpp"
 
 class Token {
 public:
-  enum class Kind {
-    None, Fun, Class, Struct, Union, Return, Var, Val,
+  enum class Kind : uint8_t {
+    None, Fun, Class, Struct, Union, Return, Var, Val, If, Else, While, For, In,
     Id, StringLiteral, I32Literal, 
     LeftParen, RightParen, LeftBrace, RightBrace, 
-    Add, Sub, Mul, Div, Assign, Equals, Great, Less, GreatOrEqual, LessOrEqual,
+    Add, Sub, Mul, Div, Assign, Equals, NotEquals, Great, Less, GreatOrEqual, LessOrEqual,
+    AddAssign, SubAssign, MulAssign, DivAssign,
     I32, I16, I8, U32, U16, U8, F32, F64,
-    Eof, Colon, Semicolon, Unknown};
+    Eof, Colon, Semicolon, Comma, Dot, DotDot, Unknown};
 
-  Token(Kind kind) : m_kind(kind) {}
+  Token(Kind kind) : m_kind(kind), u32(0) {}
   Token(const Token&) = default;
   Token(Token&&) = default;
   Token& operator=(const Token&) = default;
@@ -27,14 +29,8 @@ public:
     return m_kind;
   }
 
-  static Token::Kind id_2_token_kind(const std::string& text) {
-    auto it = s_keywords.find(text);
+  static constexpr Token::Kind id_2_token_kind(std::string_view text);
 
-    if (it == s_keywords.end())
-      return Token::Kind::Id;
-
-    return it->second;
-  }
   Kind m_kind;
   union {
     IdIndex id; 
@@ -46,11 +42,112 @@ public:
     uint8_t u8;
     IdIndex str;
   };
-private:
-  using Keywords = std::unordered_map<std::string, Token::Kind>;
-  static const Keywords s_keywords;
 };
 
+namespace keywords {
+
+struct Keyword {
+  std::string_view text;
+  Token::Kind kind;
+};
+
+// The only list of keywords, the lookup table below is generated from it.
+inline constexpr Keyword list[] = {
+  {"struct", Token::Kind::Struct},
+  {"class", Token::Kind::Class},
+  {"var", Token::Kind::Var},
+  {"val", Token::Kind::Val},
+  {"union", Token::Kind::Union},
+  {"fun", Token::Kind::Fun},
+  {"return", Token::Kind::Return},
+  {"if", Token::Kind::If},
+  {"else", Token::Kind::Else},
+  {"while", Token::Kind::While},
+  {"for", Token::Kind::For},
+  {"in", Token::Kind::In},
+  {"i32", Token::Kind::I32},
+  {"i16", Token::Kind::I16},
+  {"i8", Token::Kind::I8},
+  {"u32", Token::Kind::U32},
+  {"u16", Token::Kind::U16},
+  {"u8", Token::Kind::U8},
+  {"f32", Token::Kind::F32},
+  {"f64", Token::Kind::F64},
+};
+
+inline constexpr std::size_t count = sizeof(list) / sizeof(list[0]);
+
+constexpr std::size_t min_length() {
+  std::size_t result = list[0].text.size();
+  for (const auto& keyword : list) result = keyword.text.size() < result ? keyword.text.size() : result;
+  return result;
+}
+
+constexpr std::size_t max_length() {
+  std::size_t result = 0;
+  for (const auto& keyword : list) result = keyword.text.size() > result ? keyword.text.size() : result;
+  return result;
+}
+
+// The table has at least twice as many slots as there are keywords.
+constexpr uint32_t table_bits() {
+  uint32_t bits = 1;
+  while ((std::size_t(1) << bits) < count * 2) ++bits;
+  return bits;
+}
+
+inline constexpr uint32_t bits = table_bits();
+inline constexpr std::size_t table_size = std::size_t(1) << bits;
+
+// Multiplicative hash of the length and the first, second and last chars.
+constexpr uint32_t hash(std::string_view text, uint32_t seed) {
+  const uint32_t key = (uint32_t)(uint8_t)text[0]
+    | (uint32_t)(uint8_t)text[1] << 8
+    | (uint32_t)(uint8_t)text[text.size() - 1] << 16
+    | (uint32_t)text.size() << 24;
+  return (key * seed) >> (32 - bits);
+}
+
+constexpr bool is_perfect(uint32_t seed) {
+  std::array<bool, table_size> used{};
+  for (const auto& keyword : list) {
+    const auto h = hash(keyword.text, seed);
+    if (used[h]) return false;
+    used[h] = true;
+  }
+  return true;
+}
+
+constexpr uint32_t find_seed() {
+  for (uint32_t seed = 0x9e3779b1; seed < 0x9e3779b1 + 100000; seed += 2) {
+    if (is_perfect(seed)) return seed;
+  }
+  return 0;
+}
+
+inline constexpr uint32_t seed = find_seed();
+static_assert(seed != 0, "no perfect hash seed for the keyword list, grow table_bits");
+static_assert(min_length() >= 2, "hash reads the second char of every keyword");
+
+constexpr std::array<Keyword, table_size> make_table() {
+  std::array<Keyword, table_size> table{};
+  for (auto& slot : table) slot.kind = Token::Kind::Id;
+  for (const auto& keyword : list) table[hash(keyword.text, seed)] = keyword;
+  return table;
+}
+
+inline constexpr std::array<Keyword, table_size> table = make_table();
+
+}  // namespace keywords
+
+constexpr Token::Kind Token::id_2_token_kind(std::string_view text) {
+  if (text.size() < keywords::min_length() || text.size() > keywords::max_length())
+    return Token::Kind::Id;
+
+  const auto& slot = keywords::table[keywords::hash(text, keywords::seed)];
+  return slot.text == text ? slot.kind : Token::Kind::Id;
+}
+
 struct TokenPhantom {};
 using TokenIndex = StrongType<std::uint32_t, TokenPhantom>;
 
@@ -0,0 +1,200 @@
+#ifndef TOKEN_STORE_HPP
+#define TOKEN_STORE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "token.hpp"
+
+static_assert(sizeof(Token::Kind) == 1, "kinds are stored as bytes");
+
+// Structure of arrays token stream: one byte of kind, four bytes of payload
+// (the IdIndex or literal of the token) and a four byte source offset per
+// token, addressed by TokenIndex. Passes that only look at kinds touch just
+// the kinds array.
+class TokenStore {
+public:
+  void push_back(const Token& token, uint32_t offset) {
+    flush_offsets();
+    m_kinds.emplace_back(token.get_kind());
+    m_payloads.emplace_back(token.u32);
+    m_offsets.emplace_back(offset);
+  }
+
+  // Appends the tokens of another store from from on.
+  void append(const TokenStore& tokens, TokenIndex from = TokenIndex(0)) {
+    flush_offsets();
+    tokens.flush_offsets();
+    const auto begin = from.get();
+    m_kinds.insert(m_kinds.end(), tokens.m_kinds.begin() + begin, tokens.m_kinds.end());
+    m_payloads.insert(m_payloads.end(), tokens.m_payloads.begin() + begin, tokens.m_payloads.end());
+    m_offsets.insert(m_offsets.end(), tokens.m_offsets.begin() + begin, tokens.m_offsets.end());
+  }
+
+  // Appends every token the lexer produces up to and including Eof.
+  template <typename LexerType>
+  void lex(LexerType& lexer) {
+    do {
+      const auto& token = lexer.next();
+      push_back(token, lexer.last_offset());
+    } while (lexer.last().get_kind() != Token::Kind::Eof);
+  }
+
+  void reserve(std::size_t size) {
+    m_kinds.reserve(size);
+    m_payloads.reserve(size);
+    m_offsets.reserve(size);
+  }
+
+  void clear() {
+    m_kinds.clear();
+    m_payloads.clear();
+    m_offsets.clear();
+    m_shift_from = NoShift;
+    m_shift = 0;
+  }
+
+  // Replaces count tokens at from with all of tokens and moves the offsets
+  // of the tokens behind them by offset_delta. The move is not applied to
+  // the tail of the store but kept pending from the end of the splice, and
+  // only the offsets between the previous pending start and this one are
+  // rewritten, so edits close to each other cost little.
+  void splice(TokenIndex from, uint32_t count, const TokenStore& tokens, int64_t offset_delta) {
+    tokens.flush_offsets();
+    const auto begin = from.get();
+    const auto end = begin + count;
+    if (m_shift_from == NoShift) {
+      m_shift_from = end;
+    }
+    for (auto i = m_shift_from; i < end; ++i) {
+      m_offsets[i] = (uint32_t)(m_offsets[i] + m_shift);
+    }
+    for (auto i = end; i < m_shift_from; ++i) {
+      m_offsets[i] = (uint32_t)(m_offsets[i] - m_shift);
+    }
+    replace(m_kinds, begin, count, tokens.m_kinds);
+    replace(m_payloads, begin, count, tokens.m_payloads);
+    replace(m_offsets, begin, count, tokens.m_offsets);
+    m_shift_from = begin + (uint32_t)tokens.size();
+    m_shift += offset_delta;
+  }
+
+  // First token starting at or after offset.
+  TokenIndex lower_bound(uint32_t offset) const {
+    uint32_t first = 0;
+    uint32_t count = (uint32_t)size();
+    while (count) {
+      const auto step = count / 2;
+      if (this->offset(TokenIndex(first + step)) < offset) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return TokenIndex(first);
+  }
+
+  std::size_t size() const { return m_kinds.size(); }
+  bool empty() const { return m_kinds.empty(); }
+
+  Token::Kind kind(TokenIndex index) const { return m_kinds[index.get()]; }
+  uint32_t payload(TokenIndex index) const { return m_payloads[index.get()]; }
+  uint32_t offset(TokenIndex index) const {
+    const auto i = index.get();
+    return i < m_shift_from ? m_offsets[i] : (uint32_t)(m_offsets[i] + m_shift);
+  }
+
+  void set_payload(TokenIndex index, uint32_t payload) { m_payloads[index.get()] = payload; }
+
+  Token get(TokenIndex index) const {
+    Token token(kind(index));
+    token.u32 = payload(index);
+    return token;
+  }
+
+  TokenRange get_range() const {
+    assert(!empty());
+    return TokenRange{TokenIndex(0), TokenIndex(size() - 1)};
+  }
+
+  const std::vector<Token::Kind>& get_kinds() const { return m_kinds; }
+  const std::vector<uint32_t>& get_payloads() const { return m_payloads; }
+  const std::vector<uint32_t>& get_offsets() const { flush_offsets(); return m_offsets; }
+
+  // Replays a range of the store with the next/last/peek interface of a
+  // Lexer, so a BasicParser can run over stored tokens. Past the end of the
+  // range it keeps returning Eof.
+  class Reader {
+  public:
+    Reader(const TokenStore& store) : Reader(store, store.get_range()) {}
+    Reader(const TokenStore& store, TokenRange range) :
+      m_store(store), m_next(range.from.get()), m_end(range.to.get() + 1) {}
+
+    const Token& last() const { return m_token; }
+
+    const Token& next() {
+      if (m_next < m_end) {
+        m_current = m_next++;
+        m_token = m_store.get(TokenIndex(m_current));
+      } else {
+        m_token = Token(Token::Kind::Eof);
+      }
+      return m_token;
+    }
+
+    const Token& peek(std::size_t n = 1) {
+      const auto index = m_next + n - 1;
+      m_peeked = index < m_end ? m_store.get(TokenIndex(index)) : Token(Token::Kind::Eof);
+      return m_peeked;
+    }
+
+    TokenIndex last_index() const { return TokenIndex(m_current); }
+    uint32_t last_offset() const { return m_store.offset(TokenIndex(m_current)); }
+
+  private:
+    const TokenStore& m_store;
+    uint32_t m_next;
+    uint32_t m_end;
+    uint32_t m_current = 0;
+    Token m_token = Token(Token::Kind::None);
+    Token m_peeked = Token(Token::Kind::None);
+  };
+
+private:
+  static constexpr uint32_t NoShift = std::numeric_limits<uint32_t>::max();
+
+  // Applies the pending offset move of the last splice.
+  void flush_offsets() const {
+    if (m_shift_from == NoShift)
+      return;
+    for (auto i = m_shift_from; i < m_offsets.size(); ++i) {
+      m_offsets[i] = (uint32_t)(m_offsets[i] + m_shift);
+    }
+    m_shift_from = NoShift;
+    m_shift = 0;
+  }
+
+  template <typename T>
+  static void replace(std::vector<T>& v, uint32_t begin, uint32_t count, const std::vector<T>& with) {
+    const auto common = count < with.size() ? count : (uint32_t)with.size();
+    std::copy(with.begin(), with.begin() + common, v.begin() + begin);
+    if (count > common) {
+      v.erase(v.begin() + begin + common, v.begin() + begin + count);
+    } else {
+      v.insert(v.begin() + begin + common, with.begin() + common, with.end());
+    }
+  }
+
+  std::vector<Token::Kind> m_kinds;
+  std::vector<uint32_t> m_payloads;
+  // Offsets at and after m_shift_from are off by m_shift until flushed.
+  mutable std::vector<uint32_t> m_offsets;
+  mutable uint32_t m_shift_from = NoShift;
+  mutable int64_t m_shift = 0;
+};
+
+#endif  // TOKEN_STORE_HPP
@@ -0,0 +1,59 @@
+#ifndef TOKEN_WINDOW_HPP
+#define TOKEN_WINDOW_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "token.hpp"
+
+// Ring buffer holding only the newest tokens, a drop-in for Lexer::Tokens
+// when the whole token stream is not needed. The capacity must cover the
+// lookbehind the parser needs, the current token and the lexer's lookahead.
+class TokenWindow {
+public:
+  explicit TokenWindow(std::size_t capacity = DefaultCapacity) {
+    std::size_t size = 1;
+    while (size < capacity) size <<= 1;
+    m_tokens.assign(size, Token(Token::Kind::None));
+    m_mask = size - 1;
+  }
+
+  static constexpr std::size_t DefaultCapacity = 4;
+
+  Token& emplace_back(Token::Kind kind) {
+    auto& token = m_tokens[m_count & m_mask];
+    token = Token(kind);
+    ++m_count;
+    return token;
+  }
+
+  bool empty() const { return m_count == 0; }
+
+  // Number of tokens still held, at most the capacity.
+  std::size_t size() const { return m_count < m_tokens.size() ? m_count : m_tokens.size(); }
+  std::size_t capacity() const { return m_tokens.size(); }
+  // Number of tokens ever pushed.
+  uint64_t get_total() const { return m_count; }
+
+  // 0 is the oldest token held, size() - 1 the newest.
+  const Token& operator[](std::size_t i) const {
+    assert(i < size());
+    return m_tokens[(m_count - size() + i) & m_mask];
+  }
+  Token& operator[](std::size_t i) {
+    assert(i < size());
+    return m_tokens[(m_count - size() + i) & m_mask];
+  }
+
+  const Token& back() const { return m_tokens[(m_count - 1) & m_mask]; }
+  Token& back() { return m_tokens[(m_count - 1) & m_mask]; }
+
+private:
+  std::vector<Token> m_tokens;
+  uint64_t m_count = 0;
+  std::size_t m_mask;
+};
+
+#endif  // TOKEN_WINDOW_HPP
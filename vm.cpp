@@ -1,35 +1,394 @@
 #include "vm.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
 #include "ir.hpp"
 
-void Vm::run(IdIndex module_name, IdIndex function_name) {
+namespace {
+
+template <typename T>
+T read(const uint8_t* p) {
+  T value;
+  memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+// The n-th slot operand behind the instr and type bytes.
+uint16_t operand(const uint8_t* ip, int n) {
+  return read<uint16_t>(ip + 2 + n * 2);
+}
+
+// The field of a slot holding a T.
+template <typename T, typename Slot>
+T& as(Slot& slot) {
+  if constexpr (std::is_same<T, int32_t>::value) {
+    return slot.i;
+  } else if constexpr (std::is_same<T, int64_t>::value) {
+    return slot.l;
+  } else {
+    return slot.d;
+  }
+}
+
+template <typename T, typename Slot, typename Op>
+void binary(Slot* slots, const uint8_t* ip, Op op) {
+  as<T>(slots[operand(ip, 0)]) = op(as<T>(slots[operand(ip, 1)]), as<T>(slots[operand(ip, 2)]));
+}
+
+// Operands of a compare and jump, behind a 16-bit jump target. A wider
+// target moves them, ip is moved along.
+template <typename T, typename Slot, typename Compare>
+bool compare(Slot* slots, const uint8_t* ip, Compare compare) {
+  return compare(as<T>(slots[operand(ip, 1)]), as<T>(slots[operand(ip, 2)]));
+}
+
+template <typename T>
+T constant(const ir::Value& value) {
+  if constexpr (std::is_same<T, int32_t>::value) {
+    return (int32_t)value.i_value;
+  } else if constexpr (std::is_same<T, int64_t>::value) {
+    return (int64_t)value.l_value;
+  } else {
+    return value.d_value;
+  }
+}
+
+// Sizes of the compacted instructions: the instr and type bytes, the slot
+// operands, the target of a jump and 4 bytes of a function index.
+constexpr long SlotsSize(int slots) { return 2 + slots * 2; }
+constexpr long JumpSize(int slots, long target) { return 2 + target + slots * 2; }
+constexpr long CallSize(int slots) { return 6 + slots * 2; }
+
+}  // namespace
+
+bool Vm::run(IdIndex module_name, IdIndex function_name, std::initializer_list<ir::Value> args) {
+  m_error = nullptr;
+  m_dispatches = 0;
+  m_result = ir::Value{};
+  m_result.type = ir::Type::V;
   const auto module_index = m_context.find_module(module_name);
 
   if (module_index == module_index.undefined) {
-    return;
+    m_error = "no such module";
+    return false;
   }
   auto& module = m_context.get_module(module_index);
   const auto function_index = module.find_function(function_name);
 
   if (function_index == function_index.undefined) {
-    return;
+    m_error = "no such function";
+    return false;
   }
   auto& function = module.get_function(function_index);
+  if (args.size() != function.get_args_size()) {
+    m_error = "wrong number of arguments";
+    return false;
+  }
+
+  m_stack.resize(StackSlots);
+  m_frames.clear();
+  auto* slot = m_stack.data();
+  for (const auto& arg : args) {
+    switch (arg.type) {
+      case ir::Type::I: slot->i = (int32_t)arg.i_value; break;
+      case ir::Type::L: slot->l = (int64_t)arg.l_value; break;
+      case ir::Type::D: slot->d = arg.d_value; break;
+      default: slot->s = arg.str_value.get(); break;
+    }
+    ++slot;
+  }
+  return execute(module, function);
+}
 
-  auto& code = function.get_compacted_code();
-  auto* ip = code.data();
-  std::vector<uint8_t> heap;
-  std::vector<uint8_t> stack(1024);
+void Vm::print(ir::Type type, Slot slot) {
+  char buffer[32];
+  switch (type) {
+    case ir::Type::I:
+      snprintf(buffer, sizeof(buffer), "%" PRId32, slot.i);
+      break;
+    case ir::Type::L:
+      snprintf(buffer, sizeof(buffer), "%" PRId64, slot.l);
+      break;
+    case ir::Type::D:
+      snprintf(buffer, sizeof(buffer), "%g", slot.d);
+      break;
+    case ir::Type::S:
+      if (m_strings) {
+        const auto& string = m_strings->get(IdIndex(slot.s));
+        m_output.append(string.str, string.length);
+      }
+      return;
+    default:
+      return;
+  }
+  m_output += buffer;
+}
+
+bool Vm::execute(ir::Module& module, ir::Function& entry) {
   using namespace ir;
+  static constexpr uint16_t NoResult = std::numeric_limits<uint16_t>::max();
+
+  auto* function = &entry;
+  if (!function->is_compacted()) function->compact();
+  const uint8_t* code = function->get_compacted_code().data();
+  const uint8_t* ip = code;
+  const Value* consts = function->get_consts().data();
+  Slot* slots = m_stack.data();
+  if (function->get_args_size() + function->get_locals_size() > m_stack.size()) {
+    m_error = "stack overflow";
+    return false;
+  }
+
+  // Enters the callee with its frame at base, false on overflow.
+  const auto call = [&](long size, uint16_t result) {
+    auto& callee = module.get_function(FunctionIndex(read<uint32_t>(ip + 2)));
+    if (!callee.is_compacted()) callee.compact();
+    auto* callee_slots = slots + read<uint16_t>(ip + 6);
+    if (m_frames.size() == MaxCallDepth
+        || callee_slots + callee.get_args_size() + callee.get_locals_size() > m_stack.data() + m_stack.size()) {
+      m_error = "stack overflow";
+      return false;
+    }
+    m_frames.emplace_back(Frame{function, ip + size, slots, result});
+    function = &callee;
+    code = ip = function->get_compacted_code().data();
+    consts = function->get_consts().data();
+    slots = callee_slots;
+    return true;
+  };
+  // Leaves the function, true when it was the one run.
+  const auto ret = [&](Type type, Slot value) {
+    if (m_frames.empty()) {
+      m_result.type = type;
+      switch (type) {
+        case Type::I: m_result.i_value = (uint32_t)value.i; break;
+        case Type::L: m_result.l_value = (uint64_t)value.l; break;
+        case Type::D: m_result.d_value = value.d; break;
+        case Type::V: break;
+        default: m_result.str_value = IdIndex(value.s); break;
+      }
+      return true;
+    }
+    const auto frame = m_frames.back();
+    m_frames.pop_back();
+    if (frame.result != NoResult) frame.slots[frame.result] = value;
+    function = frame.function;
+    code = function->get_compacted_code().data();
+    consts = function->get_consts().data();
+    slots = frame.slots;
+    ip = frame.ip;
+    return false;
+  };
 
   while (true) {
-    switch ((uint16_t)*ip) {
-      case instr_type(Instr::add, Type::I): {
-         
+    ++m_dispatches;
+    const auto op = read<uint16_t>(ip);
+    switch (op) {
+      case instr_type(Instr::mov, Type::I):
+      case instr_type(Instr::mov, Type::L):
+      case instr_type(Instr::mov, Type::D):
+      case instr_type(Instr::mov, Type::S):
+      case instr_type(Instr::mov, Type::A):
+        slots[operand(ip, 0)] = slots[operand(ip, 1)];
+        ip += SlotsSize(2);
+        break;
+
+      case instr_type(Instr::ldc, Type::I):
+        slots[operand(ip, 0)].i = (int32_t)consts[operand(ip, 1)].i_value;
+        ip += SlotsSize(2);
+        break;
+      case instr_type(Instr::ldc, Type::L):
+        slots[operand(ip, 0)].l = (int64_t)consts[operand(ip, 1)].l_value;
+        ip += SlotsSize(2);
+        break;
+      case instr_type(Instr::ldc, Type::D):
+        slots[operand(ip, 0)].d = consts[operand(ip, 1)].d_value;
+        ip += SlotsSize(2);
+        break;
+      case instr_type(Instr::ldc, Type::S):
+        slots[operand(ip, 0)].s = consts[operand(ip, 1)].str_value.get();
+        ip += SlotsSize(2);
+        break;
+
+      case instr_type(Instr::add, Type::I): binary<int32_t>(slots, ip, add<int32_t>); ip += SlotsSize(3); break;
+      case instr_type(Instr::add, Type::L): binary<int64_t>(slots, ip, add<int64_t>); ip += SlotsSize(3); break;
+      case instr_type(Instr::add, Type::D): binary<double>(slots, ip, add<double>); ip += SlotsSize(3); break;
+      case instr_type(Instr::sub, Type::I): binary<int32_t>(slots, ip, sub<int32_t>); ip += SlotsSize(3); break;
+      case instr_type(Instr::sub, Type::L): binary<int64_t>(slots, ip, sub<int64_t>); ip += SlotsSize(3); break;
+      case instr_type(Instr::sub, Type::D): binary<double>(slots, ip, sub<double>); ip += SlotsSize(3); break;
+      case instr_type(Instr::mul, Type::I): binary<int32_t>(slots, ip, mul<int32_t>); ip += SlotsSize(3); break;
+      case instr_type(Instr::mul, Type::L): binary<int64_t>(slots, ip, mul<int64_t>); ip += SlotsSize(3); break;
+      case instr_type(Instr::mul, Type::D): binary<double>(slots, ip, mul<double>); ip += SlotsSize(3); break;
+      case instr_type(Instr::div, Type::I):
+        if (slots[operand(ip, 2)].i == 0) {
+          m_error = "division by zero";
+          return false;
+        }
+        binary<int32_t>(slots, ip, div<int32_t>);
+        ip += SlotsSize(3);
+        break;
+      case instr_type(Instr::div, Type::L):
+        if (slots[operand(ip, 2)].l == 0) {
+          m_error = "division by zero";
+          return false;
+        }
+        binary<int64_t>(slots, ip, div<int64_t>);
+        ip += SlotsSize(3);
+        break;
+      case instr_type(Instr::div, Type::D): binary<double>(slots, ip, div<double>); ip += SlotsSize(3); break;
+      case instr_type(Instr::shl, Type::I):
+        binary<int32_t>(slots, ip, shl<int32_t>);
+        ip += SlotsSize(3);
+        break;
+      case instr_type(Instr::shl, Type::L):
+        binary<int64_t>(slots, ip, shl<int64_t>);
+        ip += SlotsSize(3);
         break;
+      case instr_type(Instr::shr, Type::I):
+        binary<int32_t>(slots, ip, shr<int32_t>);
+        ip += SlotsSize(3);
+        break;
+      case instr_type(Instr::shr, Type::L):
+        binary<int64_t>(slots, ip, shr<int64_t>);
+        ip += SlotsSize(3);
+        break;
+
+      // t = c; d = a op c
+#define LDC_BINARY(instr, type, T, op) \
+      case instr_type(Instr::instr, Type::type): { \
+        const auto c = constant<T>(consts[operand(ip, 1)]); \
+        as<T>(slots[operand(ip, 0)]) = c; \
+        as<T>(slots[operand(ip, 2)]) = op<T>(as<T>(slots[operand(ip, 3)]), c); \
+        ip += SlotsSize(4); \
+        break; \
       }
-      case instr_type(Instr::ret, Type::I): {
+#define LDC_BINARIES(type, T) \
+      LDC_BINARY(ldcadd, type, T, add) LDC_BINARY(ldcsub, type, T, sub) LDC_BINARY(ldcmul, type, T, mul)
+      LDC_BINARIES(I, int32_t)
+      LDC_BINARIES(L, int64_t)
+      LDC_BINARIES(D, double)
+#undef LDC_BINARIES
+#undef LDC_BINARY
+
+      case instr_type(Instr::neg, Type::I):
+        slots[operand(ip, 0)].i = sub<int32_t>(0, slots[operand(ip, 1)].i);
+        ip += SlotsSize(2);
         break;
+      case instr_type(Instr::neg, Type::L):
+        slots[operand(ip, 0)].l = sub<int64_t>(0, slots[operand(ip, 1)].l);
+        ip += SlotsSize(2);
+        break;
+      case instr_type(Instr::neg, Type::D):
+        slots[operand(ip, 0)].d = -slots[operand(ip, 1)].d;
+        ip += SlotsSize(2);
+        break;
+
+      case instr_type(Instr::inc, Type::I): slots[operand(ip, 0)].i = add<int32_t>(slots[operand(ip, 0)].i, 1); ip += SlotsSize(1); break;
+      case instr_type(Instr::inc, Type::L): slots[operand(ip, 0)].l = add<int64_t>(slots[operand(ip, 0)].l, 1); ip += SlotsSize(1); break;
+      case instr_type(Instr::inc, Type::D): slots[operand(ip, 0)].d += 1; ip += SlotsSize(1); break;
+      case instr_type(Instr::dec, Type::I): slots[operand(ip, 0)].i = sub<int32_t>(slots[operand(ip, 0)].i, 1); ip += SlotsSize(1); break;
+      case instr_type(Instr::dec, Type::L): slots[operand(ip, 0)].l = sub<int64_t>(slots[operand(ip, 0)].l, 1); ip += SlotsSize(1); break;
+      case instr_type(Instr::dec, Type::D): slots[operand(ip, 0)].d -= 1; ip += SlotsSize(1); break;
+
+// The target follows the instr and type bytes, then come the slot operands.
+#define TEST_JUMP(case_of, Target, instr, type, field, op) \
+      case case_of(Instr::instr, Type::type): \
+        ip = slots[read<uint16_t>(ip + 2 + sizeof(Target))].field op 0 \
+          ? code + read<Target>(ip + 2) : ip + JumpSize(1, sizeof(Target)); \
+        break;
+#define TEST_JUMPS(case_of, Target, instr, op) \
+      TEST_JUMP(case_of, Target, instr, I, i, op) TEST_JUMP(case_of, Target, instr, L, l, op) \
+      TEST_JUMP(case_of, Target, instr, D, d, op)
+#define COMPARE_JUMP(case_of, Target, instr, type, T, op) \
+      case case_of(Instr::instr, Type::type): \
+        ip = compare<T>(slots, ip + sizeof(Target) - 2, [](T a, T b) { return a op b; }) \
+          ? code + read<Target>(ip + 2) : ip + JumpSize(2, sizeof(Target)); \
+        break;
+#define COMPARE_JUMPS(case_of, Target, type, T) \
+      COMPARE_JUMP(case_of, Target, jg, type, T, >) COMPARE_JUMP(case_of, Target, jl, type, T, <) \
+      COMPARE_JUMP(case_of, Target, jge, type, T, >=) COMPARE_JUMP(case_of, Target, jle, type, T, <=) \
+      COMPARE_JUMP(case_of, Target, je, type, T, ==) COMPARE_JUMP(case_of, Target, jne, type, T, !=)
+// inc of the slot compared, then the compare and jump.
+#define INC_JUMP(case_of, Target, instr, type, T, op) \
+      case case_of(Instr::instr, Type::type): { \
+        auto& counter = as<T>(slots[read<uint16_t>(ip + 2 + sizeof(Target))]); \
+        counter = add<T>(counter, 1); \
+        ip = compare<T>(slots, ip + sizeof(Target) - 2, [](T a, T b) { return a op b; }) \
+          ? code + read<Target>(ip + 2) : ip + JumpSize(2, sizeof(Target)); \
+        break; \
       }
+// The compare and jump, with the inc the target begins with.
+#define JUMP_INC(case_of, Target, instr, type, T, op) \
+      case case_of(Instr::instr, Type::type): \
+        if (compare<T>(slots, ip + sizeof(Target) - 2, [](T a, T b) { return a op b; })) { \
+          auto& counter = as<T>(slots[read<uint16_t>(ip + 2 + sizeof(Target))]); \
+          counter = add<T>(counter, 1); \
+          ip = code + read<Target>(ip + 2); \
+        } else { \
+          ip += JumpSize(2, sizeof(Target)); \
+        } \
+        break;
+#define INC_JUMPS(case_of, Target, type, T) \
+      INC_JUMP(case_of, Target, incjl, type, T, <) INC_JUMP(case_of, Target, incjle, type, T, <=) \
+      JUMP_INC(case_of, Target, jlinc, type, T, <) JUMP_INC(case_of, Target, jleinc, type, T, <=)
+#define JUMPS(case_of, Target) \
+      case case_of(Instr::jmp, Type::V): \
+        ip = code + read<Target>(ip + 2); \
+        break; \
+      TEST_JUMPS(case_of, Target, jz, ==) TEST_JUMPS(case_of, Target, jnz, !=) \
+      COMPARE_JUMPS(case_of, Target, I, int32_t) COMPARE_JUMPS(case_of, Target, L, int64_t) \
+      COMPARE_JUMPS(case_of, Target, D, double) \
+      INC_JUMPS(case_of, Target, I, int32_t) INC_JUMPS(case_of, Target, L, int64_t)
+      JUMPS(instr_type, uint16_t)
+      JUMPS(wide_instr_type, uint32_t)
+#undef JUMPS
+#undef INC_JUMPS
+#undef INC_JUMP
+#undef JUMP_INC
+#undef COMPARE_JUMPS
+#undef COMPARE_JUMP
+#undef TEST_JUMPS
+#undef TEST_JUMP
+
+      case instr_type(Instr::call, Type::I):
+      case instr_type(Instr::call, Type::L):
+      case instr_type(Instr::call, Type::D):
+      case instr_type(Instr::call, Type::S):
+      case instr_type(Instr::call, Type::A):
+        if (!call(CallSize(2), read<uint16_t>(ip + 8)))
+          return false;
+        break;
+      case instr_type(Instr::callv, Type::V):
+        if (!call(CallSize(1), NoResult))
+          return false;
+        break;
+      case instr_type(Instr::ret, Type::I):
+      case instr_type(Instr::ret, Type::L):
+      case instr_type(Instr::ret, Type::D):
+      case instr_type(Instr::ret, Type::S):
+      case instr_type(Instr::ret, Type::A):
+        if (ret((Type)(op >> 8), slots[operand(ip, 0)]))
+          return true;
+        break;
+      case instr_type(Instr::retv, Type::V):
+        if (ret(Type::V, Slot{}))
+          return true;
+        break;
+
+      case instr_type(Instr::print, Type::I):
+      case instr_type(Instr::print, Type::L):
+      case instr_type(Instr::print, Type::D):
+      case instr_type(Instr::print, Type::S):
+        print((Type)(op >> 8), slots[operand(ip, 0)]);
+        ip += SlotsSize(1);
+        break;
+
+      default:
+        m_error = "bad instruction";
+        return false;
     }
   }
 }
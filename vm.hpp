@@ -1,16 +1,67 @@
 #ifndef VM_HPP
 #define VM_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "id_cache.hpp"
 #include "id_index.hpp"
 #include "ir.hpp"
 
+// Interprets compacted functions, compacting them on their first call.
+// Frames are windows of one slot stack: a callee's frame begins at the
+// slot of its first argument in the caller, so arguments are never copied.
 class Vm {
 public:
   Vm(ir::Context& context) : m_context(context) {}
+  // Strings are needed to print S values.
+  Vm(ir::Context& context, const IdCache& strings) : m_context(context), m_strings(&strings) {}
+
+  // Runs a function of the module with its arguments. False when either
+  // isn't found, on a wrong number of arguments and on runtime errors.
+  bool run(IdIndex module_name, IdIndex function_name, std::initializer_list<ir::Value> args = {});
+
+  // What the last run returned, of type V when the function returns nothing.
+  const ir::Value& get_result() const { return m_result; }
+  // What print wrote, over all runs.
+  const std::string& get_output() const { return m_output; }
+  const char* get_error() const { return m_error; }
+  // Instructions the last run dispatched, a superinstruction once.
+  uint64_t get_dispatches() const { return m_dispatches; }
 
-  void run(IdIndex module_name, IdIndex function_name);
 private:
+  union Slot {
+    int32_t i;
+    int64_t l;
+    double d;
+    uint32_t s;
+  };
+
+  struct Frame {
+    ir::Function* function;
+    const uint8_t* ip;
+    Slot* slots;
+    // Where the result goes in this frame.
+    uint16_t result;
+  };
+
+  static constexpr std::size_t StackSlots = 1 << 20;
+  static constexpr std::size_t MaxCallDepth = 1 << 16;
+
   ir::Context& m_context;
+  const IdCache* m_strings = nullptr;
+  std::vector<Slot> m_stack;
+  std::vector<Frame> m_frames;
+  ir::Value m_result{};
+  std::string m_output;
+  const char* m_error = nullptr;
+  uint64_t m_dispatches = 0;
+
+  bool execute(ir::Module& module, ir::Function& function);
+  void print(ir::Type type, Slot slot);
 };
 
 #endif  // VM_HPP